@@ -2,107 +2,405 @@
 
 #include <tiny_obj_loader.h>
 
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
 namespace GLmesh
 {
 
-void StaticMesh::LoadShape(const tinyobj::shape_t& shape)
+InstanceBuffer::InstanceBuffer()
+    : mBuffer(std::make_shared<GLplus::Buffer>(GL_ARRAY_BUFFER))
+{
+}
+
+void InstanceBuffer::Upload(const GLfloat* matrices, size_t count)
+{
+    mBuffer->Upload(count * sizeof(GLfloat) * 16, matrices, GL_STREAM_DRAW);
+    mCount = count;
+}
+
+size_t InstanceBuffer::GetCount() const
+{
+    return mCount;
+}
+
+const std::shared_ptr<GLplus::Buffer>& InstanceBuffer::GetBuffer() const
+{
+    return mBuffer;
+}
+
+VertexFormat VertexFormat::Compact()
+{
+    VertexFormat format;
+    format.mPositionType = GL_HALF_FLOAT;
+    format.mNormalType = GL_INT_2_10_10_10_REV;
+    format.mTexcoordType = GL_UNSIGNED_SHORT;
+    return format;
+}
+
+static VertexAttributeFormat AppendAttribute(GLsizei& stride, GLint size, GLenum type)
+{
+    VertexAttributeFormat attribute;
+    attribute.mSize = size;
+    attribute.mType = type;
+    attribute.mNormalized = type == GL_INT_2_10_10_10_REV || type == GL_UNSIGNED_SHORT;
+    attribute.mOffset = stride;
+
+    stride += type == GL_INT_2_10_10_10_REV ? sizeof(GLuint) : size * GLplus::SizeFromGLType(type);
+
+    // keep every attribute 4 byte aligned
+    stride = (stride + 3) / 4 * 4;
+
+    return attribute;
+}
+
+// values beyond numValues are filled in with 1, which only matters for w.
+static void WriteAttribute(GLubyte* vertex, const VertexAttributeFormat& attribute, const float* values, int numValues)
+{
+    GLubyte* dst = vertex + attribute.mOffset;
+
+    switch (attribute.mType)
+    {
+    case GL_FLOAT:
+        std::memcpy(dst, values, sizeof(float) * numValues);
+        break;
+    case GL_HALF_FLOAT:
+        for (int i = 0; i < attribute.mSize; i++)
+        {
+            glm::uint16 half = glm::packHalf1x16(i < numValues ? values[i] : 1.0f);
+            std::memcpy(dst + i * sizeof(half), &half, sizeof(half));
+        }
+        break;
+    case GL_INT_2_10_10_10_REV:
+    {
+        glm::uint32 packed = glm::packSnorm3x10_1x2(glm::vec4(values[0], values[1], values[2], 0.0f));
+        std::memcpy(dst, &packed, sizeof(packed));
+        break;
+    }
+    case GL_UNSIGNED_SHORT:
+        for (int i = 0; i < attribute.mSize; i++)
+        {
+            // glm's packUnorm1x16 declaration doesn't match its definition
+            glm::uint16 unorm = (glm::uint16) glm::round(glm::clamp(values[i], 0.0f, 1.0f) * 65535.0f);
+            std::memcpy(dst + i * sizeof(unorm), &unorm, sizeof(unorm));
+        }
+        break;
+    default:
+        throw std::logic_error("Unimplemented vertex attribute type.");
+    }
+}
+
+// Levels that save less than this fraction of the triangles of the level before are dropped.
+static const float kMinLodSavings = 0.1f;
+
+static std::vector<MeshLod> BuildLods(const tinyobj::mesh_t& mesh, const LodOptions& options,
+                                      std::vector<unsigned int>& indices)
+{
+    std::vector<MeshLod> lods(1);
+    lods[0].mIndexCount = (GLsizei) mesh.indices.size();
+    indices = mesh.indices;
+
+    if (options.mMaxLevels <= 1)
+    {
+        return lods;
+    }
+
+    glm::vec3 minimum(1e30f), maximum(-1e30f);
+    for (size_t i = 0; i + 2 < mesh.positions.size(); i += 3)
+    {
+        glm::vec3 position(mesh.positions[i], mesh.positions[i + 1], mesh.positions[i + 2]);
+        minimum = glm::min(minimum, position);
+        maximum = glm::max(maximum, position);
+    }
+    float maxError = options.mMaxError * 0.5f * glm::length(maximum - minimum);
+
+    // Each level simplifies the one before, which is quicker and keeps the levels consistent with each other.
+    // So its error adds to the errors of the levels before it, and they share one budget.
+    std::vector<unsigned int> previous = mesh.indices;
+    while ((int) lods.size() < options.mMaxLevels && lods.back().mError < maxError)
+    {
+        size_t target = (size_t) (previous.size() / 3 * options.mReduction) * 3;
+
+        float error;
+        std::vector<unsigned int> simplified = SimplifyMesh(mesh, previous, target, maxError - lods.back().mError, &error);
+        if (simplified.empty() || simplified.size() > previous.size() * (1.0f - kMinLodSavings))
+        {
+            break;
+        }
+
+        MeshLod lod;
+        lod.mFirstIndex = (GLint) indices.size();
+        lod.mIndexCount = (GLsizei) simplified.size();
+        lod.mError = lods.back().mError + error;
+        lods.push_back(lod);
+
+        indices.insert(indices.end(), simplified.begin(), simplified.end());
+        previous = std::move(simplified);
+    }
+
+    return lods;
+}
+
+void StaticMesh::LoadShape(const tinyobj::shape_t& shape, const VertexFormat& format, const LodOptions& lodOptions)
+{
+    MeshData data = Prepare(shape, format, lodOptions);
+
+    std::shared_ptr<GLplus::Texture2D> diffuseTexture;
+    if (!data.mDiffuseTextureName.empty())
+    {
+        diffuseTexture.reset(new GLplus::Texture2D());
+        diffuseTexture->LoadImage(data.mDiffuseTextureName.c_str(), GLplus::Texture2D::InvertY);
+    }
+
+    Upload(data, diffuseTexture);
+}
+
+MeshData StaticMesh::Prepare(const tinyobj::shape_t& shape, const VertexFormat& format, const LodOptions& lodOptions)
 {
     if (shape.mesh.indices.size() % 3 != 0)
     {
         throw std::runtime_error("Expected 3d vertices.");
     }
 
-    std::shared_ptr<GLplus::Buffer> newIndices;
-    std::shared_ptr<GLplus::Buffer> newPositions;
-    std::shared_ptr<GLplus::Buffer> newNormals;
-    std::shared_ptr<GLplus::Buffer> newTexcoords;
-    std::shared_ptr<GLplus::Texture2D> newDiffuseTexture;
+    MeshData data;
 
-    newIndices.reset(new GLplus::Buffer(GL_ELEMENT_ARRAY_BUFFER));
-    newIndices->Upload(
-              shape.mesh.indices.size() * sizeof(shape.mesh.indices[0]),
-              shape.mesh.indices.data(), GL_STATIC_DRAW);
+    std::vector<unsigned int> indices;
+    data.mLods = BuildLods(shape.mesh, lodOptions, indices);
+
+    const std::vector<float>& positions = shape.mesh.positions;
+    const std::vector<float>& normals = shape.mesh.normals;
+    const std::vector<float>& texcoords = shape.mesh.texcoords;
+
+    size_t numVertices = positions.size() / 3;
 
-    if (!shape.mesh.positions.empty())
+    // the position of each input vertex in the vertex buffer
+    std::vector<unsigned int> remap;
+
+    data.mInputCacheStats = AnalyzeVertexCache(indices.data(), data.mLods[0].mIndexCount, numVertices);
+    if (format.mOptimizeOrder)
     {
-        newPositions.reset(new GLplus::Buffer(GL_ARRAY_BUFFER));
-        newPositions->Upload(
-                    shape.mesh.positions.size() * sizeof(shape.mesh.positions[0]),
-                    shape.mesh.positions.data(), GL_STATIC_DRAW);
+        std::vector<unsigned int> clusters;
+        for (const MeshLod& lod : data.mLods)
+        {
+            unsigned int* lodIndices = indices.data() + lod.mFirstIndex;
+            OptimizeVertexCache(lodIndices, lod.mIndexCount, numVertices, 16, &clusters);
+            OptimizeOverdraw(lodIndices, lod.mIndexCount, positions.data(), numVertices, clusters);
+        }
+
+        // the full mesh first, so the simpler levels mostly reuse its vertices in the same order
+        remap = OptimizeVertexFetch(indices.data(), indices.size(), numVertices);
     }
+    data.mCacheStats = AnalyzeVertexCache(indices.data(), data.mLods[0].mIndexCount, numVertices);
+
+    // decide on the layout
+    GLsizei stride = 0;
+    VertexAttributeFormat positionFormat, normalFormat, texcoordFormat;
 
-    if (!shape.mesh.normals.empty())
+    if (!positions.empty())
     {
-        newNormals.reset(new GLplus::Buffer(GL_ARRAY_BUFFER));
-        newNormals->Upload(
-                    shape.mesh.normals.size() * sizeof(shape.mesh.normals[0]),
-                    shape.mesh.normals.data(), GL_STATIC_DRAW);
+        GLint positionSize = format.mPositionType == GL_HALF_FLOAT ? 4 : 3;
+        positionFormat = AppendAttribute(stride, positionSize, format.mPositionType);
     }
 
-    if (!shape.mesh.texcoords.empty())
+    if (!normals.empty())
     {
-        newTexcoords.reset(new GLplus::Buffer(GL_ARRAY_BUFFER));
-        newTexcoords->Upload(
-                    shape.mesh.texcoords.size() * sizeof(shape.mesh.texcoords[0]),
-                    shape.mesh.texcoords.data(), GL_STATIC_DRAW);
+        GLenum normalType = format.mNormalType;
+        if (normalType == GL_INT_2_10_10_10_REV && !(GLEW_VERSION_3_3 || GLEW_ARB_vertex_type_2_10_10_10_rev))
+        {
+            normalType = GL_FLOAT;
+        }
+        normalFormat = AppendAttribute(stride, normalType == GL_INT_2_10_10_10_REV ? 4 : 3, normalType);
     }
 
-    if (!shape.material.diffuse_texname.empty())
+    if (!texcoords.empty())
     {
-        newDiffuseTexture.reset(new GLplus::Texture2D());
-        newDiffuseTexture->LoadImage(shape.material.diffuse_texname.c_str(), GLplus::Texture2D::InvertY);
+        GLenum texcoordType = format.mTexcoordType;
+        if (texcoordType == GL_UNSIGNED_SHORT &&
+            (*std::min_element(texcoords.begin(), texcoords.end()) < 0.0f ||
+             *std::max_element(texcoords.begin(), texcoords.end()) > 1.0f))
+        {
+            texcoordType = GL_HALF_FLOAT;
+        }
+        texcoordFormat = AppendAttribute(stride, 2, texcoordType);
     }
 
-    mVertexCount = shape.mesh.indices.size();
+    // interleave
+    std::vector<GLubyte>& vertexData = data.mVertexData;
+    vertexData.resize(numVertices * stride);
+    for (size_t v = 0; v < numVertices; v++)
+    {
+        GLubyte* vertex = &vertexData[(remap.empty() ? v : remap[v]) * stride];
+
+        if (positionFormat.mSize)
+        {
+            WriteAttribute(vertex, positionFormat, &positions[v * 3], 3);
+        }
+
+        if (normalFormat.mSize)
+        {
+            WriteAttribute(vertex, normalFormat, &normals[v * 3], 3);
+        }
 
+        if (texcoordFormat.mSize)
+        {
+            WriteAttribute(vertex, texcoordFormat, &texcoords[v * 2], 2);
+        }
+    }
+
+    data.mIndexType = GL_UNSIGNED_INT;
+    if (format.mAllowShortIndices && numVertices <= 0x10000)
+    {
+        data.mIndexType = GL_UNSIGNED_SHORT;
+        std::vector<GLushort> shortIndices(indices.begin(), indices.end());
+        data.mIndexData.assign((const GLubyte*) shortIndices.data(), (const GLubyte*) (shortIndices.data() + shortIndices.size()));
+    }
+    else
+    {
+        data.mIndexData.assign((const GLubyte*) indices.data(), (const GLubyte*) (indices.data() + indices.size()));
+    }
+
+    data.mPositionFormat = positionFormat;
+    data.mNormalFormat = normalFormat;
+    data.mTexcoordFormat = texcoordFormat;
+    data.mVertexStride = stride;
+    data.mIndexCount = indices.size();
+    data.mVertexCount = numVertices;
+    data.mDiffuseTextureName = shape.material.diffuse_texname;
+
+    return data;
+}
+
+void StaticMesh::Upload(const MeshData& data, const std::shared_ptr<GLplus::Texture2D>& diffuseTexture)
+{
+    std::shared_ptr<GLplus::Buffer> newVertices;
+    std::shared_ptr<GLplus::Buffer> newIndices;
+
+    newVertices.reset(new GLplus::Buffer(GL_ARRAY_BUFFER));
+    newVertices->Upload(data.mVertexData.size(), data.mVertexData.data(), GL_STATIC_DRAW);
+
+    newIndices.reset(new GLplus::Buffer(GL_ELEMENT_ARRAY_BUFFER));
+    newIndices->Upload(data.mIndexData.size(), data.mIndexData.data(), GL_STATIC_DRAW);
+
+    mVertexCount = data.mIndexCount;
+    mUniqueVertexCount = data.mVertexCount;
+    mLods = data.mLods;
+    mInputCacheStats = data.mInputCacheStats;
+    mCacheStats = data.mCacheStats;
+
+    mVertices = std::move(newVertices);
     mIndices = std::move(newIndices);
-    mPositions = std::move(newPositions);
-    mTexcoords = std::move(newTexcoords);
-    mNormals = std::move(newNormals);
-    mDiffuseTexture = std::move(newDiffuseTexture);
+    mPositionFormat = data.mPositionFormat;
+    mNormalFormat = data.mNormalFormat;
+    mTexcoordFormat = data.mTexcoordFormat;
+    mVertexStride = data.mVertexStride;
+    mIndexType = data.mIndexType;
+    mDiffuseTexture = diffuseTexture;
+
+    // the vertex arrays refer to the old buffers
+    mVertexArrays.Clear();
 }
 
-void StaticMesh::Render(const GLplus::Program& program) const
+void StaticMesh::SetVertexAttributes(const GLplus::Program& program, GLplus::VertexArray& vertexArray) const
 {
-    GLplus::VertexArray vertexArray;
+    vertexArray.SetIndexBuffer(mIndices, mIndexType);
+
+    struct NamedAttribute
+    {
+        const GLchar* mName;
+        const VertexAttributeFormat& mFormat;
+    };
 
-    vertexArray.SetIndexBuffer(mIndices, GL_UNSIGNED_INT);
+    const NamedAttribute attributes[] = {
+        { "position", mPositionFormat },
+        { "normal", mNormalFormat },
+        { "texcoord0", mTexcoordFormat }
+    };
 
-    if (mPositions)
+    for (const NamedAttribute& attribute : attributes)
     {
-        GLint positionLoc;
-        if (program.TryGetAttributeLocation("position", positionLoc))
+        GLint loc;
+        if (attribute.mFormat.mSize && program.TryGetAttributeLocation(attribute.mName, loc))
         {
             vertexArray.SetAttribute(
-                        positionLoc, mPositions,
-                        3, GL_FLOAT, GL_FALSE, 0, 0);
+                        loc, mVertices,
+                        attribute.mFormat.mSize, attribute.mFormat.mType, attribute.mFormat.mNormalized,
+                        mVertexStride, attribute.mFormat.mOffset);
         }
     }
+}
 
-    if (mNormals)
+void StaticMesh::Render(const GLplus::Program& program, int lod) const
+{
+    const GLplus::VertexArray& vertexArray = mVertexArrays.GetOrCreate(program,
+        [this, &program](GLplus::VertexArray& vertexArray)
     {
-        GLint normalLoc;
-        if (program.TryGetAttributeLocation("normal", normalLoc))
-        {
-            vertexArray.SetAttribute(
-                        normalLoc, mNormals,
-                        3, GL_FLOAT, GL_FALSE, 0, 0);
-        }
+        SetVertexAttributes(program, vertexArray);
+    });
+
+    // programs that don't sample the texture don't need it bound
+    std::unique_ptr<GLplus::ScopedTextureBind> diffuseBind;
+    if (mDiffuseTexture && program.FindUniform("diffuseTexture"))
+    {
+        diffuseBind.reset(new GLplus::ScopedTextureBind(*mDiffuseTexture, GL_TEXTURE0));
+        program.UploadInt("diffuseTexture", 0);
     }
 
-    if (mTexcoords)
+    GLplus::ScopedProgramBind programBind(program);
+    GLplus::ScopedVertexArrayBind vertexArrayBind(vertexArray);
+    GLplus::DrawElements(GL_TRIANGLES, mIndexType, mLods[lod].mFirstIndex, mLods[lod].mIndexCount);
+}
+
+void StaticMesh::RenderInstanced(const GLplus::Program& program, GLsizei instanceCount, int lod) const
+{
+    const GLplus::VertexArray& vertexArray = mVertexArrays.GetOrCreate(program,
+        [this, &program](GLplus::VertexArray& vertexArray)
     {
-        GLint texcoord0Loc;
-        if (program.TryGetAttributeLocation("texcoord0", texcoord0Loc))
+        SetVertexAttributes(program, vertexArray);
+    });
+
+    std::unique_ptr<GLplus::ScopedTextureBind> diffuseBind;
+    if (mDiffuseTexture && program.FindUniform("diffuseTexture"))
+    {
+        diffuseBind.reset(new GLplus::ScopedTextureBind(*mDiffuseTexture, GL_TEXTURE0));
+        program.UploadInt("diffuseTexture", 0);
+    }
+
+    GLplus::ScopedProgramBind programBind(program);
+    GLplus::ScopedVertexArrayBind vertexArrayBind(vertexArray);
+    GLplus::DrawElementsInstanced(GL_TRIANGLES, mIndexType, mLods[lod].mFirstIndex, mLods[lod].mIndexCount, instanceCount);
+}
+
+void StaticMesh::RenderInstanced(const GLplus::Program& program, const InstanceBuffer& instances, size_t count,
+                                 GLuint viewsPerInstance, int lod) const
+{
+    if (count > instances.GetCount())
+    {
+        throw std::logic_error("Rendering more instances than the InstanceBuffer has.");
+    }
+
+    const std::shared_ptr<GLplus::Buffer>& instanceBuffer = instances.GetBuffer();
+
+    // the divisor is part of the vertex array, so it's part of the key too
+    GLuint64 instanceKey = (GLuint64) viewsPerInstance << 32 | instanceBuffer->GetGLHandle();
+
+    const GLplus::VertexArray& vertexArray = mVertexArrays.GetOrCreate(program, instanceKey,
+        [this, &program, &instanceBuffer, viewsPerInstance](GLplus::VertexArray& vertexArray)
+    {
+        SetVertexAttributes(program, vertexArray);
+
+        GLint instanceModelLoc;
+        if (program.TryGetAttributeLocation("instanceModel", instanceModelLoc))
         {
-            vertexArray.SetAttribute(
-                        texcoord0Loc, mTexcoords,
-                        2, GL_FLOAT, GL_FALSE, 0, 0);
+            vertexArray.SetMatrix4Attribute(instanceModelLoc, instanceBuffer, sizeof(GLfloat) * 16, 0, viewsPerInstance);
         }
-    }
+    });
 
     std::unique_ptr<GLplus::ScopedTextureBind> diffuseBind;
-    if (mDiffuseTexture)
+    if (mDiffuseTexture && program.FindUniform("diffuseTexture"))
     {
         diffuseBind.reset(new GLplus::ScopedTextureBind(*mDiffuseTexture, GL_TEXTURE0));
         program.UploadInt("diffuseTexture", 0);
@@ -110,7 +408,48 @@ void StaticMesh::Render(const GLplus::Program& program) const
 
     GLplus::ScopedProgramBind programBind(program);
     GLplus::ScopedVertexArrayBind vertexArrayBind(vertexArray);
-    GLplus::DrawElements(GL_TRIANGLES, GL_UNSIGNED_INT, 0, mVertexCount);
+    GLplus::DrawElementsInstanced(GL_TRIANGLES, mIndexType, mLods[lod].mFirstIndex, mLods[lod].mIndexCount,
+                                  count * viewsPerInstance);
+}
+
+const std::shared_ptr<GLplus::Texture2D>& StaticMesh::GetDiffuseTexture() const
+{
+    return mDiffuseTexture;
+}
+
+const std::vector<MeshLod>& StaticMesh::GetLods() const
+{
+    return mLods;
+}
+
+size_t StaticMesh::GetTriangleCount(int lod) const
+{
+    return mLods[lod].mIndexCount / 3;
+}
+
+const VertexCacheStats& StaticMesh::GetInputVertexCacheStats() const
+{
+    return mInputCacheStats;
+}
+
+const VertexCacheStats& StaticMesh::GetVertexCacheStats() const
+{
+    return mCacheStats;
+}
+
+size_t StaticMesh::GetBytesPerVertex() const
+{
+    return mVertexStride;
+}
+
+size_t StaticMesh::GetVertexBufferSize() const
+{
+    return mUniqueVertexCount * mVertexStride;
+}
+
+size_t StaticMesh::GetIndexBufferSize() const
+{
+    return mVertexCount * GLplus::SizeFromGLType(mIndexType);
 }
 
 } // end namespace GLmesh
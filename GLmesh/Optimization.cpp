@@ -0,0 +1,468 @@
+#include "GLmesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace GLmesh
+{
+
+// sides of the square images AnalyzeOverdraw() draws into
+static const int kOverdrawResolution = 256;
+
+VertexCacheStats AnalyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount, size_t cacheSize)
+{
+    VertexCacheStats stats;
+    if (indexCount == 0)
+    {
+        return stats;
+    }
+
+    // A FIFO, like most hardware: hits don't move a vertex to the front.
+    // The clock only ticks on misses, so a vertex is cached while fewer than cacheSize misses came after its own.
+    std::vector<size_t> cacheTimes(vertexCount, 0);
+    size_t time = cacheSize + 1;
+
+    size_t misses = 0;
+    size_t usedVertices = 0;
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        unsigned int vertex = indices[i];
+        if (cacheTimes[vertex] == 0)
+        {
+            usedVertices++;
+        }
+
+        if (time - cacheTimes[vertex] > cacheSize)
+        {
+            cacheTimes[vertex] = time++;
+            misses++;
+        }
+    }
+
+    stats.mAcmr = (float) misses / (indexCount / 3);
+    stats.mAtvr = (float) misses / usedVertices;
+    return stats;
+}
+
+// the triangles using each vertex
+struct VertexTriangles
+{
+    std::vector<unsigned int> mOffsets;
+    std::vector<unsigned int> mTriangles;
+
+    VertexTriangles(const unsigned int* indices, size_t indexCount, size_t vertexCount)
+        : mOffsets(vertexCount + 1, 0)
+        , mTriangles(indexCount)
+    {
+        for (size_t i = 0; i < indexCount; i++)
+        {
+            mOffsets[indices[i] + 1]++;
+        }
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            mOffsets[v + 1] += mOffsets[v];
+        }
+
+        std::vector<unsigned int> filled(mOffsets.begin(), mOffsets.end() - 1);
+        for (size_t i = 0; i < indexCount; i++)
+        {
+            mTriangles[filled[indices[i]]++] = (unsigned int) (i / 3);
+        }
+    }
+
+    unsigned int Count(unsigned int vertex) const { return mOffsets[vertex + 1] - mOffsets[vertex]; }
+    const unsigned int* begin(unsigned int vertex) const { return mTriangles.data() + mOffsets[vertex]; }
+    const unsigned int* end(unsigned int vertex) const { return mTriangles.data() + mOffsets[vertex + 1]; }
+};
+
+void OptimizeVertexCache(unsigned int* indices, size_t indexCount, size_t vertexCount, size_t cacheSize,
+                         std::vector<unsigned int>* clusters)
+{
+    if (indexCount % 3 != 0)
+    {
+        throw std::runtime_error("Expected a triangle list.");
+    }
+
+    if (clusters)
+    {
+        clusters->clear();
+    }
+
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    // Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Tipsify).
+    // Fans out around one vertex at a time, then moves on to the neighbor that'll still be in the cache
+    // after all of its own triangles are drawn.
+    VertexTriangles vertexTriangles(indices, indexCount, vertexCount);
+
+    std::vector<unsigned int> live(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        live[v] = vertexTriangles.Count((unsigned int) v);
+    }
+
+    // when each vertex last went into the cache
+    std::vector<size_t> cacheTimes(vertexCount, 0);
+    size_t time = cacheSize + 1;
+
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<unsigned int> deadEnds;
+    std::vector<unsigned int> candidates;
+
+    std::vector<unsigned int> result;
+    result.reserve(indexCount);
+
+    // the next vertex to start from when there's nowhere to go, in input order
+    size_t cursor = 0;
+    long fanning = indices[0];
+    bool startsCluster = true;
+
+    while (fanning >= 0)
+    {
+        candidates.clear();
+
+        for (const unsigned int* t = vertexTriangles.begin(fanning); t != vertexTriangles.end(fanning); t++)
+        {
+            if (emitted[*t])
+            {
+                continue;
+            }
+
+            if (startsCluster && clusters)
+            {
+                clusters->push_back((unsigned int) (result.size() / 3));
+            }
+            startsCluster = false;
+
+            for (int corner = 0; corner < 3; corner++)
+            {
+                unsigned int vertex = indices[*t * 3 + corner];
+                result.push_back(vertex);
+                deadEnds.push_back(vertex);
+                candidates.push_back(vertex);
+                live[vertex]--;
+
+                if (time - cacheTimes[vertex] > cacheSize)
+                {
+                    cacheTimes[vertex] = time++;
+                }
+            }
+            emitted[*t] = true;
+        }
+
+        // the candidate that's been in the cache longest, as long as fanning around it won't push it out
+        long next = -1;
+        size_t bestPriority = 0;
+        for (unsigned int vertex : candidates)
+        {
+            if (live[vertex] == 0)
+            {
+                continue;
+            }
+
+            size_t priority = 0;
+            if (time - cacheTimes[vertex] + 2 * live[vertex] <= cacheSize)
+            {
+                priority = time - cacheTimes[vertex];
+            }
+
+            if (next < 0 || priority > bestPriority)
+            {
+                next = vertex;
+                bestPriority = priority;
+            }
+        }
+
+        if (next >= 0)
+        {
+            fanning = next;
+            continue;
+        }
+
+        // Nothing around here is left. Go back to a recent vertex with triangles left,
+        // or else the next one in the input, which starts a new cluster: the cache starts over there.
+        fanning = -1;
+        while (!deadEnds.empty() && fanning < 0)
+        {
+            unsigned int vertex = deadEnds.back();
+            deadEnds.pop_back();
+            if (live[vertex] > 0)
+            {
+                fanning = vertex;
+            }
+        }
+
+        while (fanning < 0 && cursor < indexCount)
+        {
+            if (live[indices[cursor]] > 0)
+            {
+                fanning = indices[cursor];
+            }
+            cursor++;
+        }
+
+        startsCluster = true;
+    }
+
+    std::copy(result.begin(), result.end(), indices);
+}
+
+void OptimizeOverdraw(unsigned int* indices, size_t indexCount, const float* positions, size_t vertexCount,
+                      const std::vector<unsigned int>& clusters, size_t cacheSize, float threshold)
+{
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0 || clusters.empty())
+    {
+        return;
+    }
+
+    // Tipsify's clusters can be big, up to the whole mesh, so they're split further where the cache starts over anyway,
+    // as long as the misses up to there stay within threshold of the whole mesh's rate.
+    float acmrLimit = AnalyzeVertexCache(indices, indexCount, vertexCount, cacheSize).mAcmr * threshold;
+
+    std::vector<unsigned int> splitClusters;
+    {
+        std::vector<size_t> cacheTimes(vertexCount, 0);
+        size_t time = cacheSize + 1;
+        size_t misses = 0;
+
+        size_t nextHardSplit = 0;
+        for (unsigned int t = 0; t < triangleCount; t++)
+        {
+            unsigned int triangleMisses = 0;
+            for (int corner = 0; corner < 3; corner++)
+            {
+                unsigned int vertex = indices[t * 3 + corner];
+                if (time - cacheTimes[vertex] > cacheSize)
+                {
+                    cacheTimes[vertex] = time++;
+                    triangleMisses++;
+                }
+            }
+
+            bool hardSplit = nextHardSplit < clusters.size() && clusters[nextHardSplit] == t;
+            if (hardSplit)
+            {
+                nextHardSplit++;
+            }
+
+            if (t == 0 || hardSplit ||
+                (triangleMisses >= 2 && (float) misses / (t - splitClusters.back()) <= acmrLimit))
+            {
+                splitClusters.push_back(t);
+            }
+            else
+            {
+                misses += triangleMisses;
+                continue;
+            }
+
+            misses = triangleMisses;
+        }
+    }
+
+    auto position = [positions](unsigned int vertex)
+    {
+        return glm::vec3(positions[vertex * 3], positions[vertex * 3 + 1], positions[vertex * 3 + 2]);
+    };
+
+    // the centroid of the whole mesh, weighted by area
+    glm::vec3 meshCenter(0.0f);
+    float meshArea = 0.0f;
+
+    struct Cluster
+    {
+        unsigned int mFirst;
+        unsigned int mEnd;
+        glm::vec3 mCenter;
+        glm::vec3 mNormal;
+        float mSortKey;
+    };
+
+    std::vector<Cluster> sortedClusters(splitClusters.size());
+    for (size_t c = 0; c < splitClusters.size(); c++)
+    {
+        Cluster& cluster = sortedClusters[c];
+        cluster.mFirst = splitClusters[c];
+        cluster.mEnd = c + 1 < splitClusters.size() ? splitClusters[c + 1] : (unsigned int) triangleCount;
+
+        glm::vec3 center(0.0f);
+        glm::vec3 areaNormal(0.0f);
+        float area = 0.0f;
+        for (unsigned int t = cluster.mFirst; t < cluster.mEnd; t++)
+        {
+            glm::vec3 p0 = position(indices[t * 3]);
+            glm::vec3 p1 = position(indices[t * 3 + 1]);
+            glm::vec3 p2 = position(indices[t * 3 + 2]);
+
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float triangleArea = 0.5f * glm::length(normal);
+
+            center += (p0 + p1 + p2) / 3.0f * triangleArea;
+            areaNormal += normal;
+            area += triangleArea;
+        }
+
+        meshCenter += center;
+        meshArea += area;
+
+        cluster.mCenter = area > 0.0f ? center / area : position(indices[cluster.mFirst * 3]);
+        cluster.mNormal = glm::length(areaNormal) > 0.0f ? glm::normalize(areaNormal) : glm::vec3(0.0f);
+    }
+
+    if (meshArea > 0.0f)
+    {
+        meshCenter /= meshArea;
+    }
+
+    // Clusters facing out from the middle of the mesh are the likeliest to cover the others, so they go first.
+    for (Cluster& cluster : sortedClusters)
+    {
+        cluster.mSortKey = glm::dot(cluster.mCenter - meshCenter, cluster.mNormal);
+    }
+
+    std::stable_sort(sortedClusters.begin(), sortedClusters.end(),
+                     [](const Cluster& a, const Cluster& b){ return a.mSortKey > b.mSortKey; });
+
+    std::vector<unsigned int> result;
+    result.reserve(indexCount);
+    for (const Cluster& cluster : sortedClusters)
+    {
+        result.insert(result.end(), indices + cluster.mFirst * 3, indices + cluster.mEnd * 3);
+    }
+
+    std::copy(result.begin(), result.end(), indices);
+}
+
+std::vector<unsigned int> OptimizeVertexFetch(unsigned int* indices, size_t indexCount, size_t vertexCount)
+{
+    std::vector<unsigned int> remap(vertexCount, ~0u);
+    unsigned int next = 0;
+
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        unsigned int& vertex = indices[i];
+        if (remap[vertex] == ~0u)
+        {
+            remap[vertex] = next++;
+        }
+        vertex = remap[vertex];
+    }
+
+    // vertices no triangle uses go at the end, in their old order
+    for (unsigned int& newIndex : remap)
+    {
+        if (newIndex == ~0u)
+        {
+            newIndex = next++;
+        }
+    }
+
+    return remap;
+}
+
+// Draws the triangles in order with a depth test, into an orthographic view down one axis.
+static void RasterizeOverdraw(const unsigned int* indices, size_t indexCount, const float* positions,
+                              const glm::vec3& minimum, const glm::vec3& extent, int axis, bool reversed,
+                              std::vector<float>& depth, std::vector<unsigned int>& shaded)
+{
+    const int u = (axis + 1) % 3;
+    const int v = (axis + 2) % 3;
+    const int size = kOverdrawResolution;
+
+    depth.assign(size * size, 1e30f);
+    shaded.assign(size * size, 0);
+
+    for (size_t t = 0; t + 2 < indexCount; t += 3)
+    {
+        glm::vec3 screen[3];
+        for (int corner = 0; corner < 3; corner++)
+        {
+            const float* p = &positions[indices[t + corner] * 3];
+            screen[corner].x = extent[u] > 0.0f ? (p[u] - minimum[u]) / extent[u] * (size - 1) : 0.0f;
+            screen[corner].y = extent[v] > 0.0f ? (p[v] - minimum[v]) / extent[v] * (size - 1) : 0.0f;
+            screen[corner].z = reversed ? -p[axis] : p[axis];
+        }
+
+        float area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) -
+                     (screen[2].x - screen[0].x) * (screen[1].y - screen[0].y);
+        if (area == 0.0f)
+        {
+            continue;
+        }
+
+        int x0 = std::max((int) std::ceil(std::min(std::min(screen[0].x, screen[1].x), screen[2].x)), 0);
+        int x1 = std::min((int) std::floor(std::max(std::max(screen[0].x, screen[1].x), screen[2].x)), size - 1);
+        int y0 = std::max((int) std::ceil(std::min(std::min(screen[0].y, screen[1].y), screen[2].y)), 0);
+        int y1 = std::min((int) std::floor(std::max(std::max(screen[0].y, screen[1].y), screen[2].y)), size - 1);
+
+        for (int y = y0; y <= y1; y++)
+        {
+            for (int x = x0; x <= x1; x++)
+            {
+                // barycentrics, from the edge functions
+                float w0 = ((screen[2].x - screen[1].x) * (y - screen[1].y) - (screen[2].y - screen[1].y) * (x - screen[1].x)) / area;
+                float w1 = ((screen[0].x - screen[2].x) * (y - screen[2].y) - (screen[0].y - screen[2].y) * (x - screen[2].x)) / area;
+                float w2 = 1.0f - w0 - w1;
+                if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                {
+                    continue;
+                }
+
+                float z = w0 * screen[0].z + w1 * screen[1].z + w2 * screen[2].z;
+                float& pixelDepth = depth[y * size + x];
+                if (z < pixelDepth)
+                {
+                    pixelDepth = z;
+                    shaded[y * size + x]++;
+                }
+            }
+        }
+    }
+}
+
+float AnalyzeOverdraw(const unsigned int* indices, size_t indexCount, const float* positions, size_t vertexCount)
+{
+    if (vertexCount == 0)
+    {
+        return 0.0f;
+    }
+
+    glm::vec3 minimum(1e30f), maximum(-1e30f);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        glm::vec3 position(positions[v * 3], positions[v * 3 + 1], positions[v * 3 + 2]);
+        minimum = glm::min(minimum, position);
+        maximum = glm::max(maximum, position);
+    }
+
+    std::vector<float> depth;
+    std::vector<unsigned int> shaded;
+    size_t shadedTotal = 0;
+    size_t coveredTotal = 0;
+
+    // from both sides of every axis, since the game draws both sides of every triangle
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (int reversed = 0; reversed < 2; reversed++)
+        {
+            RasterizeOverdraw(indices, indexCount, positions, minimum, maximum - minimum, axis, reversed != 0, depth, shaded);
+            for (unsigned int count : shaded)
+            {
+                shadedTotal += count;
+                coveredTotal += count > 0 ? 1 : 0;
+            }
+        }
+    }
+
+    return coveredTotal > 0 ? (float) shadedTotal / coveredTotal : 0.0f;
+}
+
+} // end namespace GLmesh
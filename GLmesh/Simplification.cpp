@@ -0,0 +1,544 @@
+#include "GLmesh.hpp"
+
+#include <tiny_obj_loader.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace GLmesh
+{
+
+// Every vertex is a point in this many dimensions: position, normal, texcoord.
+// Missing attributes are left at zero, and don't add to the error.
+static const int kDimensions = 8;
+
+// how much attributes count against position, as a fraction of the mesh's radius
+static const float kNormalWeight = 0.5f;
+static const float kTexcoordWeight = 1.0f;
+
+// Keeps the outline of open edges and seams in place.
+static const float kBoundaryWeight = 10.0f;
+
+// Rejects collapses that turn a triangle by more than about 75 degrees.
+static const float kMinNormalAgreement = 0.25f;
+
+// Garland and Heckbert's quadric, generalized to attributes:
+// the sum of squared distances to the planes of the triangles around a vertex, weighted by their area.
+struct Quadric
+{
+    // upper triangle of the symmetric matrix, row by row
+    double mA[kDimensions * (kDimensions + 1) / 2];
+    double mB[kDimensions];
+    double mC;
+    double mWeight;
+
+    Quadric()
+    {
+        std::memset(this, 0, sizeof(*this));
+    }
+
+    Quadric& operator+=(const Quadric& other)
+    {
+        for (size_t i = 0; i < sizeof(mA) / sizeof(mA[0]); i++)
+        {
+            mA[i] += other.mA[i];
+        }
+        for (int i = 0; i < kDimensions; i++)
+        {
+            mB[i] += other.mB[i];
+        }
+        mC += other.mC;
+        mWeight += other.mWeight;
+        return *this;
+    }
+
+    // the weighted mean squared distance of the point from the planes
+    double Evaluate(const double* point) const
+    {
+        double result = mC;
+        const double* a = mA;
+        for (int i = 0; i < kDimensions; i++)
+        {
+            result += *a++ * point[i] * point[i];
+            for (int j = i + 1; j < kDimensions; j++)
+            {
+                result += 2.0 * *a++ * point[i] * point[j];
+            }
+            result += 2.0 * mB[i] * point[i];
+        }
+        return mWeight > 0.0 ? std::max(result / mWeight, 0.0) : 0.0;
+    }
+
+    // adds weight * (dot(normal, x) - distance)^2 over the first dimensions of x
+    void AddPlane(const double* normal, double distance, int dimensions, double weight)
+    {
+        double* a = mA;
+        for (int i = 0; i < kDimensions; i++)
+        {
+            for (int j = i; j < kDimensions; j++)
+            {
+                *a++ += i < dimensions && j < dimensions ? weight * normal[i] * normal[j] : 0.0;
+            }
+            mB[i] += i < dimensions ? -weight * distance * normal[i] : 0.0;
+        }
+        mC += weight * distance * distance;
+        mWeight += weight;
+    }
+
+    // the squared distance from the plane through the three points, in every dimension at once
+    static Quadric FromTriangle(const double* p, const double* q, const double* r, double weight)
+    {
+        // an orthonormal basis of the triangle's plane
+        double e1[kDimensions], e2[kDimensions];
+        double e1Length = 0.0;
+        for (int i = 0; i < kDimensions; i++)
+        {
+            e1[i] = q[i] - p[i];
+            e1Length += e1[i] * e1[i];
+        }
+        e1Length = std::sqrt(e1Length);
+
+        Quadric quadric;
+        if (e1Length == 0.0)
+        {
+            return quadric;
+        }
+
+        double projection = 0.0;
+        for (int i = 0; i < kDimensions; i++)
+        {
+            e1[i] /= e1Length;
+            projection += (r[i] - p[i]) * e1[i];
+        }
+
+        double e2Length = 0.0;
+        for (int i = 0; i < kDimensions; i++)
+        {
+            e2[i] = r[i] - p[i] - projection * e1[i];
+            e2Length += e2[i] * e2[i];
+        }
+        e2Length = std::sqrt(e2Length);
+
+        if (e2Length == 0.0)
+        {
+            return quadric;
+        }
+
+        double pe1 = 0.0, pe2 = 0.0, pp = 0.0;
+        for (int i = 0; i < kDimensions; i++)
+        {
+            e2[i] /= e2Length;
+            pe1 += p[i] * e1[i];
+            pe2 += p[i] * e2[i];
+            pp += p[i] * p[i];
+        }
+
+        // A = I - e1 e1^T - e2 e2^T, b = (p.e1) e1 + (p.e2) e2 - p, c = p.p - (p.e1)^2 - (p.e2)^2
+        double* a = quadric.mA;
+        for (int i = 0; i < kDimensions; i++)
+        {
+            for (int j = i; j < kDimensions; j++)
+            {
+                *a++ = weight * ((i == j ? 1.0 : 0.0) - e1[i] * e1[j] - e2[i] * e2[j]);
+            }
+            quadric.mB[i] = weight * (pe1 * e1[i] + pe2 * e2[i] - p[i]);
+        }
+        quadric.mC = weight * (pp - pe1 * pe1 - pe2 * pe2);
+        quadric.mWeight = weight;
+        return quadric;
+    }
+};
+
+struct PositionHash
+{
+    size_t operator()(const glm::vec3& position) const
+    {
+        uint32_t bits[3];
+        std::memcpy(bits, &position[0], sizeof(bits));
+        return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+    }
+};
+
+// the triangles touching each group, rebuilt every pass
+struct Adjacency
+{
+    std::vector<unsigned int> mOffsets;
+    std::vector<unsigned int> mTriangles;
+
+    void Build(const std::vector<unsigned int>& indices, const std::vector<unsigned int>& groups, size_t numGroups)
+    {
+        mOffsets.assign(numGroups + 1, 0);
+        for (unsigned int index : indices)
+        {
+            mOffsets[groups[index] + 1]++;
+        }
+        for (size_t group = 0; group < numGroups; group++)
+        {
+            mOffsets[group + 1] += mOffsets[group];
+        }
+
+        mTriangles.resize(indices.size());
+        std::vector<unsigned int> filled(mOffsets.begin(), mOffsets.end() - 1);
+        for (size_t corner = 0; corner < indices.size(); corner++)
+        {
+            mTriangles[filled[groups[indices[corner]]]++] = (unsigned int) (corner / 3);
+        }
+    }
+
+    const unsigned int* begin(unsigned int group) const { return &mTriangles[0] + mOffsets[group]; }
+    const unsigned int* end(unsigned int group) const { return &mTriangles[0] + mOffsets[group + 1]; }
+};
+
+// Moving every vertex at one position onto another position.
+struct Collapse
+{
+    unsigned int mFrom;
+    unsigned int mTo;
+    // negative when the collapse isn't allowed
+    double mError;
+};
+
+// The vertices at the "from" position, each paired with the vertex at the "to" position it shares an edge with.
+// Fails when a vertex has no such edge, or more than one: that would tear a seam between normals or texcoords.
+static bool FindPartners(const Collapse& collapse, const std::vector<unsigned int>& indices,
+                         const std::vector<unsigned int>& groups, const Adjacency& adjacency,
+                         std::vector<std::pair<unsigned int, unsigned int>>& partners)
+{
+    partners.clear();
+
+    for (const unsigned int* t = adjacency.begin(collapse.mFrom); t != adjacency.end(collapse.mFrom); t++)
+    {
+        const unsigned int* triangle = &indices[*t * 3];
+
+        unsigned int from = 0, to = 0;
+        bool hasTo = false;
+        for (int corner = 0; corner < 3; corner++)
+        {
+            if (groups[triangle[corner]] == collapse.mFrom)
+            {
+                from = triangle[corner];
+            }
+            else if (groups[triangle[corner]] == collapse.mTo)
+            {
+                to = triangle[corner];
+                hasTo = true;
+            }
+        }
+
+        auto partner = std::find_if(partners.begin(), partners.end(),
+                                    [from](const std::pair<unsigned int, unsigned int>& p){ return p.first == from; });
+        if (partner == partners.end())
+        {
+            partners.push_back(std::make_pair(from, hasTo ? to : ~0u));
+        }
+        else if (hasTo)
+        {
+            if (partner->second == ~0u)
+            {
+                partner->second = to;
+            }
+            else if (partner->second != to)
+            {
+                return false;
+            }
+        }
+    }
+
+    for (const std::pair<unsigned int, unsigned int>& partner : partners)
+    {
+        if (partner.second == ~0u)
+        {
+            return false;
+        }
+    }
+    return !partners.empty();
+}
+
+// whether a triangle left after the collapse would turn over, or too far
+static bool FlipsTriangle(const Collapse& collapse, const std::vector<unsigned int>& indices,
+                          const std::vector<unsigned int>& groups, const Adjacency& adjacency,
+                          const std::vector<glm::vec3>& groupPositions)
+{
+    for (const unsigned int* t = adjacency.begin(collapse.mFrom); t != adjacency.end(collapse.mFrom); t++)
+    {
+        const unsigned int* triangle = &indices[*t * 3];
+
+        glm::vec3 before[3], after[3];
+        bool hasTo = false;
+        for (int corner = 0; corner < 3; corner++)
+        {
+            unsigned int group = groups[triangle[corner]];
+            hasTo = hasTo || group == collapse.mTo;
+            before[corner] = groupPositions[group];
+            after[corner] = group == collapse.mFrom ? groupPositions[collapse.mTo] : before[corner];
+        }
+
+        // those ones disappear
+        if (hasTo)
+        {
+            continue;
+        }
+
+        glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+        glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+        if (glm::dot(normalBefore, normalAfter) <= kMinNormalAgreement * glm::length(normalBefore) * glm::length(normalAfter))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<unsigned int> SimplifyMesh(const tinyobj::mesh_t& mesh, const std::vector<unsigned int>& indices,
+                                       size_t targetIndexCount, float maxError, float* error)
+{
+    if (indices.size() % 3 != 0)
+    {
+        throw std::runtime_error("Expected a triangle list.");
+    }
+
+    const size_t numVertices = mesh.positions.size() / 3;
+    const bool hasNormals = mesh.normals.size() == numVertices * 3;
+    const bool hasTexcoords = mesh.texcoords.size() == numVertices * 2;
+
+    // Vertices at the same position are one group, and move together.
+    // OBJ files split vertices wherever their normals or texcoords differ.
+    std::vector<unsigned int> groups(numVertices);
+    std::vector<glm::vec3> groupPositions;
+    {
+        std::unordered_map<glm::vec3, unsigned int, PositionHash> groupsByPosition;
+        for (size_t v = 0; v < numVertices; v++)
+        {
+            glm::vec3 position(mesh.positions[v * 3], mesh.positions[v * 3 + 1], mesh.positions[v * 3 + 2]);
+            auto inserted = groupsByPosition.insert(std::make_pair(position, (unsigned int) groupPositions.size()));
+            if (inserted.second)
+            {
+                groupPositions.push_back(position);
+            }
+            groups[v] = inserted.first->second;
+        }
+    }
+
+    // attributes are scaled to the size of the mesh, so that the error is in its units
+    glm::vec3 minimum(1e30f), maximum(-1e30f);
+    for (const glm::vec3& position : groupPositions)
+    {
+        minimum = glm::min(minimum, position);
+        maximum = glm::max(maximum, position);
+    }
+    const double radius = groupPositions.empty() ? 0.0 : 0.5 * glm::length(maximum - minimum);
+
+    std::vector<double> points(numVertices * kDimensions, 0.0);
+    for (size_t v = 0; v < numVertices; v++)
+    {
+        double* point = &points[v * kDimensions];
+        for (int i = 0; i < 3; i++)
+        {
+            point[i] = mesh.positions[v * 3 + i];
+            point[3 + i] = hasNormals ? mesh.normals[v * 3 + i] * kNormalWeight * radius : 0.0;
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            point[6 + i] = hasTexcoords ? mesh.texcoords[v * 2 + i] * kTexcoordWeight * radius : 0.0;
+        }
+    }
+
+    // each vertex starts out with the planes of its triangles
+    std::vector<Quadric> quadrics(numVertices);
+    std::unordered_map<uint64_t, int> edgeUses;
+    for (size_t t = 0; t < indices.size(); t += 3)
+    {
+        const unsigned int* triangle = &indices[t];
+        glm::vec3 p0 = groupPositions[groups[triangle[0]]];
+        glm::vec3 p1 = groupPositions[groups[triangle[1]]];
+        glm::vec3 p2 = groupPositions[groups[triangle[2]]];
+        double area = 0.5 * glm::length(glm::cross(p1 - p0, p2 - p0));
+
+        Quadric quadric = Quadric::FromTriangle(&points[triangle[0] * kDimensions],
+                                                &points[triangle[1] * kDimensions],
+                                                &points[triangle[2] * kDimensions], area);
+        for (int corner = 0; corner < 3; corner++)
+        {
+            quadrics[triangle[corner]] += quadric;
+
+            unsigned int a = triangle[corner], b = triangle[(corner + 1) % 3];
+            edgeUses[(uint64_t) std::min(a, b) << 32 | std::max(a, b)]++;
+        }
+    }
+
+    // Edges with a triangle on only one side are the edges of holes, or seams, where the vertices are split.
+    // A plane through the edge, at a right angle to its triangle, keeps them from moving off the line.
+    for (size_t t = 0; t < indices.size(); t += 3)
+    {
+        const unsigned int* triangle = &indices[t];
+        glm::vec3 p0 = groupPositions[groups[triangle[0]]];
+        glm::vec3 p1 = groupPositions[groups[triangle[1]]];
+        glm::vec3 p2 = groupPositions[groups[triangle[2]]];
+        glm::vec3 triangleNormal = glm::cross(p1 - p0, p2 - p0);
+        if (glm::length(triangleNormal) == 0.0f)
+        {
+            continue;
+        }
+
+        for (int corner = 0; corner < 3; corner++)
+        {
+            unsigned int a = triangle[corner], b = triangle[(corner + 1) % 3];
+            if (edgeUses[(uint64_t) std::min(a, b) << 32 | std::max(a, b)] != 1)
+            {
+                continue;
+            }
+
+            glm::vec3 pa = groupPositions[groups[a]], pb = groupPositions[groups[b]];
+            glm::vec3 edge = pb - pa;
+            glm::vec3 normal = glm::cross(edge, triangleNormal);
+            if (glm::length(normal) == 0.0f)
+            {
+                continue;
+            }
+            normal = glm::normalize(normal);
+
+            double planeNormal[3] = { normal.x, normal.y, normal.z };
+            double weight = kBoundaryWeight * glm::dot(edge, edge);
+            quadrics[a].AddPlane(planeNormal, glm::dot(normal, pa), 3, weight);
+            quadrics[b].AddPlane(planeNormal, glm::dot(normal, pb), 3, weight);
+        }
+    }
+
+    const double maxSquaredError = (double) maxError * maxError;
+    double appliedError = 0.0;
+
+    std::vector<unsigned int> result = indices;
+    Adjacency adjacency;
+    std::vector<Collapse> collapses;
+    std::vector<std::pair<unsigned int, unsigned int>> partners;
+    std::vector<unsigned int> remap(numVertices);
+    std::vector<bool> locked(groupPositions.size());
+
+    // Each pass collapses as many edges as it can without two of them touching the same triangles,
+    // so their costs don't go stale. Passes repeat until the target is reached or nothing is cheap enough.
+    while (result.size() > targetIndexCount)
+    {
+        adjacency.Build(result, groups, groupPositions.size());
+
+        collapses.clear();
+        for (size_t corner = 0; corner < result.size(); corner++)
+        {
+            unsigned int a = groups[result[corner]];
+            unsigned int b = groups[result[corner - corner % 3 + (corner % 3 + 1) % 3]];
+            if (a != b)
+            {
+                collapses.push_back(Collapse{ a, b, 0.0 });
+                collapses.push_back(Collapse{ b, a, 0.0 });
+            }
+        }
+
+        auto byGroups = [](const Collapse& x, const Collapse& y){ return x.mFrom != y.mFrom ? x.mFrom < y.mFrom : x.mTo < y.mTo; };
+        std::sort(collapses.begin(), collapses.end(), byGroups);
+        collapses.erase(std::unique(collapses.begin(), collapses.end(),
+                                    [](const Collapse& x, const Collapse& y){ return x.mFrom == y.mFrom && x.mTo == y.mTo; }),
+                        collapses.end());
+
+        // the error after a collapse is the worst of its vertices, with their quadrics merged
+        for (Collapse& collapse : collapses)
+        {
+            if (!FindPartners(collapse, result, groups, adjacency, partners) ||
+                FlipsTriangle(collapse, result, groups, adjacency, groupPositions))
+            {
+                collapse.mError = -1.0;
+                continue;
+            }
+
+            for (const std::pair<unsigned int, unsigned int>& partner : partners)
+            {
+                Quadric merged = quadrics[partner.first];
+                merged += quadrics[partner.second];
+                collapse.mError = std::max(collapse.mError, merged.Evaluate(&points[partner.second * kDimensions]));
+            }
+        }
+
+        collapses.erase(std::remove_if(collapses.begin(), collapses.end(), [](const Collapse& x){ return x.mError < 0.0; }),
+                        collapses.end());
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y){ return x.mError < y.mError; });
+
+        for (size_t v = 0; v < numVertices; v++)
+        {
+            remap[v] = (unsigned int) v;
+        }
+        std::fill(locked.begin(), locked.end(), false);
+
+        const size_t trianglesToRemove = (result.size() - targetIndexCount + 2) / 3;
+        size_t trianglesRemoved = 0;
+        size_t collapsesDone = 0;
+
+        for (const Collapse& collapse : collapses)
+        {
+            if (collapse.mError > maxSquaredError || trianglesRemoved >= trianglesToRemove)
+            {
+                break;
+            }
+
+            if (locked[collapse.mFrom] || locked[collapse.mTo])
+            {
+                continue;
+            }
+
+            FindPartners(collapse, result, groups, adjacency, partners);
+            for (const std::pair<unsigned int, unsigned int>& partner : partners)
+            {
+                remap[partner.first] = partner.second;
+                quadrics[partner.second] += quadrics[partner.first];
+            }
+
+            // nothing else may change the triangles around the vertices that moved this pass
+            for (const unsigned int* t = adjacency.begin(collapse.mFrom); t != adjacency.end(collapse.mFrom); t++)
+            {
+                bool hasTo = false;
+                for (int corner = 0; corner < 3; corner++)
+                {
+                    unsigned int group = groups[result[*t * 3 + corner]];
+                    locked[group] = true;
+                    hasTo = hasTo || group == collapse.mTo;
+                }
+                trianglesRemoved += hasTo ? 1 : 0;
+            }
+            locked[collapse.mTo] = true;
+
+            appliedError = std::max(appliedError, collapse.mError);
+            collapsesDone++;
+        }
+
+        if (collapsesDone == 0)
+        {
+            break;
+        }
+
+        // drop the triangles that lost a corner
+        size_t kept = 0;
+        for (size_t t = 0; t < result.size(); t += 3)
+        {
+            unsigned int a = remap[result[t]], b = remap[result[t + 1]], c = remap[result[t + 2]];
+            if (groups[a] != groups[b] && groups[b] != groups[c] && groups[c] != groups[a])
+            {
+                result[kept++] = a;
+                result[kept++] = b;
+                result[kept++] = c;
+            }
+        }
+        result.resize(kept);
+    }
+
+    if (error)
+    {
+        *error = (float) std::sqrt(appliedError);
+    }
+
+    return result;
+}
+
+} // end namespace GLmesh
@@ -3,29 +3,216 @@
 
 #include <GLplus.hpp>
 
+#include <string>
+#include <vector>
+
 namespace tinyobj
 {
+    struct mesh_t;
     struct shape_t;
 } // end namespace tinyobj
 
 namespace GLmesh
 {
 
+// How a StaticMesh stores its vertices.
+// All attributes of a vertex are interleaved in a single buffer.
+struct VertexFormat
+{
+    // GL_FLOAT, or GL_HALF_FLOAT
+    GLenum mPositionType = GL_FLOAT;
+    // GL_FLOAT, or GL_INT_2_10_10_10_REV (falls back to GL_FLOAT before GL 3.3)
+    GLenum mNormalType = GL_FLOAT;
+    // GL_FLOAT, GL_HALF_FLOAT, or GL_UNSIGNED_SHORT for unorm16
+    // (falls back to GL_HALF_FLOAT if texcoords leave [0,1])
+    GLenum mTexcoordType = GL_FLOAT;
+    // use GL_UNSIGNED_SHORT indices when there are few enough vertices
+    bool mAllowShortIndices = true;
+    // reorder triangles and vertices for the vertex cache, overdraw and vertex fetches
+    bool mOptimizeOrder = true;
+
+    // the smallest format for every attribute
+    static VertexFormat Compact();
+};
+
+// How StaticMesh::LoadShape makes simpler versions of a mesh, to draw when it's small on screen.
+struct LodOptions
+{
+    // including the full mesh. 1 doesn't simplify at all.
+    int mMaxLevels = 1;
+    // each level aims for this fraction of the triangles of the level before it
+    float mReduction = 0.5f;
+    // how far a level may move the surface from the full mesh, as a fraction of the mesh's radius
+    float mMaxError = 0.1f;
+};
+
+// One level of detail: a range of the mesh's index buffer, drawn with the same vertices as the others.
+struct MeshLod
+{
+    GLint mFirstIndex = 0;
+    GLsizei mIndexCount = 0;
+    // how far the surface moved from the full mesh, in the mesh's units. 0 for the full mesh.
+    // Levels are simplified from the one before, so this is the sum of those steps, which bounds the real distance.
+    float mError = 0.0f;
+};
+
+// Removes vertices by collapsing edges, cheapest first by quadric error, until at most targetIndexCount
+// indices are left or the next collapse would move the surface more than maxError.
+// Positions, normals and texcoords all count toward the error, and seams between normals or texcoords stay intact.
+// Vertices are only ever removed, never moved, so the result indexes the same vertices as the input.
+// error is set to how far the surface moved, in the mesh's units.
+std::vector<unsigned int> SimplifyMesh(const tinyobj::mesh_t& mesh, const std::vector<unsigned int>& indices,
+                                       size_t targetIndexCount, float maxError, float* error = nullptr);
+
+// How well an index buffer uses the post-transform vertex cache.
+struct VertexCacheStats
+{
+    // average cache misses per triangle. 0.5 at best on big regular meshes, 3 at worst.
+    float mAcmr = 0.0f;
+    // average times each vertex is transformed. 1 at best.
+    float mAtvr = 0.0f;
+};
+
+// Simulates a FIFO cache of cacheSize vertices over a triangle list.
+VertexCacheStats AnalyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount,
+                                    size_t cacheSize = 16);
+
+// Reorders triangles so vertices get reused while they're still in the cache, with Tipsify.
+// clusters gets the first triangle of each run that was drawn with a cold cache, for OptimizeOverdraw().
+void OptimizeVertexCache(unsigned int* indices, size_t indexCount, size_t vertexCount, size_t cacheSize = 16,
+                         std::vector<unsigned int>* clusters = nullptr);
+
+// Reorders the clusters OptimizeVertexCache() found so the ones facing out of the mesh come first and hide the others.
+// Clusters are split further where that costs fewer than threshold times the cache misses.
+// positions are 3 floats per vertex.
+void OptimizeOverdraw(unsigned int* indices, size_t indexCount, const float* positions, size_t vertexCount,
+                      const std::vector<unsigned int>& clusters, size_t cacheSize = 16, float threshold = 1.05f);
+
+// Renumbers vertices in the order the indices first use them, so fetches go through memory in order.
+// Returns each old vertex's new index. Unused vertices go last.
+std::vector<unsigned int> OptimizeVertexFetch(unsigned int* indices, size_t indexCount, size_t vertexCount);
+
+// Shaded pixels per covered pixel when drawing the triangles in order with a depth test,
+// averaged over views down both directions of each axis, with no face culling.
+float AnalyzeOverdraw(const unsigned int* indices, size_t indexCount, const float* positions, size_t vertexCount);
+
+// Where an attribute is in an interleaved vertex.
+struct VertexAttributeFormat
+{
+    // number of components, 0 if the mesh doesn't have this attribute
+    GLint mSize = 0;
+    GLenum mType = GL_FLOAT;
+    GLboolean mNormalized = GL_FALSE;
+    GLsizei mOffset = 0;
+};
+
+// A shape laid out the way a StaticMesh uploads it.
+// Making one doesn't touch GL, so it can happen on any thread once GLEW is initialized.
+struct MeshData
+{
+    std::vector<GLubyte> mVertexData;
+    // GLushort or GLuint indices, depending on mIndexType
+    std::vector<GLubyte> mIndexData;
+
+    VertexAttributeFormat mPositionFormat;
+    VertexAttributeFormat mNormalFormat;
+    VertexAttributeFormat mTexcoordFormat;
+    GLsizei mVertexStride = 0;
+    GLenum mIndexType = GL_UNSIGNED_INT;
+
+    size_t mIndexCount = 0;
+    size_t mVertexCount = 0;
+
+    std::vector<MeshLod> mLods;
+    VertexCacheStats mInputCacheStats;
+    VertexCacheStats mCacheStats;
+
+    // empty when the shape had no diffuse texture
+    std::string mDiffuseTextureName;
+};
+
+// Per-instance model matrices for StaticMesh::RenderInstanced, meant to be rewritten every frame.
+// Shaders read them from a "mat4 instanceModel" attribute.
+class InstanceBuffer
+{
+    std::shared_ptr<GLplus::Buffer> mBuffer;
+    size_t mCount = 0;
+
+public:
+    InstanceBuffer();
+
+    // column major matrices. Replaces the buffer's storage, so it doesn't wait on draws using the old data.
+    void Upload(const GLfloat* matrices, size_t count);
+
+    size_t GetCount() const;
+
+    const std::shared_ptr<GLplus::Buffer>& GetBuffer() const;
+};
+
 class StaticMesh
 {
-    std::shared_ptr<GLplus::Buffer> mPositions;
-    std::shared_ptr<GLplus::Buffer> mTexcoords;
-    std::shared_ptr<GLplus::Buffer> mNormals;
+    std::shared_ptr<GLplus::Buffer> mVertices;
     std::shared_ptr<GLplus::Buffer> mIndices;
 
+    VertexAttributeFormat mPositionFormat;
+    VertexAttributeFormat mNormalFormat;
+    VertexAttributeFormat mTexcoordFormat;
+    GLsizei mVertexStride = 0;
+    GLenum mIndexType = GL_UNSIGNED_INT;
+
     size_t mVertexCount = 0;
+    size_t mUniqueVertexCount = 0;
+
+    // the full mesh first, then simpler and simpler
+    std::vector<MeshLod> mLods;
+
+    // of the full mesh, in file order and as uploaded
+    VertexCacheStats mInputCacheStats;
+    VertexCacheStats mCacheStats;
 
     std::shared_ptr<GLplus::Texture2D> mDiffuseTexture;
 
+    mutable GLplus::VertexArrayCache mVertexArrays;
+
+    void SetVertexAttributes(const GLplus::Program& program, GLplus::VertexArray& vertexArray) const;
+
 public:
-    void LoadShape(const tinyobj::shape_t& shape);
+    // Simplified levels are made here, at load time. Every level shares the vertex buffer,
+    // and their indices follow each other in the index buffer.
+    void LoadShape(const tinyobj::shape_t& shape, const VertexFormat& format = VertexFormat(),
+                   const LodOptions& lodOptions = LodOptions());
+
+    // LoadShape() in two steps: the work that doesn't need GL, then the upload.
+    // The diffuse texture is left to the caller, which can share it between meshes.
+    static MeshData Prepare(const tinyobj::shape_t& shape, const VertexFormat& format = VertexFormat(),
+                            const LodOptions& lodOptions = LodOptions());
+    void Upload(const MeshData& data, const std::shared_ptr<GLplus::Texture2D>& diffuseTexture);
+
+    void Render(const GLplus::Program& program, int lod = 0) const;
+
+    // draws instanceCount copies in one draw call, told apart only by gl_InstanceID.
+    void RenderInstanced(const GLplus::Program& program, GLsizei instanceCount, int lod = 0) const;
+
+    // draws the first count instances of the buffer in one draw call.
+    // Each instance is drawn viewsPerInstance times in a row, like once for each eye.
+    void RenderInstanced(const GLplus::Program& program, const InstanceBuffer& instances, size_t count,
+                         GLuint viewsPerInstance = 1, int lod = 0) const;
+
+    // levels that didn't simplify enough to be worth it are left out, so there can be fewer than were asked for
+    const std::vector<MeshLod>& GetLods() const;
+    size_t GetTriangleCount(int lod = 0) const;
+
+    // of the full mesh, with the indices in the order they were loaded in
+    const VertexCacheStats& GetInputVertexCacheStats() const;
+    // of the full mesh, with the indices as they were uploaded
+    const VertexCacheStats& GetVertexCacheStats() const;
+
+    // null when the shape had no diffuse texture
+    const std::shared_ptr<GLplus::Texture2D>& GetDiffuseTexture() const;
 
-    void Render(const GLplus::Program& program) const;
+    size_t GetBytesPerVertex() const;
+    size_t GetVertexBufferSize() const;
+    size_t GetIndexBufferSize() const;
 };
 
 } // end namespace GLmesh
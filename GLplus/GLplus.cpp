@@ -1,6 +1,10 @@
 #include "GLplus.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <stdexcept>
+#include <string>
+#include <cstring>
 #include <vector>
 #include <fstream>
 #include <sstream>
@@ -25,52 +29,541 @@ static const char* StringFromGLError(GLenum err)
     }
 }
 
-void CheckGLErrors()
+// read by every GL call on the GL thread, while the main thread may still set it
+static std::atomic<ErrorCheckPolicy> sErrorCheckPolicy(ErrorCheckPolicy::PerCall);
+
+// the last GL calls made while errors are checked per scope
+struct RecentGLCalls
+{
+    static const unsigned int kCapacity = 16;
+
+    const char* mCalls[kCapacity];
+    unsigned int mCount = 0;
+
+    void Record(const char* call)
+    {
+        mCalls[mCount % kCapacity] = call;
+        mCount++;
+    }
+
+    std::string ToString() const
+    {
+        std::string calls;
+        unsigned int first = mCount > kCapacity ? mCount - kCapacity : 0;
+        for (unsigned int i = first; i < mCount; i++)
+        {
+            calls += i == first ? "" : ", ";
+            calls += mCalls[i % kCapacity];
+        }
+        return calls;
+    }
+};
+
+static thread_local RecentGLCalls sRecentGLCalls;
+
+void SetErrorCheckPolicy(ErrorCheckPolicy policy)
+{
+    sErrorCheckPolicy.store(policy, std::memory_order_relaxed);
+}
+
+ErrorCheckPolicy GetErrorCheckPolicy()
+{
+    return sErrorCheckPolicy.load(std::memory_order_relaxed);
+}
+
+static GLenum PopGLErrors()
 {
     GLenum firstError = glGetError();
 
     while (glGetError() != GL_NO_ERROR);
 
+    return firstError;
+}
+
+void CheckGLErrors(const char* call)
+{
+    switch (sErrorCheckPolicy.load(std::memory_order_relaxed))
+    {
+    case ErrorCheckPolicy::PerCall:
+    {
+        GLenum firstError = PopGLErrors();
+        if (firstError != GL_NO_ERROR)
+        {
+            throw std::runtime_error(std::string(call) + ": " + StringFromGLError(firstError));
+        }
+        break;
+    }
+    case ErrorCheckPolicy::PerScope:
+        sRecentGLCalls.Record(call);
+        break;
+    case ErrorCheckPolicy::Off:
+        break;
+    }
+}
+
+void FlushGLErrors(const char* scope)
+{
+    if (sErrorCheckPolicy.load(std::memory_order_relaxed) == ErrorCheckPolicy::Off)
+    {
+        return;
+    }
+
+    GLenum firstError = PopGLErrors();
+
+    std::string recentCalls = sRecentGLCalls.ToString();
+    sRecentGLCalls.mCount = 0;
+
     if (firstError != GL_NO_ERROR)
     {
-        throw std::runtime_error(StringFromGLError(firstError));
+        std::string message = std::string(StringFromGLError(firstError)) + " in " + scope;
+        if (!recentCalls.empty())
+        {
+            message += ". Most recent GL calls: " + recentCalls;
+        }
+        throw std::runtime_error(message);
+    }
+}
+
+static GLuint QueryBinding(GLenum pname)
+{
+    GLint binding;
+    glGetIntegerv(pname, &binding);
+    CheckGLErrors("glGetIntegerv");
+    return binding;
+}
+
+static GLenum BufferBindingFromTarget(GLenum target)
+{
+    switch (target)
+    {
+    case GL_ARRAY_BUFFER:              return GL_ARRAY_BUFFER_BINDING;
+    case GL_ELEMENT_ARRAY_BUFFER:      return GL_ELEMENT_ARRAY_BUFFER_BINDING;
+    case GL_UNIFORM_BUFFER:            return GL_UNIFORM_BUFFER_BINDING;
+    case GL_PIXEL_PACK_BUFFER:         return GL_PIXEL_PACK_BUFFER_BINDING;
+    case GL_PIXEL_UNPACK_BUFFER:       return GL_PIXEL_UNPACK_BUFFER_BINDING;
+    case GL_TRANSFORM_FEEDBACK_BUFFER: return GL_TRANSFORM_FEEDBACK_BUFFER_BINDING;
+    case GL_COPY_READ_BUFFER:          return GL_COPY_READ_BUFFER;
+    case GL_COPY_WRITE_BUFFER:         return GL_COPY_WRITE_BUFFER;
+    default: throw std::logic_error("Unknown buffer target.");
+    }
+}
+
+StateCache& StateCache::Current()
+{
+    // a GL context can only be current on one thread at a time
+    static thread_local StateCache cache;
+    return cache;
+}
+
+StateCache::Binding& StateCache::Texture2DBinding()
+{
+    GLuint unit = GetActiveTexture() - GL_TEXTURE0;
+    if (unit >= (GLuint) kMaxTextureUnits)
+    {
+        throw std::logic_error("Texture unit out of range of the StateCache.");
+    }
+    return mTextures2D[unit];
+}
+
+GLuint StateCache::GetProgram()
+{
+    if (!mProgram.mKnown)
+    {
+        mProgram.mHandle = QueryBinding(GL_CURRENT_PROGRAM);
+        mProgram.mKnown = true;
+    }
+    return mProgram.mHandle;
+}
+
+void StateCache::UseProgram(GLuint program)
+{
+    if (mProgram.mKnown && mProgram.mHandle == program)
+    {
+        mElidedCalls++;
+        return;
+    }
+
+    glUseProgram(program);
+    CheckGLErrors("glUseProgram");
+    mProgramSwitches++;
+
+    mProgram.mHandle = program;
+    mProgram.mKnown = true;
+}
+
+GLuint StateCache::GetBuffer(GLenum target)
+{
+    Binding& binding = mBuffers[target];
+    if (!binding.mKnown)
+    {
+        binding.mHandle = QueryBinding(BufferBindingFromTarget(target));
+        binding.mKnown = true;
+    }
+    return binding.mHandle;
+}
+
+void StateCache::BindBuffer(GLenum target, GLuint buffer)
+{
+    Binding& binding = mBuffers[target];
+    if (binding.mKnown && binding.mHandle == buffer)
+    {
+        mElidedCalls++;
+        return;
+    }
+
+    glBindBuffer(target, buffer);
+    CheckGLErrors("glBindBuffer");
+    mBinds++;
+
+    binding.mHandle = buffer;
+    binding.mKnown = true;
+}
+
+static GLuint64 IndexedBufferKey(GLenum target, GLuint index)
+{
+    return (GLuint64) target << 32 | index;
+}
+
+void StateCache::BindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+    IndexedBinding& binding = mIndexedBuffers[IndexedBufferKey(target, index)];
+    if (binding.mKnown && binding.mHandle == buffer && binding.mSize == -1)
+    {
+        mElidedCalls++;
+        return;
+    }
+
+    glBindBufferBase(target, index, buffer);
+    CheckGLErrors("glBindBufferBase");
+    mBinds++;
+
+    binding.mHandle = buffer;
+    binding.mOffset = 0;
+    binding.mSize = -1;
+    binding.mKnown = true;
+
+    mBuffers[target].mHandle = buffer;
+    mBuffers[target].mKnown = true;
+}
+
+void StateCache::BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    IndexedBinding& binding = mIndexedBuffers[IndexedBufferKey(target, index)];
+    if (binding.mKnown && binding.mHandle == buffer && binding.mOffset == offset && binding.mSize == size)
+    {
+        mElidedCalls++;
+        return;
+    }
+
+    glBindBufferRange(target, index, buffer, offset, size);
+    CheckGLErrors("glBindBufferRange");
+    mBinds++;
+
+    binding.mHandle = buffer;
+    binding.mOffset = offset;
+    binding.mSize = size;
+    binding.mKnown = true;
+
+    mBuffers[target].mHandle = buffer;
+    mBuffers[target].mKnown = true;
+}
+
+GLuint StateCache::GetVertexArray()
+{
+    if (!mVertexArray.mKnown)
+    {
+        mVertexArray.mHandle = QueryBinding(GL_VERTEX_ARRAY_BINDING);
+        mVertexArray.mKnown = true;
+    }
+    return mVertexArray.mHandle;
+}
+
+void StateCache::BindVertexArray(GLuint vertexArray)
+{
+    if (mVertexArray.mKnown && mVertexArray.mHandle == vertexArray)
+    {
+        mElidedCalls++;
+        return;
+    }
+
+    glBindVertexArray(vertexArray);
+    CheckGLErrors("glBindVertexArray");
+    mBinds++;
+
+    mVertexArray.mHandle = vertexArray;
+    mVertexArray.mKnown = true;
+
+    // the element array buffer binding is part of the vertex array's state.
+    mBuffers[GL_ELEMENT_ARRAY_BUFFER].mKnown = false;
+}
+
+GLenum StateCache::GetActiveTexture()
+{
+    if (!mActiveTexture.mKnown)
+    {
+        mActiveTexture.mHandle = QueryBinding(GL_ACTIVE_TEXTURE);
+        mActiveTexture.mKnown = true;
+    }
+    return mActiveTexture.mHandle;
+}
+
+void StateCache::ActiveTexture(GLenum textureIndex)
+{
+    if (mActiveTexture.mKnown && mActiveTexture.mHandle == textureIndex)
+    {
+        mElidedCalls++;
+        return;
+    }
+
+    glActiveTexture(textureIndex);
+    CheckGLErrors("glActiveTexture");
+    mBinds++;
+
+    mActiveTexture.mHandle = textureIndex;
+    mActiveTexture.mKnown = true;
+}
+
+GLuint StateCache::GetTexture2D()
+{
+    Binding& binding = Texture2DBinding();
+    if (!binding.mKnown)
+    {
+        binding.mHandle = QueryBinding(GL_TEXTURE_BINDING_2D);
+        binding.mKnown = true;
+    }
+    return binding.mHandle;
+}
+
+void StateCache::BindTexture2D(GLuint texture)
+{
+    Binding& binding = Texture2DBinding();
+    if (binding.mKnown && binding.mHandle == texture)
+    {
+        mElidedCalls++;
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    CheckGLErrors("glBindTexture");
+    mBinds++;
+
+    binding.mHandle = texture;
+    binding.mKnown = true;
+}
+
+GLuint StateCache::GetRenderBuffer()
+{
+    if (!mRenderBuffer.mKnown)
+    {
+        mRenderBuffer.mHandle = QueryBinding(GL_RENDERBUFFER_BINDING);
+        mRenderBuffer.mKnown = true;
+    }
+    return mRenderBuffer.mHandle;
+}
+
+void StateCache::BindRenderBuffer(GLuint renderBuffer)
+{
+    if (mRenderBuffer.mKnown && mRenderBuffer.mHandle == renderBuffer)
+    {
+        mElidedCalls++;
+        return;
+    }
+
+    glBindRenderbuffer(GL_RENDERBUFFER, renderBuffer);
+    CheckGLErrors("glBindRenderbuffer");
+    mBinds++;
+
+    mRenderBuffer.mHandle = renderBuffer;
+    mRenderBuffer.mKnown = true;
+}
+
+GLuint StateCache::GetFrameBuffer()
+{
+    if (!mFrameBuffer.mKnown)
+    {
+        mFrameBuffer.mHandle = QueryBinding(GL_FRAMEBUFFER_BINDING);
+        mFrameBuffer.mKnown = true;
+    }
+    return mFrameBuffer.mHandle;
+}
+
+void StateCache::BindFrameBuffer(GLuint frameBuffer)
+{
+    if (mFrameBuffer.mKnown && mFrameBuffer.mHandle == frameBuffer)
+    {
+        mElidedCalls++;
+        return;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+    CheckGLErrors("glBindFramebuffer");
+    mBinds++;
+
+    mFrameBuffer.mHandle = frameBuffer;
+    mFrameBuffer.mKnown = true;
+}
+
+void StateCache::OnDeleteBuffer(GLuint buffer)
+{
+    for (auto& targetBinding : mBuffers)
+    {
+        if (targetBinding.second.mHandle == buffer)
+        {
+            targetBinding.second.mHandle = 0;
+        }
     }
+
+    for (auto& indexedBinding : mIndexedBuffers)
+    {
+        if (indexedBinding.second.mHandle == buffer)
+        {
+            indexedBinding.second.mHandle = 0;
+            indexedBinding.second.mOffset = 0;
+            indexedBinding.second.mSize = -1;
+        }
+    }
+}
+
+void StateCache::OnDeleteVertexArray(GLuint vertexArray)
+{
+    if (mVertexArray.mHandle == vertexArray)
+    {
+        mVertexArray.mHandle = 0;
+        mBuffers[GL_ELEMENT_ARRAY_BUFFER].mKnown = false;
+    }
+}
+
+void StateCache::OnDeleteTexture(GLuint texture)
+{
+    for (Binding& binding : mTextures2D)
+    {
+        if (binding.mHandle == texture)
+        {
+            binding.mHandle = 0;
+        }
+    }
+}
+
+void StateCache::OnDeleteRenderBuffer(GLuint renderBuffer)
+{
+    if (mRenderBuffer.mHandle == renderBuffer)
+    {
+        mRenderBuffer.mHandle = 0;
+    }
+}
+
+void StateCache::OnDeleteFrameBuffer(GLuint frameBuffer)
+{
+    if (mFrameBuffer.mHandle == frameBuffer)
+    {
+        mFrameBuffer.mHandle = 0;
+    }
+}
+
+void StateCache::Invalidate()
+{
+    mProgram.mKnown = false;
+    mBuffers.clear();
+    mIndexedBuffers.clear();
+    mVertexArray.mKnown = false;
+    mActiveTexture.mKnown = false;
+    for (Binding& binding : mTextures2D)
+    {
+        binding.mKnown = false;
+    }
+    mRenderBuffer.mKnown = false;
+    mFrameBuffer.mKnown = false;
+}
+
+void StateCache::SetKeepBindings(bool keepBindings)
+{
+    mKeepBindings = keepBindings;
+}
+
+bool StateCache::IsKeepingBindings() const
+{
+    return mKeepBindings;
+}
+
+unsigned int StateCache::GetElidedCallCount() const
+{
+    return mElidedCalls;
+}
+
+unsigned int StateCache::GetBindCount() const
+{
+    return mBinds;
+}
+
+unsigned int StateCache::GetProgramSwitchCount() const
+{
+    return mProgramSwitches;
+}
+
+unsigned int StateCache::GetDrawCount() const
+{
+    return mDraws;
+}
+
+void StateCache::OnDraw()
+{
+    mDraws++;
+}
+
+void StateCache::ResetCallCounts()
+{
+    mElidedCalls = 0;
+    mBinds = 0;
+    mProgramSwitches = 0;
+    mDraws = 0;
+}
+
+ScopedKeepBindings::ScopedKeepBindings()
+{
+    StateCache& cache = StateCache::Current();
+    mOldKeepBindings = cache.IsKeepingBindings();
+    cache.SetKeepBindings(true);
+}
+
+ScopedKeepBindings::~ScopedKeepBindings()
+{
+    StateCache::Current().SetKeepBindings(mOldKeepBindings);
 }
 
 Shader::Shader(GLenum shaderType)
     : mShaderType(shaderType)
 {
     mHandle.mHandle = glCreateShader(shaderType);
-    CheckGLErrors();
+    CheckGLErrors("glCreateShader");
 }
 
 Shader::~Shader()
 {
     glDeleteShader(mHandle.mHandle);
-    CheckGLErrors();
+    CheckGLErrors("glDeleteShader");
 }
 
 void Shader::Compile(const GLchar* source)
 {
     glShaderSource(mHandle.mHandle, 1, &source, NULL);
-    CheckGLErrors();
+    CheckGLErrors("glShaderSource");
 
     glCompileShader(mHandle.mHandle);
-    CheckGLErrors();
+    CheckGLErrors("glCompileShader");
 
     int status;
     glGetShaderiv(mHandle.mHandle, GL_COMPILE_STATUS, &status);
-    CheckGLErrors();
+    CheckGLErrors("glGetShaderiv");
 
     if (!status)
     {
         int logLength;
         glGetShaderiv(mHandle.mHandle, GL_INFO_LOG_LENGTH, &logLength);
-        CheckGLErrors();
+        CheckGLErrors("glGetShaderiv");
 
         std::vector<char> log(logLength);
         glGetShaderInfoLog(mHandle.mHandle, log.size(), NULL, log.data());
-        CheckGLErrors();
+        CheckGLErrors("glGetShaderInfoLog");
 
         throw std::runtime_error(log.data());
     }
@@ -89,19 +582,19 @@ GLuint Shader::GetGLHandle() const
 Program::Program()
 {
     mHandle.mHandle = glCreateProgram();
-    CheckGLErrors();
+    CheckGLErrors("glCreateProgram");
 }
 
 Program::~Program()
 {
     glDeleteProgram(mHandle.mHandle);
-    CheckGLErrors();
+    CheckGLErrors("glDeleteProgram");
 }
 
 void Program::Attach(const std::shared_ptr<Shader>& shader)
 {
     glAttachShader(mHandle.mHandle, shader->GetGLHandle());
-    CheckGLErrors();
+    CheckGLErrors("glAttachShader");
 
     switch (shader->GetShaderType())
     {
@@ -118,267 +611,944 @@ void Program::Attach(const std::shared_ptr<Shader>& shader)
 
 void Program::Link()
 {
+    // without the hint, drivers are allowed to not keep what GetBinary() needs
+    if (HasProgramBinary())
+    {
+        glProgramParameteri(mHandle.mHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        CheckGLErrors("glProgramParameteri");
+    }
+
     glLinkProgram(mHandle.mHandle);
-    CheckGLErrors();
+    CheckGLErrors("glLinkProgram");
 
     int status;
     glGetProgramiv(mHandle.mHandle, GL_LINK_STATUS, &status);
-    CheckGLErrors();
+    CheckGLErrors("glGetProgramiv");
 
     if (!status)
     {
         int logLength;
         glGetProgramiv(mHandle.mHandle, GL_INFO_LOG_LENGTH, &logLength);
-        CheckGLErrors();
+        CheckGLErrors("glGetProgramiv");
 
         std::vector<char> log(logLength);
         glGetProgramInfoLog(mHandle.mHandle, log.size(), NULL, log.data());
-        CheckGLErrors();
+        CheckGLErrors("glGetProgramInfoLog");
 
         throw std::runtime_error(log.data());
     }
+
+    Reflect();
+}
+
+static void AddProgramVariable(
+        std::unordered_map<std::string, ProgramVariable>& variables,
+        std::string name,
+        const ProgramVariable& variable)
+{
+    variables[name] = variable;
+
+    // arrays are reported as "name[0]", but are usually looked up as "name".
+    static const std::string arraySuffix = "[0]";
+    if (name.size() > arraySuffix.size() &&
+        name.compare(name.size() - arraySuffix.size(), arraySuffix.size(), arraySuffix) == 0)
+    {
+        name.resize(name.size() - arraySuffix.size());
+        variables[name] = variable;
+    }
+}
+
+static unsigned int AttributeLayoutIDFromAttributes(
+        const std::unordered_map<std::string, ProgramVariable>& attributes)
+{
+    std::map<std::string, GLint> sortedLocations;
+    for (const auto& attribute : attributes)
+    {
+        sortedLocations[attribute.first] = attribute.second.mLocation;
+    }
+
+    std::stringstream layout;
+    for (const auto& location : sortedLocations)
+    {
+        layout << location.first << '=' << location.second << ';';
+    }
+
+    static std::unordered_map<std::string, unsigned int> sLayoutIDs;
+    auto found = sLayoutIDs.find(layout.str());
+    if (found != sLayoutIDs.end())
+    {
+        return found->second;
+    }
+
+    unsigned int layoutID = sLayoutIDs.size() + 1;
+    sLayoutIDs.emplace(layout.str(), layoutID);
+    return layoutID;
+}
+
+void Program::Reflect()
+{
+    mUniforms.clear();
+    mAttributes.clear();
+
+    GLint numUniforms, maxUniformNameLength;
+    glGetProgramiv(mHandle.mHandle, GL_ACTIVE_UNIFORMS, &numUniforms);
+    CheckGLErrors("glGetProgramiv");
+    glGetProgramiv(mHandle.mHandle, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxUniformNameLength);
+    CheckGLErrors("glGetProgramiv");
+
+    std::vector<GLchar> name(maxUniformNameLength + 1);
+    for (GLint i = 0; i < numUniforms; i++)
+    {
+        GLsizei length;
+        ProgramVariable uniform;
+        glGetActiveUniform(mHandle.mHandle, i, name.size(), &length, &uniform.mSize, &uniform.mType, name.data());
+        CheckGLErrors("glGetActiveUniform");
+
+        uniform.mLocation = glGetUniformLocation(mHandle.mHandle, name.data());
+        CheckGLErrors("glGetUniformLocation");
+
+        // members of uniform blocks don't have a location
+        if (uniform.mLocation != -1)
+        {
+            AddProgramVariable(mUniforms, std::string(name.data(), length), uniform);
+        }
+    }
+
+    GLint numAttributes, maxAttributeNameLength;
+    glGetProgramiv(mHandle.mHandle, GL_ACTIVE_ATTRIBUTES, &numAttributes);
+    CheckGLErrors("glGetProgramiv");
+    glGetProgramiv(mHandle.mHandle, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxAttributeNameLength);
+    CheckGLErrors("glGetProgramiv");
+
+    name.resize(maxAttributeNameLength + 1);
+    for (GLint i = 0; i < numAttributes; i++)
+    {
+        GLsizei length;
+        ProgramVariable attribute;
+        glGetActiveAttrib(mHandle.mHandle, i, name.size(), &length, &attribute.mSize, &attribute.mType, name.data());
+        CheckGLErrors("glGetActiveAttrib");
+
+        attribute.mLocation = glGetAttribLocation(mHandle.mHandle, name.data());
+        CheckGLErrors("glGetAttribLocation");
+
+        // built-ins like gl_VertexID don't have a location
+        if (attribute.mLocation != -1)
+        {
+            AddProgramVariable(mAttributes, std::string(name.data(), length), attribute);
+        }
+    }
+
+    mAttributeLayoutID = AttributeLayoutIDFromAttributes(mAttributes);
+}
+
+void Program::SetUniformBlockBinding(const GLchar* blockName, GLuint bindingPoint)
+{
+    GLuint blockIndex = glGetUniformBlockIndex(mHandle.mHandle, blockName);
+    CheckGLErrors("glGetUniformBlockIndex");
+
+    if (blockIndex == GL_INVALID_INDEX)
+    {
+        throw std::runtime_error(std::string("Couldn't find uniform block ") + blockName);
+    }
+
+    glUniformBlockBinding(mHandle.mHandle, blockIndex, bindingPoint);
+    CheckGLErrors("glUniformBlockBinding");
+}
+
+Program Program::FromFiles(const char* vShaderFile, const char* fShaderFile, const ShaderDefines& defines)
+{
+    return FromSources(ReadSourceFile(vShaderFile), ReadSourceFile(fShaderFile), defines);
+}
+
+Program Program::FromSources(const std::string& vShaderSource, const std::string& fShaderSource, const ShaderDefines& defines)
+{
+    std::shared_ptr<GLplus::Shader> vShader = std::make_shared<GLplus::Shader>(GL_VERTEX_SHADER);
+    vShader->Compile(AddDefines(vShaderSource, defines).c_str());
+
+    std::shared_ptr<GLplus::Shader> fShader = std::make_shared<GLplus::Shader>(GL_FRAGMENT_SHADER);
+    fShader->Compile(AddDefines(fShaderSource, defines).c_str());
+
+    // attach & link
+    Program program;
+    program.Attach(vShader);
+    program.Attach(fShader);
+    program.Link();
+
+    return program;
+}
+
+static std::string ReadShaderFile(const std::string& filename)
+{
+    std::ifstream file(filename);
+    if (!file)
+    {
+        throw std::runtime_error("Couldn't open shader file " + filename);
+    }
+
+    std::stringstream stream;
+    stream << file.rdbuf();
+    return stream.str();
+}
+
+// the quoted file name if the line is an #include, otherwise empty
+static std::string ParseInclude(const std::string& line)
+{
+    static const char directive[] = "#include";
+
+    size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos || line.compare(start, sizeof(directive) - 1, directive) != 0)
+    {
+        return std::string();
+    }
+
+    size_t open = line.find('"', start + sizeof(directive) - 1);
+    size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+    if (close == std::string::npos)
+    {
+        throw std::runtime_error("Malformed shader include: " + line);
+    }
+    return line.substr(open + 1, close - open - 1);
+}
+
+// includingFiles are the files being read, innermost last, to catch files that include themselves
+static std::string ResolveIncludes(const std::string& filename, std::vector<std::string>& includingFiles)
+{
+    if (std::find(includingFiles.begin(), includingFiles.end(), filename) != includingFiles.end())
+    {
+        throw std::runtime_error("Shader file " + filename + " includes itself");
+    }
+    includingFiles.push_back(filename);
+
+    std::string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+
+    std::istringstream source(ReadShaderFile(filename));
+    std::string resolved;
+    std::string line;
+    while (std::getline(source, line))
+    {
+        std::string included = ParseInclude(line);
+        if (included.empty())
+        {
+            resolved += line;
+        }
+        else
+        {
+            resolved += ResolveIncludes(directory + included, includingFiles);
+        }
+        resolved += '\n';
+    }
+
+    includingFiles.pop_back();
+    return resolved;
+}
+
+std::string Program::ReadSourceFile(const char* filename)
+{
+    std::vector<std::string> includingFiles;
+    return ResolveIncludes(filename, includingFiles);
+}
+
+std::string Program::AddDefines(const std::string& source, const ShaderDefines& defines)
+{
+    if (defines.empty())
+    {
+        return source;
+    }
+
+    std::string block;
+    for (const std::string& define : defines)
+    {
+        block += "#define " + define + "\n";
+    }
+
+    // nothing but comments can come before #version
+    size_t version = source.find("#version");
+    if (version == std::string::npos)
+    {
+        return block + source;
+    }
+
+    size_t lineEnd = source.find('\n', version);
+    if (lineEnd == std::string::npos)
+    {
+        return source + "\n" + block;
+    }
+    return source.substr(0, lineEnd + 1) + block + source.substr(lineEnd + 1);
+}
+
+// Queried on first use and kept, since every link asks. GLEW's entry points are process wide,
+// so the game only ever has the one context's driver to ask anyways.
+static const std::vector<GLint>& GetProgramBinaryFormats()
+{
+    static const std::vector<GLint> formats = []
+    {
+        std::vector<GLint> formats;
+        if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+        {
+            GLint numFormats = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+            CheckGLErrors("glGetIntegerv");
+
+            formats.resize(numFormats);
+            if (numFormats > 0)
+            {
+                glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats.data());
+                CheckGLErrors("glGetIntegerv");
+            }
+        }
+        return formats;
+    }();
+    return formats;
+}
+
+bool Program::HasProgramBinary()
+{
+    return !GetProgramBinaryFormats().empty();
+}
+
+bool Program::LinkBinary(const ProgramBinary& binary)
+{
+    if (binary.IsEmpty())
+    {
+        return false;
+    }
+
+    // formats the driver doesn't know are an error rather than a failed link
+    const std::vector<GLint>& formats = GetProgramBinaryFormats();
+    if (std::find(formats.begin(), formats.end(), (GLint) binary.mFormat) == formats.end())
+    {
+        return false;
+    }
+
+    glProgramBinary(mHandle.mHandle, binary.mFormat, binary.mData.data(), (GLsizei) binary.mData.size());
+    CheckGLErrors("glProgramBinary");
+
+    int status;
+    glGetProgramiv(mHandle.mHandle, GL_LINK_STATUS, &status);
+    CheckGLErrors("glGetProgramiv");
+
+    if (!status)
+    {
+        return false;
+    }
+
+    Reflect();
+    return true;
+}
+
+ProgramBinary Program::GetBinary() const
+{
+    ProgramBinary binary;
+    if (!HasProgramBinary())
+    {
+        return binary;
+    }
+
+    GLint length = 0;
+    glGetProgramiv(mHandle.mHandle, GL_PROGRAM_BINARY_LENGTH, &length);
+    CheckGLErrors("glGetProgramiv");
+
+    if (length > 0)
+    {
+        binary.mData.resize(length);
+        glGetProgramBinary(mHandle.mHandle, length, NULL, &binary.mFormat, binary.mData.data());
+        CheckGLErrors("glGetProgramBinary");
+    }
+
+    return binary;
+}
+
+const ProgramVariable* Program::FindAttribute(const GLchar* name) const
+{
+    auto found = mAttributes.find(name);
+    return found != mAttributes.end() ? &found->second : nullptr;
+}
+
+const ProgramVariable* Program::FindUniform(const GLchar* name) const
+{
+    auto found = mUniforms.find(name);
+    return found != mUniforms.end() ? &found->second : nullptr;
+}
+
+const std::unordered_map<std::string, ProgramVariable>& Program::GetAttributes() const
+{
+    return mAttributes;
+}
+
+const std::unordered_map<std::string, ProgramVariable>& Program::GetUniforms() const
+{
+    return mUniforms;
+}
+
+unsigned int Program::GetAttributeLayoutID() const
+{
+    return mAttributeLayoutID;
+}
+
+bool Program::TryGetAttributeLocation(const GLchar* name, GLint& loc) const
+{
+    const ProgramVariable* attribute = FindAttribute(name);
+    if (!attribute)
+    {
+        return false;
+    }
+
+    loc = attribute->mLocation;
+    return true;
+}
+
+GLint Program::GetAttributeLocation(const GLchar* name) const
+{
+    GLint loc;
+    if (!TryGetAttributeLocation(name, loc))
+    {
+        throw std::runtime_error("Couldn't find attribute.");
+    }
+    return loc;
+}
+
+bool Program::TryGetUniformLocation(const GLchar* name, GLint& loc) const
+{
+    const ProgramVariable* uniform = FindUniform(name);
+    if (!uniform)
+    {
+        return false;
+    }
+
+    loc = uniform->mLocation;
+    return true;
+}
+
+GLint Program::GetUniformLocation(const GLchar* name) const
+{
+    GLint loc;
+    if (!TryGetUniformLocation(name, loc))
+    {
+        throw std::runtime_error("Couldn't find uniform.");
+    }
+    return loc;
+}
+
+// the types glUniform1i can set: ints, bools and samplers
+static bool IsIntUniformType(GLenum type)
+{
+    switch (type)
+    {
+    case GL_INT:
+    case GL_BOOL:
+    case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+    case GL_SAMPLER_1D_SHADOW: case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_CUBE_SHADOW:
+    case GL_SAMPLER_1D_ARRAY: case GL_SAMPLER_2D_ARRAY:
+    case GL_SAMPLER_1D_ARRAY_SHADOW: case GL_SAMPLER_2D_ARRAY_SHADOW:
+    case GL_SAMPLER_2D_MULTISAMPLE: case GL_SAMPLER_2D_MULTISAMPLE_ARRAY:
+    case GL_SAMPLER_2D_RECT: case GL_SAMPLER_2D_RECT_SHADOW: case GL_SAMPLER_BUFFER:
+    case GL_INT_SAMPLER_1D: case GL_INT_SAMPLER_2D: case GL_INT_SAMPLER_3D: case GL_INT_SAMPLER_CUBE:
+    case GL_INT_SAMPLER_1D_ARRAY: case GL_INT_SAMPLER_2D_ARRAY:
+    case GL_INT_SAMPLER_2D_MULTISAMPLE: case GL_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+    case GL_INT_SAMPLER_2D_RECT: case GL_INT_SAMPLER_BUFFER:
+    case GL_UNSIGNED_INT_SAMPLER_1D: case GL_UNSIGNED_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_3D:
+    case GL_UNSIGNED_INT_SAMPLER_CUBE:
+    case GL_UNSIGNED_INT_SAMPLER_1D_ARRAY: case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+    case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE: case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+    case GL_UNSIGNED_INT_SAMPLER_2D_RECT: case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+        return true;
+    default:
+        return false;
+    }
+}
+
+GLint Program::GetUniformLocation(const GLchar* name, GLenum uploadType) const
+{
+    const ProgramVariable* uniform = FindUniform(name);
+    if (!uniform)
+    {
+        throw std::runtime_error(std::string("Couldn't find uniform ") + name);
+    }
+
+    // ints also set bools and samplers.
+    bool compatible = uploadType == GL_INT ? IsIntUniformType(uniform->mType)
+                                           : uniform->mType == uploadType;
+    if (!compatible)
+    {
+        throw std::logic_error(std::string("Type mismatch uploading uniform ") + name);
+    }
+
+    return uniform->mLocation;
+}
+
+// glProgramUniform* sets uniforms without binding the program.
+static bool HasProgramUniform()
+{
+    return GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects;
+}
+
+void Program::UploadInt(const GLchar* name, GLuint value) const
+{
+    UploadInt(GetUniformLocation(name, GL_INT), value);
+}
+
+void Program::UploadInt(GLint location, GLuint value) const
+{
+    if (HasProgramUniform())
+    {
+        glProgramUniform1i(mHandle.mHandle, location, value);
+        CheckGLErrors("glProgramUniform1i");
+    }
+    else
+    {
+        ScopedProgramBind binder(*this);
+        glUniform1i(location, value);
+        CheckGLErrors("glUniform1i");
+    }
+}
+
+void Program::UploadFloat(const GLchar* name, GLfloat value) const
+{
+    UploadFloat(GetUniformLocation(name, GL_FLOAT), value);
+}
+
+void Program::UploadFloat(GLint location, GLfloat value) const
+{
+    if (HasProgramUniform())
+    {
+        glProgramUniform1f(mHandle.mHandle, location, value);
+        CheckGLErrors("glProgramUniform1f");
+    }
+    else
+    {
+        ScopedProgramBind binder(*this);
+        glUniform1f(location, value);
+        CheckGLErrors("glUniform1f");
+    }
+}
+
+void Program::UploadVec2(const GLchar* name, GLfloat v0, GLfloat v1) const
+{
+    UploadVec2(GetUniformLocation(name, GL_FLOAT_VEC2), v0, v1);
+}
+
+void Program::UploadVec2(GLint location, GLfloat v0, GLfloat v1) const
+{
+    if (HasProgramUniform())
+    {
+        glProgramUniform2f(mHandle.mHandle, location, v0, v1);
+        CheckGLErrors("glProgramUniform2f");
+    }
+    else
+    {
+        ScopedProgramBind binder(*this);
+        glUniform2f(location, v0, v1);
+        CheckGLErrors("glUniform2f");
+    }
+}
+
+void Program::UploadVec2(const GLchar* name, const GLfloat* values) const
+{
+    UploadVec2(GetUniformLocation(name, GL_FLOAT_VEC2), values);
+}
+
+void Program::UploadVec2(GLint location, const GLfloat* values) const
+{
+    if (HasProgramUniform())
+    {
+        glProgramUniform2fv(mHandle.mHandle, location, 1, values);
+        CheckGLErrors("glProgramUniform2fv");
+    }
+    else
+    {
+        ScopedProgramBind binder(*this);
+        glUniform2fv(location, 1, values);
+        CheckGLErrors("glUniform2fv");
+    }
+}
+
+void Program::UploadVec4(const GLchar* name, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3) const
+{
+    UploadVec4(GetUniformLocation(name, GL_FLOAT_VEC4), v0, v1, v2, v3);
+}
+
+void Program::UploadVec4(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3) const
+{
+    if (HasProgramUniform())
+    {
+        glProgramUniform4f(mHandle.mHandle, location, v0, v1, v2, v3);
+        CheckGLErrors("glProgramUniform4f");
+    }
+    else
+    {
+        ScopedProgramBind binder(*this);
+        glUniform4f(location, v0, v1, v2, v3);
+        CheckGLErrors("glUniform4f");
+    }
+}
+
+void Program::UploadVec4(const GLchar* name, const GLfloat* values) const
+{
+    UploadVec4(GetUniformLocation(name, GL_FLOAT_VEC4), values);
+}
+
+void Program::UploadVec4(GLint location, const GLfloat* values) const
+{
+    if (HasProgramUniform())
+    {
+        glProgramUniform4fv(mHandle.mHandle, location, 1, values);
+        CheckGLErrors("glProgramUniform4fv");
+    }
+    else
+    {
+        ScopedProgramBind binder(*this);
+        glUniform4fv(location, 1, values);
+        CheckGLErrors("glUniform4fv");
+    }
+}
+
+void Program::UploadMatrix4(const GLchar* name, GLboolean transpose, const GLfloat* values) const
+{
+    UploadMatrix4(GetUniformLocation(name, GL_FLOAT_MAT4), transpose, values);
+}
+
+void Program::UploadMatrix4(GLint location, GLboolean transpose, const GLfloat* values) const
+{
+    if (HasProgramUniform())
+    {
+        glProgramUniformMatrix4fv(mHandle.mHandle, location, 1, transpose, values);
+        CheckGLErrors("glProgramUniformMatrix4fv");
+    }
+    else
+    {
+        ScopedProgramBind binder(*this);
+        glUniformMatrix4fv(location, 1, transpose, values);
+        CheckGLErrors("glUniformMatrix4fv");
+    }
+}
+
+GLuint Program::GetGLHandle() const
+{
+    return mHandle.mHandle;
+}
+
+ScopedProgramBind::ScopedProgramBind(const Program& bound)
+{
+    StateCache& cache = StateCache::Current();
+    mOldProgram.mHandle = cache.GetProgram();
+    cache.UseProgram(bound.GetGLHandle());
 }
 
-Program Program::FromFiles(const char* vShaderFile, const char* fShaderFile)
+ScopedProgramBind::~ScopedProgramBind()
 {
-    std::ifstream vFile(vShaderFile), fFile(fShaderFile);
-    if (!vFile || !fFile)
+    StateCache& cache = StateCache::Current();
+    if (!cache.IsKeepingBindings())
     {
-        throw std::runtime_error("Couldn't open shader file");
+        cache.UseProgram(mOldProgram.mHandle);
     }
+}
 
-    std::stringstream vStream, fStream;
-    vStream << vFile.rdbuf();
-    fStream << fFile.rdbuf();
+Buffer::Buffer(GLenum target)
+    : mTarget(target)
+{
+    glGenBuffers(1, &mHandle.mHandle);
+    CheckGLErrors("glGenBuffers");
+}
 
-    std::shared_ptr<GLplus::Shader> vShader = std::make_shared<GLplus::Shader>(GL_VERTEX_SHADER);
-    vShader->Compile(vStream.str().c_str());
+Buffer::~Buffer()
+{
+    glDeleteBuffers(1, &mHandle.mHandle);
+    CheckGLErrors("glDeleteBuffers");
 
-    std::shared_ptr<GLplus::Shader> fShader = std::make_shared<GLplus::Shader>(GL_FRAGMENT_SHADER);
-    fShader->Compile(fStream.str().c_str());
+    StateCache::Current().OnDeleteBuffer(mHandle.mHandle);
+}
 
-    // attach & link
-    Program program;
-    program.Attach(vShader);
-    program.Attach(fShader);
-    program.Link();
+void Buffer::Upload(GLsizeiptr size, const GLvoid* data, GLenum usage)
+{
+    ScopedBufferBind binder(*this);
 
-    return program;
+    glBufferData(mTarget, size, data, usage);
+    CheckGLErrors("glBufferData");
 }
 
-bool Program::TryGetAttributeLocation(const GLchar* name, GLint& loc) const
+void Buffer::Update(GLintptr offset, GLsizeiptr size, const GLvoid* data)
 {
-    GLint location = glGetAttribLocation(mHandle.mHandle, name);
-    CheckGLErrors();
-    if (location == -1)
-    {
-        return false;
-    }
+    ScopedBufferBind binder(*this);
 
-    loc = location;
-    return true;
+    glBufferSubData(mTarget, offset, size, data);
+    CheckGLErrors("glBufferSubData");
 }
 
-GLint Program::GetAttributeLocation(const GLchar* name) const
+void Buffer::CreateStorage(GLsizeiptr size, const GLvoid* data, GLbitfield flags)
 {
-    GLint loc;
-    if (!TryGetAttributeLocation(name, loc))
-    {
-        throw std::runtime_error("Couldn't find attribute.");
-    }
-    return loc;
+    ScopedBufferBind binder(*this);
+
+    glBufferStorage(mTarget, size, data, flags);
+    CheckGLErrors("glBufferStorage");
 }
 
-bool Program::TryGetUniformLocation(const GLchar* name, GLint& loc) const
+void* Buffer::MapRange(GLintptr offset, GLsizeiptr length, GLbitfield access)
 {
-    GLint location = glGetUniformLocation(mHandle.mHandle, name);
-    if (location == -1)
+    ScopedBufferBind binder(*this);
+
+    void* mapped = glMapBufferRange(mTarget, offset, length, access);
+    CheckGLErrors("glMapBufferRange");
+
+    if (!mapped)
     {
-        return false;
+        throw std::runtime_error("Couldn't map buffer.");
     }
 
-    loc = location;
-    return true;
+    return mapped;
 }
-GLint Program::GetUniformLocation(const GLchar* name) const
+
+void Buffer::Unmap()
 {
-    GLint loc;
-    if (!TryGetUniformLocation(name, loc))
-    {
-        throw std::runtime_error("Couldn't find uniform.");
-    }
-    return loc;
+    ScopedBufferBind binder(*this);
+
+    glUnmapBuffer(mTarget);
+    CheckGLErrors("glUnmapBuffer");
 }
 
-void Program::UploadInt(const GLchar* name, GLuint value) const
+GLenum Buffer::GetTarget() const
 {
-    UploadInt(GetUniformLocation(name), value);
+    return mTarget;
 }
 
-void Program::UploadInt(GLint location, GLuint value) const
+GLuint Buffer::GetGLHandle() const
 {
-    ScopedProgramBind binder(*this);
-    glUniform1i(location, value);
-    CheckGLErrors();
+    return mHandle.mHandle;
 }
 
-void Program::UploadFloat(const GLchar* name, GLfloat value) const
+ScopedBufferBind::ScopedBufferBind(const Buffer& bound)
+    : mTarget(bound.GetTarget())
 {
-    UploadFloat(GetUniformLocation(name), value);
+    StateCache& cache = StateCache::Current();
+    mOldBuffer.mHandle = cache.GetBuffer(mTarget);
+    cache.BindBuffer(mTarget, bound.GetGLHandle());
 }
 
-void Program::UploadFloat(GLint location, GLfloat value) const
+ScopedBufferBind::~ScopedBufferBind()
 {
-    ScopedProgramBind binder(*this);
-    glUniform1f(location, value);
-    CheckGLErrors();
+    StateCache::Current().BindBuffer(mTarget, mOldBuffer.mHandle);
 }
 
-void Program::UploadVec2(const GLchar* name, GLfloat v0, GLfloat v1) const
+UniformBuffer::UniformBuffer()
+    : mBuffer(GL_UNIFORM_BUFFER)
 {
-    UploadVec2(GetUniformLocation(name), v0, v1);
 }
 
-void Program::UploadVec2(GLint location, GLfloat v0, GLfloat v1) const
+void UniformBuffer::Upload(GLsizeiptr size, const GLvoid* data, GLenum usage)
 {
-    ScopedProgramBind binder(*this);
-    glUniform2f(location, v0, v1);
-    CheckGLErrors();
+    mBuffer.Upload(size, data, usage);
 }
 
-void Program::UploadVec2(const GLchar* name, const GLfloat* values) const
+void UniformBuffer::BindBase(GLuint bindingPoint) const
 {
-    UploadVec2(GetUniformLocation(name), values);
+    StateCache::Current().BindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, mBuffer.GetGLHandle());
 }
 
-void Program::UploadVec2(GLint location, const GLfloat* values) const
+void UniformBuffer::BindRange(GLuint bindingPoint, GLintptr offset, GLsizeiptr size) const
 {
-    ScopedProgramBind binder(*this);
-    glUniform2fv(location, 1, values);
-    CheckGLErrors();
+    StateCache::Current().BindBufferRange(GL_UNIFORM_BUFFER, bindingPoint, mBuffer.GetGLHandle(), offset, size);
 }
 
-void Program::UploadVec4(const GLchar* name, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3) const
+GLint UniformBuffer::GetOffsetAlignment()
 {
-    UploadVec4(GetUniformLocation(name), v0, v1, v2, v3);
+    GLint alignment;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    CheckGLErrors("glGetIntegerv");
+    return alignment;
 }
 
-void Program::UploadVec4(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3) const
+Buffer& UniformBuffer::GetBuffer()
 {
-    ScopedProgramBind binder(*this);
-    glUniform4f(location, v0, v1, v2, v3);
-    CheckGLErrors();
+    return mBuffer;
 }
 
-void Program::UploadVec4(const GLchar* name, const GLfloat* values) const
+const Buffer& UniformBuffer::GetBuffer() const
 {
-    UploadVec4(GetUniformLocation(name), values);
+    return mBuffer;
 }
 
-void Program::UploadVec4(GLint location, const GLfloat* values) const
+Std140Writer::Std140Writer(void* data, size_t size)
+    : mData(static_cast<GLubyte*>(data))
+    , mSize(size)
 {
-    ScopedProgramBind binder(*this);
-    glUniform4fv(location, 1, values);
-    CheckGLErrors();
 }
 
-void Program::UploadMatrix4(const GLchar* name, GLboolean transpose, const GLfloat* values) const
+GLubyte* Std140Writer::Allocate(size_t alignment, size_t size)
 {
-    UploadMatrix4(GetUniformLocation(name), transpose, values);
+    size_t offset = (mOffset + alignment - 1) / alignment * alignment;
+    if (offset + size > mSize)
+    {
+        throw std::logic_error("Std140Writer overflow.");
+    }
+
+    mOffset = offset + size;
+    return mData + offset;
 }
 
-void Program::UploadMatrix4(GLint location, GLboolean transpose, const GLfloat* values) const
+void Std140Writer::WriteInt(GLint value)
 {
-    ScopedProgramBind binder(*this);
-    glUniformMatrix4fv(location, 1, transpose, values);
-    CheckGLErrors();
+    std::memcpy(Allocate(4, sizeof(value)), &value, sizeof(value));
 }
 
-GLuint Program::GetGLHandle() const
+void Std140Writer::WriteFloat(GLfloat value)
 {
-    return mHandle.mHandle;
+    std::memcpy(Allocate(4, sizeof(value)), &value, sizeof(value));
 }
 
-ScopedProgramBind::ScopedProgramBind(const Program& bound)
+void Std140Writer::WriteVec2(const GLfloat* values)
 {
-    GLint currentProgram;
-    glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
-    CheckGLErrors();
+    std::memcpy(Allocate(8, sizeof(GLfloat) * 2), values, sizeof(GLfloat) * 2);
+}
 
-    mOldProgram.mHandle = currentProgram;
+void Std140Writer::WriteVec3(const GLfloat* values)
+{
+    std::memcpy(Allocate(16, sizeof(GLfloat) * 3), values, sizeof(GLfloat) * 3);
+}
 
-    glUseProgram(bound.GetGLHandle());
-    CheckGLErrors();
+void Std140Writer::WriteVec4(const GLfloat* values)
+{
+    std::memcpy(Allocate(16, sizeof(GLfloat) * 4), values, sizeof(GLfloat) * 4);
 }
 
-ScopedProgramBind::~ScopedProgramBind()
+void Std140Writer::WriteMatrix4(const GLfloat* values)
 {
-    glUseProgram(mOldProgram.mHandle);
-    CheckGLErrors();
+    // each column is laid out like a vec4
+    std::memcpy(Allocate(16, sizeof(GLfloat) * 16), values, sizeof(GLfloat) * 16);
 }
 
-Buffer::Buffer(GLenum target)
-    : mTarget(target)
+size_t Std140Writer::GetOffset() const
 {
-    glGenBuffers(1, &mHandle.mHandle);
-    CheckGLErrors();
+    return mOffset;
 }
 
-Buffer::~Buffer()
+static bool HasBufferStorage()
 {
-    glDeleteBuffers(1, &mHandle.mHandle);
-    CheckGLErrors();
+    return GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
 }
 
-void Buffer::Upload(GLsizeiptr size, const GLvoid* data, GLenum usage)
+UniformRingBuffer::UniformRingBuffer(GLsizeiptr frameSize, int framesInFlight)
+    : mAlignment(UniformBuffer::GetOffsetAlignment())
+    , mFences(framesInFlight, nullptr)
 {
-    ScopedBufferBind binder(*this);
+    mFrameSize = (frameSize + mAlignment - 1) / mAlignment * mAlignment;
 
-    glBufferData(mTarget, size, data, usage);
-    CheckGLErrors();
+    Buffer& buffer = mBuffer.GetBuffer();
+    if (HasBufferStorage())
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        buffer.CreateStorage(mFrameSize * framesInFlight, NULL, flags);
+        mPersistentMapping = static_cast<GLubyte*>(buffer.MapRange(0, mFrameSize * framesInFlight, flags));
+    }
+    else
+    {
+        buffer.Upload(mFrameSize * framesInFlight, NULL, GL_STREAM_DRAW);
+        mStaging.resize(mFrameSize);
+    }
 }
 
-GLenum Buffer::GetTarget() const
+UniformRingBuffer::~UniformRingBuffer()
 {
-    return mTarget;
+    for (GLsync fence : mFences)
+    {
+        if (fence)
+        {
+            glDeleteSync(fence);
+            CheckGLErrors("glDeleteSync");
+        }
+    }
+
+    if (mPersistentMapping)
+    {
+        mBuffer.GetBuffer().Unmap();
+    }
 }
 
-GLuint Buffer::GetGLHandle() const
+void UniformRingBuffer::BeginFrame()
 {
-    return mHandle.mHandle;
+    int numFrames = mFences.size();
+
+    // everything submitted until now used the previous region
+    if (mFrameIndex != -1 && mPersistentMapping)
+    {
+        mFences[mFrameIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        CheckGLErrors("glFenceSync");
+    }
+
+    mFrameIndex = (mFrameIndex + 1) % numFrames;
+    mFrameUsed = 0;
+    mFrameFlushed = 0;
+
+    GLsync& fence = mFences[mFrameIndex];
+    if (fence)
+    {
+        GLenum waitResult;
+        do
+        {
+            waitResult = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            CheckGLErrors("glClientWaitSync");
+        } while (waitResult == GL_TIMEOUT_EXPIRED);
+
+        if (waitResult == GL_WAIT_FAILED)
+        {
+            throw std::runtime_error("Waiting for uniform buffer region failed.");
+        }
+
+        glDeleteSync(fence);
+        CheckGLErrors("glDeleteSync");
+        fence = nullptr;
+    }
 }
 
-ScopedBufferBind::ScopedBufferBind(const Buffer& bound)
-    : mTarget(bound.GetTarget())
+UniformRingBuffer::Allocation UniformRingBuffer::Allocate(GLsizeiptr size)
 {
-    if (bound.GetTarget() == GL_ARRAY_BUFFER)
+    if (mFrameIndex == -1)
+    {
+        throw std::logic_error("UniformRingBuffer::Allocate called before BeginFrame.");
+    }
+
+    GLsizeiptr offsetInFrame = (mFrameUsed + mAlignment - 1) / mAlignment * mAlignment;
+    if (offsetInFrame + size > mFrameSize)
     {
-        GLint oldBuffer;
-        glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &oldBuffer);
-        CheckGLErrors();
+        throw std::runtime_error("UniformRingBuffer frame region is full.");
+    }
+
+    mFrameUsed = offsetInFrame + size;
+
+    Allocation allocation;
+    allocation.mOffset = mFrameIndex * mFrameSize + offsetInFrame;
+    allocation.mSize = size;
+    allocation.mData = mPersistentMapping ? mPersistentMapping + allocation.mOffset
+                                          : mStaging.data() + offsetInFrame;
+    return allocation;
+}
 
-        mOldBuffer.mHandle = oldBuffer;
+void UniformRingBuffer::Flush()
+{
+    // coherent mappings need no flush
+    if (!mPersistentMapping && mFrameUsed > mFrameFlushed)
+    {
+        mBuffer.GetBuffer().Update(mFrameIndex * mFrameSize + mFrameFlushed, mFrameUsed - mFrameFlushed,
+                                   mStaging.data() + mFrameFlushed);
+        mFrameFlushed = mFrameUsed;
     }
-    glBindBuffer(bound.GetTarget(), bound.GetGLHandle());
-    CheckGLErrors();
 }
 
-ScopedBufferBind::~ScopedBufferBind()
+void UniformRingBuffer::BindRange(GLuint bindingPoint, const Allocation& allocation) const
 {
-    glBindBuffer(mTarget, mOldBuffer.mHandle);
-    CheckGLErrors();
+    mBuffer.BindRange(bindingPoint, allocation.mOffset, allocation.mSize);
 }
 
 VertexArray::VertexArray()
 {
     glGenVertexArrays(1, &mHandle.mHandle);
-    CheckGLErrors();
+    CheckGLErrors("glGenVertexArrays");
 }
 
 VertexArray::~VertexArray()
 {
     glDeleteVertexArrays(1, &mHandle.mHandle);
-    CheckGLErrors();
+    CheckGLErrors("glDeleteVertexArrays");
+
+    StateCache::Current().OnDeleteVertexArray(mHandle.mHandle);
 }
 
 void VertexArray::SetAttribute(
@@ -398,18 +1568,58 @@ void VertexArray::SetAttribute(
     ScopedVertexArrayBind binder(*this);
 
     glEnableVertexAttribArray(index);
-    CheckGLErrors();
+    CheckGLErrors("glEnableVertexAttribArray");
 
     {
         ScopedBufferBind bufferBind(*buffer);
 
         glVertexAttribPointer(index, size, type, normalized, stride, (const GLvoid*) offset);
-        CheckGLErrors();
+        CheckGLErrors("glVertexAttribPointer");
 
         mVertexBuffers[index] = buffer;
     }
 }
 
+bool VertexArray::HasInstancedArrays()
+{
+    return GLEW_VERSION_3_3 || GLEW_ARB_instanced_arrays;
+}
+
+void VertexArray::SetAttributeDivisor(GLuint index, GLuint divisor)
+{
+    if (!HasInstancedArrays())
+    {
+        throw std::runtime_error("Instanced attributes need GL 3.3 or ARB_instanced_arrays.");
+    }
+
+    ScopedVertexArrayBind binder(*this);
+
+    // the extension's entry point is all a 3.1 or 3.2 driver has
+    if (GLEW_VERSION_3_3)
+    {
+        glVertexAttribDivisor(index, divisor);
+    }
+    else
+    {
+        glVertexAttribDivisorARB(index, divisor);
+    }
+    CheckGLErrors("glVertexAttribDivisor");
+}
+
+void VertexArray::SetMatrix4Attribute(
+        GLuint index,
+        const std::shared_ptr<Buffer>& buffer,
+        GLsizei stride,
+        GLsizei offset,
+        GLuint divisor)
+{
+    for (GLuint column = 0; column < 4; column++)
+    {
+        SetAttribute(index + column, buffer, 4, GL_FLOAT, GL_FALSE, stride, offset + column * sizeof(GLfloat) * 4);
+        SetAttributeDivisor(index + column, divisor);
+    }
+}
+
 void VertexArray::SetIndexBuffer(const std::shared_ptr<Buffer>& buffer, GLenum type)
 {
     if (buffer->GetTarget() != GL_ELEMENT_ARRAY_BUFFER)
@@ -420,8 +1630,7 @@ void VertexArray::SetIndexBuffer(const std::shared_ptr<Buffer>& buffer, GLenum t
     ScopedVertexArrayBind binder(*this);
 
     // spookiest, most unobviously documented thing about the GL spec I found so far.
-    glBindBuffer(buffer->GetTarget(), buffer->GetGLHandle());
-    CheckGLErrors();
+    StateCache::Current().BindBuffer(buffer->GetTarget(), buffer->GetGLHandle());
 
     mIndexBuffer = buffer;
     mIndexType = type;
@@ -441,37 +1650,60 @@ GLuint VertexArray::GetGLHandle() const
     return mHandle.mHandle;
 }
 
-ScopedVertexArrayBind::ScopedVertexArrayBind(const VertexArray& bound)
+void VertexArrayCache::Clear()
 {
-    GLint oldArray;
-    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &oldArray);
-    CheckGLErrors();
-
-    mOldVertexArray.mHandle = oldArray;
+    mVertexArrays.clear();
+}
 
-    glBindVertexArray(bound.GetGLHandle());
-    CheckGLErrors();
+ScopedVertexArrayBind::ScopedVertexArrayBind(const VertexArray& bound)
+{
+    StateCache& cache = StateCache::Current();
+    mOldVertexArray.mHandle = cache.GetVertexArray();
+    cache.BindVertexArray(bound.GetGLHandle());
 }
 
 ScopedVertexArrayBind::~ScopedVertexArrayBind()
 {
-    glBindVertexArray(mOldVertexArray.mHandle);
-    CheckGLErrors();
+    StateCache& cache = StateCache::Current();
+    if (!cache.IsKeepingBindings())
+    {
+        cache.BindVertexArray(mOldVertexArray.mHandle);
+    }
 }
 
 Texture2D::Texture2D()
 {
     glGenTextures(1, &mHandle.mHandle);
-    CheckGLErrors();
+    CheckGLErrors("glGenTextures");
 }
 
 Texture2D::~Texture2D()
 {
     glDeleteTextures(1, &mHandle.mHandle);
-    CheckGLErrors();
+    CheckGLErrors("glDeleteTextures");
+
+    StateCache::Current().OnDeleteTexture(mHandle.mHandle);
+}
+
+DecodedImage DecodedImage::FromFile(const char* filename)
+{
+    DecodedImage image;
+    unsigned char* pixels = SOIL_load_image(filename, &image.mWidth, &image.mHeight, &image.mChannels, SOIL_LOAD_AUTO);
+    if (!pixels)
+    {
+        throw std::runtime_error(std::string("Couldn't load ") + filename + ": " + SOIL_last_result());
+    }
+
+    image.mPixels.reset(pixels, SOIL_free_image_data);
+    return image;
 }
 
 void Texture2D::LoadImage(const char* filename, unsigned int flags)
+{
+    LoadImage(DecodedImage::FromFile(filename), flags);
+}
+
+void Texture2D::LoadImage(const DecodedImage& image, unsigned int flags)
 {
     unsigned int soilFlags = 0;
     if (flags & InvertY)
@@ -479,16 +1711,19 @@ void Texture2D::LoadImage(const char* filename, unsigned int flags)
         soilFlags |= SOIL_FLAG_INVERT_Y;
     }
 
-    int width, height;
-    if (!SOIL_load_OGL_texture(filename,
-                &width, &height, NULL,
-                SOIL_LOAD_AUTO,
+    int width = image.mWidth;
+    int height = image.mHeight;
+    if (!SOIL_create_OGL_texture(image.mPixels.get(),
+                &width, &height, image.mChannels,
                 mHandle.mHandle,
                 soilFlags))
     {
         throw std::runtime_error(SOIL_last_result());
     }
 
+    // SOIL binds the texture behind our back.
+    StateCache::Current().Invalidate();
+
     mWidth = width;
     mHeight = height;
 }
@@ -498,7 +1733,7 @@ void Texture2D::CreateStorage(GLsizei levels, GLenum internalformat, GLsizei wid
     ScopedTextureBind binder(*this, GL_TEXTURE0);
 
     glTexStorage2D(GL_TEXTURE_2D, levels, internalformat, width, height);
-    CheckGLErrors();
+    CheckGLErrors("glTexStorage2D");
 
     mWidth = width;
     mHeight = height;
@@ -530,41 +1765,41 @@ GLuint Texture2D::GetGLHandle() const
 ScopedTextureBind::ScopedTextureBind(const Texture2D& bound, GLenum textureIndex)
     : mTextureIndex(textureIndex)
 {
-    glGetIntegerv(GL_ACTIVE_TEXTURE, &mOldTextureIndex);
-    CheckGLErrors();
-
-    glActiveTexture(mTextureIndex);
-    CheckGLErrors();
+    StateCache& cache = StateCache::Current();
 
-    GLint oldTexture;
-    glGetIntegerv(GL_TEXTURE_BINDING_2D, &oldTexture);
-    CheckGLErrors();
+    mOldTextureIndex = cache.GetActiveTexture();
+    cache.ActiveTexture(mTextureIndex);
 
-    mOldTexture.mHandle = oldTexture;
-
-    glBindTexture(GL_TEXTURE_2D, bound.GetGLHandle());
-    CheckGLErrors();
+    mOldTexture.mHandle = cache.GetTexture2D();
+    cache.BindTexture2D(bound.GetGLHandle());
 }
 
 ScopedTextureBind::~ScopedTextureBind()
 {
-    glBindTexture(GL_TEXTURE_2D, mOldTexture.mHandle);
-    CheckGLErrors();
+    StateCache& cache = StateCache::Current();
+    if (cache.IsKeepingBindings())
+    {
+        return;
+    }
+
+    cache.ActiveTexture(mTextureIndex);
+    cache.BindTexture2D(mOldTexture.mHandle);
 
-    glActiveTexture(mOldTextureIndex);
-    CheckGLErrors();
+    cache.ActiveTexture(mOldTextureIndex);
 }
 
 RenderBuffer::RenderBuffer()
 {
     glGenRenderbuffers(1, &mHandle.mHandle);
-    CheckGLErrors();
+    CheckGLErrors("glGenRenderbuffers");
 }
 
 RenderBuffer::~RenderBuffer()
 {
     glDeleteRenderbuffers(1, &mHandle.mHandle);
-    CheckGLErrors();
+    CheckGLErrors("glDeleteRenderbuffers");
+
+    StateCache::Current().OnDeleteRenderBuffer(mHandle.mHandle);
 }
 
 void RenderBuffer::CreateStorage(GLenum internalformat, GLsizei width, GLsizei height)
@@ -572,7 +1807,7 @@ void RenderBuffer::CreateStorage(GLenum internalformat, GLsizei width, GLsizei h
     ScopedRenderBufferBind binder(*this);
 
     glRenderbufferStorage(GL_RENDERBUFFER, internalformat, width, height);
-    CheckGLErrors();
+    CheckGLErrors("glRenderbufferStorage");
 }
 
 GLuint RenderBuffer::GetGLHandle() const
@@ -582,20 +1817,14 @@ GLuint RenderBuffer::GetGLHandle() const
 
 ScopedRenderBufferBind::ScopedRenderBufferBind(const RenderBuffer& bound)
 {
-    GLint oldRenderbuffer;
-    glGetIntegerv(GL_RENDERBUFFER_BINDING, &oldRenderbuffer);
-    CheckGLErrors();
-
-    mOldRenderBuffer.mHandle = oldRenderbuffer;
-
-    glBindRenderbuffer(GL_RENDERBUFFER, bound.GetGLHandle());
-    CheckGLErrors();
+    StateCache& cache = StateCache::Current();
+    mOldRenderBuffer.mHandle = cache.GetRenderBuffer();
+    cache.BindRenderBuffer(bound.GetGLHandle());
 }
 
 ScopedRenderBufferBind::~ScopedRenderBufferBind()
 {
-    glBindRenderbuffer(GL_RENDERBUFFER, mOldRenderBuffer.mHandle);
-    CheckGLErrors();
+    StateCache::Current().BindRenderBuffer(mOldRenderBuffer.mHandle);
 }
 
 FrameBuffer::Attachment::Attachment(const std::shared_ptr<Texture2D>& texture)
@@ -611,13 +1840,15 @@ FrameBuffer::Attachment::Attachment(const std::shared_ptr<RenderBuffer>& renderB
 FrameBuffer::FrameBuffer()
 {
     glGenFramebuffers(1, &mHandle.mHandle);
-    CheckGLErrors();
+    CheckGLErrors("glGenFramebuffers");
 }
 
 FrameBuffer::~FrameBuffer()
 {
     glDeleteFramebuffers(1, &mHandle.mHandle);
-    CheckGLErrors();
+    CheckGLErrors("glDeleteFramebuffers");
+
+    StateCache::Current().OnDeleteFrameBuffer(mHandle.mHandle);
 }
 
 void FrameBuffer::Attach(GLenum attachment, const std::shared_ptr<Texture2D>& texture)
@@ -625,7 +1856,7 @@ void FrameBuffer::Attach(GLenum attachment, const std::shared_ptr<Texture2D>& te
     ScopedFrameBufferBind binder(*this);
 
     glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture->GetGLHandle(), 0);
-    CheckGLErrors();
+    CheckGLErrors("glFramebufferTexture2D");
 
     mAttachments.emplace(attachment, texture);
 }
@@ -635,7 +1866,7 @@ void FrameBuffer::Attach(GLenum attachment, const std::shared_ptr<RenderBuffer>&
     ScopedFrameBufferBind binder(*this);
 
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, renderBuffer->GetGLHandle());
-    CheckGLErrors();
+    CheckGLErrors("glFramebufferRenderbuffer");
 
     mAttachments.emplace(attachment, renderBuffer);
 }
@@ -645,7 +1876,7 @@ void FrameBuffer::Detach(GLenum attachment)
     ScopedFrameBufferBind binder(*this);
 
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, 0);
-    CheckGLErrors();
+    CheckGLErrors("glFramebufferRenderbuffer");
 
     mAttachments.erase(attachment);
 }
@@ -672,7 +1903,7 @@ GLenum FrameBuffer::GetStatus() const
     ScopedFrameBufferBind binder(*this);
 
     GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    CheckGLErrors();
+    CheckGLErrors("glCheckFramebufferStatus");
 
     return status;
 }
@@ -693,45 +1924,178 @@ GLuint FrameBuffer::GetGLHandle() const
 
 ScopedFrameBufferBind::ScopedFrameBufferBind(const FrameBuffer& bound)
 {
-    GLint oldFramebuffer;
-    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &oldFramebuffer);
-    CheckGLErrors();
+    StateCache& cache = StateCache::Current();
+    mOldFrameBuffer.mHandle = cache.GetFrameBuffer();
+    cache.BindFrameBuffer(bound.GetGLHandle());
+}
 
-    mOldFrameBuffer.mHandle = oldFramebuffer;
+ScopedFrameBufferBind::ScopedFrameBufferBind(DefaultFrameBuffer)
+{
+    StateCache& cache = StateCache::Current();
+    mOldFrameBuffer.mHandle = cache.GetFrameBuffer();
+    cache.BindFrameBuffer(0);
+}
 
-    glBindFramebuffer(GL_FRAMEBUFFER, bound.GetGLHandle());
-    CheckGLErrors();
+ScopedFrameBufferBind::~ScopedFrameBufferBind()
+{
+    StateCache& cache = StateCache::Current();
+    if (!cache.IsKeepingBindings())
+    {
+        cache.BindFrameBuffer(mOldFrameBuffer.mHandle);
+    }
 }
 
-ScopedFrameBufferBind::ScopedFrameBufferBind(DefaultFrameBuffer)
+Query::Query(GLenum target)
+    : mTarget(target)
+{
+    if ((target == GL_TIME_ELAPSED || target == GL_TIMESTAMP) && !HasTimerQuery())
+    {
+        throw std::runtime_error("Timer queries need GL 3.3 or ARB_timer_query.");
+    }
+
+    if (target == GL_ANY_SAMPLES_PASSED && !HasAnySamplesPassedQuery())
+    {
+        throw std::runtime_error("GL_ANY_SAMPLES_PASSED queries need GL 3.3 or ARB_occlusion_query2.");
+    }
+
+    glGenQueries(1, &mHandle.mHandle);
+    CheckGLErrors("glGenQueries");
+}
+
+Query::~Query()
+{
+    glDeleteQueries(1, &mHandle.mHandle);
+    CheckGLErrors("glDeleteQueries");
+}
+
+void Query::Begin()
 {
-    GLint oldFramebuffer;
-    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &oldFramebuffer);
-    CheckGLErrors();
+    glBeginQuery(mTarget, mHandle.mHandle);
+    CheckGLErrors("glBeginQuery");
+}
 
-    mOldFrameBuffer.mHandle = oldFramebuffer;
+void Query::End()
+{
+    glEndQuery(mTarget);
+    CheckGLErrors("glEndQuery");
+}
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    CheckGLErrors();
+bool Query::IsResultAvailable() const
+{
+    GLuint available;
+    glGetQueryObjectuiv(mHandle.mHandle, GL_QUERY_RESULT_AVAILABLE, &available);
+    CheckGLErrors("glGetQueryObjectuiv");
+    return available != GL_FALSE;
 }
 
-ScopedFrameBufferBind::~ScopedFrameBufferBind()
+GLuint64 Query::GetResult() const
+{
+    if (HasTimerQuery())
+    {
+        GLuint64 result;
+        glGetQueryObjectui64v(mHandle.mHandle, GL_QUERY_RESULT, &result);
+        CheckGLErrors("glGetQueryObjectui64v");
+        return result;
+    }
+    else
+    {
+        GLuint result;
+        glGetQueryObjectuiv(mHandle.mHandle, GL_QUERY_RESULT, &result);
+        CheckGLErrors("glGetQueryObjectuiv");
+        return result;
+    }
+}
+
+bool Query::TryGetResult(GLuint64& result) const
+{
+    if (!IsResultAvailable())
+    {
+        return false;
+    }
+
+    result = GetResult();
+    return true;
+}
+
+GLenum Query::GetTarget() const
+{
+    return mTarget;
+}
+
+GLuint Query::GetGLHandle() const
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, mOldFrameBuffer.mHandle);
-    CheckGLErrors();
+    return mHandle.mHandle;
+}
+
+bool Query::HasTimerQuery()
+{
+    return GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+}
+
+bool Query::HasAnySamplesPassedQuery()
+{
+    return GLEW_VERSION_3_3 || GLEW_ARB_occlusion_query2;
+}
+
+TimerQuery::TimerQuery()
+    : mQuery(GL_TIMESTAMP)
+{
+}
+
+void TimerQuery::Record()
+{
+    glQueryCounter(mQuery.GetGLHandle(), GL_TIMESTAMP);
+    CheckGLErrors("glQueryCounter");
+}
+
+bool TimerQuery::IsResultAvailable() const
+{
+    return mQuery.IsResultAvailable();
+}
+
+GLuint64 TimerQuery::GetTimestamp() const
+{
+    return mQuery.GetResult();
+}
+
+bool TimerQuery::TryGetTimestamp(GLuint64& timestamp) const
+{
+    return mQuery.TryGetResult(timestamp);
 }
 
 void DrawArrays(GLenum mode, GLint first, GLsizei count)
 {
     glDrawArrays(mode, first, count);
-    CheckGLErrors();
+    CheckGLErrors("glDrawArrays");
+
+    StateCache::Current().OnDraw();
 }
 
 void DrawElements(GLenum mode, GLenum indexType, GLint first, GLsizei count)
 {
     glDrawElements(mode, count, indexType,
                    (const GLvoid*) (SizeFromGLType(indexType) * first));
-    CheckGLErrors();
+    CheckGLErrors("glDrawElements");
+
+    StateCache::Current().OnDraw();
+}
+
+void DrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instanceCount)
+{
+    glDrawArraysInstanced(mode, first, count, instanceCount);
+    CheckGLErrors("glDrawArraysInstanced");
+
+    StateCache::Current().OnDraw();
+}
+
+void DrawElementsInstanced(GLenum mode, GLenum indexType, GLint first, GLsizei count, GLsizei instanceCount)
+{
+    glDrawElementsInstanced(mode, count, indexType,
+                            (const GLvoid*) (SizeFromGLType(indexType) * first),
+                            instanceCount);
+    CheckGLErrors("glDrawElementsInstanced");
+
+    StateCache::Current().OnDraw();
 }
 
 } // end namespace GLplus
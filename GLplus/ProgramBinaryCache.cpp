@@ -0,0 +1,218 @@
+#include "GLplus.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+
+namespace GLplus
+{
+
+// "GLPB", then the version of the layout below
+static const uint32_t kCacheMagic = 0x42504c47;
+static const uint32_t kCacheVersion = 1;
+
+struct CacheFileHeader
+{
+    uint32_t mMagic;
+    uint32_t mVersion;
+    uint32_t mFormat;
+    uint32_t mSize;
+    // of the binary, to catch files cut short by a crash
+    uint64_t mChecksum;
+};
+
+// FNV-1a. Not for security, only needs to be the same on every run.
+static uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t HashString(const std::string& string, uint64_t hash)
+{
+    // the terminator too, so "ab" + "c" doesn't hash like "a" + "bc"
+    return HashBytes(string.c_str(), string.size() + 1, hash);
+}
+
+static std::string GLString(GLenum name)
+{
+    const GLubyte* string = glGetString(name);
+    CheckGLErrors("glGetString");
+    return string ? reinterpret_cast<const char*>(string) : "";
+}
+
+static double SecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+ProgramBinaryCache::ProgramBinaryCache(const std::string& directory)
+    : mDirectory(directory)
+    , mEnabled(Program::HasProgramBinary())
+{
+    if (!mDirectory.empty() && mDirectory.back() != '/' && mDirectory.back() != '\\')
+    {
+        mDirectory += '/';
+    }
+
+    mDriver = GLString(GL_VENDOR) + '\n' + GLString(GL_RENDERER) + '\n' + GLString(GL_VERSION) + '\n' +
+              GLString(GL_SHADING_LANGUAGE_VERSION);
+}
+
+bool ProgramBinaryCache::IsEnabled() const
+{
+    return mEnabled;
+}
+
+std::string ProgramBinaryCache::GetKey(const std::string& vShaderSource, const std::string& fShaderSource) const
+{
+    uint64_t hash = HashString(mDriver, 14695981039346656037ULL);
+    hash = HashString(vShaderSource, hash);
+    hash = HashString(fShaderSource, hash);
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long) hash);
+    return key;
+}
+
+bool ProgramBinaryCache::Read(const std::string& key, ProgramBinary& binary) const
+{
+    binary = ProgramBinary();
+    if (!mEnabled)
+    {
+        return false;
+    }
+
+    std::ifstream file(mDirectory + key + ".bin", std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    CacheFileHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        header.mMagic != kCacheMagic || header.mVersion != kCacheVersion || header.mSize == 0)
+    {
+        return false;
+    }
+
+    std::vector<char> data(header.mSize);
+    if (!file.read(data.data(), data.size()) || HashBytes(data.data(), data.size()) != header.mChecksum)
+    {
+        return false;
+    }
+
+    binary.mFormat = header.mFormat;
+    binary.mData.swap(data);
+    return true;
+}
+
+bool ProgramBinaryCache::Write(const std::string& key, const ProgramBinary& binary) const
+{
+    if (!mEnabled || binary.IsEmpty())
+    {
+        return false;
+    }
+
+    // written aside and moved in place, so a reader never sees half a file
+    static std::atomic<unsigned int> sWrites(0);
+    std::string path = mDirectory + key + ".bin";
+    std::string partialPath = path + "." + std::to_string(sWrites++) + ".tmp";
+
+    {
+        std::ofstream file(partialPath, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            return false;
+        }
+
+        CacheFileHeader header;
+        header.mMagic = kCacheMagic;
+        header.mVersion = kCacheVersion;
+        header.mFormat = binary.mFormat;
+        header.mSize = (uint32_t) binary.mData.size();
+        header.mChecksum = HashBytes(binary.mData.data(), binary.mData.size());
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(binary.mData.data(), binary.mData.size());
+        if (!file.flush())
+        {
+            file.close();
+            std::remove(partialPath.c_str());
+            return false;
+        }
+    }
+
+    // rename doesn't replace files everywhere
+    std::remove(path.c_str());
+    if (std::rename(partialPath.c_str(), path.c_str()) != 0)
+    {
+        std::remove(partialPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+Program ProgramBinaryCache::Load(const std::string& vShaderSource, const std::string& fShaderSource,
+                                 const ProgramBinary& cached, ProgramBinary& toCache)
+{
+    toCache = ProgramBinary();
+
+    if (!cached.IsEmpty())
+    {
+        auto start = std::chrono::steady_clock::now();
+        Program program;
+        bool linked = program.LinkBinary(cached);
+        mStats.mLoadTime += SecondsSince(start);
+
+        if (linked)
+        {
+            mStats.mHits++;
+            return program;
+        }
+        mStats.mRejected++;
+    }
+
+    mStats.mMisses++;
+    auto start = std::chrono::steady_clock::now();
+    Program program = Program::FromSources(vShaderSource, fShaderSource);
+    mStats.mCompileTime += SecondsSince(start);
+
+    if (mEnabled)
+    {
+        toCache = program.GetBinary();
+    }
+    return program;
+}
+
+Program ProgramBinaryCache::Load(const std::string& vShaderSource, const std::string& fShaderSource)
+{
+    std::string key = GetKey(vShaderSource, fShaderSource);
+
+    ProgramBinary cached;
+    Read(key, cached);
+
+    ProgramBinary toCache;
+    Program program = Load(vShaderSource, fShaderSource, cached, toCache);
+    Write(key, toCache);
+    return program;
+}
+
+Program ProgramBinaryCache::LoadFiles(const char* vShaderFile, const char* fShaderFile)
+{
+    return Load(Program::ReadSourceFile(vShaderFile), Program::ReadSourceFile(fShaderFile));
+}
+
+const ProgramBinaryCacheStats& ProgramBinaryCache::GetStats() const
+{
+    return mStats;
+}
+
+} // end namespace GLplus
@@ -0,0 +1,142 @@
+#include "GLplus.hpp"
+
+#include <stdexcept>
+
+namespace GLplus
+{
+
+ProgramVariants::ProgramVariants(const std::string& vShaderSource, const std::string& fShaderSource,
+                                 const std::vector<std::string>& options, ProgramBinaryCache* binaryCache)
+    : mVertexSource(vShaderSource)
+    , mFragmentSource(fShaderSource)
+    , mOptions(options)
+    , mBinaryCache(binaryCache)
+{
+    if (mOptions.size() > sizeof(Mask) * 8)
+    {
+        throw std::logic_error("Too many options for a ProgramVariants mask.");
+    }
+}
+
+ProgramVariants ProgramVariants::FromFiles(const char* vShaderFile, const char* fShaderFile,
+                                           const std::vector<std::string>& options, ProgramBinaryCache* binaryCache)
+{
+    return ProgramVariants(Program::ReadSourceFile(vShaderFile), Program::ReadSourceFile(fShaderFile), options, binaryCache);
+}
+
+ProgramVariants::Mask ProgramVariants::GetOption(const std::string& option) const
+{
+    for (size_t i = 0; i < mOptions.size(); i++)
+    {
+        if (mOptions[i] == option)
+        {
+            return 1u << i;
+        }
+    }
+    throw std::logic_error("Unknown shader option " + option);
+}
+
+const std::vector<std::string>& ProgramVariants::GetOptions() const
+{
+    return mOptions;
+}
+
+ShaderDefines ProgramVariants::GetDefines(Mask variant) const
+{
+    CheckMask(variant);
+
+    ShaderDefines defines;
+    for (size_t i = 0; i < mOptions.size(); i++)
+    {
+        if (variant & (1u << i))
+        {
+            defines.push_back(mOptions[i]);
+        }
+    }
+    return defines;
+}
+
+std::string ProgramVariants::GetVertexSource(Mask variant) const
+{
+    return Program::AddDefines(mVertexSource, GetDefines(variant));
+}
+
+std::string ProgramVariants::GetFragmentSource(Mask variant) const
+{
+    return Program::AddDefines(mFragmentSource, GetDefines(variant));
+}
+
+void ProgramVariants::SetSetup(std::function<void(Program&, Mask)> setup)
+{
+    mSetup = std::move(setup);
+
+    if (mSetup)
+    {
+        for (auto& variant : mVariants)
+        {
+            mSetup(*variant.second, variant.first);
+        }
+    }
+}
+
+const std::shared_ptr<Program>& ProgramVariants::Get(Mask variant)
+{
+    auto found = mVariants.find(variant);
+    if (found != mVariants.end())
+    {
+        return found->second;
+    }
+
+    std::string vShaderSource = GetVertexSource(variant);
+    std::string fShaderSource = GetFragmentSource(variant);
+    Program program = mBinaryCache ? mBinaryCache->Load(vShaderSource, fShaderSource)
+                                   : Program::FromSources(vShaderSource, fShaderSource);
+
+    std::shared_ptr<Program>& added = mVariants[variant];
+    added = std::make_shared<Program>(std::move(program));
+    if (mSetup)
+    {
+        mSetup(*added, variant);
+    }
+    return added;
+}
+
+void ProgramVariants::Compile(const std::vector<Mask>& variants)
+{
+    for (Mask variant : variants)
+    {
+        Get(variant);
+    }
+}
+
+void ProgramVariants::Add(Mask variant, Program&& program)
+{
+    CheckMask(variant);
+
+    std::shared_ptr<Program>& added = mVariants[variant];
+    added = std::make_shared<Program>(std::move(program));
+    if (mSetup)
+    {
+        mSetup(*added, variant);
+    }
+}
+
+bool ProgramVariants::IsCompiled(Mask variant) const
+{
+    return mVariants.find(variant) != mVariants.end();
+}
+
+size_t ProgramVariants::GetCompiledCount() const
+{
+    return mVariants.size();
+}
+
+void ProgramVariants::CheckMask(Mask variant) const
+{
+    if (mOptions.size() < sizeof(Mask) * 8 && (variant >> mOptions.size()) != 0)
+    {
+        throw std::logic_error("Shader variant uses options past the end of the list.");
+    }
+}
+
+} // end namespace GLplus
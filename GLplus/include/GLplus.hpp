@@ -3,13 +3,37 @@
 
 #include <GL/glew.h>
 
+#include <functional>
+#include <map>
 #include <memory>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace GLplus
 {
 
-void CheckGLErrors();
+enum class ErrorCheckPolicy
+{
+    // glGetError after every GL call, so errors are thrown by the failing call.
+    PerCall,
+    // GL calls are only recorded, and glGetError runs once in FlushGLErrors at the end of each pass.
+    PerScope,
+    // no error checking at all.
+    Off
+};
+
+// can be changed from any thread, and applies to GL calls made after it
+void SetErrorCheckPolicy(ErrorCheckPolicy policy);
+ErrorCheckPolicy GetErrorCheckPolicy();
+
+// Called after GL calls with the name of the call.
+// Depending on the policy, checks for errors right away or just records the call.
+void CheckGLErrors(const char* call = "unnamed GL call");
+
+// Checks for errors now unless the policy is Off.
+// The exception lists the most recently recorded GL calls, since any of them might have failed.
+void FlushGLErrors(const char* scope);
 
 struct ObjectHandle
 {
@@ -17,8 +41,119 @@ struct ObjectHandle
     ObjectHandle(){ mHandle = 0; }
     ObjectHandle(const ObjectHandle& other) = delete;
     ObjectHandle& operator=(const ObjectHandle& other) = delete;
-    ObjectHandle(ObjectHandle&& other){ std::swap(mHandle, other.mHandle); }
-    ObjectHandle& operator=(ObjectHandle&& other){ std::swap(mHandle, other.mHandle); }
+    ObjectHandle(ObjectHandle&& other){ mHandle = 0; std::swap(mHandle, other.mHandle); }
+    ObjectHandle& operator=(ObjectHandle&& other){ std::swap(mHandle, other.mHandle); return *this; }
+};
+
+// Shadow copy of the bindings made through GLplus on the context current on this thread.
+// The Scoped*Bind classes read previous bindings from here instead of calling glGet*,
+// and binds that would not change anything are skipped.
+// Call Invalidate() after changing bindings with raw GL calls.
+class StateCache
+{
+    struct Binding
+    {
+        GLuint mHandle = 0;
+        bool mKnown = false;
+    };
+
+    struct IndexedBinding
+    {
+        GLuint mHandle = 0;
+        GLintptr mOffset = 0;
+        // -1 when the whole buffer is bound
+        GLsizeiptr mSize = -1;
+        bool mKnown = false;
+    };
+
+    static const int kMaxTextureUnits = 32;
+
+    Binding mProgram;
+    std::unordered_map<GLenum, Binding> mBuffers;
+    // keyed by target and index
+    std::unordered_map<GLuint64, IndexedBinding> mIndexedBuffers;
+    Binding mVertexArray;
+    Binding mActiveTexture;
+    Binding mTextures2D[kMaxTextureUnits];
+    Binding mRenderBuffer;
+    Binding mFrameBuffer;
+
+    unsigned int mElidedCalls = 0;
+    unsigned int mBinds = 0;
+    unsigned int mProgramSwitches = 0;
+    unsigned int mDraws = 0;
+
+    bool mKeepBindings = false;
+
+    Binding& Texture2DBinding();
+
+public:
+    static StateCache& Current();
+
+    GLuint GetProgram();
+    void UseProgram(GLuint program);
+
+    GLuint GetBuffer(GLenum target);
+    void BindBuffer(GLenum target, GLuint buffer);
+
+    // also replace the generic binding of the target, like GL does.
+    void BindBufferBase(GLenum target, GLuint index, GLuint buffer);
+    void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+    GLuint GetVertexArray();
+    void BindVertexArray(GLuint vertexArray);
+
+    GLenum GetActiveTexture();
+    void ActiveTexture(GLenum textureIndex);
+
+    // operates on the active texture unit
+    GLuint GetTexture2D();
+    void BindTexture2D(GLuint texture);
+
+    GLuint GetRenderBuffer();
+    void BindRenderBuffer(GLuint renderBuffer);
+
+    GLuint GetFrameBuffer();
+    void BindFrameBuffer(GLuint frameBuffer);
+
+    // GL resets bindings to deleted objects, so the cache has to follow.
+    void OnDeleteBuffer(GLuint buffer);
+    void OnDeleteVertexArray(GLuint vertexArray);
+    void OnDeleteTexture(GLuint texture);
+    void OnDeleteRenderBuffer(GLuint renderBuffer);
+    void OnDeleteFrameBuffer(GLuint frameBuffer);
+
+    void Invalidate();
+
+    // While set, the Scoped*Bind guards of programs, vertex arrays, textures and framebuffers
+    // leave their object bound instead of restoring the old one.
+    // A run of draws sorted by state then only issues the binds that actually differ.
+    // Buffers are always restored, since the element array binding belongs to the bound vertex array.
+    void SetKeepBindings(bool keepBindings);
+    bool IsKeepingBindings() const;
+
+    // number of glBind*/glUseProgram/glActiveTexture calls skipped because they were redundant
+    unsigned int GetElidedCallCount() const;
+    // number of glBind*/glActiveTexture calls that went through to GL
+    unsigned int GetBindCount() const;
+    // number of glUseProgram calls that went through to GL
+    unsigned int GetProgramSwitchCount() const;
+    // number of draw calls made through the Draw* functions below
+    unsigned int GetDrawCount() const;
+    void OnDraw();
+    void ResetCallCounts();
+};
+
+// Keeps bindings for as long as it lives, see StateCache::SetKeepBindings.
+class ScopedKeepBindings
+{
+    bool mOldKeepBindings;
+
+public:
+    ScopedKeepBindings();
+    ScopedKeepBindings(const ScopedKeepBindings&) = delete;
+    ScopedKeepBindings& operator=(const ScopedKeepBindings&) = delete;
+    ~ScopedKeepBindings();
 };
 
 class Shader
@@ -41,14 +176,59 @@ public:
     GLuint GetGLHandle() const;
 };
 
+// An active uniform or attribute of a linked program.
+struct ProgramVariable
+{
+    GLint mLocation;
+    GLenum mType;
+    // number of array elements, 1 if not an array.
+    GLint mSize;
+};
+
+// Preprocessor symbols to compile shaders with, each "NAME" or "NAME value".
+typedef std::vector<std::string> ShaderDefines;
+
+// A linked program in the driver's own format. Only the driver that made it can load it.
+struct ProgramBinary
+{
+    GLenum mFormat = 0;
+    std::vector<char> mData;
+
+    bool IsEmpty() const { return mData.empty(); }
+};
+
 class Program
 {
     ObjectHandle mHandle;
     std::shared_ptr<Shader> mFragmentShader;
     std::shared_ptr<Shader> mVertexShader;
 
+    // reflected once at link time, so lookups by name don't need to ask GL.
+    // arrays are found both by "name" and "name[0]".
+    std::unordered_map<std::string, ProgramVariable> mUniforms;
+    std::unordered_map<std::string, ProgramVariable> mAttributes;
+
+    // programs with the same attribute names and locations share an ID.
+    unsigned int mAttributeLayoutID = 0;
+
+    void Reflect();
+    GLint GetUniformLocation(const GLchar* name, GLenum uploadType) const;
+
 public:
-    static Program FromFiles(const char* vShaderFile, const char* fShaderFile);
+    static Program FromFiles(const char* vShaderFile, const char* fShaderFile,
+                             const ShaderDefines& defines = ShaderDefines());
+    static Program FromSources(const std::string& vShaderSource, const std::string& fShaderSource,
+                               const ShaderDefines& defines = ShaderDefines());
+
+    // The whole file, with each #include "file" line replaced by that file, without needing GL.
+    // Included paths are relative to the file including them.
+    static std::string ReadSourceFile(const char* filename);
+
+    // the source with a #define for each of the defines, right after its #version line
+    static std::string AddDefines(const std::string& source, const ShaderDefines& defines);
+
+    // glGetProgramBinary and glProgramBinary, with at least one binary format.
+    static bool HasProgramBinary();
 
     Program();
     Program(const Program&) = delete;
@@ -60,12 +240,33 @@ public:
     void Attach(const std::shared_ptr<Shader>& shader);
     void Link();
 
+    // Links from a binary instead of shaders. Returns false, leaving the program unlinked,
+    // if the driver rejects it, which it may do for any reason, e.g. after an update.
+    bool LinkBinary(const ProgramBinary& binary);
+
+    // The linked program, to give LinkBinary() on a later run. Empty without HasProgramBinary().
+    ProgramBinary GetBinary() const;
+
+    // Connects a uniform block to a buffer binding point (see UniformBuffer::BindBase).
+    void SetUniformBlockBinding(const GLchar* blockName, GLuint bindingPoint);
+
+    const ProgramVariable* FindAttribute(const GLchar* name) const;
+    const ProgramVariable* FindUniform(const GLchar* name) const;
+
+    const std::unordered_map<std::string, ProgramVariable>& GetAttributes() const;
+    const std::unordered_map<std::string, ProgramVariable>& GetUniforms() const;
+
+    // Vertex arrays built for one program work for all programs with the same attribute layout ID.
+    unsigned int GetAttributeLayoutID() const;
+
     bool TryGetAttributeLocation(const GLchar* name, GLint& loc) const;
     GLint GetAttributeLocation(const GLchar* name) const;
 
     bool TryGetUniformLocation(const GLchar* name, GLint& loc) const;
     GLint GetUniformLocation(const GLchar* name) const;
 
+    // Uploads use glProgramUniform* where available. Otherwise the program is bound for the upload,
+    // so keep it bound with a ScopedProgramBind around a batch of uploads to bind it only once.
     void UploadInt(const GLchar* name, GLuint value) const;
     void UploadInt(GLint location, GLuint value) const;
 
@@ -88,6 +289,110 @@ public:
     GLuint GetGLHandle() const;
 };
 
+struct ProgramBinaryCacheStats
+{
+    unsigned int mHits = 0;
+    unsigned int mMisses = 0;
+    // found, but the driver wouldn't load them
+    unsigned int mRejected = 0;
+    // seconds spent compiling and linking the misses, and loading the hits
+    double mCompileTime = 0.0;
+    double mLoadTime = 0.0;
+};
+
+// Keeps linked programs on disk, so they don't need compiling again on the next run.
+//
+// Entries are keyed by a hash of the sources and the GL vendor, renderer and version,
+// so changing any of them compiles again rather than handing the driver a binary it can't use.
+// Defines have to be in the sources to be part of the key.
+// Binaries the driver rejects anyway are compiled and replaced.
+class ProgramBinaryCache
+{
+    std::string mDirectory;
+    std::string mDriver;
+    bool mEnabled;
+    ProgramBinaryCacheStats mStats;
+
+public:
+    // Reads the driver strings, so it needs the GL context. The directory has to exist already;
+    // if it doesn't, or the driver can't give out binaries, every program is compiled.
+    explicit ProgramBinaryCache(const std::string& directory);
+
+    bool IsEnabled() const;
+
+    // GetKey, Read and Write don't need GL, so files can be read and written on other threads.
+    std::string GetKey(const std::string& vShaderSource, const std::string& fShaderSource) const;
+    // false if there's no usable entry
+    bool Read(const std::string& key, ProgramBinary& binary) const;
+    bool Write(const std::string& key, const ProgramBinary& binary) const;
+
+    // Links cached, the binary Read() found for the sources, or compiles them if it's empty or rejected.
+    // A compiled program's binary goes in toCache, for Write(), otherwise toCache is left empty.
+    Program Load(const std::string& vShaderSource, const std::string& fShaderSource,
+                 const ProgramBinary& cached, ProgramBinary& toCache);
+
+    // reads, links or compiles, and writes, all at once
+    Program Load(const std::string& vShaderSource, const std::string& fShaderSource);
+    Program LoadFiles(const char* vShaderFile, const char* fShaderFile);
+
+    const ProgramBinaryCacheStats& GetStats() const;
+};
+
+// One pair of shaders compiled with any combination of a list of options, so nothing has to branch on them at run time.
+//
+// Each option is a define, and a variant is the options it's compiled with, as a mask with bit i set for option i.
+// Variants are compiled the first time they're asked for, or ahead of time with Compile(),
+// both on the calling thread, which has to be the GL thread.
+class ProgramVariants
+{
+public:
+    typedef unsigned int Mask;
+
+private:
+    std::string mVertexSource;
+    std::string mFragmentSource;
+    std::vector<std::string> mOptions;
+    ProgramBinaryCache* mBinaryCache;
+    std::function<void(Program&, Mask)> mSetup;
+    std::unordered_map<Mask, std::shared_ptr<Program>> mVariants;
+
+public:
+    // The sources' includes have to be resolved already. With a binary cache, variants are loaded through it.
+    ProgramVariants(const std::string& vShaderSource, const std::string& fShaderSource,
+                    const std::vector<std::string>& options, ProgramBinaryCache* binaryCache = nullptr);
+
+    static ProgramVariants FromFiles(const char* vShaderFile, const char* fShaderFile,
+                                     const std::vector<std::string>& options, ProgramBinaryCache* binaryCache = nullptr);
+
+    // The option's bit. Throws for options that aren't in the list.
+    Mask GetOption(const std::string& option) const;
+    const std::vector<std::string>& GetOptions() const;
+
+    ShaderDefines GetDefines(Mask variant) const;
+
+    // what the variant compiles, without needing GL
+    std::string GetVertexSource(Mask variant) const;
+    std::string GetFragmentSource(Mask variant) const;
+
+    // Runs on every variant and its mask once it's linked, e.g. to bind its uniform blocks,
+    // starting with the ones linked before it was set.
+    void SetSetup(std::function<void(Program&, Mask)> setup);
+
+    const std::shared_ptr<Program>& Get(Mask variant);
+
+    // Compiles the variants now, so that Get() doesn't have to later.
+    void Compile(const std::vector<Mask>& variants);
+
+    // a variant linked some other way, e.g. from a binary read on another thread
+    void Add(Mask variant, Program&& program);
+
+    bool IsCompiled(Mask variant) const;
+    size_t GetCompiledCount() const;
+
+private:
+    void CheckMask(Mask variant) const;
+};
+
 class ScopedProgramBind
 {
     ObjectHandle mOldProgram;
@@ -111,6 +416,13 @@ public:
     ~Buffer();
 
     void Upload(GLsizeiptr size, const GLvoid* data, GLenum usage);
+    void Update(GLintptr offset, GLsizeiptr size, const GLvoid* data);
+
+    // Immutable storage. Requires GL 4.4 or ARB_buffer_storage.
+    void CreateStorage(GLsizeiptr size, const GLvoid* data, GLbitfield flags);
+
+    void* MapRange(GLintptr offset, GLsizeiptr length, GLbitfield access);
+    void Unmap();
 
     GLenum GetTarget() const;
 
@@ -127,6 +439,94 @@ public:
     ~ScopedBufferBind();
 };
 
+class UniformBuffer
+{
+    Buffer mBuffer;
+
+public:
+    UniformBuffer();
+
+    void Upload(GLsizeiptr size, const GLvoid* data, GLenum usage);
+
+    void BindBase(GLuint bindingPoint) const;
+    void BindRange(GLuint bindingPoint, GLintptr offset, GLsizeiptr size) const;
+
+    // offsets given to BindRange must be multiples of this.
+    static GLint GetOffsetAlignment();
+
+    Buffer& GetBuffer();
+    const Buffer& GetBuffer() const;
+};
+
+// Writes values with the std140 layout rules, so they can be read as a uniform block.
+// Values have to be written in the order they are declared in the block.
+class Std140Writer
+{
+    GLubyte* mData;
+    size_t mSize;
+    size_t mOffset = 0;
+
+    GLubyte* Allocate(size_t alignment, size_t size);
+
+public:
+    Std140Writer(void* data, size_t size);
+
+    void WriteInt(GLint value);
+    void WriteFloat(GLfloat value);
+    void WriteVec2(const GLfloat* values);
+    void WriteVec3(const GLfloat* values);
+    void WriteVec4(const GLfloat* values);
+    // column major
+    void WriteMatrix4(const GLfloat* values);
+
+    size_t GetOffset() const;
+};
+
+// A uniform buffer split into one region per frame in flight.
+// Blocks for a frame are allocated from its region and sent to GL together by Flush().
+// With GL 4.4 or ARB_buffer_storage the buffer stays mapped and is written directly,
+// otherwise the region is staged in memory and uploaded with a single glBufferSubData.
+class UniformRingBuffer
+{
+    UniformBuffer mBuffer;
+    GLsizeiptr mFrameSize;
+    GLint mAlignment;
+
+    int mFrameIndex = -1;
+    GLsizeiptr mFrameUsed = 0;
+    // how much of this frame's region has gone up already, when it isn't persistently mapped
+    GLsizeiptr mFrameFlushed = 0;
+
+    GLubyte* mPersistentMapping = nullptr;
+    std::vector<GLubyte> mStaging;
+    // signaled when the GPU is done reading each frame's region.
+    std::vector<GLsync> mFences;
+
+public:
+    struct Allocation
+    {
+        GLintptr mOffset;
+        GLsizeiptr mSize;
+        void* mData;
+    };
+
+    UniformRingBuffer(GLsizeiptr frameSize, int framesInFlight = 3);
+    UniformRingBuffer(const UniformRingBuffer&) = delete;
+    UniformRingBuffer& operator=(const UniformRingBuffer&) = delete;
+    ~UniformRingBuffer();
+
+    // Moves to the next region, waiting until the GPU is done with it.
+    void BeginFrame();
+
+    Allocation Allocate(GLsizeiptr size);
+
+    // Makes the allocations since the last Flush visible to GL. Call before drawing with them.
+    // Earlier ranges aren't uploaded again, since draws that are already queued may be reading them.
+    void Flush();
+
+    void BindRange(GLuint bindingPoint, const Allocation& allocation) const;
+};
+
 class VertexArray
 {
     ObjectHandle mHandle;
@@ -151,6 +551,21 @@ public:
             GLsizei stride,
             GLsizei offset);
 
+    // glVertexAttribDivisor, from GL 3.3 or ARB_instanced_arrays.
+    static bool HasInstancedArrays();
+
+    // A divisor of N advances the attribute once every N instances instead of every vertex.
+    // Throws without HasInstancedArrays().
+    void SetAttributeDivisor(GLuint index, GLuint divisor);
+
+    // A mat4 attribute takes four locations starting at index, one per column.
+    void SetMatrix4Attribute(
+            GLuint index,
+            const std::shared_ptr<Buffer>& buffer,
+            GLsizei stride,
+            GLsizei offset,
+            GLuint divisor);
+
     void SetIndexBuffer(
             const std::shared_ptr<Buffer>& buffer,
             GLenum type);
@@ -160,6 +575,37 @@ public:
     GLuint GetGLHandle() const;
 };
 
+// Keeps the vertex arrays built to draw a set of buffers, one per program attribute layout,
+// so they are only built the first time they are drawn with.
+// Clear it when the buffers are replaced.
+class VertexArrayCache
+{
+    std::map<std::pair<unsigned int, GLuint64>, std::unique_ptr<VertexArray>> mVertexArrays;
+
+public:
+    // build is called with a new VertexArray if none exists yet for the program's layout.
+    template<class BuildFunction>
+    const VertexArray& GetOrCreate(const Program& program, BuildFunction build)
+    {
+        return GetOrCreate(program, 0, build);
+    }
+
+    // extraKey tells apart vertex arrays that also read from other buffers, like per-instance data.
+    template<class BuildFunction>
+    const VertexArray& GetOrCreate(const Program& program, GLuint64 extraKey, BuildFunction build)
+    {
+        std::unique_ptr<VertexArray>& vertexArray = mVertexArrays[std::make_pair(program.GetAttributeLayoutID(), extraKey)];
+        if (!vertexArray)
+        {
+            vertexArray.reset(new VertexArray());
+            build(*vertexArray);
+        }
+        return *vertexArray;
+    }
+
+    void Clear();
+};
+
 class ScopedVertexArrayBind
 {
     ObjectHandle mOldVertexArray;
@@ -169,6 +615,18 @@ public:
     ~ScopedVertexArrayBind();
 };
 
+// Pixels decoded from an image file, 8 bits per channel.
+// Decoding doesn't touch GL, so it can happen on any thread.
+struct DecodedImage
+{
+    std::shared_ptr<unsigned char> mPixels;
+    int mWidth = 0;
+    int mHeight = 0;
+    int mChannels = 0;
+
+    static DecodedImage FromFile(const char* filename);
+};
+
 class Texture2D
 {
     ObjectHandle mHandle;
@@ -190,6 +648,7 @@ public:
     ~Texture2D();
 
     void LoadImage(const char* filename, unsigned int flags);
+    void LoadImage(const DecodedImage& image, unsigned int flags);
     void CreateStorage(GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
 
     int GetWidth() const;
@@ -281,9 +740,69 @@ public:
     ~ScopedFrameBufferBind();
 };
 
+// Counts samples or measures GPU time between Begin() and End().
+// The result arrives some time later, so poll IsResultAvailable() instead of stalling in GetResult().
+class Query
+{
+    ObjectHandle mHandle;
+    GLenum mTarget;
+
+public:
+    explicit Query(GLenum target);
+    Query(const Query&) = delete;
+    Query& operator=(const Query&) = delete;
+    Query(Query&&) = default;
+    Query& operator=(Query&&) = default;
+    ~Query();
+
+    void Begin();
+    void End();
+
+    bool IsResultAvailable() const;
+
+    // waits for the result if it isn't available yet. GL_TIME_ELAPSED results are in nanoseconds.
+    GLuint64 GetResult() const;
+
+    // reads the result only if it's available, and never waits
+    bool TryGetResult(GLuint64& result) const;
+
+    GLenum GetTarget() const;
+    GLuint GetGLHandle() const;
+
+    // GL_TIME_ELAPSED, GL_TIMESTAMP and 64-bit results need GL 3.3 or ARB_timer_query
+    static bool HasTimerQuery();
+
+    // GL_ANY_SAMPLES_PASSED needs GL 3.3 or ARB_occlusion_query2. GL_SAMPLES_PASSED works everywhere, but counts every sample.
+    static bool HasAnySamplesPassedQuery();
+};
+
+// The GPU's clock when it reaches a point in the command stream, from glQueryCounter.
+// Unlike GL_TIME_ELAPSED queries, any number of these can be in flight,
+// so spans timed with them can nest, and can overlap an elapsed query that's running.
+class TimerQuery
+{
+    Query mQuery;
+
+public:
+    TimerQuery();
+
+    // takes the time once the GPU gets through the commands before this
+    void Record();
+
+    bool IsResultAvailable() const;
+
+    // in nanoseconds. Waits for the result if it isn't available yet.
+    GLuint64 GetTimestamp() const;
+
+    // reads the result only if it's available, and never waits
+    bool TryGetTimestamp(GLuint64& timestamp) const;
+};
+
 constexpr size_t SizeFromGLType(GLenum type)
 {
-    return type == GL_UNSIGNED_INT   ? sizeof(GLuint)   :
+    return type == GL_FLOAT          ? sizeof(GLfloat)  :
+           type == GL_HALF_FLOAT     ? sizeof(GLushort) :
+           type == GL_UNSIGNED_INT   ? sizeof(GLuint)   :
            type == GL_INT            ? sizeof(GLint)    :
            type == GL_UNSIGNED_SHORT ? sizeof(GLushort) :
            type == GL_SHORT          ? sizeof(GLshort)  :
@@ -296,6 +815,10 @@ void DrawArrays(GLenum mode, GLint first, GLsizei count);
 
 void DrawElements(GLenum mode, GLenum indexType, GLint first, GLsizei count);
 
+void DrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instanceCount);
+
+void DrawElementsInstanced(GLenum mode, GLenum indexType, GLint first, GLsizei count, GLsizei instanceCount);
+
 } // end namespace GLplus
 
 #endif // GLPLUS_H
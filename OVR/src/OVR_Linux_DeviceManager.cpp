@@ -36,6 +36,8 @@ limitations under the License.
 #include "Kernel/OVR_Std.h"
 #include "Kernel/OVR_Log.h"
 
+#include <Profiler.hpp>
+
 namespace OVR { namespace Linux {
 
 
@@ -185,6 +187,7 @@ int DeviceManagerThread::Run()
     ThreadCommand::PopBuffer command;
 
     SetThreadName("OVR::DeviceManagerThread");
+    PROFILE_THREAD("OVR device manager");
     LogText("OVR::DeviceManagerThread - running (ThreadId=%p).\n", GetThreadId());
     
     // Signal to the parent thread that initialization has finished.
@@ -30,6 +30,8 @@ limitations under the License.
 #include "OVR_JSON.h"
 #include "OVR_Profile.h"
 
+#include <Profiler.hpp>
+
 #define MAX_DEVICE_PROFILE_MAJOR_VERSION 1
 
 namespace OVR {
@@ -134,6 +136,8 @@ Vector3f SensorFusion_ComputeCorrection(Vector3f measured, Vector3f estimated)
 
 void SensorFusion::handleMessage(const MessageBodyFrame& msg)
 {
+    PROFILE_ZONE("SensorFusion::handleMessage");
+
     if (msg.Type != Message_BodyFrame || !IsMotionTrackingEnabled())
         return;
 
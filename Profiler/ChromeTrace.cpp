@@ -0,0 +1,78 @@
+#include "ChromeTrace.hpp"
+
+#include <stdexcept>
+
+namespace Profiler
+{
+
+namespace
+{
+
+// names are mostly string literals, but quotes would still break the file
+std::string EscapeJSON(const char* text)
+{
+    std::string escaped;
+    for (const char* c = text; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            escaped += '\\';
+        }
+        escaped += (unsigned char) *c < 0x20 ? ' ' : *c;
+    }
+    return escaped;
+}
+
+} // end anonymous namespace
+
+ChromeTrace::ChromeTrace(const std::string& filename)
+    : mFile(fopen(filename.c_str(), "w"))
+    , mFirstEvent(true)
+    , mStart(std::chrono::steady_clock::now())
+{
+    if (!mFile)
+    {
+        throw std::runtime_error("Couldn't open trace file " + filename);
+    }
+
+    fprintf(mFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+}
+
+ChromeTrace::~ChromeTrace()
+{
+    fprintf(mFile, "\n]}\n");
+    fclose(mFile);
+}
+
+double ChromeTrace::ToMicroseconds(std::chrono::steady_clock::time_point time) const
+{
+    return std::chrono::duration<double, std::micro>(time - mStart).count();
+}
+
+double ChromeTrace::Now() const
+{
+    return ToMicroseconds(std::chrono::steady_clock::now());
+}
+
+void ChromeTrace::NameTrack(int track, const std::string& name)
+{
+    WriteEvent("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" + std::to_string(track) +
+               ",\"args\":{\"name\":\"" + EscapeJSON(name.c_str()) + "\"}}");
+}
+
+void ChromeTrace::WriteSpan(int track, const char* name, double start, double duration)
+{
+    char times[64];
+    snprintf(times, sizeof(times), "\"ts\":%.3f,\"dur\":%.3f", start, duration);
+    WriteEvent("{\"ph\":\"X\",\"name\":\"" + EscapeJSON(name) + "\",\"pid\":1,\"tid\":" + std::to_string(track) +
+               "," + times + "}");
+}
+
+void ChromeTrace::WriteEvent(const std::string& event)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    fprintf(mFile, "%s%s", mFirstEvent ? "" : ",\n", event.c_str());
+    mFirstEvent = false;
+}
+
+} // end namespace Profiler
@@ -0,0 +1,177 @@
+#include "Profiler.hpp"
+#include "ChromeTrace.hpp"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Profiler
+{
+
+std::atomic<bool> gEnabled(false);
+
+namespace
+{
+
+struct ZoneEvent
+{
+    const char* mName;
+    std::chrono::steady_clock::time_point mStart;
+    std::chrono::steady_clock::time_point mEnd;
+};
+
+// zones per thread between flushes, a power of two
+const uint64_t kBufferSize = 1 << 14;
+
+// Written only by its thread, and read only by Flush. Each side only moves its own counter,
+// so the zones between them are either the writer's or the reader's, never both.
+struct ThreadBuffer
+{
+    int mTrack = 0;
+    ZoneEvent mZones[kBufferSize];
+    std::atomic<uint64_t> mWritten{ 0 };
+    std::atomic<uint64_t> mRead{ 0 };
+    std::atomic<uint64_t> mDropped{ 0 };
+
+    // under the registry's mutex
+    std::string mName;
+    bool mNameWritten = false;
+};
+
+// outlives the threads, so a thread's last zones can still be flushed after it's gone
+struct Registry
+{
+    std::mutex mMutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> mBuffers;
+    int mNextTrack = 1;
+};
+
+Registry& GetRegistry()
+{
+    static Registry registry;
+    return registry;
+}
+
+// set by SetThreadName, so a thread that never records a zone never makes a buffer
+std::string& GetThreadName()
+{
+    static thread_local std::string tName;
+    return tName;
+}
+
+// empty until the thread records its first zone
+std::shared_ptr<ThreadBuffer>& GetThreadBufferSlot()
+{
+    static thread_local std::shared_ptr<ThreadBuffer> tBuffer;
+    return tBuffer;
+}
+
+ThreadBuffer& GetThreadBuffer()
+{
+    std::shared_ptr<ThreadBuffer>& buffer = GetThreadBufferSlot();
+    if (!buffer)
+    {
+        buffer = std::make_shared<ThreadBuffer>();
+
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.mMutex);
+        buffer->mTrack = registry.mNextTrack++;
+        buffer->mName = GetThreadName();
+        registry.mBuffers.push_back(buffer);
+    }
+    return *buffer;
+}
+
+} // end anonymous namespace
+
+void SetEnabled(bool enabled)
+{
+    gEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool IsEnabled()
+{
+    return gEnabled.load(std::memory_order_relaxed);
+}
+
+void SetThreadName(const char* name)
+{
+    GetThreadName() = name;
+
+    // renamed after its first zone
+    const std::shared_ptr<ThreadBuffer>& buffer = GetThreadBufferSlot();
+    if (buffer)
+    {
+        std::lock_guard<std::mutex> lock(GetRegistry().mMutex);
+        buffer->mName = name;
+        buffer->mNameWritten = false;
+    }
+}
+
+void Flush(ChromeTrace& trace)
+{
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.mMutex);
+        buffers = registry.mBuffers;
+
+        for (const std::shared_ptr<ThreadBuffer>& buffer : buffers)
+        {
+            if (!buffer->mNameWritten)
+            {
+                trace.NameTrack(buffer->mTrack, buffer->mName.empty() ? "thread " + std::to_string(buffer->mTrack)
+                                                                       : buffer->mName);
+                buffer->mNameWritten = true;
+            }
+        }
+    }
+
+    for (const std::shared_ptr<ThreadBuffer>& buffer : buffers)
+    {
+        uint64_t read = buffer->mRead.load(std::memory_order_relaxed);
+        uint64_t written = buffer->mWritten.load(std::memory_order_acquire);
+        for (; read != written; read++)
+        {
+            const ZoneEvent& zone = buffer->mZones[read & (kBufferSize - 1)];
+            double start = trace.ToMicroseconds(zone.mStart);
+            trace.WriteSpan(buffer->mTrack, zone.mName, start, trace.ToMicroseconds(zone.mEnd) - start);
+        }
+        buffer->mRead.store(written, std::memory_order_release);
+    }
+}
+
+uint64_t GetDroppedZones()
+{
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mMutex);
+
+    uint64_t dropped = 0;
+    for (const std::shared_ptr<ThreadBuffer>& buffer : registry.mBuffers)
+    {
+        dropped += buffer->mDropped.load(std::memory_order_relaxed);
+    }
+    return dropped;
+}
+
+void Zone::Record(const char* name, std::chrono::steady_clock::time_point start,
+                  std::chrono::steady_clock::time_point end)
+{
+    ThreadBuffer& buffer = GetThreadBuffer();
+
+    uint64_t written = buffer.mWritten.load(std::memory_order_relaxed);
+    if (written - buffer.mRead.load(std::memory_order_acquire) == kBufferSize)
+    {
+        buffer.mDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    ZoneEvent& zone = buffer.mZones[written & (kBufferSize - 1)];
+    zone.mName = name;
+    zone.mStart = start;
+    zone.mEnd = end;
+    buffer.mWritten.store(written + 1, std::memory_order_release);
+}
+
+} // end namespace Profiler
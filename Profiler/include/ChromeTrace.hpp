@@ -0,0 +1,44 @@
+#ifndef CHROMETRACE_H
+#define CHROMETRACE_H
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+namespace Profiler
+{
+
+// Writes spans in the Chrome trace event format, to open in chrome://tracing or Perfetto.
+//
+// Spans go on numbered tracks, which show up as the threads of one process.
+// Times are in microseconds since the trace was opened. Spans can be written from any thread.
+class ChromeTrace
+{
+    FILE* mFile;
+    std::mutex mMutex;
+    bool mFirstEvent;
+    std::chrono::steady_clock::time_point mStart;
+
+public:
+    // throws if the file can't be opened
+    explicit ChromeTrace(const std::string& filename);
+    ChromeTrace(const ChromeTrace&) = delete;
+    ChromeTrace& operator=(const ChromeTrace&) = delete;
+
+    // finishes the file, which isn't valid JSON until then
+    ~ChromeTrace();
+
+    double ToMicroseconds(std::chrono::steady_clock::time_point time) const;
+    double Now() const;
+
+    void NameTrack(int track, const std::string& name);
+    void WriteSpan(int track, const char* name, double start, double duration);
+
+private:
+    void WriteEvent(const std::string& event);
+};
+
+} // end namespace Profiler
+
+#endif // CHROMETRACE_H
@@ -97,6 +97,53 @@ void Window::GLSwapWindow()
     SDL_GL_SwapWindow(mWindowHandle.get());
 }
 
+bool Window::SetGLSwapInterval(int interval)
+{
+    if (!mGLContextHandle)
+    {
+        throw std::runtime_error("SetGLSwapInterval used on non-GL window.");
+    }
+
+    return SDL_GL_SetSwapInterval(interval) == 0;
+}
+
+int Window::GetGLSwapInterval() const
+{
+    return SDL_GL_GetSwapInterval();
+}
+
+void Window::MakeGLContextCurrent()
+{
+    if (!mGLContextHandle)
+    {
+        throw std::runtime_error("MakeGLContextCurrent used on non-GL window.");
+    }
+
+    if (SDL_GL_MakeCurrent(mWindowHandle.get(), mGLContextHandle.get()))
+    {
+        throw std::runtime_error(SDL_GetError());
+    }
+}
+
+void Window::ReleaseGLContext()
+{
+    if (SDL_GL_MakeCurrent(mWindowHandle.get(), NULL))
+    {
+        throw std::runtime_error(SDL_GetError());
+    }
+}
+
+int Window::GetRefreshRate() const
+{
+    SDL_DisplayMode mode;
+    if (SDL_GetWindowDisplayMode(GetSDLHandle(), &mode))
+    {
+        return 0;
+    }
+
+    return mode.refresh_rate;
+}
+
 SDL_Window* Window::GetSDLHandle() const
 {
     return mWindowHandle.get();
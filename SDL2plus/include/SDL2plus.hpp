@@ -45,6 +45,19 @@ public:
 
     void GLSwapWindow();
 
+    // 1 waits for vsync, 0 doesn't, -1 asks for late swaps to tear instead of waiting.
+    // Returns false if the driver doesn't support the interval.
+    bool SetGLSwapInterval(int interval);
+    int GetGLSwapInterval() const;
+
+    // The GL context can only be current on one thread at a time.
+    // Release it on one thread before making it current on another.
+    void MakeGLContextCurrent();
+    void ReleaseGLContext();
+
+    // refresh rate in Hz of the display the window is on, or 0 if it's unknown
+    int GetRefreshRate() const;
+
     SDL_Window* GetSDLHandle() const;
 };
 
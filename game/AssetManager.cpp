@@ -0,0 +1,524 @@
+#include "AssetManager.hpp"
+
+#include <Profiler.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+Asset::Asset(const std::string& name, AssetType type)
+    : mName(name)
+    , mType(type)
+    , mRequested(std::chrono::steady_clock::now())
+{
+}
+
+Asset::~Asset()
+{
+}
+
+const std::string& Asset::GetName() const
+{
+    return mName;
+}
+
+AssetType Asset::GetType() const
+{
+    return mType;
+}
+
+bool Asset::IsLoaded() const
+{
+    return mLoaded;
+}
+
+const AssetTiming& Asset::GetTiming() const
+{
+    return mTiming;
+}
+
+TextureAsset::TextureAsset(const std::string& name, unsigned int flags)
+    : Asset(name, AssetType::Texture)
+    , mFlags(flags)
+{
+}
+
+const std::shared_ptr<GLplus::Texture2D>& TextureAsset::Get() const
+{
+    return mTexture;
+}
+
+ProgramAsset::ProgramAsset(const std::string& name, const std::vector<std::string>& options,
+                           const std::vector<GLplus::ProgramVariants::Mask>& variants)
+    : Asset(name, AssetType::Program)
+    , mOptions(options)
+{
+    for (GLplus::ProgramVariants::Mask variant : variants)
+    {
+        mLoadedVariants.push_back(LoadedVariant{ variant, std::string(), GLplus::ProgramBinary() });
+    }
+}
+
+std::shared_ptr<GLplus::Program> ProgramAsset::Get() const
+{
+    return mVariants->Get(0);
+}
+
+GLplus::ProgramVariants& ProgramAsset::GetVariants() const
+{
+    return *mVariants;
+}
+
+int ProgramAsset::GetCachedVariantCount() const
+{
+    return mCachedVariants;
+}
+
+int ProgramAsset::GetLoadedVariantCount() const
+{
+    return (int) mLoadedVariants.size();
+}
+
+MeshAsset::MeshAsset(const std::string& name, const GLmesh::VertexFormat& format, const GLmesh::LodOptions& lodOptions)
+    : Asset(name, AssetType::Mesh)
+    , mFormat(format)
+    , mLodOptions(lodOptions)
+{
+}
+
+const std::vector<tinyobj::shape_t>& MeshAsset::GetShapes() const
+{
+    return mShapes;
+}
+
+const std::vector<std::shared_ptr<GLmesh::StaticMesh>>& MeshAsset::GetMeshes() const
+{
+    return mMeshes;
+}
+
+AssetManager::AssetManager(int numThreads, GLplus::ProgramBinaryCache* programCache)
+    : mProgramCache(programCache)
+    , mCreated(std::chrono::steady_clock::now())
+    , mPending(0)
+    , mJobs(numThreads)
+{
+}
+
+std::shared_ptr<MeshAsset> AssetManager::LoadMesh(const std::string& filename,
+                                                  const GLmesh::VertexFormat& format,
+                                                  const GLmesh::LodOptions& lodOptions)
+{
+    std::shared_ptr<MeshAsset> mesh;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        std::shared_ptr<MeshAsset>& found = mMeshes[filename];
+        if (found)
+        {
+            return found;
+        }
+        found = mesh = std::make_shared<MeshAsset>(filename, format, lodOptions);
+        mAssets.push_back(mesh);
+        mPending++;
+    }
+
+    Start(mesh,
+        [this, mesh]
+    {
+        PROFILE_ZONE("load mesh");
+
+        // materials are next to the .obj
+        const std::string& filename = mesh->GetName();
+        std::string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+
+        std::string error = tinyobj::LoadObj(mesh->mShapes, filename.c_str(), directory.empty() ? nullptr : directory.c_str());
+        if (mesh->mShapes.empty())
+        {
+            throw std::runtime_error("Couldn't load " + filename + ": " + error);
+        }
+
+        for (const tinyobj::shape_t& shape : mesh->mShapes)
+        {
+            mesh->mData.push_back(GLmesh::StaticMesh::Prepare(shape, mesh->mFormat, mesh->mLodOptions));
+
+            const std::string& textureName = mesh->mData.back().mDiffuseTextureName;
+            mesh->mTextures.push_back(textureName.empty() ? nullptr : LoadTexture(textureName, GLplus::Texture2D::InvertY));
+        }
+    },
+        [this, mesh]
+    {
+        auto upload = [this, mesh]
+        {
+            PROFILE_ZONE("upload mesh");
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < mesh->mData.size(); i++)
+            {
+                std::shared_ptr<GLmesh::StaticMesh> staticMesh = std::make_shared<GLmesh::StaticMesh>();
+                staticMesh->Upload(mesh->mData[i], mesh->mTextures[i] ? mesh->mTextures[i]->Get() : nullptr);
+                mesh->mMeshes.push_back(staticMesh);
+            }
+            mesh->mData.clear();
+            mesh->mTiming.mGLTime += Seconds(start, std::chrono::steady_clock::now());
+
+            FinishLoading(*mesh);
+        };
+
+        // the buffers go up once every texture they draw with has
+        auto waiting = std::make_shared<size_t>(0);
+        for (const std::shared_ptr<TextureAsset>& texture : mesh->mTextures)
+        {
+            if (texture && !texture->IsLoaded())
+            {
+                ++*waiting;
+                texture->mOnLoaded.push_back([waiting, upload]
+                {
+                    if (--*waiting == 0)
+                    {
+                        upload();
+                    }
+                });
+            }
+        }
+
+        if (*waiting == 0)
+        {
+            upload();
+        }
+    });
+
+    return mesh;
+}
+
+std::shared_ptr<TextureAsset> AssetManager::LoadTexture(const std::string& filename, unsigned int flags)
+{
+    std::shared_ptr<TextureAsset> texture;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        std::shared_ptr<TextureAsset>& found = mTextures[filename];
+        if (found)
+        {
+            return found;
+        }
+        found = texture = std::make_shared<TextureAsset>(filename, flags);
+        mAssets.push_back(texture);
+        mPending++;
+    }
+
+    Start(texture,
+        [texture]
+    {
+        PROFILE_ZONE("decode texture");
+        texture->mImage = GLplus::DecodedImage::FromFile(texture->GetName().c_str());
+    },
+        [this, texture]
+    {
+        PROFILE_ZONE("upload texture");
+        auto start = std::chrono::steady_clock::now();
+        texture->mTexture = std::make_shared<GLplus::Texture2D>();
+        texture->mTexture->LoadImage(texture->mImage, texture->mFlags);
+        texture->mImage = GLplus::DecodedImage();
+        texture->mTiming.mGLTime += Seconds(start, std::chrono::steady_clock::now());
+
+        FinishLoading(*texture);
+    });
+
+    return texture;
+}
+
+std::shared_ptr<ProgramAsset> AssetManager::LoadProgram(const std::string& vertexShaderFile, const std::string& fragmentShaderFile,
+                                                        const std::vector<std::string>& options,
+                                                        const std::vector<GLplus::ProgramVariants::Mask>& variants)
+{
+    std::string name = vertexShaderFile + " + " + fragmentShaderFile;
+    for (size_t i = 0; i < options.size(); i++)
+    {
+        name += (i == 0 ? " [" : ", ") + options[i] + (i + 1 == options.size() ? "]" : "");
+    }
+
+    std::shared_ptr<ProgramAsset> program;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        std::shared_ptr<ProgramAsset>& found = mPrograms[name];
+        if (found)
+        {
+            return found;
+        }
+        found = program = std::make_shared<ProgramAsset>(name, options, variants);
+        mAssets.push_back(program);
+        mPending++;
+    }
+
+    Start(program,
+        [this, program, vertexShaderFile, fragmentShaderFile]
+    {
+        PROFILE_ZONE("read shaders");
+        program->mVariants = std::make_shared<GLplus::ProgramVariants>(
+                    ReadSource(vertexShaderFile), ReadSource(fragmentShaderFile), program->mOptions, mProgramCache);
+
+        if (mProgramCache)
+        {
+            for (ProgramAsset::LoadedVariant& variant : program->mLoadedVariants)
+            {
+                variant.mCacheKey = mProgramCache->GetKey(program->mVariants->GetVertexSource(variant.mMask),
+                                                          program->mVariants->GetFragmentSource(variant.mMask));
+                mProgramCache->Read(variant.mCacheKey, variant.mCachedBinary);
+            }
+        }
+    },
+        [this, program]
+    {
+        PROFILE_ZONE("link program");
+        auto start = std::chrono::steady_clock::now();
+        for (ProgramAsset::LoadedVariant& variant : program->mLoadedVariants)
+        {
+            if (!mProgramCache)
+            {
+                program->mVariants->Get(variant.mMask);
+                continue;
+            }
+
+            unsigned int hits = mProgramCache->GetStats().mHits;
+            GLplus::ProgramBinary toCache;
+            program->mVariants->Add(variant.mMask, mProgramCache->Load(program->mVariants->GetVertexSource(variant.mMask),
+                                                                      program->mVariants->GetFragmentSource(variant.mMask),
+                                                                      variant.mCachedBinary, toCache));
+            if (mProgramCache->GetStats().mHits > hits)
+            {
+                program->mCachedVariants++;
+            }
+            variant.mCachedBinary = GLplus::ProgramBinary();
+
+            if (!toCache.IsEmpty())
+            {
+                GLplus::ProgramBinaryCache* cache = mProgramCache;
+                std::string key = variant.mCacheKey;
+                auto binary = std::make_shared<GLplus::ProgramBinary>(std::move(toCache));
+                mJobs.Submit([cache, key, binary]
+                {
+                    PROFILE_ZONE("write program binary");
+                    cache->Write(key, *binary);
+                });
+            }
+        }
+        program->mTiming.mGLTime += Seconds(start, std::chrono::steady_clock::now());
+
+        FinishLoading(*program);
+    });
+
+    return program;
+}
+
+void AssetManager::ProcessCompletions()
+{
+    for (;;)
+    {
+        std::function<void()> completion;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (mCompletions.empty())
+            {
+                return;
+            }
+            completion = std::move(mCompletions.front());
+            mCompletions.pop_front();
+        }
+
+        completion();
+    }
+}
+
+void AssetManager::WaitAll()
+{
+    PROFILE_ZONE("wait for assets");
+
+    for (;;)
+    {
+        ProcessCompletions();
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (mPending == 0)
+        {
+            return;
+        }
+        mCompletionsReady.wait(lock, [this]{ return !mCompletions.empty(); });
+    }
+}
+
+size_t AssetManager::GetPendingCount()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mPending;
+}
+
+void AssetManager::PrintTimings(FILE* file)
+{
+    std::vector<std::shared_ptr<Asset>> assets;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (const std::shared_ptr<Asset>& asset : mAssets)
+        {
+            if (asset->IsLoaded())
+            {
+                assets.push_back(asset);
+            }
+        }
+    }
+
+    if (assets.empty())
+    {
+        return;
+    }
+
+    std::sort(assets.begin(), assets.end(), [](const std::shared_ptr<Asset>& a, const std::shared_ptr<Asset>& b)
+    {
+        return a->GetTiming().mTotalTime > b->GetTiming().mTotalTime;
+    });
+
+    // from the first request to the last asset being done
+    std::chrono::steady_clock::time_point first = assets.front()->mRequested;
+    std::chrono::steady_clock::time_point last = first;
+    double workerTime = 0.0;
+    double glTime = 0.0;
+    for (const std::shared_ptr<Asset>& asset : assets)
+    {
+        const AssetTiming& timing = asset->GetTiming();
+        first = std::min(first, asset->mRequested);
+        last = std::max(last, asset->mRequested + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                      std::chrono::duration<double>(timing.mTotalTime)));
+        workerTime += timing.mWorkerTime;
+        glTime += timing.mGLTime;
+    }
+
+    double wallTime = Seconds(first, last);
+    fprintf(file, "Loaded %d assets in %.1f ms with %d worker threads: %.1f ms of work on the workers (%.1fx overlap), %.1f ms on the GL thread\n",
+            (int) assets.size(), wallTime * 1000.0, mJobs.GetThreadCount(),
+            workerTime * 1000.0, wallTime > 0.0 ? workerTime / wallTime : 0.0, glTime * 1000.0);
+
+    if (mProgramCache)
+    {
+        const GLplus::ProgramBinaryCacheStats& stats = mProgramCache->GetStats();
+        if (mProgramCache->IsEnabled())
+        {
+            fprintf(file, "Program binary cache: %u hits, %u misses, %u rejected; %.1f ms compiling, %.1f ms loading binaries\n",
+                    stats.mHits, stats.mMisses, stats.mRejected, stats.mCompileTime * 1000.0, stats.mLoadTime * 1000.0);
+        }
+        else
+        {
+            fprintf(file, "Program binary cache: not supported by the driver; %.1f ms compiling\n", stats.mCompileTime * 1000.0);
+        }
+    }
+
+    static const char* typeNames[] = { "mesh", "texture", "program" };
+    for (const std::shared_ptr<Asset>& asset : assets)
+    {
+        const AssetTiming& timing = asset->GetTiming();
+        fprintf(file, "  %-7s %-44s %7.2f ms: %6.2f queued, %6.2f on a worker, %6.2f on the GL thread, done at %7.2f",
+                typeNames[(int) asset->GetType()], asset->GetName().c_str(),
+                timing.mTotalTime * 1000.0, timing.mQueueTime * 1000.0, timing.mWorkerTime * 1000.0, timing.mGLTime * 1000.0,
+                (Seconds(mCreated, asset->mRequested) + timing.mTotalTime) * 1000.0);
+
+        if (mProgramCache && asset->GetType() == AssetType::Program)
+        {
+            const ProgramAsset& program = static_cast<const ProgramAsset&>(*asset);
+            fprintf(file, ", %d/%d variants cached", program.GetCachedVariantCount(), program.GetLoadedVariantCount());
+        }
+        fprintf(file, "\n");
+    }
+}
+
+double AssetManager::Seconds(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) const
+{
+    return std::chrono::duration<double>(to - from).count();
+}
+
+void AssetManager::Start(const std::shared_ptr<Asset>& asset, std::function<void()> work, std::function<void()> finish)
+{
+    mJobs.Submit([this, asset, work, finish]
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        std::exception_ptr error;
+        try
+        {
+            work();
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        // only read on the GL thread, after the completion is handed over
+        asset->mTiming.mQueueTime = Seconds(asset->mRequested, start);
+        asset->mTiming.mWorkerTime = Seconds(start, std::chrono::steady_clock::now());
+
+        PushCompletion([error, finish]
+        {
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+            finish();
+        });
+    });
+}
+
+void AssetManager::PushCompletion(std::function<void()> completion)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCompletions.push_back(std::move(completion));
+    }
+    mCompletionsReady.notify_all();
+}
+
+void AssetManager::FinishLoading(Asset& asset)
+{
+    asset.mLoaded = true;
+    asset.mTiming.mTotalTime = Seconds(asset.mRequested, std::chrono::steady_clock::now());
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mPending--;
+    }
+
+    // these can finish other assets in turn
+    std::vector<std::function<void()>> onLoaded;
+    onLoaded.swap(asset.mOnLoaded);
+    for (const std::function<void()>& callback : onLoaded)
+    {
+        callback();
+    }
+}
+
+std::string AssetManager::ReadSource(const std::string& filename)
+{
+    std::promise<std::string> reading;
+    std::shared_future<std::string> source;
+    bool isReader = false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto found = mSources.find(filename);
+        if (found != mSources.end())
+        {
+            source = found->second;
+        }
+        else
+        {
+            source = reading.get_future().share();
+            mSources[filename] = source;
+            isReader = true;
+        }
+    }
+
+    if (isReader)
+    {
+        try
+        {
+            reading.set_value(GLplus::Program::ReadSourceFile(filename.c_str()));
+        }
+        catch (...)
+        {
+            reading.set_exception(std::current_exception());
+        }
+    }
+
+    return source.get();
+}
@@ -0,0 +1,208 @@
+#ifndef ASSETMANAGER_H
+#define ASSETMANAGER_H
+
+#include "JobPool.hpp"
+
+#include <GLmesh.hpp>
+#include <GLplus.hpp>
+#include <tiny_obj_loader.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class AssetType
+{
+    Mesh,
+    Texture,
+    Program
+};
+
+// Where an asset's load time went, in seconds.
+struct AssetTiming
+{
+    // from the request until a worker started on it
+    double mQueueTime = 0.0;
+    // on the worker: reading, parsing and decoding
+    double mWorkerTime = 0.0;
+    // on the GL thread: creating the GL objects
+    double mGLTime = 0.0;
+    // from the request until it was loaded, including the waits in between and on the assets it needs
+    double mTotalTime = 0.0;
+};
+
+// Something an AssetManager loads. Its contents can only be used on the GL thread, once it's loaded.
+class Asset
+{
+    friend class AssetManager;
+
+    std::string mName;
+    AssetType mType;
+    std::chrono::steady_clock::time_point mRequested;
+
+    // GL thread
+    bool mLoaded = false;
+    std::vector<std::function<void()>> mOnLoaded;
+    AssetTiming mTiming;
+
+public:
+    Asset(const std::string& name, AssetType type);
+    virtual ~Asset();
+    Asset(const Asset&) = delete;
+    Asset& operator=(const Asset&) = delete;
+
+    const std::string& GetName() const;
+    AssetType GetType() const;
+
+    bool IsLoaded() const;
+    const AssetTiming& GetTiming() const;
+};
+
+class TextureAsset : public Asset
+{
+    friend class AssetManager;
+
+    unsigned int mFlags;
+    GLplus::DecodedImage mImage;
+    std::shared_ptr<GLplus::Texture2D> mTexture;
+
+public:
+    TextureAsset(const std::string& name, unsigned int flags);
+
+    const std::shared_ptr<GLplus::Texture2D>& Get() const;
+};
+
+// A pair of shaders, as every variant of their options (see GLplus::ProgramVariants).
+class ProgramAsset : public Asset
+{
+    friend class AssetManager;
+
+    // the variants linked as part of loading, and what the workers found for them in the binary cache
+    struct LoadedVariant
+    {
+        GLplus::ProgramVariants::Mask mMask;
+        std::string mCacheKey;
+        GLplus::ProgramBinary mCachedBinary;
+    };
+
+    std::vector<std::string> mOptions;
+    std::vector<LoadedVariant> mLoadedVariants;
+    int mCachedVariants = 0;
+    std::shared_ptr<GLplus::ProgramVariants> mVariants;
+
+public:
+    ProgramAsset(const std::string& name, const std::vector<std::string>& options,
+                 const std::vector<GLplus::ProgramVariants::Mask>& variants);
+
+    // the variant without any options
+    std::shared_ptr<GLplus::Program> Get() const;
+
+    // Variants that weren't loaded with the asset are compiled the first time they're asked for.
+    GLplus::ProgramVariants& GetVariants() const;
+
+    // how many of the variants loaded with the asset were linked from cached binaries rather than compiled
+    int GetCachedVariantCount() const;
+    int GetLoadedVariantCount() const;
+};
+
+// Every shape of an .obj file, as a StaticMesh with its diffuse texture.
+class MeshAsset : public Asset
+{
+    friend class AssetManager;
+
+    GLmesh::VertexFormat mFormat;
+    GLmesh::LodOptions mLodOptions;
+
+    std::vector<tinyobj::shape_t> mShapes;
+    std::vector<GLmesh::MeshData> mData;
+    std::vector<std::shared_ptr<TextureAsset>> mTextures;
+    std::vector<std::shared_ptr<GLmesh::StaticMesh>> mMeshes;
+
+public:
+    MeshAsset(const std::string& name, const GLmesh::VertexFormat& format, const GLmesh::LodOptions& lodOptions);
+
+    // the shapes as they were parsed, for anything that needs the triangles on the CPU
+    const std::vector<tinyobj::shape_t>& GetShapes() const;
+    const std::vector<std::shared_ptr<GLmesh::StaticMesh>>& GetMeshes() const;
+};
+
+// Loads meshes, textures and shaders on a pool of worker threads.
+//
+// Files are read, parsed and decoded on the workers, and the GL objects are made afterwards,
+// on whichever thread calls ProcessCompletions() or WaitAll(), which has to be the GL thread.
+// Each file is loaded once: asking for the same path again returns the same asset, loaded or not,
+// with the options it was first asked for. Shader sources are shared between programs too.
+// Errors are thrown on the GL thread, from the call that would have finished the asset.
+// With a ProgramBinaryCache, the workers read the programs' cached binaries along with their sources,
+// and the binaries of programs that had to be compiled are written back on the workers.
+//
+// Requests can come from any thread.
+class AssetManager
+{
+    GLplus::ProgramBinaryCache* mProgramCache;
+    std::chrono::steady_clock::time_point mCreated;
+
+    std::mutex mMutex;
+    std::condition_variable mCompletionsReady;
+    std::deque<std::function<void()>> mCompletions;
+    // requested and not loaded yet
+    size_t mPending;
+
+    std::vector<std::shared_ptr<Asset>> mAssets;
+    std::unordered_map<std::string, std::shared_ptr<MeshAsset>> mMeshes;
+    std::unordered_map<std::string, std::shared_ptr<TextureAsset>> mTextures;
+    std::unordered_map<std::string, std::shared_ptr<ProgramAsset>> mPrograms;
+    std::unordered_map<std::string, std::shared_future<std::string>> mSources;
+
+    // Last, so it's destroyed first: its destructor finishes the jobs already submitted,
+    // and those still use everything above.
+    JobPool mJobs;
+
+public:
+    // numThreads 0 uses one worker per core. The program cache, if any, has to outlive the manager.
+    explicit AssetManager(int numThreads = 0, GLplus::ProgramBinaryCache* programCache = nullptr);
+
+    std::shared_ptr<MeshAsset> LoadMesh(const std::string& filename,
+                                        const GLmesh::VertexFormat& format = GLmesh::VertexFormat(),
+                                        const GLmesh::LodOptions& lodOptions = GLmesh::LodOptions());
+    std::shared_ptr<TextureAsset> LoadTexture(const std::string& filename, unsigned int flags = GLplus::Texture2D::NoFlags);
+    // Links the given variants of the shaders' options as part of loading. Any others are compiled when they're first used.
+    std::shared_ptr<ProgramAsset> LoadProgram(const std::string& vertexShaderFile, const std::string& fragmentShaderFile,
+                                              const std::vector<std::string>& options = std::vector<std::string>(),
+                                              const std::vector<GLplus::ProgramVariants::Mask>& variants =
+                                                  std::vector<GLplus::ProgramVariants::Mask>(1, 0));
+
+    // Makes the GL objects of whatever the workers have finished, without waiting for the rest. GL thread only.
+    void ProcessCompletions();
+
+    // Processes completions until every requested asset is loaded. GL thread only.
+    void WaitAll();
+
+    // assets requested and not loaded yet
+    size_t GetPendingCount();
+
+    // the load time of every asset so far, slowest first, how much the workers overlapped, and the program cache's hits
+    void PrintTimings(FILE* file);
+
+private:
+    double Seconds(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) const;
+
+    // runs work on a worker, then finish on the GL thread. If work throws, the error is thrown by the GL thread instead.
+    void Start(const std::shared_ptr<Asset>& asset, std::function<void()> work, std::function<void()> finish);
+    void PushCompletion(std::function<void()> completion);
+    void FinishLoading(Asset& asset);
+
+    // the file's contents, read only once however many shaders include it. Blocks while another worker reads it.
+    std::string ReadSource(const std::string& filename);
+};
+
+#endif // ASSETMANAGER_H
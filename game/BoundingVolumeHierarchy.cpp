@@ -0,0 +1,562 @@
+#include "BoundingVolumeHierarchy.hpp"
+
+#include <tiny_obj_loader.h>
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+void BoundingBox::Grow(const glm::vec3& point)
+{
+    mMin = glm::min(mMin, point);
+    mMax = glm::max(mMax, point);
+}
+
+void BoundingBox::Grow(const BoundingBox& box)
+{
+    mMin = glm::min(mMin, box.mMin);
+    mMax = glm::max(mMax, box.mMax);
+}
+
+bool BoundingBox::IsEmpty() const
+{
+    return mMin.x > mMax.x || mMin.y > mMax.y || mMin.z > mMax.z;
+}
+
+glm::vec3 BoundingBox::GetCenter() const
+{
+    return (mMin + mMax) * 0.5f;
+}
+
+float BoundingBox::GetSurfaceArea() const
+{
+    if (IsEmpty())
+    {
+        return 0.0f;
+    }
+
+    glm::vec3 size = mMax - mMin;
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+BoundingBox BoundingBox::Transformed(const glm::mat4& transform) const
+{
+    if (IsEmpty())
+    {
+        return *this;
+    }
+
+    // the extents along each new axis are the sum of the old extents' contributions to it
+    glm::vec3 center = glm::vec3(transform * glm::vec4(GetCenter(), 1.0f));
+    glm::vec3 extents = (mMax - mMin) * 0.5f;
+
+    glm::vec3 newExtents(0.0f);
+    for (int column = 0; column < 3; column++)
+    {
+        newExtents += glm::abs(glm::vec3(transform[column])) * extents[column];
+    }
+
+    BoundingBox box;
+    box.mMin = center - newExtents;
+    box.mMax = center + newExtents;
+    return box;
+}
+
+Ray Ray::Transformed(const glm::mat4& transform) const
+{
+    Ray ray;
+    ray.mOrigin = glm::vec3(transform * glm::vec4(mOrigin, 1.0f));
+    ray.mDirection = glm::vec3(transform * glm::vec4(mDirection, 0.0f));
+    return ray;
+}
+
+bool IntersectRayTriangle(const Ray& ray, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, float& distance)
+{
+    glm::vec3 edge1 = v1 - v0;
+    glm::vec3 edge2 = v2 - v0;
+
+    glm::vec3 p = glm::cross(ray.mDirection, edge2);
+    float determinant = glm::dot(edge1, p);
+    if (std::fabs(determinant) < 1e-12f)
+    {
+        // parallel to the triangle
+        return false;
+    }
+
+    float inverseDeterminant = 1.0f / determinant;
+
+    glm::vec3 t = ray.mOrigin - v0;
+    float u = glm::dot(t, p) * inverseDeterminant;
+    if (u < 0.0f || u > 1.0f)
+    {
+        return false;
+    }
+
+    glm::vec3 q = glm::cross(t, edge1);
+    float v = glm::dot(ray.mDirection, q) * inverseDeterminant;
+    if (v < 0.0f || u + v > 1.0f)
+    {
+        return false;
+    }
+
+    distance = glm::dot(edge2, q) * inverseDeterminant;
+    return distance >= 0.0f;
+}
+
+std::vector<BoundingBox> TriangleBounds(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices)
+{
+    std::vector<BoundingBox> bounds(indices.size() / 3);
+    for (size_t triangle = 0; triangle < bounds.size(); triangle++)
+    {
+        for (int corner = 0; corner < 3; corner++)
+        {
+            bounds[triangle].Grow(positions.at(indices[triangle * 3 + corner]));
+        }
+    }
+    return bounds;
+}
+
+BoundingBox ShapeBounds(const tinyobj::shape_t& shape)
+{
+    BoundingBox bounds;
+    const std::vector<float>& positions = shape.mesh.positions;
+    for (size_t i = 0; i + 2 < positions.size(); i += 3)
+    {
+        bounds.Grow(glm::vec3(positions[i], positions[i + 1], positions[i + 2]));
+    }
+    return bounds;
+}
+
+namespace
+{
+
+// bins of primitive centers along an axis, for the surface area heuristic
+const int kNumBins = 16;
+
+// Past this, nodes are split in half instead, which adds at most 32 more levels.
+// That keeps the tree within BoundingVolumeHierarchy::kMaxDepth.
+const int kMaxSahDepth = 32;
+
+// smaller subtrees aren't worth a thread
+const uint32_t kMinParallelPrimitives = 4096;
+
+struct BuildNode
+{
+    BoundingBox mBounds;
+    uint32_t mFirst = 0;
+    uint32_t mCount = 0;
+    int mAxis = 0;
+    std::unique_ptr<BuildNode> mLeft;
+    std::unique_ptr<BuildNode> mRight;
+};
+
+struct BuildContext
+{
+    const std::vector<BoundingBox>* mBounds;
+    std::vector<glm::vec3> mCenters;
+    // each subtree only touches its own range of these, so threads don't share any
+    std::vector<uint32_t>* mIndices;
+    uint32_t mMaxLeafSize;
+    // subtrees above this depth are built on their own thread
+    int mParallelDepth;
+};
+
+std::unique_ptr<BuildNode> BuildSubtree(const BuildContext& context, uint32_t first, uint32_t count, int depth)
+{
+    std::vector<uint32_t>& indices = *context.mIndices;
+
+    std::unique_ptr<BuildNode> node(new BuildNode());
+    node->mFirst = first;
+    node->mCount = count;
+
+    BoundingBox centerBounds;
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        node->mBounds.Grow((*context.mBounds)[indices[i]]);
+        centerBounds.Grow(context.mCenters[indices[i]]);
+    }
+
+    if (count <= context.mMaxLeafSize)
+    {
+        return node;
+    }
+
+    // find the cheapest split between bins, on any axis
+    float bestCost = 1e30f;
+    int bestAxis = -1;
+    int bestBin = 0;
+
+    glm::vec3 centerExtents = centerBounds.mMax - centerBounds.mMin;
+
+    for (int axis = 0; axis < 3 && depth < kMaxSahDepth; axis++)
+    {
+        if (centerExtents[axis] <= 0.0f)
+        {
+            continue;
+        }
+
+        float binScale = kNumBins / centerExtents[axis];
+
+        BoundingBox binBounds[kNumBins];
+        uint32_t binCounts[kNumBins] = { };
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            int bin = std::min((int) ((context.mCenters[indices[i]][axis] - centerBounds.mMin[axis]) * binScale), kNumBins - 1);
+            binBounds[bin].Grow((*context.mBounds)[indices[i]]);
+            binCounts[bin]++;
+        }
+
+        // the area and count right of each split, swept from the right
+        float rightAreas[kNumBins];
+        uint32_t rightCounts[kNumBins];
+        BoundingBox right;
+        uint32_t rightCount = 0;
+        for (int bin = kNumBins - 1; bin > 0; bin--)
+        {
+            right.Grow(binBounds[bin]);
+            rightCount += binCounts[bin];
+            rightAreas[bin] = right.GetSurfaceArea();
+            rightCounts[bin] = rightCount;
+        }
+
+        BoundingBox left;
+        uint32_t leftCount = 0;
+        for (int bin = 0; bin < kNumBins - 1; bin++)
+        {
+            left.Grow(binBounds[bin]);
+            leftCount += binCounts[bin];
+
+            if (leftCount == 0 || rightCounts[bin + 1] == 0)
+            {
+                continue;
+            }
+
+            float cost = left.GetSurfaceArea() * leftCount + rightAreas[bin + 1] * rightCounts[bin + 1];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = bin;
+            }
+        }
+    }
+
+    uint32_t leftCount = 0;
+
+    if (bestAxis >= 0)
+    {
+        float binScale = kNumBins / centerExtents[bestAxis];
+        uint32_t* middle = std::partition(&indices[first], &indices[first] + count, [&](uint32_t primitive)
+        {
+            int bin = std::min((int) ((context.mCenters[primitive][bestAxis] - centerBounds.mMin[bestAxis]) * binScale), kNumBins - 1);
+            return bin <= bestBin;
+        });
+        leftCount = (uint32_t) (middle - &indices[first]);
+        node->mAxis = bestAxis;
+    }
+
+    if (leftCount == 0 || leftCount == count)
+    {
+        // the centers are all in one place, or the tree is too deep: split in half along the widest axis
+        int axis = 0;
+        if (centerExtents.y > centerExtents[axis]) axis = 1;
+        if (centerExtents.z > centerExtents[axis]) axis = 2;
+
+        leftCount = count / 2;
+        std::nth_element(&indices[first], &indices[first] + leftCount, &indices[first] + count,
+            [&](uint32_t a, uint32_t b)
+        {
+            return context.mCenters[a][axis] < context.mCenters[b][axis];
+        });
+        node->mAxis = axis;
+    }
+
+    if (depth < context.mParallelDepth && count >= kMinParallelPrimitives)
+    {
+        std::future<std::unique_ptr<BuildNode>> left = std::async(std::launch::async,
+            &BuildSubtree, std::cref(context), first, leftCount, depth + 1);
+        node->mRight = BuildSubtree(context, first + leftCount, count - leftCount, depth + 1);
+        node->mLeft = left.get();
+    }
+    else
+    {
+        node->mLeft = BuildSubtree(context, first, leftCount, depth + 1);
+        node->mRight = BuildSubtree(context, first + leftCount, count - leftCount, depth + 1);
+    }
+
+    return node;
+}
+
+uint32_t Flatten(const BuildNode& buildNode, std::vector<BoundingVolumeHierarchy::Node>& nodes)
+{
+    uint32_t index = (uint32_t) nodes.size();
+
+    BoundingVolumeHierarchy::Node node;
+    node.mMin = buildNode.mBounds.mMin;
+    node.mMax = buildNode.mBounds.mMax;
+    node.mAxis = (uint16_t) buildNode.mAxis;
+
+    if (!buildNode.mLeft)
+    {
+        node.mOffset = buildNode.mFirst;
+        node.mCount = (uint16_t) buildNode.mCount;
+        nodes.push_back(node);
+        return index;
+    }
+
+    node.mOffset = 0;
+    node.mCount = 0;
+    nodes.push_back(node);
+
+    Flatten(*buildNode.mLeft, nodes);
+    nodes[index].mOffset = Flatten(*buildNode.mRight, nodes);
+
+    return index;
+}
+
+} // end anonymous namespace
+
+void BoundingVolumeHierarchy::Build(const std::vector<BoundingBox>& primitiveBounds, int maxLeafSize, int numThreads)
+{
+    if (maxLeafSize < 1 || maxLeafSize > 0xFFFF)
+    {
+        throw std::logic_error("BoundingVolumeHierarchy leaves hold between 1 and 65535 primitives.");
+    }
+
+    mNodes.clear();
+    mPrimitiveIndices.resize(primitiveBounds.size());
+    for (size_t i = 0; i < mPrimitiveIndices.size(); i++)
+    {
+        mPrimitiveIndices[i] = (uint32_t) i;
+    }
+
+    if (primitiveBounds.empty())
+    {
+        return;
+    }
+
+    if (numThreads <= 0)
+    {
+        numThreads = std::max((int) std::thread::hardware_concurrency(), 1);
+    }
+
+    BuildContext context;
+    context.mBounds = &primitiveBounds;
+    context.mIndices = &mPrimitiveIndices;
+    context.mMaxLeafSize = maxLeafSize;
+    // each level doubles the threads
+    context.mParallelDepth = 0;
+    while ((1 << context.mParallelDepth) < numThreads)
+    {
+        context.mParallelDepth++;
+    }
+
+    context.mCenters.resize(primitiveBounds.size());
+    for (size_t i = 0; i < primitiveBounds.size(); i++)
+    {
+        context.mCenters[i] = primitiveBounds[i].GetCenter();
+    }
+
+    std::unique_ptr<BuildNode> root = BuildSubtree(context, 0, (uint32_t) primitiveBounds.size(), 0);
+
+    mNodes.reserve(primitiveBounds.size() * 2);
+    Flatten(*root, mNodes);
+}
+
+void BoundingVolumeHierarchy::Refit(const std::vector<BoundingBox>& primitiveBounds)
+{
+    if (primitiveBounds.size() != mPrimitiveIndices.size())
+    {
+        throw std::logic_error("BoundingVolumeHierarchy refit with a different number of primitives than it was built with.");
+    }
+
+    // children come after their parents
+    for (size_t i = mNodes.size(); i-- > 0; )
+    {
+        Node& node = mNodes[i];
+
+        BoundingBox bounds;
+        if (node.mCount > 0)
+        {
+            for (uint32_t primitive = node.mOffset; primitive < node.mOffset + node.mCount; primitive++)
+            {
+                bounds.Grow(primitiveBounds[mPrimitiveIndices[primitive]]);
+            }
+        }
+        else
+        {
+            const Node& left = mNodes[i + 1];
+            const Node& right = mNodes[node.mOffset];
+            bounds.mMin = glm::min(left.mMin, right.mMin);
+            bounds.mMax = glm::max(left.mMax, right.mMax);
+        }
+
+        node.mMin = bounds.mMin;
+        node.mMax = bounds.mMax;
+    }
+}
+
+void BoundingVolumeHierarchy::GetPrimitiveRange(uint32_t node, uint32_t& first, uint32_t& end) const
+{
+    uint32_t leftmost = node;
+    while (mNodes[leftmost].mCount == 0)
+    {
+        leftmost = leftmost + 1;
+    }
+
+    uint32_t rightmost = node;
+    while (mNodes[rightmost].mCount == 0)
+    {
+        rightmost = mNodes[rightmost].mOffset;
+    }
+
+    first = mNodes[leftmost].mOffset;
+    end = mNodes[rightmost].mOffset + mNodes[rightmost].mCount;
+}
+
+void BoundingVolumeHierarchy::CullFrustum(const Frustum& frustum, std::vector<uint32_t>& visible) const
+{
+    visible.clear();
+    if (mNodes.empty())
+    {
+        return;
+    }
+
+    const uint32_t kAllPlanes = (1 << Frustum::NumPlanes) - 1;
+
+    // a node, and the planes its parent wasn't already entirely inside of
+    struct Entry
+    {
+        uint32_t mNode;
+        uint32_t mPlaneMask;
+    };
+
+    Entry stack[kMaxDepth + 2];
+    int stackSize = 0;
+    stack[stackSize++] = Entry{ 0, kAllPlanes };
+
+    while (stackSize > 0)
+    {
+        Entry entry = stack[--stackSize];
+        const Node& node = mNodes[entry.mNode];
+
+        bool outside = false;
+        for (int p = 0; p < Frustum::NumPlanes && !outside; p++)
+        {
+            if (!(entry.mPlaneMask & (1 << p)))
+            {
+                continue;
+            }
+
+            const glm::vec4& plane = frustum.mPlanes[p];
+
+            // the corners farthest along the normal and against it
+            glm::vec3 farCorner(plane.x >= 0.0f ? node.mMax.x : node.mMin.x,
+                                plane.y >= 0.0f ? node.mMax.y : node.mMin.y,
+                                plane.z >= 0.0f ? node.mMax.z : node.mMin.z);
+            glm::vec3 nearCorner(plane.x >= 0.0f ? node.mMin.x : node.mMax.x,
+                                 plane.y >= 0.0f ? node.mMin.y : node.mMax.y,
+                                 plane.z >= 0.0f ? node.mMin.z : node.mMax.z);
+
+            if (glm::dot(glm::vec3(plane), farCorner) + plane.w < 0.0f)
+            {
+                outside = true;
+            }
+            else if (glm::dot(glm::vec3(plane), nearCorner) + plane.w >= 0.0f)
+            {
+                entry.mPlaneMask &= ~(1 << p);
+            }
+        }
+
+        if (outside)
+        {
+            continue;
+        }
+
+        // leaves that touch the frustum keep all their primitives
+        if (node.mCount > 0 || entry.mPlaneMask == 0)
+        {
+            uint32_t first, end;
+            GetPrimitiveRange(entry.mNode, first, end);
+            visible.insert(visible.end(), mPrimitiveIndices.begin() + first, mPrimitiveIndices.begin() + end);
+            continue;
+        }
+
+        stack[stackSize++] = Entry{ node.mOffset, entry.mPlaneMask };
+        stack[stackSize++] = Entry{ entry.mNode + 1, entry.mPlaneMask };
+    }
+}
+
+bool BoundingVolumeHierarchy::IntersectRayNode(const Ray& ray, const glm::vec3& inverseDirection, const Node& node,
+                                               float maxDistance, float& entryDistance)
+{
+    glm::vec3 toMin = (node.mMin - ray.mOrigin) * inverseDirection;
+    glm::vec3 toMax = (node.mMax - ray.mOrigin) * inverseDirection;
+
+    glm::vec3 nearest = glm::min(toMin, toMax);
+    glm::vec3 farthest = glm::max(toMin, toMax);
+
+    float entry = std::max(std::max(nearest.x, nearest.y), nearest.z);
+    float exit = std::min(std::min(farthest.x, farthest.y), farthest.z);
+
+    entryDistance = entry;
+    return exit >= std::max(entry, 0.0f) && entry < maxDistance;
+}
+
+const std::vector<BoundingVolumeHierarchy::Node>& BoundingVolumeHierarchy::GetNodes() const
+{
+    return mNodes;
+}
+
+const std::vector<uint32_t>& BoundingVolumeHierarchy::GetPrimitiveIndices() const
+{
+    return mPrimitiveIndices;
+}
+
+BoundingBox BoundingVolumeHierarchy::GetBounds() const
+{
+    BoundingBox bounds;
+    if (!mNodes.empty())
+    {
+        bounds.mMin = mNodes[0].mMin;
+        bounds.mMax = mNodes[0].mMax;
+    }
+    return bounds;
+}
+
+int BoundingVolumeHierarchy::GetDepth() const
+{
+    if (mNodes.empty())
+    {
+        return 0;
+    }
+
+    struct Entry
+    {
+        uint32_t mNode;
+        int mDepth;
+    };
+
+    std::vector<Entry> stack(1, Entry{ 0, 1 });
+    int depth = 0;
+
+    while (!stack.empty())
+    {
+        Entry entry = stack.back();
+        stack.pop_back();
+
+        depth = std::max(depth, entry.mDepth);
+
+        const Node& node = mNodes[entry.mNode];
+        if (node.mCount == 0)
+        {
+            stack.push_back(Entry{ entry.mNode + 1, entry.mDepth + 1 });
+            stack.push_back(Entry{ node.mOffset, entry.mDepth + 1 });
+        }
+    }
+
+    return depth;
+}
@@ -0,0 +1,195 @@
+#ifndef BOUNDINGVOLUMEHIERARCHY_H
+#define BOUNDINGVOLUMEHIERARCHY_H
+
+#include "FrustumCulling.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace tinyobj
+{
+struct shape_t;
+}
+
+struct BoundingBox
+{
+    glm::vec3 mMin = glm::vec3(1e30f);
+    glm::vec3 mMax = glm::vec3(-1e30f);
+
+    void Grow(const glm::vec3& point);
+    void Grow(const BoundingBox& box);
+
+    bool IsEmpty() const;
+    glm::vec3 GetCenter() const;
+    float GetSurfaceArea() const;
+
+    // the box around this one after it's transformed
+    BoundingBox Transformed(const glm::mat4& transform) const;
+};
+
+struct Ray
+{
+    glm::vec3 mOrigin;
+    // doesn't need to be unit length. Distances along the ray are in multiples of it.
+    glm::vec3 mDirection;
+
+    Ray Transformed(const glm::mat4& transform) const;
+};
+
+// Moller-Trumbore. Counts hits on either side of the triangle.
+bool IntersectRayTriangle(const Ray& ray, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, float& distance);
+
+// the bounds of every triangle of an indexed triangle list
+std::vector<BoundingBox> TriangleBounds(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices);
+
+BoundingBox ShapeBounds(const tinyobj::shape_t& shape);
+
+// A binary tree of boxes over primitives, which only the caller knows about by index:
+// the shapes of an obj, the triangles of a mesh, or the objects of a scene.
+//
+// Nodes are stored depth first in one array, 32 bytes each.
+// A node's left child comes right after it, and each subtree's primitives are contiguous.
+class BoundingVolumeHierarchy
+{
+public:
+    // Build() never makes a deeper tree, so traversals can keep their stacks on the stack
+    static const int kMaxDepth = 64;
+
+    struct Node
+    {
+        glm::vec3 mMin;
+        // leaves: index of the first primitive index. Interior nodes: index of the right child.
+        uint32_t mOffset;
+        glm::vec3 mMax;
+        // 0 for interior nodes
+        uint16_t mCount;
+        // the axis the children were split along, to visit the nearer one first
+        uint16_t mAxis;
+    };
+
+private:
+    std::vector<Node> mNodes;
+    std::vector<uint32_t> mPrimitiveIndices;
+
+    // the first and one past the last primitive index under a node
+    void GetPrimitiveRange(uint32_t node, uint32_t& first, uint32_t& end) const;
+
+public:
+    // Builds with the surface area heuristic, by binning primitive centers.
+    // Subtrees that are big enough are built on numThreads threads, 0 meaning one per core.
+    void Build(const std::vector<BoundingBox>& primitiveBounds, int maxLeafSize = 4, int numThreads = 0);
+
+    // Updates the boxes for primitives that moved, without changing the tree.
+    // Cheap, but the tree gets worse as primitives move away from where it was built.
+    void Refit(const std::vector<BoundingBox>& primitiveBounds);
+
+    // Replaces visible with the primitives whose boxes intersect the frustum.
+    // Subtrees fully inside the frustum are taken without testing what's under them.
+    void CullFrustum(const Frustum& frustum, std::vector<uint32_t>& visible) const;
+
+    // Finds the nearest primitive the ray hits within maxDistance.
+    // intersect(primitive, ray, distance) tests one primitive, and sets distance when it hits.
+    template<class IntersectPrimitive>
+    bool Raycast(const Ray& ray, float maxDistance, IntersectPrimitive intersect,
+                 uint32_t& hitPrimitive, float& hitDistance) const;
+
+    // whether the ray enters the node's box before maxDistance, and where
+    static bool IntersectRayNode(const Ray& ray, const glm::vec3& inverseDirection, const Node& node,
+                                 float maxDistance, float& entryDistance);
+
+    const std::vector<Node>& GetNodes() const;
+    const std::vector<uint32_t>& GetPrimitiveIndices() const;
+    BoundingBox GetBounds() const;
+    int GetDepth() const;
+};
+
+template<class IntersectPrimitive>
+bool BoundingVolumeHierarchy::Raycast(const Ray& ray, float maxDistance, IntersectPrimitive intersect,
+                                      uint32_t& hitPrimitive, float& hitDistance) const
+{
+    if (mNodes.empty())
+    {
+        return false;
+    }
+
+    const glm::vec3 inverseDirection = 1.0f / ray.mDirection;
+
+    bool hit = false;
+    hitDistance = maxDistance;
+
+    // far children wait here while the near ones are visited
+    uint32_t stack[kMaxDepth + 1];
+    int stackSize = 0;
+
+    float entryDistance;
+    if (!IntersectRayNode(ray, inverseDirection, mNodes[0], hitDistance, entryDistance))
+    {
+        return false;
+    }
+
+    uint32_t current = 0;
+    for (;;)
+    {
+        const Node& node = mNodes[current];
+
+        if (node.mCount > 0)
+        {
+            for (uint32_t i = node.mOffset; i < node.mOffset + node.mCount; i++)
+            {
+                float distance;
+                if (intersect(mPrimitiveIndices[i], ray, distance) && distance >= 0.0f && distance < hitDistance)
+                {
+                    hit = true;
+                    hitDistance = distance;
+                    hitPrimitive = mPrimitiveIndices[i];
+                }
+            }
+        }
+        else
+        {
+            uint32_t nearChild = current + 1;
+            uint32_t farChild = node.mOffset;
+            if (ray.mDirection[node.mAxis] < 0.0f)
+            {
+                std::swap(nearChild, farChild);
+            }
+
+            float nearEntry, farEntry;
+            bool hitNear = IntersectRayNode(ray, inverseDirection, mNodes[nearChild], hitDistance, nearEntry);
+            bool hitFar = IntersectRayNode(ray, inverseDirection, mNodes[farChild], hitDistance, farEntry);
+
+            if (hitNear)
+            {
+                if (hitFar)
+                {
+                    stack[stackSize++] = farChild;
+                }
+                current = nearChild;
+                continue;
+            }
+            else if (hitFar)
+            {
+                current = farChild;
+                continue;
+            }
+        }
+
+        // the stacked nodes might be behind a hit found since they were pushed
+        bool found = false;
+        while (stackSize > 0 && !found)
+        {
+            current = stack[--stackSize];
+            found = IntersectRayNode(ray, inverseDirection, mNodes[current], hitDistance, entryDistance);
+        }
+
+        if (!found)
+        {
+            return hit;
+        }
+    }
+}
+
+#endif // BOUNDINGVOLUMEHIERARCHY_H
@@ -0,0 +1,127 @@
+// Times the frustum culling kernels, and the bounding volume hierarchy, on a field of random objects around a stereo camera.
+// usage: cull_benchmark [number of objects]
+
+#include "BoundingVolumeHierarchy.hpp"
+#include "FrustumCulling.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <thread>
+
+static const int kRepetitions = 200;
+
+// seconds per call, the best of all repetitions
+template<class Function>
+static double TimeBest(Function function)
+{
+    double best = 1e30;
+    for (int repetition = 0; repetition < kRepetitions; repetition++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        function();
+        auto end = std::chrono::high_resolution_clock::now();
+
+        best = std::min(best, std::chrono::duration<double>(end - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t numObjects = argc > 1 ? (size_t) atol(argv[1]) : 100000;
+
+    // objects scattered through a cube, around a camera looking down -z
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> size(0.1f, 2.0f);
+
+    BoundingVolumes volumes;
+    std::vector<BoundingBox> boxes(numObjects);
+    volumes.Resize(numObjects);
+    for (size_t i = 0; i < numObjects; i++)
+    {
+        glm::vec3 center(position(random), position(random), position(random));
+        glm::vec3 extents(size(random), size(random), size(random));
+        volumes.SetSphere(i, center, glm::length(extents));
+        volumes.SetBox(i, center - extents, center + extents);
+        boxes[i].mMin = center - extents;
+        boxes[i].mMax = center + extents;
+    }
+
+    // roughly the DK1's eyes: 64mm apart, with their projection centers pushed outwards
+    const float halfIpd = 0.032f;
+    glm::mat4 projection = glm::perspective(110.0f, 0.8f, 0.01f, 1000.0f);
+    glm::mat4 leftProjection = glm::translate(glm::mat4(), glm::vec3(0.15f, 0.0f, 0.0f)) * projection;
+    glm::mat4 rightProjection = glm::translate(glm::mat4(), glm::vec3(-0.15f, 0.0f, 0.0f)) * projection;
+    glm::mat4 leftView = glm::translate(glm::mat4(), glm::vec3(halfIpd, 0.0f, 0.0f));
+    glm::mat4 rightView = glm::translate(glm::mat4(), glm::vec3(-halfIpd, 0.0f, 0.0f));
+
+    Frustum frustum = Frustum::StereoUnion(
+            Frustum::FromViewProjection(leftProjection * leftView),
+            Frustum::FromViewProjection(rightProjection * rightView));
+
+    printf("%d objects, SIMD kernel: %s\n", (int) numObjects, BoundingVolumes::GetSimdKernelName());
+
+    std::vector<uint32_t> scalarVisible;
+    std::vector<uint32_t> simdVisible;
+
+    struct Test
+    {
+        const char* mName;
+        void (BoundingVolumes::*mCull)(const Frustum&, std::vector<uint32_t>&, CullingKernel) const;
+    };
+
+    const Test tests[] = {
+        { "spheres", &BoundingVolumes::CullSpheres },
+        { "boxes", &BoundingVolumes::CullBoxes }
+    };
+
+    for (const Test& test : tests)
+    {
+        double scalarTime = TimeBest([&]{ (volumes.*test.mCull)(frustum, scalarVisible, CullingKernel::Scalar); });
+        double simdTime = TimeBest([&]{ (volumes.*test.mCull)(frustum, simdVisible, CullingKernel::Simd); });
+
+        if (scalarVisible != simdVisible)
+        {
+            fprintf(stderr, "%s: the SIMD kernel disagrees with the scalar one\n", test.mName);
+            return 1;
+        }
+
+        printf("%-8s %d visible. scalar: %8.1f objects/us, SIMD: %8.1f objects/us (%.1fx)\n",
+               test.mName, (int) simdVisible.size(),
+               numObjects / (scalarTime * 1e6), numObjects / (simdTime * 1e6), scalarTime / simdTime);
+    }
+
+    // the tree only pays for its build when the objects stay put, or just move a little
+    BoundingVolumeHierarchy tree;
+    int numThreads = std::max((int) std::thread::hardware_concurrency(), 1);
+
+    auto timeOnce = [](std::function<void()> function)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        function();
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double>(end - start).count();
+    };
+
+    double serialBuildTime = timeOnce([&]{ tree.Build(boxes, 1, 1); });
+    double parallelBuildTime = timeOnce([&]{ tree.Build(boxes, 1, numThreads); });
+    double refitTime = TimeBest([&]{ tree.Refit(boxes); });
+
+    std::vector<uint32_t> treeVisible;
+    double treeTime = TimeBest([&]{ tree.CullFrustum(frustum, treeVisible); });
+
+    printf("BVH      %d nodes, %d deep. build: %.1f ms on 1 thread, %.1f ms on %d. refit: %.2f ms\n",
+           (int) tree.GetNodes().size(), tree.GetDepth(),
+           serialBuildTime * 1e3, parallelBuildTime * 1e3, numThreads, refitTime * 1e3);
+    printf("BVH      %d visible. hierarchical: %8.1f objects/us\n",
+           (int) treeVisible.size(), numObjects / (treeTime * 1e6));
+
+    return 0;
+}
@@ -0,0 +1,395 @@
+#include "DistortionMesh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+
+struct MeshVertex
+{
+    glm::vec2 mPosition;
+    // red, green and blue
+    glm::vec2 mTexcoords[3];
+};
+
+const int kFloatsPerVertex = sizeof(MeshVertex) / sizeof(float);
+
+// which side of the eye's texture region a texture coordinate falls off of, as a bitmask
+int OutsideMask(const EyeWarp& eye, const glm::vec2& texcoord)
+{
+    return (texcoord.x < eye.mEyeMin.x ? 1 : 0)
+         | (texcoord.y < eye.mEyeMin.y ? 2 : 0)
+         | (texcoord.x > eye.mEyeMax.x ? 4 : 0)
+         | (texcoord.y > eye.mEyeMax.y ? 8 : 0);
+}
+
+glm::vec2 GridPoint(const EyeWarp& eye, int gridResolution, float x, float y)
+{
+    glm::vec2 cell((eye.mEyeMax - eye.mEyeMin) / (float) gridResolution);
+    return eye.mEyeMin + cell * glm::vec2(x, y);
+}
+
+MeshVertex Lerp(const MeshVertex& a, const MeshVertex& b, float t)
+{
+    MeshVertex lerped;
+    lerped.mPosition = a.mPosition + (b.mPosition - a.mPosition) * t;
+    for (int channel = 0; channel < 3; channel++)
+    {
+        lerped.mTexcoords[channel] = a.mTexcoords[channel] + (b.mTexcoords[channel] - a.mTexcoords[channel]) * t;
+    }
+    return lerped;
+}
+
+// how far the vertex's blue texture coordinate is inside one side of the eye's region, negative outside of it
+float InsideDistance(const EyeWarp& eye, const MeshVertex& vertex, int side)
+{
+    const glm::vec2& blue = vertex.mTexcoords[2];
+    switch (side)
+    {
+    case 0:  return blue.x - eye.mEyeMin.x;
+    case 1:  return blue.y - eye.mEyeMin.y;
+    case 2:  return eye.mEyeMax.x - blue.x;
+    default: return eye.mEyeMax.y - blue.y;
+    }
+}
+
+// Cuts a triangle down to the part that samples inside the eye's region.
+// The texture coordinates are interpolated linearly across a triangle, so cutting it where they cross
+// the region's edges leaves exactly the pixels that sampled inside, and the rest keep the clear color.
+std::vector<MeshVertex> ClipToEye(const EyeWarp& eye, std::vector<MeshVertex> polygon)
+{
+    for (int side = 0; side < 4 && !polygon.empty(); side++)
+    {
+        std::vector<MeshVertex> clipped;
+        for (size_t i = 0; i < polygon.size(); i++)
+        {
+            const MeshVertex& a = polygon[i];
+            const MeshVertex& b = polygon[(i + 1) % polygon.size()];
+            float insideA = InsideDistance(eye, a, side);
+            float insideB = InsideDistance(eye, b, side);
+
+            if (insideA >= 0.0f)
+            {
+                clipped.push_back(a);
+            }
+            if ((insideA >= 0.0f) != (insideB >= 0.0f))
+            {
+                clipped.push_back(Lerp(a, b, insideA / (insideA - insideB)));
+            }
+        }
+        polygon.swap(clipped);
+    }
+    return polygon;
+}
+
+} // end anonymous namespace
+
+EyeWarp EyeWarp::FromStereoConfig(OVR::Util::Render::StereoConfig& config, OVR::Util::Render::StereoEye eye)
+{
+    const OVR::HMDInfo& info = config.GetHMDInfo();
+    const OVR::Util::Render::DistortionConfig& distortion = config.GetDistortionConfig();
+
+    // XCenterOffset is the left lens center in the left eye's [-1,1] viewport space
+    float leftLensCenterX = 0.25f + distortion.XCenterOffset * 0.25f;
+    float lensCenterY = info.VScreenCenter / info.VScreenSize;
+    float aspect = (float) info.HResolution / info.VResolution;
+
+    EyeWarp warp = Identity(eye);
+
+    warp.mLensCenter = glm::vec2(eye == OVR::Util::Render::StereoEye_Right ? 1.0f - leftLensCenterX : leftLensCenterX,
+                                 lensCenterY);
+
+    // one unit of lens space is the distance from the lens center to the middle of the screen
+    warp.mLensToTextureScale = glm::vec2(0.5f - leftLensCenterX, 0.5f / aspect);
+    warp.mTextureToLensScale = 1.0f / warp.mLensToTextureScale;
+
+    std::copy(distortion.K, distortion.K + 4, warp.mK);
+    std::copy(distortion.ChromaticAberration, distortion.ChromaticAberration + 4, warp.mChromaticAberration);
+
+    return warp;
+}
+
+EyeWarp EyeWarp::Identity(OVR::Util::Render::StereoEye eye)
+{
+    EyeWarp warp;
+
+    if (eye == OVR::Util::Render::StereoEye_Right)
+    {
+        warp.mEyeMin = glm::vec2(0.5f, 0.0f);
+        warp.mEyeMax = glm::vec2(1.0f, 1.0f);
+    }
+    else
+    {
+        warp.mEyeMin = glm::vec2(0.0f, 0.0f);
+        warp.mEyeMax = glm::vec2(0.5f, 1.0f);
+    }
+
+    warp.mLensCenter = (warp.mEyeMin + warp.mEyeMax) * 0.5f;
+    warp.mTextureToLensScale = glm::vec2(1.0f);
+    warp.mLensToTextureScale = glm::vec2(1.0f);
+
+    static const float identityK[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
+    static const float identityChromaticAberration[4] = { 1.0f, 0.0f, 1.0f, 0.0f };
+    std::copy(identityK, identityK + 4, warp.mK);
+    std::copy(identityChromaticAberration, identityChromaticAberration + 4, warp.mChromaticAberration);
+
+    return warp;
+}
+
+void EyeWarp::Apply(const glm::vec2& screenTexcoord, glm::vec2 warped[3]) const
+{
+    glm::vec2 inLensSpace = (screenTexcoord - mLensCenter) * mTextureToLensScale;
+
+    float rSq = glm::dot(inLensSpace, inLensSpace);
+    float distortionScale = mK[0] + mK[1] * rSq + mK[2] * rSq * rSq + mK[3] * rSq * rSq * rSq;
+
+    glm::vec2 green = inLensSpace * distortionScale;
+    glm::vec2 red = green * (mChromaticAberration[0] + mChromaticAberration[1] * rSq);
+    glm::vec2 blue = green * (mChromaticAberration[2] + mChromaticAberration[3] * rSq);
+
+    warped[0] = mLensCenter + red * mLensToTextureScale;
+    warped[1] = mLensCenter + green * mLensToTextureScale;
+    warped[2] = mLensCenter + blue * mLensToTextureScale;
+}
+
+bool EyeWarp::Contains(const glm::vec2& texcoord) const
+{
+    return OutsideMask(*this, texcoord) == 0;
+}
+
+DistortionMesh::DistortionMesh(const EyeWarp& leftEye, const EyeWarp& rightEye, int gridResolution)
+    : mGridResolution(gridResolution)
+{
+    if (gridResolution < 1)
+    {
+        throw std::logic_error("DistortionMesh needs at least one cell per side.");
+    }
+
+    mEyes[0] = leftEye;
+    mEyes[1] = rightEye;
+
+    Build();
+}
+
+void DistortionMesh::SetGridResolution(int gridResolution)
+{
+    if (gridResolution < 1)
+    {
+        throw std::logic_error("DistortionMesh needs at least one cell per side.");
+    }
+
+    mGridResolution = gridResolution;
+    Build();
+}
+
+void DistortionMesh::Build()
+{
+    int gridResolution = mGridResolution;
+    int verticesPerSide = gridResolution + 1;
+    int verticesPerEye = verticesPerSide * verticesPerSide;
+
+    std::vector<MeshVertex> vertices;
+    vertices.reserve(2 * verticesPerEye);
+
+    // which sides of the texture each vertex's blue texture coordinate is off of.
+    // Blue is scaled out the furthest, so it decides what's inside.
+    std::vector<int> outsideMasks;
+    outsideMasks.reserve(2 * verticesPerEye);
+
+    for (const EyeWarp& eye : mEyes)
+    {
+        for (int y = 0; y < verticesPerSide; y++)
+        {
+            for (int x = 0; x < verticesPerSide; x++)
+            {
+                glm::vec2 screenTexcoord = GridPoint(eye, gridResolution, (float) x, (float) y);
+                glm::vec2 position = screenTexcoord * 2.0f - 1.0f;
+
+                MeshVertex vertex;
+                vertex.mPosition = position;
+                eye.Apply(screenTexcoord, vertex.mTexcoords);
+                vertices.push_back(vertex);
+
+                outsideMasks.push_back(OutsideMask(eye, vertex.mTexcoords[2]));
+            }
+        }
+    }
+
+    std::vector<GLuint> indices;
+    indices.reserve(2 * gridResolution * gridResolution * 6);
+
+    for (int eye = 0; eye < 2; eye++)
+    {
+        for (int y = 0; y < gridResolution; y++)
+        {
+            for (int x = 0; x < gridResolution; x++)
+            {
+                GLuint v00 = eye * verticesPerEye + y * verticesPerSide + x;
+                GLuint v10 = v00 + 1;
+                GLuint v01 = v00 + verticesPerSide;
+                GLuint v11 = v01 + 1;
+
+                // if every corner falls off the same side, so does everything interpolated between them
+                if (outsideMasks[v00] & outsideMasks[v10] & outsideMasks[v01] & outsideMasks[v11])
+                {
+                    continue;
+                }
+
+                const GLuint triangles[2][3] = { { v00, v10, v11 }, { v00, v11, v01 } };
+                for (const GLuint* triangle : triangles)
+                {
+                    if ((outsideMasks[triangle[0]] | outsideMasks[triangle[1]] | outsideMasks[triangle[2]]) == 0)
+                    {
+                        indices.insert(indices.end(), triangle, triangle + 3);
+                        continue;
+                    }
+
+                    // on the edge of the eye, so the fragment shader never has to check
+                    std::vector<MeshVertex> clipped = ClipToEye(mEyes[eye],
+                        { vertices[triangle[0]], vertices[triangle[1]], vertices[triangle[2]] });
+
+                    GLuint first = vertices.size();
+                    vertices.insert(vertices.end(), clipped.begin(), clipped.end());
+                    for (GLuint i = 2; i < clipped.size(); i++)
+                    {
+                        indices.insert(indices.end(), { first, first + i - 1, first + i });
+                    }
+                }
+            }
+        }
+    }
+
+    mVertexBuffer = std::make_shared<GLplus::Buffer>(GL_ARRAY_BUFFER);
+    mVertexBuffer->Upload(vertices.size() * sizeof(vertices[0]), vertices.data(), GL_STATIC_DRAW);
+
+    mIndexBuffer = std::make_shared<GLplus::Buffer>(GL_ELEMENT_ARRAY_BUFFER);
+    mIndexCount = indices.size();
+
+    if (vertices.size() <= 65536)
+    {
+        std::vector<GLushort> shortIndices(indices.begin(), indices.end());
+        mIndexType = GL_UNSIGNED_SHORT;
+        mIndexBuffer->Upload(shortIndices.size() * sizeof(shortIndices[0]), shortIndices.data(), GL_STATIC_DRAW);
+    }
+    else
+    {
+        mIndexType = GL_UNSIGNED_INT;
+        mIndexBuffer->Upload(indices.size() * sizeof(indices[0]), indices.data(), GL_STATIC_DRAW);
+    }
+
+    // the old vertex arrays point at the old buffers
+    mVertexArrays.Clear();
+}
+
+int DistortionMesh::GetGridResolution() const
+{
+    return mGridResolution;
+}
+
+GLsizei DistortionMesh::GetTriangleCount() const
+{
+    return mIndexCount / 3;
+}
+
+DistortionMesh::Error DistortionMesh::MeasureError(int textureWidth, int textureHeight, int samplesPerCell) const
+{
+    Error error = { 0.0f, 0.0f };
+    double errorSum = 0.0;
+    long long numSamples = 0;
+
+    glm::vec2 texelsPerUnit((float) textureWidth, (float) textureHeight);
+
+    for (const EyeWarp& eye : mEyes)
+    {
+        for (int y = 0; y < mGridResolution; y++)
+        {
+            for (int x = 0; x < mGridResolution; x++)
+            {
+                glm::vec2 corners[4][3];
+                eye.Apply(GridPoint(eye, mGridResolution, (float) x,     (float) y),     corners[0]);
+                eye.Apply(GridPoint(eye, mGridResolution, (float) x + 1, (float) y),     corners[1]);
+                eye.Apply(GridPoint(eye, mGridResolution, (float) x,     (float) y + 1), corners[2]);
+                eye.Apply(GridPoint(eye, mGridResolution, (float) x + 1, (float) y + 1), corners[3]);
+
+                for (int sy = 0; sy < samplesPerCell; sy++)
+                {
+                    for (int sx = 0; sx < samplesPerCell; sx++)
+                    {
+                        float s = (sx + 0.5f) / samplesPerCell;
+                        float t = (sy + 0.5f) / samplesPerCell;
+
+                        glm::vec2 analytic[3];
+                        eye.Apply(GridPoint(eye, mGridResolution, x + s, y + t), analytic);
+
+                        if (!eye.Contains(analytic[2]))
+                        {
+                            continue;
+                        }
+
+                        float sampleError = 0.0f;
+                        for (int channel = 0; channel < 3; channel++)
+                        {
+                            const glm::vec2& v00 = corners[0][channel];
+                            const glm::vec2& v10 = corners[1][channel];
+                            const glm::vec2& v01 = corners[2][channel];
+                            const glm::vec2& v11 = corners[3][channel];
+
+                            // the cell is split along its v00-v11 diagonal
+                            glm::vec2 interpolated = s >= t
+                                    ? v00 + s * (v10 - v00) + t * (v11 - v10)
+                                    : v00 + t * (v01 - v00) + s * (v11 - v01);
+
+                            float channelError = glm::length((interpolated - analytic[channel]) * texelsPerUnit);
+                            sampleError = std::max(sampleError, channelError);
+                        }
+
+                        error.mMax = std::max(error.mMax, sampleError);
+                        errorSum += sampleError;
+                        numSamples++;
+                    }
+                }
+            }
+        }
+    }
+
+    if (numSamples > 0)
+    {
+        error.mMean = (float) (errorSum / numSamples);
+    }
+
+    return error;
+}
+
+void DistortionMesh::Render(const GLplus::Program& program) const
+{
+    const GLplus::VertexArray& vertexArray = mVertexArrays.GetOrCreate(program,
+        [this, &program](GLplus::VertexArray& vertexArray)
+    {
+        static const char* attributeNames[] = {
+            "position", "texcoordRed", "texcoordGreen", "texcoordBlue"
+        };
+        static const GLint attributeSizes[] = { 2, 2, 2, 2 };
+
+        GLint offset = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            GLint location;
+            if (program.TryGetAttributeLocation(attributeNames[i], location))
+            {
+                vertexArray.SetAttribute(location, mVertexBuffer,
+                    attributeSizes[i], GL_FLOAT, GL_FALSE, sizeof(float) * kFloatsPerVertex, sizeof(float) * offset);
+            }
+            offset += attributeSizes[i];
+        }
+
+        vertexArray.SetIndexBuffer(mIndexBuffer, mIndexType);
+    });
+
+    GLplus::ScopedVertexArrayBind vertexArrayBind(vertexArray);
+    GLplus::ScopedProgramBind programBind(program);
+
+    GLplus::DrawElements(GL_TRIANGLES, mIndexType, 0, mIndexCount);
+}
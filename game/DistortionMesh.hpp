@@ -0,0 +1,85 @@
+#ifndef DISTORTIONMESH_H
+#define DISTORTIONMESH_H
+
+#include <GLplus.hpp>
+
+#include <glm/glm.hpp>
+
+#include <OVR.h>
+
+// The lens warp of one eye, in texture coordinates of the side by side stereo texture.
+struct EyeWarp
+{
+    // position of lens center in texture coordinates
+    glm::vec2 mLensCenter;
+
+    // the region of the texture that holds this eye
+    glm::vec2 mEyeMin;
+    glm::vec2 mEyeMax;
+
+    // ratio to scale texture coordinates to coordinates in a unit space around the lens
+    glm::vec2 mTextureToLensScale;
+    // and vice versa
+    glm::vec2 mLensToTextureScale;
+
+    // the four distortion parameters
+    float mK[4];
+
+    // red constant, red r^2, blue constant and blue r^2 scales applied after the distortion
+    float mChromaticAberration[4];
+
+    static EyeWarp FromStereoConfig(OVR::Util::Render::StereoConfig& config, OVR::Util::Render::StereoEye eye);
+
+    // maps the eye's half of the screen straight onto its half of the texture
+    static EyeWarp Identity(OVR::Util::Render::StereoEye eye);
+
+    // writes the warped red, green and blue texture coordinates of a position on the screen in [0,1]
+    void Apply(const glm::vec2& screenTexcoord, glm::vec2 warped[3]) const;
+
+    // true if the texture coordinate lands inside this eye's half of the texture
+    bool Contains(const glm::vec2& texcoord) const;
+};
+
+// A tessellated grid per eye with the warp baked into its texture coordinates,
+// so the distortion pass is a plain textured draw instead of evaluating the warp per pixel.
+// The cells on the edge of each eye are cut where their texture coordinates leave the eye's half of the texture,
+// and what's outside isn't drawn at all.
+class DistortionMesh
+{
+    EyeWarp mEyes[2];
+    int mGridResolution;
+
+    std::shared_ptr<GLplus::Buffer> mVertexBuffer;
+    std::shared_ptr<GLplus::Buffer> mIndexBuffer;
+    GLenum mIndexType;
+    GLsizei mIndexCount;
+    mutable GLplus::VertexArrayCache mVertexArrays;
+
+public:
+    // how far the interpolated texture coordinates stray from the analytic warp, in texels
+    struct Error
+    {
+        float mMax;
+        float mMean;
+    };
+
+    // gridResolution is the number of cells along each side of an eye's grid.
+    DistortionMesh(const EyeWarp& leftEye, const EyeWarp& rightEye, int gridResolution);
+
+    // remakes the grid with a different number of cells
+    void SetGridResolution(int gridResolution);
+    int GetGridResolution() const;
+    GLsizei GetTriangleCount() const;
+
+    // compares the warp at samplesPerCell^2 points inside each cell to what the rasterizer interpolates there.
+    // Only points that end up inside the eye's texture are counted, since the rest aren't drawn.
+    Error MeasureError(int textureWidth, int textureHeight, int samplesPerCell = 4) const;
+
+    // draws both eyes in one draw call
+    void Render(const GLplus::Program& program) const;
+
+private:
+    void Build();
+};
+
+#endif // DISTORTIONMESH_H
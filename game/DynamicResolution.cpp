@@ -0,0 +1,166 @@
+#include "DynamicResolution.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+// the share of the frame period the GPU is allowed, leaving some room for spikes
+const double kTargetFraction = 0.85;
+
+// the average is lowered past this fraction of the target, and raised only below the other for kIncreaseDelay samples
+const double kDecreaseThreshold = 1.0;
+const double kIncreaseThreshold = 0.75;
+const int kIncreaseDelay = 45;
+
+// weight of each new sample in the running average
+const double kAverageWeight = 0.2;
+
+// the largest steps the scale takes at once, down and up
+const float kMaxDecrease = 0.75f;
+const float kMaxIncrease = 1.1f;
+
+// scales are rounded to steps of this, so noise doesn't keep nudging the resolution
+const float kScaleStep = 1.0f / 32.0f;
+
+// frames that can be in flight when the resolution changes, whose times were for the old one
+const int kSettleSamples = 5;
+
+} // end anonymous namespace
+
+DynamicResolution::DynamicResolution(GLsizei maxWidth, GLsizei maxHeight, double framePeriod, float minScale)
+    : mMaxWidth(maxWidth)
+    , mMaxHeight(maxHeight)
+    , mTargetTime(framePeriod * kTargetFraction)
+    , mMinScale(minScale)
+    , mEnabled(true)
+    , mScale(1.0f)
+    , mAverageTime(0.0)
+    , mSettleSamples(0)
+    , mSamplesUnderTarget(0)
+    , mDecreases(0)
+    , mIncreases(0)
+{
+}
+
+void DynamicResolution::ReportGPUTime(double seconds)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mNewTimes.push_back(seconds);
+}
+
+void DynamicResolution::Update()
+{
+    std::vector<double> times;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        times.swap(mNewTimes);
+    }
+
+    if (!mEnabled)
+    {
+        return;
+    }
+
+    // changes aim for the middle of the band, so the next frames don't land right back outside it
+    const double aim = mTargetTime * (kIncreaseThreshold + kDecreaseThreshold) / 2.0;
+
+    for (double time : times)
+    {
+        if (mSettleSamples > 0)
+        {
+            mSettleSamples--;
+            continue;
+        }
+
+        mAverageTime = mAverageTime == 0.0 ? time : mAverageTime + (time - mAverageTime) * kAverageWeight;
+
+        // the GPU time goes roughly with the number of pixels, so with the square of the scale
+        if (mAverageTime > mTargetTime * kDecreaseThreshold || time > mTargetTime / kTargetFraction)
+        {
+            double worst = std::max(mAverageTime, time);
+            float scale = mScale * (float) std::sqrt(aim / worst);
+            scale = std::floor(std::max(scale, mScale * kMaxDecrease) / kScaleStep) * kScaleStep;
+            if (mScale > mMinScale)
+            {
+                SetScale(std::min(scale, mScale - kScaleStep));
+                mDecreases++;
+            }
+            mSamplesUnderTarget = 0;
+        }
+        else if (mAverageTime < mTargetTime * kIncreaseThreshold)
+        {
+            if (++mSamplesUnderTarget >= kIncreaseDelay && mScale < 1.0f)
+            {
+                float scale = mScale * (float) std::sqrt(aim / mAverageTime);
+                scale = std::floor(std::min(scale, mScale * kMaxIncrease) / kScaleStep) * kScaleStep;
+                SetScale(std::max(scale, mScale + kScaleStep));
+                mIncreases++;
+            }
+        }
+        else
+        {
+            mSamplesUnderTarget = 0;
+        }
+    }
+}
+
+void DynamicResolution::SetEnabled(bool enabled)
+{
+    mEnabled = enabled;
+    SetScale(1.0f);
+}
+
+bool DynamicResolution::IsEnabled() const
+{
+    return mEnabled;
+}
+
+GLsizei DynamicResolution::GetWidth() const
+{
+    if (mScale >= 1.0f)
+    {
+        return mMaxWidth;
+    }
+    return std::max((GLsizei) std::round(mMaxWidth / 2 * mScale), 1) * 2;
+}
+
+GLsizei DynamicResolution::GetHeight() const
+{
+    if (mScale >= 1.0f)
+    {
+        return mMaxHeight;
+    }
+    return std::max((GLsizei) std::round(mMaxHeight * mScale), 1);
+}
+
+glm::vec2 DynamicResolution::GetTextureScale() const
+{
+    return glm::vec2((float) GetWidth() / mMaxWidth, (float) GetHeight() / mMaxHeight);
+}
+
+DynamicResolutionStats DynamicResolution::GetStats() const
+{
+    DynamicResolutionStats stats;
+    stats.mScale = mScale;
+    stats.mAverageGPUTime = mAverageTime;
+    stats.mTargetGPUTime = mTargetTime;
+    stats.mDecreases = mDecreases;
+    stats.mIncreases = mIncreases;
+    return stats;
+}
+
+void DynamicResolution::SetScale(float scale)
+{
+    scale = std::min(std::max(scale, mMinScale), 1.0f);
+    if (scale == mScale)
+    {
+        return;
+    }
+
+    mScale = scale;
+    mAverageTime = 0.0;
+    mSettleSamples = kSettleSamples;
+    mSamplesUnderTarget = 0;
+}
@@ -0,0 +1,81 @@
+#ifndef DYNAMICRESOLUTION_H
+#define DYNAMICRESOLUTION_H
+
+#include <GLplus.hpp>
+
+#include <glm/glm.hpp>
+
+#include <mutex>
+#include <vector>
+
+// What the resolution controller is doing.
+struct DynamicResolutionStats
+{
+    // of each side of the render target
+    float mScale = 1.0f;
+    // the running average the controller goes by, in seconds. 0 until it has settled after a change.
+    double mAverageGPUTime = 0.0;
+    double mTargetGPUTime = 0.0;
+    unsigned int mDecreases = 0;
+    unsigned int mIncreases = 0;
+};
+
+// Renders the scene into a smaller part of the render target when the GPU can't keep up,
+// so frames get blurrier instead of being dropped.
+//
+// The controller goes by the GPU time of whole frames, which arrives a few frames late.
+// It lowers the resolution as soon as the average gets near the frame period, or right away when a frame overruns it.
+// It only raises the resolution again after the average has stayed well under the period for a while,
+// so the resolution doesn't go back and forth under a steady load.
+// After every change it waits for frames drawn at the new resolution before judging again.
+//
+// ReportGPUTime() can be called from any thread, everything else from the thread that records frames.
+class DynamicResolution
+{
+    GLsizei mMaxWidth;
+    GLsizei mMaxHeight;
+    double mTargetTime;
+    float mMinScale;
+
+    bool mEnabled;
+    float mScale;
+    double mAverageTime;
+    // samples still to ignore, since they were drawn before the last change
+    int mSettleSamples;
+    int mSamplesUnderTarget;
+    unsigned int mDecreases;
+    unsigned int mIncreases;
+
+    std::mutex mMutex;
+    std::vector<double> mNewTimes;
+
+public:
+    // framePeriod is the time the GPU has for each frame, in seconds
+    DynamicResolution(GLsizei maxWidth, GLsizei maxHeight, double framePeriod, float minScale = 0.5f);
+    DynamicResolution(const DynamicResolution&) = delete;
+    DynamicResolution& operator=(const DynamicResolution&) = delete;
+
+    // the GPU time of a finished frame, in seconds
+    void ReportGPUTime(double seconds);
+
+    // Adjusts the resolution for the next frame, going by the times reported since the last update.
+    void Update();
+
+    // While disabled frames are drawn at the full size.
+    void SetEnabled(bool enabled);
+    bool IsEnabled() const;
+
+    // The size to render at, from the corner of the render target. The width is even, so the eyes get the same halves.
+    GLsizei GetWidth() const;
+    GLsizei GetHeight() const;
+
+    // the part of the render target's texture coordinates that GetWidth() by GetHeight() covers
+    glm::vec2 GetTextureScale() const;
+
+    DynamicResolutionStats GetStats() const;
+
+private:
+    void SetScale(float scale);
+};
+
+#endif // DYNAMICRESOLUTION_H
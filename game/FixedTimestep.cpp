@@ -0,0 +1,49 @@
+#include "FixedTimestep.hpp"
+
+FixedTimestep::FixedTimestep(double ticksPerSecond, int maxTicksPerFrame)
+    : mTickLength(1.0 / ticksPerSecond)
+    , mMaxTicksPerFrame(maxTicksPerFrame)
+    , mLastTime(SDL_GetPerformanceCounter())
+    , mAccumulator(0.0)
+    , mDroppedTime(0.0)
+    , mTickCount(0)
+{ }
+
+int FixedTimestep::Advance()
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+    mAccumulator += (double) (now - mLastTime) / SDL_GetPerformanceFrequency();
+    mLastTime = now;
+
+    int ticks = (int) (mAccumulator / mTickLength);
+    mAccumulator -= ticks * mTickLength;
+
+    if (ticks > mMaxTicksPerFrame)
+    {
+        mDroppedTime += (ticks - mMaxTicksPerFrame) * mTickLength;
+        ticks = mMaxTicksPerFrame;
+    }
+
+    mTickCount += ticks;
+    return ticks;
+}
+
+double FixedTimestep::GetTickLength() const
+{
+    return mTickLength;
+}
+
+float FixedTimestep::GetInterpolation() const
+{
+    return (float) (mAccumulator / mTickLength);
+}
+
+unsigned long long FixedTimestep::GetTickCount() const
+{
+    return mTickCount;
+}
+
+double FixedTimestep::GetDroppedTime() const
+{
+    return mDroppedTime;
+}
@@ -0,0 +1,40 @@
+#ifndef FIXEDTIMESTEP_H
+#define FIXEDTIMESTEP_H
+
+#include <SDL.h>
+
+// Steps a simulation at a fixed rate, no matter how often frames are drawn.
+//
+// Each frame asks Advance() how many ticks are due, runs them,
+// then draws the state GetInterpolation() of the way from the previous tick to the latest one.
+class FixedTimestep
+{
+    double mTickLength;
+    int mMaxTicksPerFrame;
+
+    Uint64 mLastTime;
+    double mAccumulator;
+    double mDroppedTime;
+    unsigned long long mTickCount;
+
+public:
+    // maxTicksPerFrame bounds the catch-up after a slow frame.
+    explicit FixedTimestep(double ticksPerSecond = 120.0, int maxTicksPerFrame = 8);
+
+    // samples the clock once and returns how many ticks are due since the last call.
+    // Time beyond maxTicksPerFrame ticks is dropped, so the simulation slows down instead of falling further behind.
+    int Advance();
+
+    // seconds per tick
+    double GetTickLength() const;
+
+    // how far the frame's timestamp is past the latest tick, as a fraction of a tick in [0,1)
+    float GetInterpolation() const;
+
+    unsigned long long GetTickCount() const;
+
+    // seconds of real time that were dropped to keep up
+    double GetDroppedTime() const;
+};
+
+#endif // FIXEDTIMESTEP_H
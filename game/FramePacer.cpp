@@ -0,0 +1,316 @@
+#include "FramePacer.hpp"
+
+#include <Profiler.hpp>
+
+#include <algorithm>
+#include <string>
+
+namespace
+{
+
+// frames that can be in flight on the GPU before we wait for their timings
+const size_t kNumGPUQueries = 4;
+
+// CPU and GPU timings kept to predict the next frame's work, about half a second's worth
+const size_t kWorkHistory = 60;
+
+} // end anonymous namespace
+
+FrameTimeHistogram::FrameTimeHistogram(double bucketWidth, int numBuckets)
+    : mBucketWidth(bucketWidth)
+    , mBuckets(numBuckets)
+{
+    Clear();
+}
+
+void FrameTimeHistogram::Record(double seconds)
+{
+    size_t bucket = std::min((size_t) std::max(seconds / mBucketWidth, 0.0), mBuckets.size() - 1);
+    mBuckets[bucket]++;
+    mCount++;
+    mSum += seconds;
+    mMax = std::max(mMax, seconds);
+}
+
+void FrameTimeHistogram::Clear()
+{
+    std::fill(mBuckets.begin(), mBuckets.end(), 0);
+    mCount = 0;
+    mSum = 0.0;
+    mMax = 0.0;
+}
+
+unsigned int FrameTimeHistogram::GetCount() const
+{
+    return mCount;
+}
+
+double FrameTimeHistogram::GetMean() const
+{
+    return mCount ? mSum / mCount : 0.0;
+}
+
+double FrameTimeHistogram::GetMax() const
+{
+    return mMax;
+}
+
+double FrameTimeHistogram::GetPercentile(double fraction) const
+{
+    unsigned int wanted = (unsigned int) (fraction * mCount);
+    unsigned int seen = 0;
+    for (size_t i = 0; i < mBuckets.size(); i++)
+    {
+        seen += mBuckets[i];
+        if (seen > wanted || seen == mCount)
+        {
+            return std::min((i + 1) * mBucketWidth, mMax);
+        }
+    }
+    return mMax;
+}
+
+void FrameTimeHistogram::Print(FILE* file, const char* name) const
+{
+    fprintf(file, "%s: %u frames, mean %.2f ms, p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+            name, mCount,
+            GetMean() * 1000.0,
+            GetPercentile(0.5) * 1000.0,
+            GetPercentile(0.9) * 1000.0,
+            GetPercentile(0.99) * 1000.0,
+            mMax * 1000.0);
+
+    if (mCount == 0)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < mBuckets.size(); i++)
+    {
+        double fraction = (double) mBuckets[i] / mCount;
+        if (fraction < 0.01)
+        {
+            continue;
+        }
+
+        bool last = i + 1 == mBuckets.size();
+        fprintf(file, "  %6.2f ms%s |%-50s| %5.1f%%\n",
+                i * mBucketWidth * 1000.0, last ? "+" : " ",
+                std::string((size_t) (fraction * 50.0 + 0.5), '#').c_str(),
+                fraction * 100.0);
+    }
+}
+
+FramePacer::FramePacer(SDL2plus::Window& window, bool vsync)
+    : mWindow(window)
+    , mVSync(vsync && window.SetGLSwapInterval(1))
+    , mLateStart(false)
+    , mSpinThreshold(0.002)
+    , mLateStartMargin(0.001)
+    , mNextGPUQuery(0)
+{
+    if (!vsync)
+    {
+        window.SetGLSwapInterval(0);
+    }
+
+    int refreshRate = window.GetRefreshRate();
+    mPeriod = 1.0 / (refreshRate > 0 ? refreshRate : 60);
+
+    if (GLplus::Query::HasTimerQuery())
+    {
+        for (size_t i = 0; i < kNumGPUQueries; i++)
+        {
+            mGPUQueries.emplace_back(new GLplus::Query(GL_TIME_ELAPSED));
+        }
+    }
+
+    mFrameStart = SDL_GetPerformanceCounter();
+    mLastSwap = mFrameStart;
+    mDeadline = mFrameStart;
+}
+
+void FramePacer::BeginFrame()
+{
+    Uint64 start = mLateStart
+            ? mDeadline - std::min(ToTicks(PredictWork() + mLateStartMargin), ToTicks(mPeriod))
+            : mDeadline - ToTicks(mPeriod);
+
+    {
+        PROFILE_ZONE("pace frame");
+        WaitUntil(start);
+    }
+
+    ReadBackGPUTimes(false);
+
+    mFrameStart = SDL_GetPerformanceCounter();
+
+    if (!mGPUQueries.empty())
+    {
+        GLplus::Query* query = mGPUQueries[mNextGPUQuery].get();
+        mNextGPUQuery = (mNextGPUQuery + 1) % mGPUQueries.size();
+
+        // every query is in flight, so wait for the oldest one to make room
+        if (mPendingGPUQueries.size() == mGPUQueries.size())
+        {
+            ReadBackGPUTimes(true);
+        }
+
+        query->Begin();
+        mPendingGPUQueries.push_back(query);
+    }
+}
+
+void FramePacer::EndFrame()
+{
+    if (!mPendingGPUQueries.empty())
+    {
+        mPendingGPUQueries.back()->End();
+    }
+
+    Uint64 renderEnd = SDL_GetPerformanceCounter();
+    double cpuTime = ToSeconds(renderEnd - mFrameStart);
+    mCPUTimes.Record(cpuTime);
+    RecordWork(cpuTime);
+
+    {
+        PROFILE_ZONE("swap");
+        mWindow.GLSwapWindow();
+    }
+
+    Uint64 swap = SDL_GetPerformanceCounter();
+    mTotalTimes.Record(ToSeconds(swap - mLastSwap));
+    mLastSwap = swap;
+
+    if (mVSync)
+    {
+        // the swap returned at the vertical blank, the next one is a period away
+        mDeadline = swap + ToTicks(mPeriod);
+    }
+    else
+    {
+        // keep the frames on a steady beat, unless we've fallen behind it
+        mDeadline += ToTicks(mPeriod);
+        if (mDeadline < swap)
+        {
+            mDeadline = swap + ToTicks(mPeriod);
+        }
+    }
+}
+
+void FramePacer::SetLateStart(bool lateStart)
+{
+    mLateStart = lateStart;
+}
+
+bool FramePacer::IsLateStart() const
+{
+    return mLateStart;
+}
+
+bool FramePacer::IsVSync() const
+{
+    return mVSync;
+}
+
+void FramePacer::SetGPUTimeCallback(std::function<void(double)> callback)
+{
+    mGPUTimeCallback = std::move(callback);
+}
+
+double FramePacer::GetPeriod() const
+{
+    return mPeriod;
+}
+
+void FramePacer::PrintHistograms(FILE* file) const
+{
+    fprintf(file, "Frame pacing: %.2f ms period, vsync %s, late start %s\n",
+            mPeriod * 1000.0, mVSync ? "on" : "off", mLateStart ? "on" : "off");
+    mCPUTimes.Print(file, "cpu");
+    if (!mGPUQueries.empty())
+    {
+        mGPUTimes.Print(file, "gpu");
+    }
+    mTotalTimes.Print(file, "total");
+}
+
+void FramePacer::ClearHistograms()
+{
+    mCPUTimes.Clear();
+    mGPUTimes.Clear();
+    mTotalTimes.Clear();
+}
+
+void FramePacer::WaitUntil(Uint64 target) const
+{
+    Uint64 spinThreshold = ToTicks(mSpinThreshold);
+
+    for (;;)
+    {
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (now >= target)
+        {
+            return;
+        }
+
+        // SDL_Delay can oversleep by a millisecond or more, so only sleep until close to the target
+        Uint64 remaining = target - now;
+        if (remaining > spinThreshold)
+        {
+            SDL_Delay((Uint32) (ToSeconds(remaining - spinThreshold) * 1000.0));
+        }
+    }
+}
+
+void FramePacer::ReadBackGPUTimes(bool wait)
+{
+    while (!mPendingGPUQueries.empty())
+    {
+        GLplus::Query* query = mPendingGPUQueries.front();
+        if (!wait && !query->IsResultAvailable())
+        {
+            return;
+        }
+
+        double gpuTime = query->GetResult() / 1e9;
+        mGPUTimes.Record(gpuTime);
+        RecordWork(gpuTime);
+        if (mGPUTimeCallback)
+        {
+            mGPUTimeCallback(gpuTime);
+        }
+
+        mPendingGPUQueries.pop_front();
+        wait = false;
+    }
+}
+
+void FramePacer::RecordWork(double seconds)
+{
+    mRecentWork.push_back(seconds);
+    if (mRecentWork.size() > kWorkHistory)
+    {
+        mRecentWork.pop_front();
+    }
+}
+
+double FramePacer::PredictWork() const
+{
+    if (mRecentWork.empty())
+    {
+        return mPeriod;
+    }
+
+    return *std::max_element(mRecentWork.begin(), mRecentWork.end());
+}
+
+double FramePacer::ToSeconds(Uint64 ticks) const
+{
+    return (double) ticks / SDL_GetPerformanceFrequency();
+}
+
+Uint64 FramePacer::ToTicks(double seconds) const
+{
+    return (Uint64) (seconds * SDL_GetPerformanceFrequency());
+}
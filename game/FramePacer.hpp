@@ -0,0 +1,115 @@
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+#include <GLplus.hpp>
+#include <SDL2plus.hpp>
+
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Counts frame times in fixed width buckets, so percentiles don't need every sample kept around.
+class FrameTimeHistogram
+{
+    double mBucketWidth;
+    // the last bucket also collects everything slower than it
+    std::vector<unsigned int> mBuckets;
+    unsigned int mCount;
+    double mSum;
+    double mMax;
+
+public:
+    // bucketWidth is in seconds
+    FrameTimeHistogram(double bucketWidth = 0.0005, int numBuckets = 100);
+
+    void Record(double seconds);
+    void Clear();
+
+    unsigned int GetCount() const;
+    double GetMean() const;
+    double GetMax() const;
+
+    // upper edge of the bucket that the given fraction of the samples are at or below
+    double GetPercentile(double fraction) const;
+
+    // a summary line, then a bar for every bucket holding at least 1% of the samples
+    void Print(FILE* file, const char* name) const;
+};
+
+// Decides when each frame starts and swaps it, in place of a fixed sleep.
+//
+// With vsync the swap returns at the vertical blank and paces the frames by itself.
+// Without it frames are spaced one refresh period apart.
+// Late start delays the start of each frame to just before it has to be finished,
+// based on how long recent frames took, which shortens the time between sampling
+// the input and the frame reaching the display.
+// That only helps when the input is sampled after BeginFrame on the same thread.
+class FramePacer
+{
+    SDL2plus::Window& mWindow;
+
+    bool mVSync;
+    bool mLateStart;
+    double mPeriod;
+
+    // how close to the target a wait stops sleeping and starts spinning
+    double mSpinThreshold;
+    // extra time left before the deadline when starting late
+    double mLateStartMargin;
+
+    Uint64 mFrameStart;
+    Uint64 mDeadline;
+    Uint64 mLastSwap;
+
+    // how long recent frames kept the CPU or GPU busy, to predict the next one
+    std::deque<double> mRecentWork;
+
+    // one per frame in flight, read back once the GPU catches up
+    std::vector<std::unique_ptr<GLplus::Query>> mGPUQueries;
+    std::deque<GLplus::Query*> mPendingGPUQueries;
+    size_t mNextGPUQuery;
+
+    std::function<void(double)> mGPUTimeCallback;
+
+    FrameTimeHistogram mCPUTimes;
+    FrameTimeHistogram mGPUTimes;
+    FrameTimeHistogram mTotalTimes;
+
+public:
+    // vsync is only used if the driver supports it
+    explicit FramePacer(SDL2plus::Window& window, bool vsync = true);
+
+    // waits until this frame should start, sleeping then spinning for the last stretch
+    void BeginFrame();
+
+    // swaps the window, and times the frame
+    void EndFrame();
+
+    void SetLateStart(bool lateStart);
+    bool IsLateStart() const;
+
+    bool IsVSync() const;
+
+    // called with each frame's GPU time in seconds as it's read back, a few frames late, on the thread running the pacer
+    void SetGPUTimeCallback(std::function<void(double)> callback);
+
+    // seconds between refreshes of the display
+    double GetPeriod() const;
+
+    void PrintHistograms(FILE* file) const;
+    void ClearHistograms();
+
+private:
+    void WaitUntil(Uint64 target) const;
+    void ReadBackGPUTimes(bool wait);
+    void RecordWork(double seconds);
+    // the longest CPU or GPU time seen recently
+    double PredictWork() const;
+
+    double ToSeconds(Uint64 ticks) const;
+    Uint64 ToTicks(double seconds) const;
+};
+
+#endif // FRAMEPACER_H
@@ -0,0 +1,307 @@
+#include "FrustumCulling.hpp"
+
+#ifdef FRUSTUMCULLING_AVX
+#include <immintrin.h>
+#endif
+
+#ifdef FRUSTUMCULLING_SSE
+#include <xmmintrin.h>
+#endif
+
+// the arrays are padded to a multiple of the widest kernel
+static const size_t kSimdWidth = 8;
+
+// Padding and new objects. Spheres with a hugely negative radius and inside out boxes are behind every plane.
+static const float kEmptyRadius = -1e30f;
+static const float kEmptyMinimum = 1e30f;
+static const float kEmptyMaximum = -1e30f;
+
+Frustum Frustum::FromViewProjection(const glm::mat4& viewProjection)
+{
+    // rows of the matrix. glm is column major.
+    glm::vec4 rows[4];
+    for (int row = 0; row < 4; row++)
+    {
+        rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+    }
+
+    // -w <= x,y,z <= w in clip space
+    Frustum frustum;
+    frustum.mPlanes[LeftPlane] = rows[3] + rows[0];
+    frustum.mPlanes[RightPlane] = rows[3] - rows[0];
+    frustum.mPlanes[BottomPlane] = rows[3] + rows[1];
+    frustum.mPlanes[TopPlane] = rows[3] - rows[1];
+    frustum.mPlanes[NearPlane] = rows[3] + rows[2];
+    frustum.mPlanes[FarPlane] = rows[3] - rows[2];
+
+    for (glm::vec4& plane : frustum.mPlanes)
+    {
+        plane /= glm::length(glm::vec3(plane));
+    }
+
+    return frustum;
+}
+
+Frustum Frustum::StereoUnion(const Frustum& leftEye, const Frustum& rightEye)
+{
+    Frustum frustum = leftEye;
+    frustum.mPlanes[RightPlane] = rightEye.mPlanes[RightPlane];
+    return frustum;
+}
+
+bool Frustum::IntersectsSphere(const glm::vec3& center, float radius) const
+{
+    for (const glm::vec4& plane : mPlanes)
+    {
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Frustum::IntersectsBox(const glm::vec3& minimum, const glm::vec3& maximum) const
+{
+    for (const glm::vec4& plane : mPlanes)
+    {
+        // the corner farthest along the normal
+        glm::vec3 corner(plane.x >= 0.0f ? maximum.x : minimum.x,
+                         plane.y >= 0.0f ? maximum.y : minimum.y,
+                         plane.z >= 0.0f ? maximum.z : minimum.z);
+
+        if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void BoundingVolumes::Resize(size_t count)
+{
+    size_t padded = (count + kSimdWidth - 1) / kSimdWidth * kSimdWidth;
+
+    mCenterX.resize(padded, 0.0f);
+    mCenterY.resize(padded, 0.0f);
+    mCenterZ.resize(padded, 0.0f);
+    mRadius.resize(padded, kEmptyRadius);
+
+    mMinX.resize(padded, kEmptyMinimum);
+    mMinY.resize(padded, kEmptyMinimum);
+    mMinZ.resize(padded, kEmptyMinimum);
+    mMaxX.resize(padded, kEmptyMaximum);
+    mMaxY.resize(padded, kEmptyMaximum);
+    mMaxZ.resize(padded, kEmptyMaximum);
+
+    // the padding may have been objects before a shrink
+    for (size_t i = count; i < padded; i++)
+    {
+        SetSphere(i, glm::vec3(0.0f), kEmptyRadius);
+        SetBox(i, glm::vec3(kEmptyMinimum), glm::vec3(kEmptyMaximum));
+    }
+
+    mCount = count;
+}
+
+size_t BoundingVolumes::GetCount() const
+{
+    return mCount;
+}
+
+void BoundingVolumes::SetSphere(size_t index, const glm::vec3& center, float radius)
+{
+    mCenterX[index] = center.x;
+    mCenterY[index] = center.y;
+    mCenterZ[index] = center.z;
+    mRadius[index] = radius;
+}
+
+void BoundingVolumes::SetBox(size_t index, const glm::vec3& minimum, const glm::vec3& maximum)
+{
+    mMinX[index] = minimum.x;
+    mMinY[index] = minimum.y;
+    mMinZ[index] = minimum.z;
+    mMaxX[index] = maximum.x;
+    mMaxY[index] = maximum.y;
+    mMaxZ[index] = maximum.z;
+}
+
+// appends the lanes set in mask, starting at index first
+static uint32_t* AppendVisible(uint32_t* visible, int mask, size_t first)
+{
+    for (uint32_t index = (uint32_t) first; mask; mask >>= 1, index++)
+    {
+        if (mask & 1)
+        {
+            *visible++ = index;
+        }
+    }
+    return visible;
+}
+
+void BoundingVolumes::CullSpheres(const Frustum& frustum, std::vector<uint32_t>& visible, CullingKernel kernel) const
+{
+    visible.resize(mCenterX.size());
+    uint32_t* out = visible.data();
+
+    const glm::vec4* planes = frustum.mPlanes;
+
+#if defined(FRUSTUMCULLING_AVX)
+    if (kernel == CullingKernel::Simd)
+    {
+        for (size_t i = 0; i < mCount; i += 8)
+        {
+            __m256 x = _mm256_loadu_ps(&mCenterX[i]);
+            __m256 y = _mm256_loadu_ps(&mCenterY[i]);
+            __m256 z = _mm256_loadu_ps(&mCenterZ[i]);
+            __m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&mRadius[i]));
+
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (int p = 0; p < Frustum::NumPlanes; p++)
+            {
+                __m256 distance = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(planes[p].x), x),
+                                  _mm256_mul_ps(_mm256_set1_ps(planes[p].y), y)),
+                    _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(planes[p].z), z),
+                                  _mm256_set1_ps(planes[p].w)));
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+            }
+
+            out = AppendVisible(out, _mm256_movemask_ps(inside), i);
+        }
+
+        visible.resize(out - visible.data());
+        return;
+    }
+#elif defined(FRUSTUMCULLING_SSE)
+    if (kernel == CullingKernel::Simd)
+    {
+        for (size_t i = 0; i < mCount; i += 4)
+        {
+            __m128 x = _mm_loadu_ps(&mCenterX[i]);
+            __m128 y = _mm_loadu_ps(&mCenterY[i]);
+            __m128 z = _mm_loadu_ps(&mCenterZ[i]);
+            __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&mRadius[i]));
+
+            __m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+            for (int p = 0; p < Frustum::NumPlanes; p++)
+            {
+                __m128 distance = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].x), x),
+                               _mm_mul_ps(_mm_set1_ps(planes[p].y), y)),
+                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].z), z),
+                               _mm_set1_ps(planes[p].w)));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+            }
+
+            out = AppendVisible(out, _mm_movemask_ps(inside), i);
+        }
+
+        visible.resize(out - visible.data());
+        return;
+    }
+#endif
+
+    for (size_t i = 0; i < mCount; i++)
+    {
+        if (frustum.IntersectsSphere(glm::vec3(mCenterX[i], mCenterY[i], mCenterZ[i]), mRadius[i]))
+        {
+            *out++ = (uint32_t) i;
+        }
+    }
+
+    visible.resize(out - visible.data());
+}
+
+void BoundingVolumes::CullBoxes(const Frustum& frustum, std::vector<uint32_t>& visible, CullingKernel kernel) const
+{
+    visible.resize(mMinX.size());
+    uint32_t* out = visible.data();
+
+    const glm::vec4* planes = frustum.mPlanes;
+
+    // the normals are the same for every box, so each plane's farthest corner always comes from the same arrays
+    const float* cornerX[Frustum::NumPlanes];
+    const float* cornerY[Frustum::NumPlanes];
+    const float* cornerZ[Frustum::NumPlanes];
+    for (int p = 0; p < Frustum::NumPlanes; p++)
+    {
+        cornerX[p] = planes[p].x >= 0.0f ? mMaxX.data() : mMinX.data();
+        cornerY[p] = planes[p].y >= 0.0f ? mMaxY.data() : mMinY.data();
+        cornerZ[p] = planes[p].z >= 0.0f ? mMaxZ.data() : mMinZ.data();
+    }
+
+#if defined(FRUSTUMCULLING_AVX)
+    if (kernel == CullingKernel::Simd)
+    {
+        for (size_t i = 0; i < mCount; i += 8)
+        {
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (int p = 0; p < Frustum::NumPlanes; p++)
+            {
+                __m256 distance = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(planes[p].x), _mm256_loadu_ps(cornerX[p] + i)),
+                                  _mm256_mul_ps(_mm256_set1_ps(planes[p].y), _mm256_loadu_ps(cornerY[p] + i))),
+                    _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(planes[p].z), _mm256_loadu_ps(cornerZ[p] + i)),
+                                  _mm256_set1_ps(planes[p].w)));
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+            }
+
+            out = AppendVisible(out, _mm256_movemask_ps(inside), i);
+        }
+
+        visible.resize(out - visible.data());
+        return;
+    }
+#elif defined(FRUSTUMCULLING_SSE)
+    if (kernel == CullingKernel::Simd)
+    {
+        for (size_t i = 0; i < mCount; i += 4)
+        {
+            __m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+            for (int p = 0; p < Frustum::NumPlanes; p++)
+            {
+                __m128 distance = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].x), _mm_loadu_ps(cornerX[p] + i)),
+                               _mm_mul_ps(_mm_set1_ps(planes[p].y), _mm_loadu_ps(cornerY[p] + i))),
+                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].z), _mm_loadu_ps(cornerZ[p] + i)),
+                               _mm_set1_ps(planes[p].w)));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+            }
+
+            out = AppendVisible(out, _mm_movemask_ps(inside), i);
+        }
+
+        visible.resize(out - visible.data());
+        return;
+    }
+#endif
+
+    for (size_t i = 0; i < mCount; i++)
+    {
+        bool inside = true;
+        for (int p = 0; p < Frustum::NumPlanes && inside; p++)
+        {
+            inside = planes[p].x * cornerX[p][i] + planes[p].y * cornerY[p][i] + planes[p].z * cornerZ[p][i] + planes[p].w >= 0.0f;
+        }
+
+        if (inside)
+        {
+            *out++ = (uint32_t) i;
+        }
+    }
+
+    visible.resize(out - visible.data());
+}
+
+const char* BoundingVolumes::GetSimdKernelName()
+{
+#if defined(FRUSTUMCULLING_AVX)
+    return "AVX, 8 objects at a time";
+#elif defined(FRUSTUMCULLING_SSE)
+    return "SSE, 4 objects at a time";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,91 @@
+#ifndef FRUSTUMCULLING_H
+#define FRUSTUMCULLING_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#if defined(__AVX__)
+#define FRUSTUMCULLING_AVX
+#endif
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRUSTUMCULLING_SSE
+#endif
+
+// Six planes as (normal, distance), facing in.
+// A point p is inside a plane when dot(normal, p) + distance >= 0.
+struct Frustum
+{
+    enum Plane
+    {
+        LeftPlane,
+        RightPlane,
+        BottomPlane,
+        TopPlane,
+        NearPlane,
+        FarPlane,
+        NumPlanes
+    };
+
+    glm::vec4 mPlanes[NumPlanes];
+
+    // the planes of projection * view, in world space, with unit normals
+    static Frustum FromViewProjection(const glm::mat4& viewProjection);
+
+    // One frustum around both eyes, so that objects are culled once for the two of them.
+    // The eyes only differ by a horizontal offset, so they share their top, bottom, near and far planes,
+    // and the left eye's left plane and the right eye's right plane bound them both.
+    static Frustum StereoUnion(const Frustum& leftEye, const Frustum& rightEye);
+
+    bool IntersectsSphere(const glm::vec3& center, float radius) const;
+    bool IntersectsBox(const glm::vec3& minimum, const glm::vec3& maximum) const;
+};
+
+enum class CullingKernel
+{
+    Scalar,
+    // AVX if the compiler targets it, SSE otherwise. Falls back to scalar on other CPUs.
+    Simd
+};
+
+// Bounding spheres and axis aligned boxes of many objects, stored as a struct of arrays
+// so that the culling kernels test 4 or 8 objects at once.
+class BoundingVolumes
+{
+    std::vector<float> mCenterX;
+    std::vector<float> mCenterY;
+    std::vector<float> mCenterZ;
+    std::vector<float> mRadius;
+
+    std::vector<float> mMinX;
+    std::vector<float> mMinY;
+    std::vector<float> mMinZ;
+    std::vector<float> mMaxX;
+    std::vector<float> mMaxY;
+    std::vector<float> mMaxZ;
+
+    size_t mCount = 0;
+
+public:
+    // Objects added by a resize start out empty, and are always culled.
+    // The arrays are padded the same way up to the SIMD width.
+    void Resize(size_t count);
+    size_t GetCount() const;
+
+    void SetSphere(size_t index, const glm::vec3& center, float radius);
+    void SetBox(size_t index, const glm::vec3& minimum, const glm::vec3& maximum);
+
+    // Replaces visible with the indices of the objects that intersect the frustum, in increasing order.
+    // Conservative: objects near the frustum's corners can pass without being in it.
+    void CullSpheres(const Frustum& frustum, std::vector<uint32_t>& visible,
+                     CullingKernel kernel = CullingKernel::Simd) const;
+    void CullBoxes(const Frustum& frustum, std::vector<uint32_t>& visible,
+                   CullingKernel kernel = CullingKernel::Simd) const;
+
+    // the kernel CullingKernel::Simd runs in this build
+    static const char* GetSimdKernelName();
+};
+
+#endif // FRUSTUMCULLING_H
@@ -0,0 +1,390 @@
+#include "GPUProfiler.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+
+// the track GPU scopes go on in a Chrome trace
+const int kGPUTraceTrack = 1000;
+
+// where the bars go in each eye's half of the viewport, in normalized device coordinates
+const float kOverlayLeft = 0.15f;
+const float kOverlayWidth = 0.7f;
+const float kOverlayTop = 0.45f;
+const float kOverlayRowHeight = 0.045f;
+// in pixels
+const int kOverlayBarThickness = 5;
+
+// bars past the budget are cut off here, as a multiple of it
+const double kOverlayMaxOverBudget = 1.4;
+
+const float kOverlayColors[][4] = {
+    { 1.0f, 1.0f, 1.0f, 1.0f },
+    { 1.0f, 0.6f, 0.1f, 1.0f },
+    { 0.2f, 0.8f, 1.0f, 1.0f },
+    { 0.4f, 1.0f, 0.3f, 1.0f },
+    { 1.0f, 0.3f, 0.8f, 1.0f },
+    { 1.0f, 1.0f, 0.2f, 1.0f }
+};
+const float kOverlayBudgetColor[] = { 1.0f, 0.0f, 0.0f, 1.0f };
+
+} // end anonymous namespace
+
+GPUProfiler::GPUProfiler(int framesInFlight, int historyLength)
+    : mSupported(GLplus::Query::HasTimerQuery())
+    , mHistoryLength(std::max(historyLength, 1))
+    , mFrames(std::max(framesInFlight, 1))
+    , mNextFrame(0)
+    , mRecording(false)
+    , mFrameNumber(0)
+    , mSkippedFrames(0)
+    , mCSVFile(nullptr)
+    , mTraceClockOffset(0.0)
+{
+}
+
+GPUProfiler::~GPUProfiler()
+{
+    StopCapture();
+}
+
+bool GPUProfiler::IsSupported() const
+{
+    return mSupported;
+}
+
+void GPUProfiler::BeginFrame()
+{
+    if (!mSupported)
+    {
+        return;
+    }
+
+    ReadBack();
+
+    Frame& frame = mFrames[mNextFrame];
+    mRecording = !frame.mPending;
+    if (!mRecording)
+    {
+        mSkippedFrames++;
+        return;
+    }
+
+    frame.mNumber = mFrameNumber++;
+    frame.mUsedQueries = 0;
+    frame.mScopes.clear();
+
+    BeginScope("frame");
+}
+
+void GPUProfiler::EndFrame()
+{
+    if (!mRecording)
+    {
+        return;
+    }
+
+    // the frame's own scope is the only one left
+    if (mOpenScopes.size() > 1)
+    {
+        throw std::logic_error(std::string("GPU scope ") + mFrames[mNextFrame].mScopes[mOpenScopes.back()].mName + " wasn't ended.");
+    }
+    EndScope();
+
+    mFrames[mNextFrame].mPending = true;
+    mNextFrame = (mNextFrame + 1) % mFrames.size();
+    mRecording = false;
+}
+
+void GPUProfiler::BeginScope(const char* name)
+{
+    if (!mRecording)
+    {
+        return;
+    }
+
+    Frame& frame = mFrames[mNextFrame];
+
+    Scope scope;
+    scope.mName = name;
+    scope.mDepth = (int) mOpenScopes.size();
+    scope.mEndQuery = 0;
+    RecordTimestamp(frame, scope.mBeginQuery).Record();
+
+    mOpenScopes.push_back(frame.mScopes.size());
+    frame.mScopes.push_back(scope);
+}
+
+void GPUProfiler::EndScope()
+{
+    if (!mRecording)
+    {
+        return;
+    }
+
+    if (mOpenScopes.empty())
+    {
+        throw std::logic_error("Ending a GPU scope that wasn't begun.");
+    }
+
+    Frame& frame = mFrames[mNextFrame];
+    Scope& scope = frame.mScopes[mOpenScopes.back()];
+    RecordTimestamp(frame, scope.mEndQuery).Record();
+    mOpenScopes.pop_back();
+}
+
+const std::vector<GPUScopeStats>& GPUProfiler::GetStats() const
+{
+    return mStats;
+}
+
+unsigned int GPUProfiler::GetSkippedFrames() const
+{
+    return mSkippedFrames;
+}
+
+void GPUProfiler::Print(FILE* file) const
+{
+    if (!mSupported)
+    {
+        fprintf(file, "GPU profile: timer queries aren't supported\n");
+        return;
+    }
+
+    fprintf(file, "GPU profile over the last %d frames, %u frames skipped waiting on the GPU:\n",
+            (int) mHistoryLength, mSkippedFrames);
+    for (const GPUScopeStats& stats : mStats)
+    {
+        fprintf(file, "  %*s%-*s last %6.3f ms, min %6.3f, avg %6.3f, max %6.3f\n",
+                stats.mDepth * 2, "", 20 - stats.mDepth * 2, stats.mName.c_str(),
+                stats.mLast, stats.mMin, stats.mAverage, stats.mMax);
+    }
+}
+
+void GPUProfiler::StartCapture(const std::string& filename)
+{
+    StopCapture();
+
+    static const std::string csvExtension = ".csv";
+    if (filename.size() >= csvExtension.size() &&
+        filename.compare(filename.size() - csvExtension.size(), csvExtension.size(), csvExtension) == 0)
+    {
+        mCSVFile = fopen(filename.c_str(), "w");
+        if (!mCSVFile)
+        {
+            throw std::runtime_error("Couldn't open GPU profile file " + filename);
+        }
+        fprintf(mCSVFile, "frame,scope,depth,start_ms,duration_ms\n");
+        return;
+    }
+
+    StartCapture(std::make_shared<Profiler::ChromeTrace>(filename));
+}
+
+void GPUProfiler::StartCapture(const std::shared_ptr<Profiler::ChromeTrace>& trace)
+{
+    StopCapture();
+
+    mTrace = trace;
+    mTrace->NameTrack(kGPUTraceTrack, "GPU");
+
+    // GPU timestamps count from whenever the driver likes, so line them up with the trace's clock here
+    if (mSupported)
+    {
+        GLint64 gpuNow;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        GLplus::CheckGLErrors("glGetInteger64v");
+        mTraceClockOffset = mTrace->Now() - gpuNow / 1000.0;
+    }
+}
+
+void GPUProfiler::StopCapture()
+{
+    if (mCSVFile)
+    {
+        fclose(mCSVFile);
+        mCSVFile = nullptr;
+    }
+    mTrace.reset();
+}
+
+GLplus::TimerQuery& GPUProfiler::RecordTimestamp(Frame& frame, size_t& index)
+{
+    if (frame.mUsedQueries == frame.mQueries.size())
+    {
+        frame.mQueries.emplace_back(new GLplus::TimerQuery());
+    }
+
+    index = frame.mUsedQueries++;
+    return *frame.mQueries[index];
+}
+
+void GPUProfiler::ReadBack()
+{
+    // the GPU finishes frames in order, so stop at the first one it hasn't
+    for (size_t i = 0; i < mFrames.size(); i++)
+    {
+        Frame& frame = mFrames[(mNextFrame + i) % mFrames.size()];
+        if (!frame.mPending)
+        {
+            continue;
+        }
+
+        // the frame's last timestamp is its outermost scope's end
+        if (!frame.mQueries[frame.mScopes.front().mEndQuery]->IsResultAvailable())
+        {
+            break;
+        }
+
+        ReadBack(frame);
+        frame.mPending = false;
+    }
+}
+
+void GPUProfiler::ReadBack(Frame& frame)
+{
+    std::vector<GLuint64> timestamps(frame.mUsedQueries);
+    for (size_t i = 0; i < frame.mUsedQueries; i++)
+    {
+        timestamps[i] = frame.mQueries[i]->GetTimestamp();
+    }
+
+    const GLuint64 frameStart = timestamps[frame.mScopes.front().mBeginQuery];
+    for (const Scope& scope : frame.mScopes)
+    {
+        GLuint64 begin = timestamps[scope.mBeginQuery];
+        GLuint64 end = std::max(timestamps[scope.mEndQuery], begin);
+        double milliseconds = (end - begin) / 1e6;
+
+        // names are usually the same literal, so compare the pointers first
+        auto history = std::find_if(mHistories.begin(), mHistories.end(), [&scope](const History& history)
+        {
+            return history.mName.c_str() == scope.mName || history.mName == scope.mName;
+        });
+        if (history == mHistories.end())
+        {
+            mHistories.push_back(History{ scope.mName, scope.mDepth, std::deque<double>() });
+            history = mHistories.end() - 1;
+        }
+
+        history->mDepth = scope.mDepth;
+        history->mTimes.push_back(milliseconds);
+        if (history->mTimes.size() > mHistoryLength)
+        {
+            history->mTimes.pop_front();
+        }
+
+        if (mCSVFile)
+        {
+            fprintf(mCSVFile, "%llu,%s,%d,%.4f,%.4f\n", (unsigned long long) frame.mNumber, scope.mName, scope.mDepth,
+                    (begin - frameStart) / 1e6, milliseconds);
+        }
+
+        if (mTrace)
+        {
+            mTrace->WriteSpan(kGPUTraceTrack, scope.mName, begin / 1000.0 + mTraceClockOffset, (end - begin) / 1000.0);
+        }
+    }
+
+    mStats.resize(mHistories.size());
+    for (size_t i = 0; i < mHistories.size(); i++)
+    {
+        const History& history = mHistories[i];
+        GPUScopeStats& stats = mStats[i];
+        stats.mName = history.mName;
+        stats.mDepth = history.mDepth;
+        stats.mLast = history.mTimes.back();
+        stats.mMin = *std::min_element(history.mTimes.begin(), history.mTimes.end());
+        stats.mMax = *std::max_element(history.mTimes.begin(), history.mTimes.end());
+
+        double sum = 0.0;
+        for (double time : history.mTimes)
+        {
+            sum += time;
+        }
+        stats.mAverage = sum / history.mTimes.size();
+    }
+}
+
+GPUProfilerOverlay::GPUProfilerOverlay()
+    : mVertexBuffer(std::make_shared<GLplus::Buffer>(GL_ARRAY_BUFFER))
+{
+}
+
+void GPUProfilerOverlay::Render(const GLplus::Program& program, const std::vector<GPUScopeStats>& stats, double budget,
+                                float pixelHeight)
+{
+    if (stats.empty() || budget <= 0.0)
+    {
+        return;
+    }
+
+    mVertices.clear();
+
+    // the same bars over both eyes, each of which is half of the viewport
+    for (float eyeLeft : { -1.0f, 0.0f })
+    {
+        float left = eyeLeft + kOverlayLeft;
+
+        for (size_t row = 0; row < stats.size(); row++)
+        {
+            const GPUScopeStats& scope = stats[row];
+            const float* color = kOverlayColors[row % (sizeof(kOverlayColors) / sizeof(kOverlayColors[0]))];
+            float top = kOverlayTop - row * kOverlayRowHeight;
+
+            auto toX = [left, budget](double milliseconds)
+            {
+                return left + kOverlayWidth * (float) (std::min(milliseconds / budget, kOverlayMaxOverBudget));
+            };
+
+            // deeper scopes are indented, so nesting shows
+            float start = left + scope.mDepth * 0.01f;
+            for (int line = 0; line < kOverlayBarThickness; line++)
+            {
+                float y = top - line * pixelHeight;
+                AddLine(start, y, std::max(toX(scope.mAverage), start), y, color);
+            }
+
+            float rangeY = top + 2.0f * pixelHeight;
+            AddLine(toX(scope.mMin), rangeY, std::max(toX(scope.mMax), toX(scope.mMin) + pixelHeight), rangeY, color);
+
+            float budgetX = toX(budget);
+            AddLine(budgetX, top + 3.0f * pixelHeight, budgetX, top - (kOverlayBarThickness + 1) * pixelHeight, kOverlayBudgetColor);
+        }
+    }
+
+    mVertexBuffer->Upload(mVertices.size() * sizeof(float), mVertices.data(), GL_STREAM_DRAW);
+
+    const GLplus::VertexArray& vertexArray = mVertexArrays.GetOrCreate(program,
+        [this, &program](GLplus::VertexArray& vertexArray)
+    {
+        GLint positionLoc;
+        if (program.TryGetAttributeLocation("position", positionLoc))
+        {
+            vertexArray.SetAttribute(positionLoc, mVertexBuffer,
+                2, GL_FLOAT, GL_FALSE, sizeof(float) * 6, 0);
+        }
+
+        GLint colorLoc;
+        if (program.TryGetAttributeLocation("color", colorLoc))
+        {
+            vertexArray.SetAttribute(colorLoc, mVertexBuffer,
+                4, GL_FLOAT, GL_FALSE, sizeof(float) * 6, sizeof(float) * 2);
+        }
+    });
+
+    GLplus::ScopedVertexArrayBind vertexArrayBind(vertexArray);
+    GLplus::ScopedProgramBind programBind(program);
+
+    GLplus::DrawArrays(GL_LINES, 0, (GLsizei) (mVertices.size() / 6));
+}
+
+void GPUProfilerOverlay::AddLine(float x0, float y0, float x1, float y1, const float* color)
+{
+    mVertices.insert(mVertices.end(), {
+        x0, y0,     color[0], color[1], color[2], color[3],
+        x1, y1,     color[0], color[1], color[2], color[3]
+    });
+}
@@ -0,0 +1,138 @@
+#ifndef GPUPROFILER_H
+#define GPUPROFILER_H
+
+#include <ChromeTrace.hpp>
+#include <GLplus.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+// How long a scope took on the GPU over the last frames that timed it, in milliseconds.
+struct GPUScopeStats
+{
+    std::string mName;
+    // how many scopes it's inside, 0 for the whole frame
+    int mDepth = 0;
+    double mLast = 0.0;
+    double mMin = 0.0;
+    double mAverage = 0.0;
+    double mMax = 0.0;
+};
+
+// Times named scopes of each frame on the GPU.
+//
+// Scopes are timestamp queries at their start and end, so they can nest, and they don't get in the way
+// of FramePacer's GL_TIME_ELAPSED query around the whole frame. Frames are read back a few frames later,
+// once the GPU is done with them. If it falls further behind than that, frames go untimed rather than wait on it.
+// The whole frame is the outermost scope.
+//
+// Everything here runs on the GL thread.
+class GPUProfiler
+{
+    struct Scope
+    {
+        const char* mName;
+        int mDepth;
+        size_t mBeginQuery;
+        size_t mEndQuery;
+    };
+
+    struct Frame
+    {
+        uint64_t mNumber = 0;
+        bool mPending = false;
+        std::vector<std::unique_ptr<GLplus::TimerQuery>> mQueries;
+        size_t mUsedQueries = 0;
+        std::vector<Scope> mScopes;
+    };
+
+    struct History
+    {
+        std::string mName;
+        int mDepth;
+        std::deque<double> mTimes;
+    };
+
+    bool mSupported;
+    size_t mHistoryLength;
+
+    // one per frame in flight. mNextFrame is the one recorded next, and the oldest of the ones pending.
+    std::vector<Frame> mFrames;
+    size_t mNextFrame;
+    bool mRecording;
+    std::vector<size_t> mOpenScopes;
+    uint64_t mFrameNumber;
+    unsigned int mSkippedFrames;
+
+    // by name, in the order they were first seen
+    std::vector<History> mHistories;
+    std::vector<GPUScopeStats> mStats;
+
+    // captures every frame's scopes as they're read back
+    FILE* mCSVFile;
+    std::shared_ptr<Profiler::ChromeTrace> mTrace;
+    // from GPU timestamps in microseconds to the trace's time
+    double mTraceClockOffset;
+
+public:
+    // historyLength is how many frames the min, average and max are over
+    explicit GPUProfiler(int framesInFlight = 4, int historyLength = 120);
+    GPUProfiler(const GPUProfiler&) = delete;
+    GPUProfiler& operator=(const GPUProfiler&) = delete;
+    ~GPUProfiler();
+
+    // needs GL 3.3 or ARB_timer_query, otherwise nothing is timed
+    bool IsSupported() const;
+
+    // reads back the frames the GPU has finished, then starts timing this one
+    void BeginFrame();
+    void EndFrame();
+
+    // the name has to last, like a string literal
+    void BeginScope(const char* name);
+    void EndScope();
+
+    const std::vector<GPUScopeStats>& GetStats() const;
+
+    // frames that weren't timed because every query was still in flight
+    unsigned int GetSkippedFrames() const;
+
+    void Print(FILE* file) const;
+
+    // Writes every timed scope from here on to the file, as CSV if its name ends in .csv,
+    // otherwise as a Chrome trace. Throws if the file can't be opened.
+    void StartCapture(const std::string& filename);
+    // writes to a trace that's shared with others, like the CPU zones
+    void StartCapture(const std::shared_ptr<Profiler::ChromeTrace>& trace);
+    void StopCapture();
+
+private:
+    GLplus::TimerQuery& RecordTimestamp(Frame& frame, size_t& index);
+    void ReadBack();
+    void ReadBack(Frame& frame);
+};
+
+// Draws a GPUProfiler's scopes as bars over each eye, with the overlaydebug shader.
+// A scope's bar is its average, with a thin line over it from its min to its max,
+// and the bars are scaled so that the tick at the end of each row is the frame's budget.
+class GPUProfilerOverlay
+{
+    std::shared_ptr<GLplus::Buffer> mVertexBuffer;
+    GLplus::VertexArrayCache mVertexArrays;
+    std::vector<float> mVertices;
+
+public:
+    GPUProfilerOverlay();
+
+    // budget is in milliseconds, and pixelHeight is the height of a pixel of the viewport in normalized device coordinates
+    void Render(const GLplus::Program& program, const std::vector<GPUScopeStats>& stats, double budget, float pixelHeight);
+
+private:
+    void AddLine(float x0, float y0, float x1, float y1, const float* color);
+};
+
+#endif // GPUPROFILER_H
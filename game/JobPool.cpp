@@ -0,0 +1,144 @@
+#include "JobPool.hpp"
+
+#include <Profiler.hpp>
+
+#include <algorithm>
+
+namespace
+{
+
+// which pool and worker the current thread belongs to, if any
+thread_local const JobPool* tCurrentPool = nullptr;
+thread_local int tCurrentWorker = -1;
+
+} // end anonymous namespace
+
+JobPool::JobPool(int numThreads)
+    : mQueuedJobs(0)
+    , mStopping(false)
+    , mNextWorker(0)
+    , mSteals(0)
+{
+    if (numThreads <= 0)
+    {
+        numThreads = std::max((int) std::thread::hardware_concurrency(), 1);
+    }
+
+    for (int i = 0; i < numThreads; i++)
+    {
+        mWorkers.emplace_back(new Worker());
+    }
+
+    for (int i = 0; i < numThreads; i++)
+    {
+        mThreads.emplace_back(&JobPool::Run, this, i);
+    }
+}
+
+JobPool::~JobPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mSleepMutex);
+        mStopping = true;
+    }
+    mWake.notify_all();
+
+    for (std::thread& thread : mThreads)
+    {
+        thread.join();
+    }
+}
+
+void JobPool::Submit(std::function<void()> job)
+{
+    int worker = GetCurrentWorker();
+    if (worker < 0)
+    {
+        worker = (int) (mNextWorker++ % mWorkers.size());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mWorkers[worker]->mMutex);
+        mWorkers[worker]->mJobs.push_back(std::move(job));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mSleepMutex);
+        mQueuedJobs++;
+    }
+    mWake.notify_one();
+}
+
+int JobPool::GetThreadCount() const
+{
+    return (int) mThreads.size();
+}
+
+unsigned int JobPool::GetStealCount() const
+{
+    return mSteals;
+}
+
+int JobPool::GetCurrentWorker() const
+{
+    return tCurrentPool == this ? tCurrentWorker : -1;
+}
+
+void JobPool::Run(int worker)
+{
+    tCurrentPool = this;
+    tCurrentWorker = worker;
+    PROFILE_THREAD("job worker");
+
+    std::function<void()> job;
+    for (;;)
+    {
+        // Taking one off the count reserves a job. Jobs are queued before they're counted,
+        // and only reserved ones are taken, so there's always one to find.
+        {
+            std::unique_lock<std::mutex> lock(mSleepMutex);
+            mWake.wait(lock, [this]{ return mQueuedJobs > 0 || mStopping; });
+            if (mQueuedJobs == 0)
+            {
+                return;
+            }
+            mQueuedJobs--;
+        }
+
+        while (!TryPop(worker, job))
+        {
+        }
+
+        job();
+        job = nullptr;
+    }
+}
+
+bool JobPool::TryPop(int worker, std::function<void()>& job)
+{
+    {
+        Worker& own = *mWorkers[worker];
+        std::lock_guard<std::mutex> lock(own.mMutex);
+        if (!own.mJobs.empty())
+        {
+            job = std::move(own.mJobs.back());
+            own.mJobs.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < mWorkers.size(); i++)
+    {
+        Worker& victim = *mWorkers[(worker + i) % mWorkers.size()];
+        std::lock_guard<std::mutex> lock(victim.mMutex);
+        if (!victim.mJobs.empty())
+        {
+            job = std::move(victim.mJobs.front());
+            victim.mJobs.pop_front();
+            mSteals++;
+            return true;
+        }
+    }
+
+    return false;
+}
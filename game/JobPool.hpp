@@ -0,0 +1,65 @@
+#ifndef JOBPOOL_H
+#define JOBPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs jobs on a fixed set of worker threads.
+//
+// Each worker has its own queue. Jobs submitted from a worker go on that worker's queue,
+// and it runs its own newest job first, while its related data is still in the cache.
+// Workers with nothing left take the oldest job from another worker's queue,
+// so one that submits a lot of jobs doesn't end up doing them all by itself.
+// Jobs submitted from other threads are spread over the queues in turn.
+class JobPool
+{
+    struct Worker
+    {
+        std::mutex mMutex;
+        std::deque<std::function<void()>> mJobs;
+    };
+
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    std::vector<std::thread> mThreads;
+
+    // jobs queued and not yet reserved by a worker, guarded by mSleepMutex so workers can't miss a wakeup
+    std::mutex mSleepMutex;
+    std::condition_variable mWake;
+    size_t mQueuedJobs;
+    bool mStopping;
+
+    std::atomic<unsigned int> mNextWorker;
+    std::atomic<unsigned int> mSteals;
+
+public:
+    // numThreads 0 uses one thread per core
+    explicit JobPool(int numThreads = 0);
+    JobPool(const JobPool&) = delete;
+    JobPool& operator=(const JobPool&) = delete;
+
+    // finishes the jobs already submitted
+    ~JobPool();
+
+    // Jobs must not throw. Can be called from any thread, including from inside a job.
+    void Submit(std::function<void()> job);
+
+    int GetThreadCount() const;
+
+    // jobs that ran on a different worker than they were queued on
+    unsigned int GetStealCount() const;
+
+    // the worker running the calling thread, or -1 if it isn't one of this pool's
+    int GetCurrentWorker() const;
+
+private:
+    void Run(int worker);
+    bool TryPop(int worker, std::function<void()>& job);
+};
+
+#endif // JOBPOOL_H
@@ -0,0 +1,108 @@
+#include "LevelOfDetail.hpp"
+
+#include <algorithm>
+#include <queue>
+
+LodSelector::LodSelector(size_t numObjects, float maxPixelError, float hysteresis, size_t triangleBudget)
+    : mMaxPixelError(maxPixelError)
+    , mHysteresis(hysteresis)
+    , mTriangleBudget(triangleBudget)
+    , mErrorLevels(numObjects, 0)
+    , mLevels(numObjects, 0)
+{
+}
+
+void LodSelector::SetTriangleBudget(size_t triangles)
+{
+    mTriangleBudget = triangles;
+}
+
+size_t LodSelector::GetTriangleBudget() const
+{
+    return mTriangleBudget;
+}
+
+void LodSelector::Select(const std::vector<LodCandidate>& candidates)
+{
+    mStats.mTriangles = 0;
+    mStats.mBudgetDrops = 0;
+
+    for (const LodCandidate& candidate : candidates)
+    {
+        const std::vector<GLmesh::MeshLod>& lods = candidate.mMesh->GetLods();
+        int& level = mErrorLevels[candidate.mObject];
+        level = std::min(level, (int) lods.size() - 1);
+
+        while (level > 0 && lods[level].mError * candidate.mPixelsPerUnit > mMaxPixelError)
+        {
+            level--;
+        }
+
+        while (level + 1 < (int) lods.size() &&
+               lods[level + 1].mError * candidate.mPixelsPerUnit < mMaxPixelError * mHysteresis)
+        {
+            level++;
+        }
+
+        mLevels[candidate.mObject] = level;
+        mStats.mTriangles += candidate.mMesh->GetTriangleCount(level);
+    }
+
+    // over budget: drop the level whose extra error shows the least, one at a time
+    typedef std::pair<float, size_t> Drop;
+    std::priority_queue<Drop, std::vector<Drop>, std::greater<Drop>> drops;
+
+    auto pushDrop = [&](size_t candidateIndex)
+    {
+        const LodCandidate& candidate = candidates[candidateIndex];
+        const std::vector<GLmesh::MeshLod>& lods = candidate.mMesh->GetLods();
+        int level = mLevels[candidate.mObject];
+        if (level + 1 < (int) lods.size())
+        {
+            drops.push(Drop(lods[level + 1].mError * candidate.mPixelsPerUnit, candidateIndex));
+        }
+    };
+
+    if (mStats.mTriangles > mTriangleBudget)
+    {
+        for (size_t i = 0; i < candidates.size(); i++)
+        {
+            pushDrop(i);
+        }
+    }
+
+    while (mStats.mTriangles > mTriangleBudget && !drops.empty())
+    {
+        size_t candidateIndex = drops.top().second;
+        drops.pop();
+
+        const LodCandidate& candidate = candidates[candidateIndex];
+        int& level = mLevels[candidate.mObject];
+        mStats.mTriangles -= candidate.mMesh->GetTriangleCount(level) - candidate.mMesh->GetTriangleCount(level + 1);
+        level++;
+        mStats.mBudgetDrops++;
+
+        pushDrop(candidateIndex);
+    }
+
+    mStats.mObjectsPerLevel.clear();
+    for (const LodCandidate& candidate : candidates)
+    {
+        int level = mLevels[candidate.mObject];
+        if ((int) mStats.mObjectsPerLevel.size() <= level)
+        {
+            mStats.mObjectsPerLevel.resize(level + 1, 0);
+        }
+        mStats.mObjectsPerLevel[level]++;
+    }
+}
+
+int LodSelector::GetLevel(uint32_t object) const
+{
+    return mLevels[object];
+}
+
+const LodStats& LodSelector::GetStats() const
+{
+    return mStats;
+}
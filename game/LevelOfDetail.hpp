@@ -0,0 +1,65 @@
+#ifndef LEVELOFDETAIL_H
+#define LEVELOFDETAIL_H
+
+#include <GLmesh.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// One visible object, for LodSelector::Select().
+struct LodCandidate
+{
+    uint32_t mObject;
+    const GLmesh::StaticMesh* mMesh;
+    // how many pixels of the render target one unit of the mesh covers, at the object's distance and scale
+    float mPixelsPerUnit;
+};
+
+// What the last Select() picked.
+struct LodStats
+{
+    // triangles of every candidate at its level, for one eye
+    size_t mTriangles = 0;
+    // objects at each level
+    std::vector<unsigned int> mObjectsPerLevel;
+    // levels dropped further to stay within the budget
+    unsigned int mBudgetDrops = 0;
+};
+
+// Picks a level of detail for every object, each frame.
+//
+// An object gets the simplest level whose error covers less than a pixel or so of the render target.
+// It only moves to a simpler level once that level's error is well under the limit, so objects
+// sitting near the limit don't flip back and forth between two levels.
+// When the chosen levels add up to more than the triangle budget, the objects whose next level
+// is hardest to see are simplified further. Those drops are made again each frame from the levels
+// picked by error alone, so objects get their detail back once the budget allows it.
+class LodSelector
+{
+    float mMaxPixelError;
+    // fraction of mMaxPixelError that a simpler level's error has to stay below to switch to it
+    float mHysteresis;
+    size_t mTriangleBudget;
+
+    // by error alone, which the hysteresis works from
+    std::vector<int> mErrorLevels;
+    // after the budget drops, to be drawn
+    std::vector<int> mLevels;
+    LodStats mStats;
+
+public:
+    explicit LodSelector(size_t numObjects, float maxPixelError = 1.0f, float hysteresis = 0.5f,
+                         size_t triangleBudget = 1000000);
+
+    void SetTriangleBudget(size_t triangles);
+    size_t GetTriangleBudget() const;
+
+    // Levels of objects that aren't candidates stay where they were.
+    void Select(const std::vector<LodCandidate>& candidates);
+
+    int GetLevel(uint32_t object) const;
+
+    const LodStats& GetStats() const;
+};
+
+#endif // LEVELOFDETAIL_H
@@ -0,0 +1,200 @@
+// Reorders meshes the way StaticMesh::LoadShape does, and reports the vertex cache and overdraw before and after.
+// usage: mesh_benchmark [.obj files]
+// Without arguments it runs on cornell_box.obj and a few generated meshes.
+
+#include <GLmesh.hpp>
+
+#include <tiny_obj_loader.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+static const float kPi = 3.14159265f;
+
+struct TestMesh
+{
+    std::string mName;
+    std::vector<float> mPositions;
+    std::vector<unsigned int> mIndices;
+};
+
+// a grid of size x size quads, in rows like a heightmap exporter would write them
+static TestMesh MakeGrid(int size)
+{
+    TestMesh mesh;
+    mesh.mName = "grid " + std::to_string(size) + "x" + std::to_string(size);
+
+    for (int y = 0; y <= size; y++)
+    {
+        for (int x = 0; x <= size; x++)
+        {
+            mesh.mPositions.push_back((float) x / size);
+            mesh.mPositions.push_back(0.1f * std::sin(x * 0.2f) * std::cos(y * 0.2f));
+            mesh.mPositions.push_back((float) y / size);
+        }
+    }
+
+    for (int y = 0; y < size; y++)
+    {
+        for (int x = 0; x < size; x++)
+        {
+            unsigned int corner = y * (size + 1) + x;
+            unsigned int quad[] = { corner, corner + 1, corner + size + 2, corner, corner + size + 2, corner + size + 1 };
+            mesh.mIndices.insert(mesh.mIndices.end(), quad, quad + 6);
+        }
+    }
+
+    return mesh;
+}
+
+static TestMesh MakeSphere(int slices, int stacks)
+{
+    TestMesh mesh;
+    mesh.mName = "sphere " + std::to_string(slices) + "x" + std::to_string(stacks);
+
+    for (int stack = 0; stack <= stacks; stack++)
+    {
+        float phi = kPi * stack / stacks;
+        for (int slice = 0; slice <= slices; slice++)
+        {
+            float theta = 2.0f * kPi * slice / slices;
+            mesh.mPositions.push_back(std::sin(phi) * std::cos(theta));
+            mesh.mPositions.push_back(std::cos(phi));
+            mesh.mPositions.push_back(std::sin(phi) * std::sin(theta));
+        }
+    }
+
+    for (int stack = 0; stack < stacks; stack++)
+    {
+        for (int slice = 0; slice < slices; slice++)
+        {
+            unsigned int corner = stack * (slices + 1) + slice;
+            unsigned int quad[] = { corner, corner + slices + 1, corner + 1, corner + 1, corner + slices + 1, corner + slices + 2 };
+            mesh.mIndices.insert(mesh.mIndices.end(), quad, quad + 6);
+        }
+    }
+
+    return mesh;
+}
+
+// the same triangles in a random order, like a file that went through a tool that doesn't care
+static TestMesh Shuffled(TestMesh mesh)
+{
+    mesh.mName += ", shuffled";
+
+    std::vector<size_t> triangles(mesh.mIndices.size() / 3);
+    for (size_t t = 0; t < triangles.size(); t++)
+    {
+        triangles[t] = t;
+    }
+    std::shuffle(triangles.begin(), triangles.end(), std::mt19937(1234));
+
+    std::vector<unsigned int> indices;
+    for (size_t t : triangles)
+    {
+        indices.insert(indices.end(), &mesh.mIndices[t * 3], &mesh.mIndices[t * 3] + 3);
+    }
+    mesh.mIndices = std::move(indices);
+
+    return mesh;
+}
+
+static double Seconds(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static void Benchmark(const TestMesh& mesh)
+{
+    size_t vertexCount = mesh.mPositions.size() / 3;
+    std::vector<unsigned int> indices = mesh.mIndices;
+    std::vector<float> positions = mesh.mPositions;
+
+    GLmesh::VertexCacheStats before = GLmesh::AnalyzeVertexCache(indices.data(), indices.size(), vertexCount);
+    float overdrawBefore = GLmesh::AnalyzeOverdraw(indices.data(), indices.size(), positions.data(), vertexCount);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<unsigned int> clusters;
+    GLmesh::OptimizeVertexCache(indices.data(), indices.size(), vertexCount, 16, &clusters);
+    double cacheTime = Seconds(start);
+
+    start = std::chrono::high_resolution_clock::now();
+    GLmesh::OptimizeOverdraw(indices.data(), indices.size(), positions.data(), vertexCount, clusters);
+    double overdrawTime = Seconds(start);
+
+    start = std::chrono::high_resolution_clock::now();
+    std::vector<unsigned int> remap = GLmesh::OptimizeVertexFetch(indices.data(), indices.size(), vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        std::copy(&mesh.mPositions[v * 3], &mesh.mPositions[v * 3] + 3, &positions[remap[v] * 3]);
+    }
+    double fetchTime = Seconds(start);
+
+    GLmesh::VertexCacheStats after = GLmesh::AnalyzeVertexCache(indices.data(), indices.size(), vertexCount);
+    float overdrawAfter = GLmesh::AnalyzeOverdraw(indices.data(), indices.size(), positions.data(), vertexCount);
+
+    printf("%s: %d triangles, %d vertices, %d clusters\n",
+           mesh.mName.c_str(), (int) (indices.size() / 3), (int) vertexCount, (int) clusters.size());
+    printf("  ACMR     %6.3f -> %6.3f\n", before.mAcmr, after.mAcmr);
+    printf("  ATVR     %6.3f -> %6.3f\n", before.mAtvr, after.mAtvr);
+    printf("  overdraw %6.3f -> %6.3f\n", overdrawBefore, overdrawAfter);
+    printf("  time: vertex cache %.2f ms, overdraw %.2f ms, vertex fetch %.2f ms\n",
+           cacheTime * 1e3, overdrawTime * 1e3, fetchTime * 1e3);
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<TestMesh> meshes;
+
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++)
+    {
+        files.push_back(argv[i]);
+    }
+    if (files.empty())
+    {
+        files.push_back("cornell_box.obj");
+    }
+
+    for (const std::string& file : files)
+    {
+        std::vector<tinyobj::shape_t> shapes;
+        std::string error = tinyobj::LoadObj(shapes, file.c_str());
+        if (!error.empty() || shapes.empty())
+        {
+            fprintf(stderr, "Couldn't load %s: %s\n", file.c_str(), error.c_str());
+            return 1;
+        }
+
+        for (const tinyobj::shape_t& shape : shapes)
+        {
+            TestMesh mesh;
+            mesh.mName = file + " " + shape.name;
+            mesh.mPositions = shape.mesh.positions;
+            mesh.mIndices = shape.mesh.indices;
+            meshes.push_back(std::move(mesh));
+        }
+    }
+
+    if (argc <= 1)
+    {
+        meshes.push_back(MakeGrid(300));
+        meshes.push_back(Shuffled(MakeGrid(300)));
+        meshes.push_back(MakeSphere(256, 128));
+        meshes.push_back(Shuffled(MakeSphere(256, 128)));
+    }
+
+    for (const TestMesh& mesh : meshes)
+    {
+        Benchmark(mesh);
+    }
+
+    return 0;
+}
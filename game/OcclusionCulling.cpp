@@ -0,0 +1,155 @@
+#include "OcclusionCulling.hpp"
+
+#include <algorithm>
+
+OcclusionCuller::OcclusionCuller(size_t numObjects)
+    : mQueryFrames(numObjects, 0)
+    , mQueryPending(numObjects, false)
+    , mQueriesIssued(0)
+    , mEnabled(true)
+    , mFrame(0)
+    , mValidFrom(numObjects, 0)
+    , mWasCandidate(numObjects, false)
+    , mResults(numObjects, Result{ 0, false })
+    , mLastQueriesIssued(0)
+    , mLastQueriesPending(0)
+{
+    GLenum target = GLplus::Query::HasAnySamplesPassedQuery() ? GL_ANY_SAMPLES_PASSED : GL_SAMPLES_PASSED;
+    for (size_t i = 0; i < numObjects; i++)
+    {
+        mQueries.emplace_back(new GLplus::Query(target));
+    }
+}
+
+size_t OcclusionCuller::GetObjectCount() const
+{
+    return mQueries.size();
+}
+
+void OcclusionCuller::SetEnabled(bool enabled)
+{
+    if (enabled && !mEnabled)
+    {
+        std::fill(mValidFrom.begin(), mValidFrom.end(), mFrame + 1);
+    }
+    mEnabled = enabled;
+}
+
+bool OcclusionCuller::IsEnabled() const
+{
+    return mEnabled;
+}
+
+void OcclusionCuller::Cull(const std::vector<uint32_t>& candidates, std::vector<uint32_t>& visible)
+{
+    mFrame++;
+
+    mFrameStats.mCandidates = (unsigned int) candidates.size();
+    mFrameStats.mOccluded = 0;
+
+    if (!mEnabled)
+    {
+        visible = candidates;
+        return;
+    }
+
+    // what was hidden before the object left the frustum says nothing about it now
+    for (uint32_t object : candidates)
+    {
+        if (!mWasCandidate[object])
+        {
+            mValidFrom[object] = mFrame;
+        }
+    }
+
+    std::fill(mWasCandidate.begin(), mWasCandidate.end(), false);
+    for (uint32_t object : candidates)
+    {
+        mWasCandidate[object] = true;
+    }
+
+    visible.clear();
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (uint32_t object : candidates)
+    {
+        const Result& result = mResults[object];
+        if (result.mOccluded && result.mFrame >= mValidFrom[object])
+        {
+            mFrameStats.mOccluded++;
+        }
+        else
+        {
+            visible.push_back(object);
+        }
+    }
+}
+
+void OcclusionCuller::Invalidate(uint32_t object)
+{
+    mValidFrom[object] = mFrame + 1;
+}
+
+uint64_t OcclusionCuller::GetFrame() const
+{
+    return mFrame;
+}
+
+void OcclusionCuller::ResolveQueries()
+{
+    unsigned int pending = 0;
+
+    for (size_t object = 0; object < mQueries.size(); object++)
+    {
+        if (!mQueryPending[object])
+        {
+            continue;
+        }
+
+        GLuint64 samples;
+        if (!mQueries[object]->TryGetResult(samples))
+        {
+            pending++;
+            continue;
+        }
+
+        mQueryPending[object] = false;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mResults[object] = Result{ mQueryFrames[object], samples == 0 };
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mLastQueriesIssued = mQueriesIssued;
+    mLastQueriesPending = pending;
+    mQueriesIssued = 0;
+}
+
+bool OcclusionCuller::BeginQuery(uint32_t object, uint64_t frame)
+{
+    if (mQueryPending[object])
+    {
+        return false;
+    }
+
+    mQueries[object]->Begin();
+    mQueryFrames[object] = frame;
+    mQueryPending[object] = true;
+    mQueriesIssued++;
+    return true;
+}
+
+void OcclusionCuller::EndQuery(uint32_t object)
+{
+    mQueries[object]->End();
+}
+
+OcclusionStats OcclusionCuller::GetStats() const
+{
+    OcclusionStats stats = mFrameStats;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    stats.mQueriesIssued = mLastQueriesIssued;
+    stats.mQueriesPending = mLastQueriesPending;
+    return stats;
+}
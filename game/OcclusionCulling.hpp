@@ -0,0 +1,95 @@
+#ifndef OCCLUSIONCULLING_H
+#define OCCLUSIONCULLING_H
+
+#include <GLplus.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// What occlusion culling did in the last frame.
+struct OcclusionStats
+{
+    // objects that made it through frustum culling
+    unsigned int mCandidates = 0;
+    // the ones of those that were skipped, because their last query saw nothing of them
+    unsigned int mOccluded = 0;
+    // counted on the GL thread, a frame behind: queries started, and queries the GPU hadn't finished when they were polled
+    unsigned int mQueriesIssued = 0;
+    unsigned int mQueriesPending = 0;
+};
+
+// Skips objects that were hidden behind others, going by occlusion queries from earlier frames.
+//
+// Each frame the caller draws a stand-in for every candidate inside a query, usually its box, after the scene.
+// Those results are polled in later frames and never waited for, so an object that comes out from behind
+// something shows up a frame or two late. Results older than the object's last entry into the frustum are ignored.
+// One query covers every eye, so the eyes share one result.
+//
+// Cull() and the frame counting run on the thread that records frames.
+// The queries run on the GL thread, in ResolveQueries(), BeginQuery() and EndQuery().
+class OcclusionCuller
+{
+    struct Result
+    {
+        // the frame the query was recorded in
+        uint64_t mFrame;
+        bool mOccluded;
+    };
+
+    // GL thread
+    std::vector<std::unique_ptr<GLplus::Query>> mQueries;
+    std::vector<uint64_t> mQueryFrames;
+    std::vector<bool> mQueryPending;
+    unsigned int mQueriesIssued;
+
+    // recording thread
+    bool mEnabled;
+    uint64_t mFrame;
+    // the frame from which each object's results count
+    std::vector<uint64_t> mValidFrom;
+    std::vector<bool> mWasCandidate;
+    OcclusionStats mFrameStats;
+
+    // shared by both
+    mutable std::mutex mMutex;
+    std::vector<Result> mResults;
+    unsigned int mLastQueriesIssued;
+    unsigned int mLastQueriesPending;
+
+public:
+    // Makes a query per object, so it needs the GL context.
+    // Uses GL_ANY_SAMPLES_PASSED where it's supported, which can stop counting at the first sample.
+    explicit OcclusionCuller(size_t numObjects);
+    OcclusionCuller(const OcclusionCuller&) = delete;
+    OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+    size_t GetObjectCount() const;
+
+    // While disabled every candidate is visible. Results from before it was enabled again are ignored.
+    void SetEnabled(bool enabled);
+    bool IsEnabled() const;
+
+    // Starts a new frame, and replaces visible with the candidates that weren't found hidden.
+    // candidates should hold every object that's in the frustum this frame, and each of them should be queried.
+    void Cull(const std::vector<uint32_t>& candidates, std::vector<uint32_t>& visible);
+
+    // Forgets what earlier queries found, so the object is visible until a new query says otherwise.
+    // For objects that can't be tested this frame, like the ones the eye is inside of.
+    void Invalidate(uint32_t object);
+
+    // the frame being recorded, to hand to BeginQuery()
+    uint64_t GetFrame() const;
+
+    // Reads back every query that's done, without waiting on the ones that aren't. Needs the GL context.
+    void ResolveQueries();
+
+    // Starts the object's query, unless its last one is still in flight, in which case nothing needs drawing.
+    bool BeginQuery(uint32_t object, uint64_t frame);
+    void EndQuery(uint32_t object);
+
+    OcclusionStats GetStats() const;
+};
+
+#endif // OCCLUSIONCULLING_H
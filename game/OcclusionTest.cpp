@@ -0,0 +1,192 @@
+// Checks occlusion culling end to end on a real GL context, with a hidden window:
+// a wall, one box behind it and one beside it, drawn and queried the way the game does it, both eyes at once.
+// The box behind the wall has to be skipped by the third frame, and the wall and the other box never can be.
+// usage: occlusion_test [number of frames]
+
+#include "BoundingVolumeHierarchy.hpp"
+#include "OcclusionCulling.hpp"
+#include "RenderCommands.hpp"
+
+#include <SDL2plus.hpp>
+#include <GLplus.hpp>
+#include <GLmesh.hpp>
+#include <tiny_obj_loader.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+enum TestObject
+{
+    Wall,
+    Hidden,
+    Beside,
+    NumTestObjects
+};
+
+static const char* const kObjectNames[NumTestObjects] = { "wall", "box behind the wall", "box beside the wall" };
+
+// the first frame the box behind the wall has to be skipped in: the queries of frame 1 are read back in frame 2
+static const int kFirstOccludedFrame = 3;
+
+// same as the game's, so the proxies aren't hidden by their own objects
+static const float kOcclusionProxyMargin = 0.02f;
+
+static const GLuint kStereoCameraBinding = 0;
+
+// stretches box.obj over the box
+static glm::mat4 GetBoxModel(const BoundingBox& box, const BoundingBox& meshBounds)
+{
+    glm::mat4 model;
+    model = glm::translate(model, box.GetCenter());
+    model = glm::scale(model, (box.mMax - box.mMin) / (meshBounds.mMax - meshBounds.mMin));
+    model = glm::translate(model, -meshBounds.GetCenter());
+    return model;
+}
+
+static int run(int numFrames)
+{
+    SDL2plus::LibSDL sdl(SDL_INIT_VIDEO);
+
+    sdl.SetGLAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    sdl.SetGLAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
+    sdl.SetGLAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+
+    SDL2plus::Window window(256, 128, "Occlusion test", SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+
+    std::vector<tinyobj::shape_t> shapes;
+    std::string error = tinyobj::LoadObj(shapes, "box.obj");
+    if (shapes.empty())
+    {
+        throw std::runtime_error("Couldn't load box.obj: " + error);
+    }
+
+    GLmesh::StaticMesh mesh;
+    mesh.LoadShape(shapes.front());
+    const BoundingBox meshBounds = ShapeBounds(shapes.front());
+
+    // the game's proxy shader, which draws both eyes side by side
+    GLplus::ProgramVariants variants = GLplus::ProgramVariants::FromFiles("object.vs", "object.fs", { "STEREO" });
+    variants.SetSetup([](GLplus::Program& program, GLplus::ProgramVariants::Mask)
+    {
+        program.SetUniformBlockBinding("StereoCamera", kStereoCameraBinding);
+    });
+    const GLplus::Program& program = *variants.Get(variants.GetOption("STEREO"));
+
+    // both eyes at the origin looking down -z, 90 degrees across
+    const float halfIpd = 0.032f;
+    const glm::mat4 projection = glm::frustum(-0.1f, 0.1f, -0.1f, 0.1f, 0.1f, 100.0f);
+    const glm::mat4 cameraMatrices[4] = {
+        glm::translate(glm::mat4(), glm::vec3(halfIpd, 0.0f, 0.0f)),
+        glm::translate(glm::mat4(), glm::vec3(-halfIpd, 0.0f, 0.0f)),
+        projection,
+        projection
+    };
+
+    GLplus::UniformBuffer camera;
+    camera.Upload(sizeof(cameraMatrices), cameraMatrices, GL_STATIC_DRAW);
+    camera.BindBase(kStereoCameraBinding);
+
+    BoundingBox bounds[NumTestObjects];
+    bounds[Wall].mMin = glm::vec3(-2.0f, -2.0f, -5.1f);
+    bounds[Wall].mMax = glm::vec3(2.0f, 2.0f, -4.9f);
+    bounds[Hidden].mMin = glm::vec3(-0.5f, -0.5f, -8.5f);
+    bounds[Hidden].mMax = glm::vec3(0.5f, 0.5f, -7.5f);
+    bounds[Beside].mMin = glm::vec3(3.0f, -0.5f, -5.5f);
+    bounds[Beside].mMax = glm::vec3(4.0f, 0.5f, -4.5f);
+
+    OcclusionProxy proxies[NumTestObjects];
+    std::vector<uint32_t> candidates;
+    for (uint32_t object = 0; object < NumTestObjects; object++)
+    {
+        BoundingBox proxy = bounds[object];
+        proxy.mMin -= kOcclusionProxyMargin;
+        proxy.mMax += kOcclusionProxyMargin;
+        proxies[object] = OcclusionProxy{ object, GetBoxModel(proxy, meshBounds) };
+        candidates.push_back(object);
+    }
+
+    OcclusionCuller culler(NumTestObjects);
+    std::vector<uint32_t> visible;
+    int failures = 0;
+
+    for (int frame = 1; frame <= numFrames; frame++)
+    {
+        culler.Cull(candidates, visible);
+
+        bool skipped[NumTestObjects];
+        for (uint32_t object = 0; object < NumTestObjects; object++)
+        {
+            skipped[object] = std::find(visible.begin(), visible.end(), object) == visible.end();
+        }
+
+        printf("frame %d: %u of %u objects skipped\n", frame, culler.GetStats().mOccluded, (unsigned int) NumTestObjects);
+
+        if (skipped[Wall] || skipped[Beside])
+        {
+            fprintf(stderr, "frame %d: the %s was skipped, but it's in plain sight\n",
+                    frame, skipped[Wall] ? kObjectNames[Wall] : kObjectNames[Beside]);
+            failures++;
+        }
+        if (frame >= kFirstOccludedFrame && !skipped[Hidden])
+        {
+            fprintf(stderr, "frame %d: the %s was drawn, but it's hidden\n", frame, kObjectNames[Hidden]);
+            failures++;
+        }
+
+        glViewport(0, 0, window.GetWidth(), window.GetHeight());
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_CLIP_DISTANCE0);
+        GLplus::CheckGLErrors("glEnable");
+
+        {
+            GLplus::ScopedProgramBind programBind(program);
+            for (uint32_t object : visible)
+            {
+                glm::mat4 model = GetBoxModel(bounds[object], meshBounds);
+                program.UploadMatrix4("model", GL_FALSE, &model[0][0]);
+                mesh.RenderInstanced(program, 2);
+            }
+        }
+
+        DrawOcclusionQueriesCommand queries = {
+            &culler, culler.GetFrame(), &mesh, &program, 2, proxies, NumTestObjects
+        };
+        queries.Execute();
+
+        glDisable(GL_CLIP_DISTANCE0);
+        GLplus::CheckGLErrors("glDisable");
+
+        window.GLSwapWindow();
+    }
+
+    if (numFrames < kFirstOccludedFrame)
+    {
+        fprintf(stderr, "Needs at least %d frames to see the %s skipped\n", kFirstOccludedFrame, kObjectNames[Hidden]);
+        failures++;
+    }
+
+    printf("%s\n", failures == 0 ? "passed" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+    int numFrames = argc > 1 ? atoi(argv[1]) : 10;
+
+    try
+    {
+        return run(numFrames);
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "Fatal exception: %s\n", e.what());
+        return 1;
+    }
+}
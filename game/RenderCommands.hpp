@@ -0,0 +1,280 @@
+#ifndef RENDERCOMMANDS_H
+#define RENDERCOMMANDS_H
+
+#include "GPUProfiler.hpp"
+#include "OcclusionCulling.hpp"
+#include "RenderQueue.hpp"
+
+#include <GLplus.hpp>
+#include <GLmesh.hpp>
+
+#include <glm/glm.hpp>
+
+#include <cstring>
+
+// Commands for the RenderQueue that are shared by every pass.
+// Bindings go through the StateCache, and stay bound for the packets that follow.
+
+struct SetViewportCommand
+{
+    GLint mX;
+    GLint mY;
+    GLsizei mWidth;
+    GLsizei mHeight;
+
+    void Execute() const
+    {
+        glViewport(mX, mY, mWidth, mHeight);
+        GLplus::CheckGLErrors("glViewport");
+    }
+};
+
+struct ClearCommand
+{
+    glm::vec4 mColor;
+    GLbitfield mMask;
+
+    void Execute() const
+    {
+        glClearColor(mColor.r, mColor.g, mColor.b, mColor.a);
+        glClear(mMask);
+        GLplus::CheckGLErrors("glClear");
+    }
+};
+
+struct SetCapabilityCommand
+{
+    GLenum mCapability;
+    bool mEnabled;
+
+    void Execute() const
+    {
+        if (mEnabled)
+        {
+            glEnable(mCapability);
+            GLplus::CheckGLErrors("glEnable");
+        }
+        else
+        {
+            glDisable(mCapability);
+            GLplus::CheckGLErrors("glDisable");
+        }
+    }
+};
+
+// 0 binds the window's framebuffer
+struct BindFrameBufferCommand
+{
+    GLuint mFrameBuffer;
+
+    void Execute() const
+    {
+        GLplus::StateCache::Current().BindFrameBuffer(mFrameBuffer);
+    }
+};
+
+struct BindTextureCommand
+{
+    GLenum mTextureUnit;
+    GLuint mTexture;
+
+    void Execute() const
+    {
+        GLplus::StateCache& cache = GLplus::StateCache::Current();
+        cache.ActiveTexture(mTextureUnit);
+        cache.BindTexture2D(mTexture);
+    }
+};
+
+// Writes std140 data recorded into the frame's memory to the uniform ring buffer, and binds it.
+struct BindUniformBlockCommand
+{
+    GLplus::UniformRingBuffer* mUniforms;
+    GLuint mBindingPoint;
+    const void* mData;
+    GLsizeiptr mSize;
+
+    void Execute() const
+    {
+        GLplus::UniformRingBuffer::Allocation block = mUniforms->Allocate(mSize);
+        std::memcpy(block.mData, mData, mSize);
+        mUniforms->Flush();
+        mUniforms->BindRange(mBindingPoint, block);
+    }
+};
+
+// mMatrices points into the frame's memory
+struct UploadInstancesCommand
+{
+    GLmesh::InstanceBuffer* mInstances;
+    const float* mMatrices;
+    size_t mCount;
+
+    void Execute() const
+    {
+        mInstances->Upload(mMatrices, mCount);
+    }
+};
+
+// Draws a StaticMesh, with a model matrix uniform or with an InstanceBuffer.
+struct DrawMeshCommand
+{
+    const GLmesh::StaticMesh* mMesh;
+    const GLplus::Program* mProgram;
+
+    bool mHasModel;
+    glm::mat4 mModel;
+    // copies only told apart by gl_InstanceID
+    GLsizei mCopies;
+
+    const GLmesh::InstanceBuffer* mInstances;
+    size_t mInstanceCount;
+    GLuint mViewsPerInstance;
+
+    // the mesh's level of detail
+    int mLod;
+
+    static DrawMeshCommand WithModel(
+            const GLmesh::StaticMesh& mesh, const GLplus::Program& program,
+            const glm::mat4& model, GLsizei copies = 1, int lod = 0)
+    {
+        DrawMeshCommand command = { &mesh, &program, true, model, copies, nullptr, 0, 1, lod };
+        return command;
+    }
+
+    static DrawMeshCommand Instanced(
+            const GLmesh::StaticMesh& mesh, const GLplus::Program& program,
+            const GLmesh::InstanceBuffer& instances, size_t instanceCount, GLuint viewsPerInstance = 1, int lod = 0)
+    {
+        DrawMeshCommand command = { &mesh, &program, false, glm::mat4(), 1, &instances, instanceCount, viewsPerInstance, lod };
+        return command;
+    }
+
+    // sorts the draw by its program, then by the mesh's texture
+    GLuint64 MakeKey(unsigned int pass, unsigned int view, unsigned int material = 0, unsigned int depth = 0) const
+    {
+        const std::shared_ptr<GLplus::Texture2D>& texture = mMesh->GetDiffuseTexture();
+        return MakeRenderKey(pass, view, mProgram->GetGLHandle(), texture ? texture->GetGLHandle() : 0, material, depth);
+    }
+
+    void Execute() const
+    {
+        if (mInstances)
+        {
+            mMesh->RenderInstanced(*mProgram, *mInstances, mInstanceCount, mViewsPerInstance, mLod);
+            return;
+        }
+
+        GLplus::ScopedProgramBind programBind(*mProgram);
+
+        if (mHasModel)
+        {
+            mProgram->UploadMatrix4("model", GL_FALSE, &mModel[0][0]);
+        }
+
+        if (mCopies > 1)
+        {
+            mMesh->RenderInstanced(*mProgram, mCopies, mLod);
+        }
+        else
+        {
+            mMesh->Render(*mProgram, mLod);
+        }
+    }
+};
+
+// what an occlusion query draws in place of an object, usually its box
+struct OcclusionProxy
+{
+    uint32_t mObject;
+    glm::mat4 mModel;
+};
+
+// Polls the queries of earlier frames, then draws a proxy inside a query for every object that isn't waiting on one.
+// The proxies are depth tested against everything drawn before them, and write nothing.
+// They pass at equal depths, so a proxy a little bigger than its object isn't hidden by the object itself.
+// Expects the default GL_LESS depth function, and puts it back.
+struct DrawOcclusionQueriesCommand
+{
+    OcclusionCuller* mCuller;
+    uint64_t mFrame;
+
+    const GLmesh::StaticMesh* mMesh;
+    const GLplus::Program* mProgram;
+    // one copy per eye for stereo programs, so one query covers both eyes
+    GLsizei mCopies;
+
+    // points into the frame's memory
+    const OcclusionProxy* mProxies;
+    size_t mCount;
+
+    void Execute() const
+    {
+        mCuller->ResolveQueries();
+
+        if (mCount == 0)
+        {
+            return;
+        }
+
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glDepthFunc(GL_LEQUAL);
+        GLplus::CheckGLErrors("glDepthFunc");
+
+        GLplus::ScopedProgramBind programBind(*mProgram);
+
+        for (size_t i = 0; i < mCount; i++)
+        {
+            if (!mCuller->BeginQuery(mProxies[i].mObject, mFrame))
+            {
+                continue;
+            }
+
+            mProgram->UploadMatrix4("model", GL_FALSE, &mProxies[i].mModel[0][0]);
+            mMesh->RenderInstanced(*mProgram, mCopies);
+
+            mCuller->EndQuery(mProxies[i].mObject);
+        }
+
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+        GLplus::CheckGLErrors("glDepthFunc");
+    }
+};
+
+// Reports errors from the packets since the last check, under the pass' name, when checking once per scope.
+struct CheckErrorsCommand
+{
+    const char* mScope;
+
+    void Execute() const
+    {
+        GLplus::FlushGLErrors(mScope);
+    }
+};
+
+// Times the packets between this and the matching EndGPUScopeCommand. The name has to last, like a string literal.
+struct BeginGPUScopeCommand
+{
+    GPUProfiler* mProfiler;
+    const char* mName;
+
+    void Execute() const
+    {
+        mProfiler->BeginScope(mName);
+    }
+};
+
+struct EndGPUScopeCommand
+{
+    GPUProfiler* mProfiler;
+
+    void Execute() const
+    {
+        mProfiler->EndScope();
+    }
+};
+
+#endif // RENDERCOMMANDS_H
@@ -0,0 +1,355 @@
+#include "RenderQueue.hpp"
+
+#include <GLplus.hpp>
+#include <Profiler.hpp>
+
+#include <cstdint>
+#include <stdexcept>
+
+FrameAllocator::FrameAllocator(size_t capacity)
+    : mMemory(new char[capacity])
+    , mCapacity(capacity)
+    , mUsed(0)
+{ }
+
+void* FrameAllocator::Allocate(size_t size, size_t alignment)
+{
+    uintptr_t base = reinterpret_cast<uintptr_t>(mMemory.get());
+    uintptr_t aligned = (base + mUsed + alignment - 1) / alignment * alignment;
+    size_t offset = aligned - base;
+
+    if (offset + size > mCapacity)
+    {
+        throw std::bad_alloc();
+    }
+
+    mUsed = offset + size;
+    return mMemory.get() + offset;
+}
+
+void FrameAllocator::Reset()
+{
+    mUsed = 0;
+}
+
+size_t FrameAllocator::GetUsed() const
+{
+    return mUsed;
+}
+
+size_t FrameAllocator::GetCapacity() const
+{
+    return mCapacity;
+}
+
+CommandBuffer::CommandBuffer(size_t capacity)
+    : mAllocator(capacity)
+{ }
+
+void* CommandBuffer::Allocate(size_t size, size_t alignment)
+{
+    return mAllocator.Allocate(size, alignment);
+}
+
+const std::vector<RenderPacket>& CommandBuffer::GetPackets() const
+{
+    return mPackets;
+}
+
+size_t CommandBuffer::GetBytesUsed() const
+{
+    return mAllocator.GetUsed();
+}
+
+void CommandBuffer::Reset()
+{
+    mAllocator.Reset();
+    mPackets.clear();
+}
+
+RenderFrame::RenderFrame(int numRecordingThreads, size_t bytesPerThread)
+{
+    for (int i = 0; i < numRecordingThreads; i++)
+    {
+        mCommandBuffers.emplace_back(new CommandBuffer(bytesPerThread));
+    }
+}
+
+CommandBuffer& RenderFrame::GetCommandBuffer(int threadIndex)
+{
+    return *mCommandBuffers.at(threadIndex);
+}
+
+int RenderFrame::GetNumCommandBuffers() const
+{
+    return mCommandBuffers.size();
+}
+
+void RenderFrame::Sort()
+{
+    mSortedPackets.clear();
+    for (const std::unique_ptr<CommandBuffer>& commandBuffer : mCommandBuffers)
+    {
+        const std::vector<RenderPacket>& packets = commandBuffer->GetPackets();
+        mSortedPackets.insert(mSortedPackets.end(), packets.begin(), packets.end());
+    }
+
+    // Least significant byte first. Each pass is stable, so the whole sort is too.
+    size_t numPackets = mSortedPackets.size();
+    if (numPackets < 2)
+    {
+        return;
+    }
+
+    size_t counts[8][256] = { };
+    for (const RenderPacket& packet : mSortedPackets)
+    {
+        for (int digit = 0; digit < 8; digit++)
+        {
+            counts[digit][(packet.mKey >> (digit * 8)) & 0xFF]++;
+        }
+    }
+
+    mSortScratch.resize(numPackets);
+
+    for (int digit = 0; digit < 8; digit++)
+    {
+        int shift = digit * 8;
+
+        // most keys share most of their bytes, like the unused depth of state changes
+        if (counts[digit][(mSortedPackets[0].mKey >> shift) & 0xFF] == numPackets)
+        {
+            continue;
+        }
+
+        size_t offsets[256];
+        size_t offset = 0;
+        for (int bucket = 0; bucket < 256; bucket++)
+        {
+            offsets[bucket] = offset;
+            offset += counts[digit][bucket];
+        }
+
+        for (const RenderPacket& packet : mSortedPackets)
+        {
+            mSortScratch[offsets[(packet.mKey >> shift) & 0xFF]++] = packet;
+        }
+
+        mSortedPackets.swap(mSortScratch);
+    }
+}
+
+void RenderFrame::Execute()
+{
+    GLplus::StateCache& cache = GLplus::StateCache::Current();
+
+    unsigned int draws = cache.GetDrawCount();
+    unsigned int binds = cache.GetBindCount();
+    unsigned int programSwitches = cache.GetProgramSwitchCount();
+    unsigned int elidedCalls = cache.GetElidedCallCount();
+
+    {
+        // the packets are sorted by state, so whatever the last one bound is likely what the next one needs
+        GLplus::ScopedKeepBindings keepBindings;
+
+        for (const RenderPacket& packet : mSortedPackets)
+        {
+            packet.mExecute(packet.mCommand);
+        }
+    }
+
+    mStats.mPackets = mSortedPackets.size();
+    mStats.mDraws = cache.GetDrawCount() - draws;
+    mStats.mBinds = cache.GetBindCount() - binds;
+    mStats.mProgramSwitches = cache.GetProgramSwitchCount() - programSwitches;
+    mStats.mElidedCalls = cache.GetElidedCallCount() - elidedCalls;
+}
+
+size_t RenderFrame::GetPacketCount() const
+{
+    return mSortedPackets.size();
+}
+
+const RenderStats& RenderFrame::GetStats() const
+{
+    return mStats;
+}
+
+void RenderFrame::Reset()
+{
+    for (const std::unique_ptr<CommandBuffer>& commandBuffer : mCommandBuffers)
+    {
+        commandBuffer->Reset();
+    }
+    mSortedPackets.clear();
+}
+
+RenderQueue::RenderQueue(SDL2plus::Window& window, bool threaded, int numRecordingThreads, size_t bytesPerThread)
+    : mWindow(window)
+    , mThreaded(threaded)
+    , mRecordingFrame(-1)
+    , mQuit(false)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        mFrames[i].reset(new RenderFrame(numRecordingThreads, bytesPerThread));
+        mFrameStates[i] = FrameState::Free;
+    }
+
+    if (mThreaded)
+    {
+        // a context can only be current on one thread at a time
+        mWindow.ReleaseGLContext();
+        mThread = std::thread(&RenderQueue::ThreadMain, this);
+    }
+}
+
+RenderQueue::~RenderQueue()
+{
+    if (mThreaded)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mQuit = true;
+        }
+        mFrameSubmitted.notify_all();
+        mThread.join();
+
+        // give the context back, and forget what this thread thought was bound while it was away
+        mWindow.MakeGLContextCurrent();
+        GLplus::StateCache::Current().Invalidate();
+    }
+}
+
+RenderFrame& RenderQueue::BeginFrame()
+{
+    int frameIndex = (mRecordingFrame + 1) % 2;
+
+    {
+        PROFILE_ZONE("wait for GL thread");
+        std::unique_lock<std::mutex> lock(mMutex);
+        mFrameFreed.wait(lock, [&]{ return mFrameStates[frameIndex] == FrameState::Free || mError; });
+        RethrowError();
+        mFrameStates[frameIndex] = FrameState::Recording;
+    }
+
+    mRecordingFrame = frameIndex;
+
+    RenderFrame& frame = *mFrames[frameIndex];
+    frame.Reset();
+    return frame;
+}
+
+void RenderQueue::EndFrame()
+{
+    if (mRecordingFrame == -1 || mFrameStates[mRecordingFrame] != FrameState::Recording)
+    {
+        throw std::logic_error("RenderQueue::EndFrame called without BeginFrame.");
+    }
+
+    if (!mThreaded)
+    {
+        SubmitFrame(mRecordingFrame);
+        mFrameStates[mRecordingFrame] = FrameState::Free;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFrameStates[mRecordingFrame] = FrameState::Submitted;
+        mSubmittedFrames.push_back(mRecordingFrame);
+    }
+    mFrameSubmitted.notify_one();
+}
+
+void RenderQueue::Finish()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mFrameFreed.wait(lock, [&]{ return mSubmittedFrames.empty() || mError; });
+    RethrowError();
+}
+
+bool RenderQueue::IsThreaded() const
+{
+    return mThreaded;
+}
+
+RenderStats RenderQueue::GetLastFrameStats() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mLastFrameStats;
+}
+
+void RenderQueue::SubmitFrame(int frameIndex)
+{
+    RenderFrame& frame = *mFrames[frameIndex];
+    {
+        PROFILE_ZONE("sort packets");
+        frame.Sort();
+    }
+    {
+        PROFILE_ZONE("execute packets");
+        frame.Execute();
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mLastFrameStats = frame.GetStats();
+}
+
+void RenderQueue::ThreadMain()
+{
+    PROFILE_THREAD("GL thread");
+
+    try
+    {
+        mWindow.MakeGLContextCurrent();
+
+        for (;;)
+        {
+            int frameIndex;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mFrameSubmitted.wait(lock, [&]{ return !mSubmittedFrames.empty() || mQuit; });
+                if (mSubmittedFrames.empty())
+                {
+                    break;
+                }
+                frameIndex = mSubmittedFrames.front();
+            }
+
+            SubmitFrame(frameIndex);
+
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mSubmittedFrames.pop_front();
+                mFrameStates[frameIndex] = FrameState::Free;
+            }
+            mFrameFreed.notify_all();
+        }
+    }
+    catch (...)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mError = std::current_exception();
+        }
+        mFrameFreed.notify_all();
+    }
+
+    try
+    {
+        mWindow.ReleaseGLContext();
+    }
+    catch (...)
+    {
+        // the destructor makes it current again anyways
+    }
+}
+
+void RenderQueue::RethrowError()
+{
+    if (mError)
+    {
+        std::rethrow_exception(mError);
+    }
+}
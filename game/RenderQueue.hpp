@@ -0,0 +1,234 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <SDL2plus.hpp>
+#include <GL/glew.h>
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Hands out memory for one frame by bumping an offset. Everything is given back at once by Reset().
+class FrameAllocator
+{
+    std::unique_ptr<char[]> mMemory;
+    size_t mCapacity;
+    size_t mUsed;
+
+public:
+    explicit FrameAllocator(size_t capacity);
+    FrameAllocator(const FrameAllocator&) = delete;
+    FrameAllocator& operator=(const FrameAllocator&) = delete;
+
+    // throws std::bad_alloc when the frame's memory runs out
+    void* Allocate(size_t size, size_t alignment);
+
+    void Reset();
+
+    size_t GetUsed() const;
+    size_t GetCapacity() const;
+};
+
+// Packets run in order of their keys:
+//
+//   63..56  pass
+//   55..48  view within the pass
+//   47..36  program
+//   35..24  texture
+//   23..16  material, anything else that's costly to switch, like the mesh
+//   15..0   depth, front to back
+//
+// so that draws sharing a program, and then a texture, run next to each other.
+// GL names are truncated to fit, which only makes grouping worse, never wrong.
+// Packets with equal keys run in the order they were recorded.
+inline GLuint64 MakeRenderKey(unsigned int pass, unsigned int view = 0, unsigned int program = 0,
+                              unsigned int texture = 0, unsigned int material = 0, unsigned int depth = 0)
+{
+    return (GLuint64) (pass & 0xFF) << 56
+         | (GLuint64) (view & 0xFF) << 48
+         | (GLuint64) (program & 0xFFF) << 36
+         | (GLuint64) (texture & 0xFFF) << 24
+         | (GLuint64) (material & 0xFF) << 16
+         | (GLuint64) (depth & 0xFFFF);
+}
+
+// the 16 bits of depth in a key, for a distance from the eye between 0 and maxDepth
+inline unsigned int QuantizeRenderDepth(float depth, float maxDepth)
+{
+    float normalized = depth / maxDepth;
+    normalized = normalized < 0.0f ? 0.0f : normalized > 1.0f ? 1.0f : normalized;
+    return (unsigned int) (normalized * 0xFFFF);
+}
+
+// One recorded command.
+struct RenderPacket
+{
+    GLuint64 mKey;
+    void (*mExecute)(const void* command);
+    const void* mCommand;
+};
+
+// What a frame cost to submit, counted on the GL thread.
+struct RenderStats
+{
+    size_t mPackets = 0;
+    unsigned int mDraws = 0;
+    // glBind*/glActiveTexture calls that went through to GL
+    unsigned int mBinds = 0;
+    unsigned int mProgramSwitches = 0;
+    // redundant calls the StateCache skipped
+    unsigned int mElidedCalls = 0;
+};
+
+// Records the commands of one thread for one frame.
+//
+// Commands are copied into the frame's memory and never destroyed, so they must be trivially destructible.
+// Each one has an Execute() const, which is called on the GL thread.
+class CommandBuffer
+{
+    FrameAllocator mAllocator;
+    std::vector<RenderPacket> mPackets;
+
+    template<class Command>
+    static void ExecuteCommand(const void* command)
+    {
+        static_cast<const Command*>(command)->Execute();
+    }
+
+public:
+    explicit CommandBuffer(size_t capacity);
+    CommandBuffer(const CommandBuffer&) = delete;
+    CommandBuffer& operator=(const CommandBuffer&) = delete;
+
+    template<class Command>
+    void Record(GLuint64 key, const Command& command)
+    {
+        static_assert(std::is_trivially_destructible<Command>::value,
+                      "Commands are never destroyed, so they must be trivially destructible.");
+
+        void* memory = mAllocator.Allocate(sizeof(Command), alignof(Command));
+        const Command* copy = new (memory) Command(command);
+
+        RenderPacket packet = { key, &ExecuteCommand<Command>, copy };
+        mPackets.push_back(packet);
+    }
+
+    // copies data a command points to into the frame's memory, where it lives until the frame is recycled
+    template<class T>
+    const T* Copy(const T* data, size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "Frame data is never destroyed, so it must be trivially destructible.");
+
+        T* copy = static_cast<T*>(mAllocator.Allocate(sizeof(T) * count, alignof(T)));
+        std::uninitialized_copy(data, data + count, copy);
+        return copy;
+    }
+
+    // uninitialized memory for commands that write their data in place
+    void* Allocate(size_t size, size_t alignment);
+
+    const std::vector<RenderPacket>& GetPackets() const;
+    size_t GetBytesUsed() const;
+
+    void Reset();
+};
+
+// Everything recorded for one frame, with a command buffer per recording thread.
+class RenderFrame
+{
+    std::vector<std::unique_ptr<CommandBuffer>> mCommandBuffers;
+    std::vector<RenderPacket> mSortedPackets;
+    std::vector<RenderPacket> mSortScratch;
+    RenderStats mStats;
+
+public:
+    RenderFrame(int numRecordingThreads, size_t bytesPerThread);
+    RenderFrame(const RenderFrame&) = delete;
+    RenderFrame& operator=(const RenderFrame&) = delete;
+
+    // each recording thread sticks to its own index, so recording needs no locks
+    CommandBuffer& GetCommandBuffer(int threadIndex);
+    int GetNumCommandBuffers() const;
+
+    // merges every thread's packets and radix sorts them by key.
+    // Equal keys keep the order of the threads, then the order they were recorded in.
+    void Sort();
+
+    // runs the sorted packets, keeping bindings from one packet to the next. Needs the GL context.
+    void Execute();
+
+    size_t GetPacketCount() const;
+
+    // counts from the last Execute()
+    const RenderStats& GetStats() const;
+
+    void Reset();
+};
+
+// Hands out frames to record, and submits recorded frames to GL.
+//
+// Frames are double buffered: one is recorded while the GL thread submits the other,
+// so the next frame's simulation overlaps this frame's GL calls.
+class RenderQueue
+{
+    enum class FrameState
+    {
+        Free,
+        Recording,
+        Submitted
+    };
+
+    SDL2plus::Window& mWindow;
+    bool mThreaded;
+
+    std::unique_ptr<RenderFrame> mFrames[2];
+    FrameState mFrameStates[2];
+    int mRecordingFrame;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mFrameSubmitted;
+    std::condition_variable mFrameFreed;
+    std::deque<int> mSubmittedFrames;
+    bool mQuit;
+    std::exception_ptr mError;
+    RenderStats mLastFrameStats;
+
+    std::thread mThread;
+
+public:
+    // With threaded set, the window's GL context moves to a GL thread for as long as the queue lives.
+    // Otherwise frames are submitted from EndFrame(), on the calling thread.
+    RenderQueue(SDL2plus::Window& window, bool threaded, int numRecordingThreads = 1, size_t bytesPerThread = 1 << 20);
+    RenderQueue(const RenderQueue&) = delete;
+    RenderQueue& operator=(const RenderQueue&) = delete;
+    ~RenderQueue();
+
+    // waits until a frame is free to record.
+    // Rethrows exceptions from the GL thread.
+    RenderFrame& BeginFrame();
+
+    // hands the recorded frame to the GL thread
+    void EndFrame();
+
+    // waits until every submitted frame has been executed
+    void Finish();
+
+    bool IsThreaded() const;
+
+    // stats of the most recently submitted frame
+    RenderStats GetLastFrameStats() const;
+
+private:
+    void SubmitFrame(int frameIndex);
+    void ThreadMain();
+    void RethrowError();
+};
+
+#endif // RENDERQUEUE_H
@@ -0,0 +1,44 @@
+// The camera's uniform block, and CameraTransform() from world space to clip space with it.
+// With STEREO, both eyes are drawn side by side in one target: even instances draw the left eye,
+// odd instances draw the right eye, and GL_CLIP_DISTANCE0 has to be enabled.
+
+#ifdef STEREO
+
+out float gl_ClipDistance[1];
+
+// both eyes, written once per frame
+layout(std140) uniform StereoCamera
+{
+    mat4 views[2];
+    mat4 projections[2];
+};
+
+vec4 CameraTransform(vec4 worldPosition)
+{
+    int eye = gl_InstanceID % 2;
+    float eyeSign = eye == 0 ? -1.0 : 1.0;
+
+    vec4 clipPosition = projections[eye] * views[eye] * worldPosition;
+
+    // keep the eye's triangles out of the other eye's half
+    gl_ClipDistance[0] = clipPosition.w + eyeSign * clipPosition.x;
+
+    // squeeze the eye into its half of the render target
+    return vec4(0.5 * (clipPosition.x + eyeSign * clipPosition.w), clipPosition.yzw);
+}
+
+#else
+
+// written once per frame for each eye
+layout(std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+};
+
+vec4 CameraTransform(vec4 worldPosition)
+{
+    return projection * view * worldPosition;
+}
+
+#endif
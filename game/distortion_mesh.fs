@@ -0,0 +1,19 @@
+#version 140
+
+in vec2 ftexcoordRed;
+in vec2 ftexcoordGreen;
+in vec2 ftexcoordBlue;
+
+out vec4 color;
+
+// both eyes side by side
+uniform sampler2D RenderedStereoscopicScene;
+
+void main()
+{
+    // the mesh is cut to the eye's half of the texture, so every fragment samples inside it
+    color = vec4(texture(RenderedStereoscopicScene, ftexcoordRed).r,
+                 texture(RenderedStereoscopicScene, ftexcoordGreen).g,
+                 texture(RenderedStereoscopicScene, ftexcoordBlue).b,
+                 1.0);
+}
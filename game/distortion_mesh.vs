@@ -0,0 +1,23 @@
+#version 140
+
+in vec2 position;
+
+// texture coordinates with the lens warp already applied, one per color channel
+in vec2 texcoordRed;
+in vec2 texcoordGreen;
+in vec2 texcoordBlue;
+
+out vec2 ftexcoordRed;
+out vec2 ftexcoordGreen;
+out vec2 ftexcoordBlue;
+
+// the part of the texture the scene was rendered into, when it's rendered at a lower resolution
+uniform vec2 TextureScale;
+
+void main()
+{
+    ftexcoordRed = texcoordRed * TextureScale;
+    ftexcoordGreen = texcoordGreen * TextureScale;
+    ftexcoordBlue = texcoordBlue * TextureScale;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
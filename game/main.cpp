@@ -2,66 +2,700 @@
 #include <SOIL2.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <stdio.h>
 
+#include <algorithm>
 #include <sstream>
 #include <fstream>
 
 #include <SDL2plus.hpp>
 #include <GLplus.hpp>
 #include <GLmesh.hpp>
+#include <ChromeTrace.hpp>
+#include <Profiler.hpp>
 #include <tiny_obj_loader.h>
 
 #include <OVR.h>
 
+#include "AssetManager.hpp"
+#include "BoundingVolumeHierarchy.hpp"
+#include "DistortionMesh.hpp"
+#include "DynamicResolution.hpp"
+#include "FixedTimestep.hpp"
+#include "FramePacer.hpp"
+#include "FrustumCulling.hpp"
+#include "GPUProfiler.hpp"
+#include "LevelOfDetail.hpp"
+#include "OcclusionCulling.hpp"
+#include "RenderCommands.hpp"
+#include "RenderQueue.hpp"
+
+// binding points of the uniform blocks shared by the shaders
+enum UniformBlockBinding
+{
+    CameraBlockBinding,
+    StereoCameraBlockBinding
+};
+
+// the order of the parts of a frame, in the top byte of every packet's key
+enum RenderPass
+{
+    FrameBeginPass,
+    UploadPass,
+    ScenePass,
+    OverlayPass,
+    DistortionPass,
+    FrameEndPass
+};
+
+// views within the scene pass. Setup runs first, and the error check runs last.
+enum SceneView
+{
+    SceneSetupView = 0,
+    LeftEyeView = 1,
+    RightEyeView = 2,
+    BothEyesView = 1,
+    // after every eye, so the occlusion queries test against all of their depth
+    OcclusionView = 3,
+    ErrorCheckView = 0xFF
+};
+
+// how the two eyes of the scene pass are drawn
+enum class StereoRendering
+{
+    // one viewport and one set of draws per eye
+    Multipass,
+    // both eyes in every draw, one instance per eye
+    SinglePass
+};
+
+// Everything the simulation moves.
+// It's stepped at a fixed rate, and blended between the last two steps for drawing.
+struct SceneState
+{
+    // seconds of simulated time
+    double mTime = 0.0;
+
+    // in degrees, kept in [0,360)
+    float mCubeRotation = 0.0f;
+    float mPropRotation = 0.0f;
+
+    glm::vec3 mEyePoint;
+
+    void Tick(double dt)
+    {
+        mTime += dt;
+        mCubeRotation = fmod(mCubeRotation + 90.0f * dt, 360.0f);
+        mPropRotation = fmod(mPropRotation + 20.0f * dt, 360.0f);
+
+        float rotation2 = mTime * 3.14 / 2;
+        float rotation3 = mTime * 3.14 / 3;
+        mEyePoint = glm::vec3(0.0f, 5.0f * sin(rotation2), 5.0f * fabs(sin(rotation3) + 1.5f));
+    }
+
+    static SceneState Interpolate(const SceneState& from, const SceneState& to, float alpha)
+    {
+        SceneState state;
+        state.mTime = from.mTime + (to.mTime - from.mTime) * alpha;
+        state.mCubeRotation = InterpolateDegrees(from.mCubeRotation, to.mCubeRotation, alpha);
+        state.mPropRotation = InterpolateDegrees(from.mPropRotation, to.mPropRotation, alpha);
+        state.mEyePoint = glm::mix(from.mEyePoint, to.mEyePoint, alpha);
+        return state;
+    }
+
+private:
+    // goes the short way around, in case the angle wrapped between the two steps
+    static float InterpolateDegrees(float from, float to, float alpha)
+    {
+        float delta = to - from;
+        if (delta > 180.0f)
+        {
+            delta -= 360.0f;
+        }
+        else if (delta < -180.0f)
+        {
+            delta += 360.0f;
+        }
+        return from + delta * alpha;
+    }
+};
+
 class Scene
 {
-    GLmesh::StaticMesh mCubeMesh;
-    GLplus::Program mObjectShader;
+public:
+    // what the scene draws with, requested up front so it loads along with everything else
+    struct Assets
+    {
+        std::shared_ptr<MeshAsset> mBox;
+        std::shared_ptr<ProgramAsset> mObjectShader;
+    };
+
+private:
+    // object.vs and object.fs's options, by their bits in a variant's mask
+    enum ObjectShaderOption : GLplus::ProgramVariants::Mask
+    {
+        InstancedOption = 1 << 0,
+        StereoOption = 1 << 1,
+        DiffuseTextureOption = 1 << 2,
+        AlphaTestOption = 1 << 3
+    };
+
+    Assets mAssets;
+    GLmesh::StaticMesh& mCubeMesh;
+    // the cheapest variants that draw the box's material
+    GLplus::Program& mObjectShader;
+    GLplus::Program& mInstancedObjectShader;
+    GLplus::Program& mStereoObjectShader;
+    GLplus::Program& mInstancedStereoObjectShader;
+    // the proxies write no color, so they don't need the material at all
+    GLplus::Program& mOcclusionShader;
+
+    // small boxes circling the big one, drawn with one instanced draw per level of detail
+    static const int kNumProps = 32;
+    std::vector<GLmesh::InstanceBuffer> mPropInstances;
+    std::vector<glm::mat4> mPropTransforms;
+
+    // box.obj's triangles, for rays that need to hit more than a box
+    std::vector<glm::vec3> mBoxPositions;
+    std::vector<uint32_t> mBoxIndices;
+    BoundingVolumeHierarchy mBoxTriangles;
+    BoundingBox mBoxBounds;
+
+    // The big box is object 0, and props are the ones after it.
+    // The tree is built once and refit as they move, since they move together.
+    std::vector<BoundingBox> mObjectBounds;
+    BoundingVolumeHierarchy mObjectTree;
+
+    // Skips objects hidden behind the ones drawn last frame.
+    // Queried with boxes around each object, drawn after both eyes.
+    OcclusionCuller mOcclusionCuller;
+    std::vector<OcclusionProxy> mOcclusionProxies;
+
+    // what survived culling this frame
+    bool mCubeVisible = true;
+    std::vector<uint32_t> mFrustumVisibleObjects;
+    std::vector<uint32_t> mVisibleObjects;
+    // by level of detail
+    int mCubeLod = 0;
+    std::vector<std::vector<glm::mat4>> mVisiblePropTransforms;
+
+    // Levels of detail are picked by how big their error is in the render target.
+    // 0 until the projection is known, which keeps every object at full detail.
+    LodSelector mLodSelector;
+    std::vector<LodCandidate> mLodCandidates;
+    float mPixelsPerUnitAtUnitDistance = 0.0f;
+
+    // where the head is turned, relative to the eye point's view
+    glm::quat mHeadOrientation;
+
+    // the last two simulation steps, and the blend of them being drawn this frame
+    SceneState mPreviousState;
+    SceneState mCurrentState;
+    SceneState mRenderState;
 
 public:
-    Scene()
-        : mObjectShader(GLplus::Program::FromFiles("object.vs","object.fs"))
+    static Assets RequestAssets(AssetManager& assets)
+    {
+        GLmesh::LodOptions lodOptions;
+        lodOptions.mMaxLevels = 4;
+
+        Assets requested;
+        requested.mBox = assets.LoadMesh("box.obj", GLmesh::VertexFormat::Compact(), lodOptions);
+
+        // The textured variants the box can draw with, and the occlusion proxies' one.
+        // Other materials' variants are compiled when they first show up.
+        std::vector<GLplus::ProgramVariants::Mask> variants;
+        for (GLplus::ProgramVariants::Mask views : { 0u, (unsigned int) StereoOption })
+        {
+            variants.push_back(views | DiffuseTextureOption);
+            variants.push_back(views | InstancedOption | DiffuseTextureOption);
+        }
+        variants.push_back(StereoOption);
+
+        requested.mObjectShader = assets.LoadProgram("object.vs", "object.fs",
+                                                     { "INSTANCED", "STEREO", "DIFFUSE_TEXTURE", "ALPHA_TEST" }, variants);
+        return requested;
+    }
+
+    // the assets have to be loaded already
+    explicit Scene(const Assets& assets)
+        : mAssets(assets)
+        , mCubeMesh(*assets.mBox->GetMeshes().front())
+        , mObjectShader(GetObjectShader(assets, mCubeMesh, 0))
+        , mInstancedObjectShader(GetObjectShader(assets, mCubeMesh, InstancedOption))
+        , mStereoObjectShader(GetObjectShader(assets, mCubeMesh, StereoOption))
+        , mInstancedStereoObjectShader(GetObjectShader(assets, mCubeMesh, InstancedOption | StereoOption))
+        , mOcclusionShader(*assets.mObjectShader->GetVariants().Get(StereoOption))
+        , mOcclusionCuller(1 + kNumProps)
+        , mLodSelector(1 + kNumProps)
+    {
+        const std::vector<tinyobj::shape_t>& shapes = assets.mBox->GetShapes();
+        printf("Loaded box.obj with %d bytes per vertex (%d bytes of vertices, %d bytes of indices)\n",
+               (int) mCubeMesh.GetBytesPerVertex(),
+               (int) mCubeMesh.GetVertexBufferSize(),
+               (int) mCubeMesh.GetIndexBufferSize());
+        printf("  vertex cache: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+               mCubeMesh.GetInputVertexCacheStats().mAcmr, mCubeMesh.GetVertexCacheStats().mAcmr,
+               mCubeMesh.GetInputVertexCacheStats().mAtvr, mCubeMesh.GetVertexCacheStats().mAtvr);
+        for (size_t lod = 0; lod < mCubeMesh.GetLods().size(); lod++)
+        {
+            printf("  level of detail %d: %d triangles, error %.4f\n",
+                   (int) lod, (int) mCubeMesh.GetTriangleCount(lod), mCubeMesh.GetLods()[lod].mError);
+        }
+        fflush(stdout);
+
+        mPropInstances.resize(mCubeMesh.GetLods().size());
+        mVisiblePropTransforms.resize(mCubeMesh.GetLods().size());
+
+        const tinyobj::mesh_t& boxMesh = shapes.front().mesh;
+        for (size_t i = 0; i + 2 < boxMesh.positions.size(); i += 3)
+        {
+            mBoxPositions.push_back(glm::vec3(boxMesh.positions[i], boxMesh.positions[i + 1], boxMesh.positions[i + 2]));
+        }
+        mBoxIndices.assign(boxMesh.indices.begin(), boxMesh.indices.end());
+        mBoxTriangles.Build(TriangleBounds(mBoxPositions, mBoxIndices));
+        mBoxBounds = ShapeBounds(shapes.front());
+
+        mAssets.mObjectShader->GetVariants().SetSetup([](GLplus::Program& program, GLplus::ProgramVariants::Mask variant)
+        {
+            if (variant & StereoOption)
+            {
+                program.SetUniformBlockBinding("StereoCamera", StereoCameraBlockBinding);
+            }
+            else
+            {
+                program.SetUniformBlockBinding("Camera", CameraBlockBinding);
+            }
+        });
+
+        mCurrentState.Tick(0.0);
+        mPreviousState = mCurrentState;
+        mRenderState = mCurrentState;
+    }
+
+    // steps the simulation forward by one fixed tick
+    void Tick(double dt)
+    {
+        mPreviousState = mCurrentState;
+        mCurrentState.Tick(dt);
+    }
+
+    // picks the state drawn this frame, alpha of the way from the previous tick to the current one.
+    // Both eyes see this same state.
+    void Update(float alpha)
     {
-        // load box into mesh
-        std::vector<tinyobj::shape_t> shapes;
-        tinyobj::LoadObj(shapes, "box.obj");
-        if (shapes.empty())
+        mRenderState = SceneState::Interpolate(mPreviousState, mCurrentState, alpha);
+
+        float rotation = mRenderState.mPropRotation;
+
+        mPropTransforms.resize(kNumProps);
+        for (int i = 0; i < kNumProps; i++)
+        {
+            glm::mat4& model = mPropTransforms[i];
+            model = glm::mat4();
+            model = glm::rotate(model, rotation + i * 360.0f / kNumProps, glm::vec3(0,1,0));
+            model = glm::translate(model, glm::vec3(6.0f, 0.0f, 0.0f));
+            model = glm::scale(model, glm::vec3(kPropScale));
+        }
+
+        mObjectBounds.resize(GetObjectCount());
+        for (int object = 0; object < GetObjectCount(); object++)
+        {
+            mObjectBounds[object] = mBoxBounds.Transformed(GetObjectModel(object));
+        }
+
+        if (mObjectTree.GetNodes().empty())
         {
-            throw std::runtime_error("Expected shapes.");
+            mObjectTree.Build(mObjectBounds, 1);
         }
-        mCubeMesh.LoadShape(shapes.front());
+        else
+        {
+            mObjectTree.Refit(mObjectBounds);
+        }
+    }
+
+    void SetHeadOrientation(const glm::quat& orientation)
+    {
+        mHeadOrientation = orientation;
     }
 
-    void Render(glm::mat4 projection, glm::mat4 viewAdjustmentForEye) const
+    // keeps what's in the frustum, which should cover every eye that draws this frame,
+    // and wasn't hidden the last time it was checked
+    void Cull(const Frustum& frustum)
+    {
+        mObjectTree.CullFrustum(frustum, mFrustumVisibleObjects);
+        std::sort(mFrustumVisibleObjects.begin(), mFrustumVisibleObjects.end());
+
+        mOcclusionProxies.clear();
+        for (uint32_t object : mFrustumVisibleObjects)
+        {
+            BoundingBox proxy = GetOcclusionProxyBounds(object);
+
+            // the near plane would cut away the faces of a box the eye is in, or right up against
+            if (glm::all(glm::greaterThan(mRenderState.mEyePoint, proxy.mMin - kEyeClearance)) &&
+                glm::all(glm::lessThan(mRenderState.mEyePoint, proxy.mMax + kEyeClearance)))
+            {
+                mOcclusionCuller.Invalidate(object);
+                continue;
+            }
+
+            if (mOcclusionCuller.IsEnabled())
+            {
+                mOcclusionProxies.push_back(OcclusionProxy{ object, GetBoxModel(proxy) });
+            }
+        }
+
+        mOcclusionCuller.Cull(mFrustumVisibleObjects, mVisibleObjects);
+
+        if (mPixelsPerUnitAtUnitDistance > 0.0f)
+        {
+            mLodCandidates.clear();
+            for (uint32_t object : mVisibleObjects)
+            {
+                const BoundingBox& bounds = mObjectBounds[object];
+                const glm::vec3& eye = mRenderState.mEyePoint;
+                float distance = std::max(glm::distance(eye, glm::clamp(eye, bounds.mMin, bounds.mMax)), kMinLodDistance);
+
+                float scale = object == 0 ? 1.0f : kPropScale;
+                mLodCandidates.push_back(LodCandidate{ object, &mCubeMesh, mPixelsPerUnitAtUnitDistance * scale / distance });
+            }
+            mLodSelector.Select(mLodCandidates);
+        }
+
+        mCubeVisible = false;
+        for (std::vector<glm::mat4>& transforms : mVisiblePropTransforms)
+        {
+            transforms.clear();
+        }
+
+        for (uint32_t object : mVisibleObjects)
+        {
+            int lod = mLodSelector.GetLevel(object);
+            if (object == 0)
+            {
+                mCubeVisible = true;
+                mCubeLod = lod;
+            }
+            else
+            {
+                mVisiblePropTransforms[lod].push_back(mPropTransforms[object - 1]);
+            }
+        }
+    }
+
+    // How many pixels of the render target one unit covers one unit in front of the eye.
+    // Levels of detail are only picked once this is set.
+    void SetLodProjection(float pixelsPerUnitAtUnitDistance)
+    {
+        mPixelsPerUnitAtUnitDistance = pixelsPerUnitAtUnitDistance;
+    }
+
+    // the most triangles the visible objects can add up to, for each eye
+    void SetTriangleBudget(size_t triangles)
+    {
+        mLodSelector.SetTriangleBudget(triangles);
+    }
+
+    size_t GetTriangleBudget() const
+    {
+        return mLodSelector.GetTriangleBudget();
+    }
+
+    const LodStats& GetLodStats() const
+    {
+        return mLodSelector.GetStats();
+    }
+
+    // the nearest object the ray hits, by its triangles
+    bool Pick(const Ray& ray, int& object, float& distance) const
+    {
+        auto intersectObject = [this](uint32_t object, const Ray& ray, float& distance)
+        {
+            Ray localRay = ray.Transformed(glm::inverse(GetObjectModel(object)));
+
+            auto intersectTriangle = [this](uint32_t triangle, const Ray& ray, float& distance)
+            {
+                return IntersectRayTriangle(ray,
+                                            mBoxPositions[mBoxIndices[triangle * 3 + 0]],
+                                            mBoxPositions[mBoxIndices[triangle * 3 + 1]],
+                                            mBoxPositions[mBoxIndices[triangle * 3 + 2]],
+                                            distance);
+            };
+
+            uint32_t triangle;
+            return mBoxTriangles.Raycast(localRay, 1e30f, intersectTriangle, triangle, distance);
+        };
+
+        uint32_t hitObject;
+        if (!mObjectTree.Raycast(ray, 1e30f, intersectObject, hitObject, distance))
+        {
+            return false;
+        }
+
+        object = hitObject;
+        return true;
+    }
+
+    // straight ahead from between the eyes
+    Ray GetGazeRay() const
+    {
+        glm::mat4 inverseView = glm::inverse(GetView());
+
+        Ray ray;
+        ray.mOrigin = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+        ray.mDirection = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -1.0f, 0.0f));
+        return ray;
+    }
+
+    int GetObjectCount() const
+    {
+        return 1 + kNumProps;
+    }
+
+    int GetVisibleObjectCount() const
+    {
+        int count = mCubeVisible ? 1 : 0;
+        for (const std::vector<glm::mat4>& transforms : mVisiblePropTransforms)
+        {
+            count += (int) transforms.size();
+        }
+        return count;
+    }
+
+    void SetOcclusionCulling(bool enabled)
+    {
+        mOcclusionCuller.SetEnabled(enabled);
+    }
+
+    bool IsOcclusionCulling() const
+    {
+        return mOcclusionCuller.IsEnabled();
+    }
+
+    OcclusionStats GetOcclusionStats() const
+    {
+        return mOcclusionCuller.GetStats();
+    }
+
+    // streams this frame's visible prop transforms, shared by both eyes
+    void RecordUpload(CommandBuffer& commands)
+    {
+        for (size_t lod = 0; lod < mVisiblePropTransforms.size(); lod++)
+        {
+            const std::vector<glm::mat4>& transforms = mVisiblePropTransforms[lod];
+            if (transforms.empty())
+            {
+                continue;
+            }
+
+            UploadInstancesCommand upload = {
+                &mPropInstances[lod],
+                commands.Copy(&transforms[0][0][0], transforms.size() * 16),
+                transforms.size()
+            };
+            commands.Record(MakeRenderKey(UploadPass), upload);
+        }
+    }
+
+    // the view before the adjustment for each eye
+    glm::mat4 GetView() const
     {
         glm::vec3 center(0.0f);
         glm::vec3 up = glm::vec3(0.0f,1.0f,0.0f);
 
-        float rotation = SDL_GetTicks() / 1000.0f * 90.0f;
-        float rotation2 = SDL_GetTicks() / 1000.0f * 3.14 / 2;
-        float rotation3 = SDL_GetTicks() / 1000.0f * 3.14 / 3;
+        return glm::mat4_cast(glm::inverse(mHeadOrientation)) * glm::lookAt(mRenderState.mEyePoint, center, up);
+    }
+
+    // draws one eye. Expects the eye's Camera block to be bound by an earlier packet of the view.
+    void Record(CommandBuffer& commands, unsigned int view) const
+    {
+        if (mCubeVisible)
+        {
+            DrawMeshCommand cube = DrawMeshCommand::WithModel(mCubeMesh, mObjectShader, GetCubeModel(), 1, mCubeLod);
+            commands.Record(cube.MakeKey(ScenePass, view, kCubeMaterial, GetCubeDepth()), cube);
+        }
+
+        for (size_t lod = 0; lod < mVisiblePropTransforms.size(); lod++)
+        {
+            if (mVisiblePropTransforms[lod].empty())
+            {
+                continue;
+            }
+
+            DrawMeshCommand props = DrawMeshCommand::Instanced(mCubeMesh, mInstancedObjectShader, mPropInstances[lod],
+                                                               mVisiblePropTransforms[lod].size(), 1, (int) lod);
+            commands.Record(props.MakeKey(ScenePass, view, kCubeMaterial, GetPropsDepth(lod)), props);
+        }
+    }
+
+    // Queries this frame's candidates for later frames, with both eyes in each query.
+    // Expects the same setup as RecordStereo(), and both eyes' depth to be drawn by earlier views.
+    void RecordOcclusionQueries(CommandBuffer& commands, unsigned int view)
+    {
+        if (!mOcclusionCuller.IsEnabled())
+        {
+            return;
+        }
+
+        DrawOcclusionQueriesCommand queries = {
+            &mOcclusionCuller, mOcclusionCuller.GetFrame(),
+            &mCubeMesh, &mOcclusionShader, 2,
+            mOcclusionProxies.empty() ? nullptr : commands.Copy(mOcclusionProxies.data(), mOcclusionProxies.size()),
+            mOcclusionProxies.size()
+        };
+        commands.Record(MakeRenderKey(ScenePass, view, mOcclusionShader.GetGLHandle()), queries);
+    }
+
+    // draws both eyes side by side in the full viewport.
+    // expects the StereoCamera block to be bound and GL_CLIP_DISTANCE0 to be enabled
+    void RecordStereo(CommandBuffer& commands, unsigned int view) const
+    {
+        if (mCubeVisible)
+        {
+            DrawMeshCommand cube = DrawMeshCommand::WithModel(mCubeMesh, mStereoObjectShader, GetCubeModel(), 2, mCubeLod);
+            commands.Record(cube.MakeKey(ScenePass, view, kCubeMaterial, GetCubeDepth()), cube);
+        }
+
+        for (size_t lod = 0; lod < mVisiblePropTransforms.size(); lod++)
+        {
+            if (mVisiblePropTransforms[lod].empty())
+            {
+                continue;
+            }
+
+            DrawMeshCommand props = DrawMeshCommand::Instanced(mCubeMesh, mInstancedStereoObjectShader, mPropInstances[lod],
+                                                               mVisiblePropTransforms[lod].size(), 2, (int) lod);
+            commands.Record(props.MakeKey(ScenePass, view, kCubeMaterial, GetPropsDepth(lod)), props);
+        }
+    }
+
+private:
+    // every object is a box for now
+    static const unsigned int kCubeMaterial = 0;
+
+    // The variant for the mesh's material, with only what it needs: the texture if it has one.
+    // Materials have no alpha test yet. Compiles the variant if it wasn't loaded with the asset.
+    static GLplus::Program& GetObjectShader(const Assets& assets, const GLmesh::StaticMesh& mesh,
+                                            GLplus::ProgramVariants::Mask options)
+    {
+        if (mesh.GetDiffuseTexture())
+        {
+            options |= DiffuseTextureOption;
+        }
+        return *assets.mObjectShader->GetVariants().Get(options);
+    }
 
-        glm::vec3 eyePoint = glm::vec3(0.0f, 5.0f * sin(rotation2), 5.0f * fabs(sin(rotation3) + 1.5f));
+    static constexpr float kPropScale = 0.3f;
+
+    glm::mat4 GetObjectModel(int object) const
+    {
+        return object == 0 ? GetCubeModel() : mPropTransforms[object - 1];
+    }
 
-        glm::mat4 modelview;
-        modelview = glm::rotate(modelview, rotation, glm::vec3(0,1,0));
-        modelview = glm::lookAt(eyePoint, center, up) * modelview;
-        modelview = viewAdjustmentForEye * modelview;
+    // how much bigger an occlusion proxy is than its object, so that it's never behind the object's own surface
+    static constexpr float kOcclusionProxyMargin = 0.02f;
+    // more than the near plane and half the distance between the eyes
+    static constexpr float kEyeClearance = 0.1f;
 
-        mObjectShader.UploadMatrix4("modelview", GL_FALSE, &modelview[0][0]);
-        mObjectShader.UploadMatrix4("projection", GL_FALSE, &projection[0][0]);
+    // objects closer than this are treated as this close, when picking their level of detail
+    static constexpr float kMinLodDistance = 0.1f;
 
-        mCubeMesh.Render(mObjectShader);
+    BoundingBox GetOcclusionProxyBounds(int object) const
+    {
+        BoundingBox bounds = mObjectBounds[object];
+        bounds.mMin -= kOcclusionProxyMargin;
+        bounds.mMax += kOcclusionProxyMargin;
+        return bounds;
+    }
+
+    // stretches box.obj over the box, since box.obj is a box too
+    glm::mat4 GetBoxModel(const BoundingBox& box) const
+    {
+        glm::mat4 model;
+        model = glm::translate(model, box.GetCenter());
+        model = glm::scale(model, (box.mMax - box.mMin) / (mBoxBounds.mMax - mBoxBounds.mMin));
+        model = glm::translate(model, -mBoxBounds.GetCenter());
+        return model;
+    }
+
+    // farther than anything in the scene can be from the eye
+    static constexpr float kMaxSortDepth = 50.0f;
+
+    unsigned int GetCubeDepth() const
+    {
+        return QuantizeRenderDepth(glm::length(mRenderState.mEyePoint), kMaxSortDepth);
+    }
+
+    // the props of a level are drawn at once, so they sort by the nearest one
+    unsigned int GetPropsDepth(size_t lod) const
+    {
+        float nearest = kMaxSortDepth;
+        for (const glm::mat4& model : mVisiblePropTransforms[lod])
+        {
+            nearest = std::min(nearest, glm::distance(glm::vec3(model[3]), mRenderState.mEyePoint));
+        }
+        return QuantizeRenderDepth(nearest, kMaxSortDepth);
+    }
+
+    glm::mat4 GetCubeModel() const
+    {
+        glm::mat4 model;
+        model = glm::rotate(model, mRenderState.mCubeRotation, glm::vec3(0,1,0));
+        return model;
     }
 };
 
+constexpr float Scene::kPropScale;
+constexpr float Scene::kOcclusionProxyMargin;
+constexpr float Scene::kEyeClearance;
+constexpr float Scene::kMinLodDistance;
+
+static void RecordCameraBlock(
+        CommandBuffer& commands, GLuint64 key,
+        GLplus::UniformRingBuffer& uniforms,
+        const glm::mat4& view,
+        const glm::mat4& projection)
+{
+    GLsizeiptr size = sizeof(glm::mat4) * 2;
+    void* data = commands.Allocate(size, 16);
+
+    GLplus::Std140Writer writer(data, size);
+    writer.WriteMatrix4(&view[0][0]);
+    writer.WriteMatrix4(&projection[0][0]);
+
+    BindUniformBlockCommand bind = { &uniforms, CameraBlockBinding, data, size };
+    commands.Record(key, bind);
+}
+
+static void RecordStereoCameraBlock(
+        CommandBuffer& commands, GLuint64 key,
+        GLplus::UniformRingBuffer& uniforms,
+        const glm::mat4& leftView, const glm::mat4& rightView,
+        const glm::mat4& leftProjection, const glm::mat4& rightProjection)
+{
+    GLsizeiptr size = sizeof(glm::mat4) * 4;
+    void* data = commands.Allocate(size, 16);
+
+    GLplus::Std140Writer writer(data, size);
+    writer.WriteMatrix4(&leftView[0][0]);
+    writer.WriteMatrix4(&rightView[0][0]);
+    writer.WriteMatrix4(&leftProjection[0][0]);
+    writer.WriteMatrix4(&rightProjection[0][0]);
+
+    BindUniformBlockCommand bind = { &uniforms, StereoCameraBlockBinding, data, size };
+    commands.Record(key, bind);
+}
+
 class Oculus
 {
     OVR::System mSystem;
     std::unique_ptr<OVR::DeviceManager, void(*)(OVR::DeviceManager*)> mDeviceManager;
     std::unique_ptr<OVR::HMDDevice, void(*)(OVR::HMDDevice*)> mHMDDevice;
+    std::unique_ptr<OVR::SensorDevice, void(*)(OVR::SensorDevice*)> mSensorDevice;
+    // detaches from the sensor before it's released
+    OVR::SensorFusion mSensorFusion;
 
 public:
     Oculus()
@@ -69,11 +703,30 @@ public:
                          [](OVR::DeviceManager* manager){ if (manager) manager->Release(); })
         , mHMDDevice(mDeviceManager ? mDeviceManager->EnumerateDevices<OVR::HMDDevice>().CreateDevice() : nullptr,
                      [](OVR::HMDDevice* device){ if (device) device->Release(); })
+        , mSensorDevice(mHMDDevice ? mHMDDevice->GetSensor() : nullptr,
+                        [](OVR::SensorDevice* device){ if (device) device->Release(); })
     {
         if (!mDeviceManager || !mHMDDevice)
         {
             printf("Warning: Couldn't connect to real oculus. Using fake oculus.\n");
         }
+
+        if (mSensorDevice)
+        {
+            mSensorFusion.AttachToSensor(mSensorDevice.get());
+        }
+    }
+
+    // where the head is turned, predicted ahead to when the frame is shown. Straight ahead without a sensor.
+    glm::quat GetHeadOrientation()
+    {
+        if (!mSensorDevice)
+        {
+            return glm::quat();
+        }
+
+        OVR::Quatf orientation = mSensorFusion.GetPredictedOrientation();
+        return glm::quat(orientation.w, orientation.x, orientation.y, orientation.z);
     }
 
     OVR::HMDInfo GetHMDInfo() const
@@ -110,6 +763,7 @@ class OverlayDebugLines
 {
     std::shared_ptr<GLplus::Buffer> mVertexBuffer;
     size_t mNumVertices;
+    GLplus::VertexArrayCache mVertexArrays;
 
 public:
     OverlayDebugLines(const OVR::Util::Render::StereoConfig& configRef)
@@ -202,21 +856,23 @@ public:
     {
         glLineWidth(2.0f);
 
-        GLplus::VertexArray vertexArray;
-
-        GLint positionLoc;
-        if (program.TryGetAttributeLocation("position", positionLoc))
+        const GLplus::VertexArray& vertexArray = mVertexArrays.GetOrCreate(program,
+            [this, &program](GLplus::VertexArray& vertexArray)
         {
-            vertexArray.SetAttribute(positionLoc, mVertexBuffer,
-                2, GL_FLOAT, GL_FALSE, sizeof(float) * 6, 0);
-        }
+            GLint positionLoc;
+            if (program.TryGetAttributeLocation("position", positionLoc))
+            {
+                vertexArray.SetAttribute(positionLoc, mVertexBuffer,
+                    2, GL_FLOAT, GL_FALSE, sizeof(float) * 6, 0);
+            }
 
-        GLint colorLoc;
-        if (program.TryGetAttributeLocation("color", colorLoc))
-        {
-            vertexArray.SetAttribute(colorLoc, mVertexBuffer,
-                4, GL_FLOAT, GL_FALSE, sizeof(float) * 6, sizeof(float) * 2);
-        }
+            GLint colorLoc;
+            if (program.TryGetAttributeLocation("color", colorLoc))
+            {
+                vertexArray.SetAttribute(colorLoc, mVertexBuffer,
+                    4, GL_FLOAT, GL_FALSE, sizeof(float) * 6, sizeof(float) * 2);
+            }
+        });
 
         GLplus::ScopedVertexArrayBind vertexArrayBind(vertexArray);
         GLplus::ScopedProgramBind programBind(program);
@@ -225,103 +881,162 @@ public:
     }
 };
 
-class FourFullscreenTriangles
+// Commands of the game's own passes, which run on the GL thread.
+
+// paces the frame, starts this frame's region of the uniform ring buffer and starts timing it on the GPU
+struct BeginFrameCommand
 {
-    std::shared_ptr<GLplus::Buffer> mPositions;
-    std::shared_ptr<GLplus::Buffer> mTexcoords;
+    FramePacer* mFramePacer;
+    GLplus::UniformRingBuffer* mUniforms;
+    GPUProfiler* mGPUProfiler;
 
-public:
-    FourFullscreenTriangles()
-    {
-        static const float positions[] = {
-            // bottom triangle of left eye
-            -1.0f,  1.0f,
-            -1.0f, -1.0f,
-             0.0f, -1.0f,
-            // top triangle of left eye
-             0.0f, -1.0f,
-             0.0f,  1.0f,
-            -1.0f,  1.0f,
-            // bottom triangle of right eye
-             0.0f,  1.0f,
-             0.0f, -1.0f,
-             1.0f, -1.0f,
-            // top triangle of right eye
-             1.0f, -1.0f,
-             1.0f,  1.0f,
-             0.0f,  1.0f
-        };
+    void Execute() const
+    {
+        mFramePacer->BeginFrame();
+        mUniforms->BeginFrame();
+        mGPUProfiler->BeginFrame();
+    }
+};
 
-        static const float texcoords[] = {
-            // bottom triangle of left eye
-            0.0f, 1.0f,
-            0.0f, 0.0f,
-            0.5f, 0.0f,
-            // top triangle of left eye
-            0.5f, 0.0f,
-            0.5f, 1.0f,
-            0.0f, 1.0f,
-            // bottom triangle of right eye
-            0.5f, 1.0f,
-            0.5f, 0.0f,
-            1.0f, 0.0f,
-            // top triangle of right eye
-            1.0f, 0.0f,
-            1.0f, 1.0f,
-            0.5f, 1.0f
-        };
+struct EndFrameCommand
+{
+    FramePacer* mFramePacer;
+    GPUProfiler* mGPUProfiler;
 
-        mPositions = std::make_shared<GLplus::Buffer>(GL_ARRAY_BUFFER);
-        mPositions->Upload(sizeof(positions), positions, GL_STATIC_DRAW);
+    void Execute() const
+    {
+        mGPUProfiler->EndFrame();
+        mFramePacer->EndFrame();
+    }
+};
+
+struct DrawDebugLinesCommand
+{
+    OverlayDebugLines* mLines;
+    const GLplus::Program* mProgram;
 
-        mTexcoords = std::make_shared<GLplus::Buffer>(GL_ARRAY_BUFFER);
-        mTexcoords->Upload(sizeof(texcoords), texcoords, GL_STATIC_DRAW);
+    void Execute() const
+    {
+        mLines->Render(*mProgram);
     }
+};
+
+struct DrawGPUProfilerOverlayCommand
+{
+    GPUProfilerOverlay* mOverlay;
+    const GPUProfiler* mProfiler;
+    const GLplus::Program* mProgram;
+    double mBudget;
+    float mPixelHeight;
 
-    void RenderLeft(const GLplus::Program& program)
+    void Execute() const
     {
-        RenderImpl(program, 0);
+        mOverlay->Render(*mProgram, mProfiler->GetStats(), mBudget, mPixelHeight);
     }
+};
+
+struct DrawDistortionMeshCommand
+{
+    const DistortionMesh* mMesh;
+    const GLplus::Program* mProgram;
+    glm::vec2 mTextureScale;
 
-    void RenderRight(const GLplus::Program& program)
+    void Execute() const
     {
-        RenderImpl(program, 6);
+        mProgram->UploadVec2("TextureScale", mTextureScale.x, mTextureScale.y);
+        mMesh->Render(*mProgram);
     }
+};
 
-private:
-    void RenderImpl(const GLplus::Program& program, GLint first)
+struct SetDistortionGridCommand
+{
+    DistortionMesh* mMesh;
+    int mGridResolution;
+    int mTextureWidth;
+    int mTextureHeight;
+
+    void Execute() const
     {
-        GLplus::VertexArray vertexArray;
+        mMesh->SetGridResolution(mGridResolution);
 
-        GLint positionLoc;
-        if (program.TryGetAttributeLocation("position",positionLoc))
-        {
-            vertexArray.SetAttribute(program.GetAttributeLocation("position"),
-                                     mPositions, 2, GL_FLOAT, GL_FALSE, 0, 0);
-        }
+        DistortionMesh::Error error = mMesh->MeasureError(mTextureWidth, mTextureHeight);
+        printf("Distortion mesh: %dx%d cells per eye, %d triangles, error vs. analytic warp: max %.3f texels, mean %.3f texels\n",
+               mGridResolution, mGridResolution, (int) mMesh->GetTriangleCount(), error.mMax, error.mMean);
+        fflush(stdout);
+    }
+};
 
-        GLint texcoordLoc;
-        if (program.TryGetAttributeLocation("texcoord",texcoordLoc))
-        {
-            vertexArray.SetAttribute(program.GetAttributeLocation("texcoord"),
-                                     mTexcoords, 2, GL_FLOAT, GL_FALSE, 0, 0);
+struct ToggleLateStartCommand
+{
+    FramePacer* mFramePacer;
 
-        }
+    void Execute() const
+    {
+        mFramePacer->SetLateStart(!mFramePacer->IsLateStart());
+        printf("Late frame start: %s\n", mFramePacer->IsLateStart() ? "on" : "off");
+        fflush(stdout);
+    }
+};
 
-        GLplus::ScopedVertexArrayBind vertexArrayBind(vertexArray);
-        GLplus::ScopedProgramBind programBind(program);
+struct PrintFrameHistogramsCommand
+{
+    FramePacer* mFramePacer;
+
+    void Execute() const
+    {
+        mFramePacer->PrintHistograms(stdout);
+        mFramePacer->ClearHistograms();
+        fflush(stdout);
+    }
+};
+
+struct PrintGPUProfileCommand
+{
+    const GPUProfiler* mProfiler;
 
-        GLplus::DrawArrays(GL_TRIANGLES, first, 6);
+    void Execute() const
+    {
+        mProfiler->Print(stdout);
+        fflush(stdout);
     }
 };
 
-void run()
+// times the packets from beginKey to endKey. Packets with the same key as either run in the order they were recorded
+void RecordGPUScope(CommandBuffer& commands, GPUProfiler* profiler, const char* name, GLuint64 beginKey, GLuint64 endKey)
 {
+    commands.Record(beginKey, BeginGPUScopeCommand{ profiler, name });
+    commands.Record(endKey, EndGPUScopeCommand{ profiler });
+}
+
+// the last key of a pass, after even its ErrorCheckView packets
+GLuint64 LastRenderKey(unsigned int pass)
+{
+    return MakeRenderKey(pass + 1) - 1;
+}
+
+void run(bool threadedRendering, const std::string& gpuProfileFile, const std::string& traceFile)
+{
+    // zones of every thread, from the sensor's messages to the swap, go to one trace
+    PROFILE_THREAD("main");
+    std::shared_ptr<Profiler::ChromeTrace> trace;
+    if (!traceFile.empty())
+    {
+        trace = std::make_shared<Profiler::ChromeTrace>(traceFile);
+        Profiler::SetEnabled(true);
+        printf("Tracing: writing zones of every thread to %s\n", traceFile.c_str());
+        fflush(stdout);
+    }
+
     Oculus oculus;
     const OVR::HMDInfo hmdInfo = oculus.GetHMDInfo();
 
     SDL2plus::LibSDL sdl(SDL_INIT_VIDEO);
 
+#ifdef NDEBUG
+    // release builds only check for GL errors once per pass
+    GLplus::SetErrorCheckPolicy(GLplus::ErrorCheckPolicy::PerScope);
+#endif
+
     sdl.SetGLAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
     sdl.SetGLAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
     sdl.SetGLAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
@@ -333,6 +1048,21 @@ void run()
     printf("Created window with size (%d,%d)\n", window.GetWidth(), window.GetHeight());
     fflush(stdout);
 
+    // the props are drawn instanced, so say so here rather than fail in the middle of the first frame
+    if (!GLplus::VertexArray::HasInstancedArrays())
+    {
+        throw std::runtime_error("The scene needs GL 3.3 or ARB_instanced_arrays for its instanced props.");
+    }
+
+    // Files are read and parsed on worker threads while this one sets up the rest,
+    // then the GL objects are made here once everything is in.
+    // Programs linked on an earlier run with the same driver are loaded from their binaries instead of compiled.
+    GLplus::ProgramBinaryCache programCache("shadercache");
+    AssetManager assets(0, &programCache);
+    const Scene::Assets sceneAssets = Scene::RequestAssets(assets);
+    std::shared_ptr<ProgramAsset> distortionMeshAsset = assets.LoadProgram("distortion_mesh.vs", "distortion_mesh.fs");
+    std::shared_ptr<ProgramAsset> debugLineAsset = assets.LoadProgram("overlaydebug.vs", "overlaydebug.fs");
+
     OVR::Util::Render::StereoConfig stereoConfig;
     stereoConfig.SetFullViewport(OVR::Util::Render::Viewport(0, 0, window.GetWidth(), window.GetHeight()));
     stereoConfig.SetStereoMode(OVR::Util::Render::Stereo_LeftRight_Multipass);
@@ -359,26 +1089,102 @@ void run()
     printf("Created offscreen buffer with size (%d,%d)\n", renderedTexture->GetWidth(), renderedTexture->GetHeight());
     fflush(stdout);
 
-    GLplus::Program barrelProgram(GLplus::Program::FromFiles("barrel.vs","barrel.fs"));
-    GLplus::Program blitProgram(GLplus::Program::FromFiles("blit.vs","blit.fs"));
-    GLplus::Program debugLineProgram(GLplus::Program::FromFiles("overlaydebug.vs","overlaydebug.fs"));
+    const GLsizei renderedWidth = renderedTexture->GetWidth();
+    const GLsizei renderedHeight = renderedTexture->GetHeight();
 
-    Scene scene;
+    assets.WaitAll();
+    assets.PrintTimings(stdout);
+    fflush(stdout);
+
+    GLplus::Program& distortionMeshProgram = *distortionMeshAsset->Get();
+    GLplus::Program& debugLineProgram = *debugLineAsset->Get();
+
+    distortionMeshProgram.UploadInt("RenderedStereoscopicScene", 0);
+
+    // camera blocks, rewritten every frame
+    GLplus::UniformRingBuffer frameUniforms(4096);
+
+    const glm::mat4 leftEyeProjection = glm::make_mat4((const float*) leftEyeParams.Projection.Transposed().M);
+    const glm::mat4 leftViewAdjustment = glm::make_mat4((const float*) leftEyeParams.ViewAdjust.Transposed().M);
+    const glm::mat4 rightEyeProjection = glm::make_mat4((const float*) rightEyeParams.Projection.Transposed().M);
+    const glm::mat4 rightViewAdjustment = glm::make_mat4((const float*) rightEyeParams.ViewAdjust.Transposed().M);
+
+    Scene scene(sceneAssets);
     OverlayDebugLines debugLines(stereoConfig);
-    FourFullscreenTriangles fourTriangles;
+
+    const EyeWarp leftEyeWarp = EyeWarp::FromStereoConfig(stereoConfig, OVR::Util::Render::StereoEye_Left);
+    const EyeWarp rightEyeWarp = EyeWarp::FromStereoConfig(stereoConfig, OVR::Util::Render::StereoEye_Right);
+
+    // the lens warp baked into a grid, remade when its resolution is changed with [ and ]
+    int distortionGridResolution = 64;
+    DistortionMesh distortionMesh(leftEyeWarp, rightEyeWarp, distortionGridResolution);
+    SetDistortionGridCommand{ &distortionMesh, distortionGridResolution, renderedWidth, renderedHeight }.Execute();
+
+    // shows the undistorted eyes, for comparison
+    const DistortionMesh blitMesh(EyeWarp::Identity(OVR::Util::Render::StereoEye_Left),
+                                  EyeWarp::Identity(OVR::Util::Render::StereoEye_Right), 1);
 
     bool useDistortion = true;
+    StereoRendering stereoRendering = StereoRendering::SinglePass;
+
+    // starts and swaps each frame in step with the display
+    FramePacer framePacer(window);
+    printf("Frame pacing: %.2f ms period, vsync %s\n", framePacer.GetPeriod() * 1000.0, framePacer.IsVSync() ? "on" : "off");
+    fflush(stdout);
 
-    Uint32 timeOfLastFrame = SDL_GetTicks();
+    // the scene is drawn into a smaller part of the render target when the GPU falls behind
+    DynamicResolution dynamicResolution(renderedWidth, renderedHeight, framePacer.GetPeriod());
+    framePacer.SetGPUTimeCallback([&dynamicResolution](double seconds){ dynamicResolution.ReportGPUTime(seconds); });
+
+    // Each pass is timed on the GPU. T shows the times over the scene, and P prints them.
+    // Timestamps are read back a few frames late, so the GPU isn't waited on.
+    GPUProfiler gpuProfiler;
+    GPUProfilerOverlay gpuProfilerOverlay;
+    bool showGPUProfile = false;
+    if (!gpuProfiler.IsSupported())
+    {
+        printf("GPU profiling: timer queries aren't supported\n");
+    }
+    if (!gpuProfileFile.empty())
+    {
+        gpuProfiler.StartCapture(gpuProfileFile);
+        printf("GPU profiling: writing every frame to %s\n", gpuProfileFile.c_str());
+    }
+    else if (trace)
+    {
+        gpuProfiler.StartCapture(trace);
+    }
+    fflush(stdout);
+
+    // the scene's simulation runs at its own rate, and frames draw in between its steps
+    FixedTimestep simulationTimestep(120.0);
+
+    // Frames are recorded here and submitted on the GL thread, one frame behind.
+    // From here on this thread must not touch GL.
+    RenderQueue renderQueue(window, threadedRendering);
+    printf("Rendering: %s\n", renderQueue.IsThreaded() ? "GL calls on a separate thread" : "GL calls on the main thread");
+    fflush(stdout);
 
     // begin main loop
     int isGameRunning = 1;
     while (isGameRunning)
     {
-        Uint32 timeOfThisFrame = SDL_GetTicks();
-        Uint32 deltaTimeMilliSec = timeOfThisFrame - timeOfLastFrame;
+        PROFILE_ZONE("frame");
+
+        // waits for the GL thread to be done with the frame before last
+        RenderFrame& frame = renderQueue.BeginFrame();
+        CommandBuffer& commands = frame.GetCommandBuffer(0);
+
+        commands.Record(MakeRenderKey(FrameBeginPass), BeginFrameCommand{ &framePacer, &frameUniforms, &gpuProfiler });
+
+        // recorded first, so they start before and end after everything else in their pass
+        RecordGPUScope(commands, &gpuProfiler, "upload", MakeRenderKey(UploadPass), LastRenderKey(UploadPass));
+        RecordGPUScope(commands, &gpuProfiler, "scene", MakeRenderKey(ScenePass), LastRenderKey(ScenePass));
+        RecordGPUScope(commands, &gpuProfiler, "overlay", MakeRenderKey(OverlayPass), LastRenderKey(OverlayPass));
+        RecordGPUScope(commands, &gpuProfiler, "distortion", MakeRenderKey(DistortionPass), LastRenderKey(DistortionPass));
 
         // handle all the events
+        PROFILE_ZONE_NAMED(eventsZone, "events");
         SDL_Event e;
         while (SDL_PollEvent(&e))
         {
@@ -390,100 +1196,277 @@ void run()
                 {
                     useDistortion = !useDistortion;
                 }
+                else if (e.key.keysym.sym == SDLK_LEFTBRACKET || e.key.keysym.sym == SDLK_RIGHTBRACKET)
+                {
+                    distortionGridResolution = e.key.keysym.sym == SDLK_LEFTBRACKET
+                            ? std::max(distortionGridResolution / 2, 1)
+                            : std::min(distortionGridResolution * 2, 256);
+                    commands.Record(MakeRenderKey(UploadPass),
+                        SetDistortionGridCommand{ &distortionMesh, distortionGridResolution, renderedWidth, renderedHeight });
+                }
+                else if (e.key.keysym.sym == SDLK_l)
+                {
+                    // The pacer waits on the GL thread, after this thread has already read the head orientation,
+                    // so starting late there would only make the pose older when it's shown.
+                    if (renderQueue.IsThreaded())
+                    {
+                        printf("Late frame start: only with GL calls on the main thread, run with --no-render-thread\n");
+                        fflush(stdout);
+                    }
+                    else
+                    {
+                        commands.Record(MakeRenderKey(FrameEndPass), ToggleLateStartCommand{ &framePacer });
+                    }
+                }
+                else if (e.key.keysym.sym == SDLK_h)
+                {
+                    commands.Record(MakeRenderKey(FrameEndPass), PrintFrameHistogramsCommand{ &framePacer });
+                    printf("Simulation: %llu ticks of %.2f ms, %.1f ms dropped to catch up\n",
+                           simulationTimestep.GetTickCount(), simulationTimestep.GetTickLength() * 1000.0,
+                           simulationTimestep.GetDroppedTime() * 1000.0);
+                    fflush(stdout);
+                }
+                else if (e.key.keysym.sym == SDLK_m)
+                {
+                    stereoRendering = stereoRendering == StereoRendering::SinglePass
+                            ? StereoRendering::Multipass : StereoRendering::SinglePass;
+                    printf("Stereo rendering: %s\n",
+                           stereoRendering == StereoRendering::SinglePass ? "single pass" : "multipass");
+                    fflush(stdout);
+                }
+                else if (e.key.keysym.sym == SDLK_COMMA || e.key.keysym.sym == SDLK_PERIOD)
+                {
+                    size_t budget = scene.GetTriangleBudget();
+                    budget = e.key.keysym.sym == SDLK_COMMA
+                            ? std::max(budget / 2, (size_t) 1)
+                            : std::min(budget * 2, (size_t) 1 << 30);
+                    scene.SetTriangleBudget(budget);
+                    printf("Triangle budget: %d per eye\n", (int) budget);
+                    fflush(stdout);
+                }
+                else if (e.key.keysym.sym == SDLK_r)
+                {
+                    dynamicResolution.SetEnabled(!dynamicResolution.IsEnabled());
+                    printf("Dynamic resolution: %s\n", dynamicResolution.IsEnabled() ? "on" : "off");
+                    fflush(stdout);
+                }
+                else if (e.key.keysym.sym == SDLK_o)
+                {
+                    scene.SetOcclusionCulling(!scene.IsOcclusionCulling());
+                    printf("Occlusion culling: %s\n", scene.IsOcclusionCulling() ? "on" : "off");
+                    fflush(stdout);
+                }
+                else if (e.key.keysym.sym == SDLK_g)
+                {
+                    int object;
+                    float distance;
+                    if (scene.Pick(scene.GetGazeRay(), object, distance))
+                    {
+                        printf("Looking at %s %d, %.2f units away\n", object == 0 ? "box" : "prop", object, distance);
+                    }
+                    else
+                    {
+                        printf("Looking at nothing\n");
+                    }
+                    fflush(stdout);
+                }
+                else if (e.key.keysym.sym == SDLK_p)
+                {
+                    RenderStats stats = renderQueue.GetLastFrameStats();
+                    printf("Last frame: %d packets, %u draws, %u binds, %u program switches, %u redundant calls elided\n",
+                           (int) stats.mPackets, stats.mDraws, stats.mBinds, stats.mProgramSwitches, stats.mElidedCalls);
+                    OcclusionStats occlusion = scene.GetOcclusionStats();
+                    printf("Culling: %u of %d objects in the frustum, %u of those occluded, %d drawn\n",
+                           occlusion.mCandidates, scene.GetObjectCount(), occlusion.mOccluded, scene.GetVisibleObjectCount());
+                    printf("Occlusion queries: %u issued, %u still waiting on the GPU\n",
+                           occlusion.mQueriesIssued, occlusion.mQueriesPending);
+                    const LodStats& lods = scene.GetLodStats();
+                    printf("Levels of detail: %d triangles per eye, budget %d, %u levels dropped for the budget. Objects per level:",
+                           (int) lods.mTriangles, (int) scene.GetTriangleBudget(), lods.mBudgetDrops);
+                    for (unsigned int objects : lods.mObjectsPerLevel)
+                    {
+                        printf(" %u", objects);
+                    }
+                    printf("\n");
+                    DynamicResolutionStats resolution = dynamicResolution.GetStats();
+                    printf("Resolution: %dx%d of %dx%d, GPU %.2f ms on average for a %.2f ms target, %u decreases, %u increases\n",
+                           (int) dynamicResolution.GetWidth(), (int) dynamicResolution.GetHeight(),
+                           (int) renderedWidth, (int) renderedHeight,
+                           resolution.mAverageGPUTime * 1000.0, resolution.mTargetGPUTime * 1000.0,
+                           resolution.mDecreases, resolution.mIncreases);
+                    fflush(stdout);
+
+                    commands.Record(MakeRenderKey(FrameEndPass), PrintGPUProfileCommand{ &gpuProfiler });
+                }
+                else if (e.key.keysym.sym == SDLK_t)
+                {
+                    showGPUProfile = !showGPUProfile;
+                }
             }
         }
 
-        {
-            GLplus::ScopedFrameBufferBind offscreenBind(offscreenFrameBuffer);
-
-            glClearColor(1.0f,1.0f,1.0f,1.0f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-            glEnable(GL_DEPTH_TEST);
-            GLplus::CheckGLErrors();
+        PROFILE_ZONE_END(eventsZone);
 
-            glViewport(0, 0, renderedTexture->GetWidth() / 2, renderedTexture->GetHeight());
-            glm::mat4 leftEyeProjection = glm::make_mat4((const float*) leftEyeParams.Projection.Transposed().M);
-            glm::mat4 leftViewAdjustment = glm::make_mat4((const float*) leftEyeParams.ViewAdjust.Transposed().M);
-            scene.Render(leftEyeProjection, leftViewAdjustment);
+        PROFILE_ZONE_NAMED(sceneZone, "scene");
+        dynamicResolution.Update();
+        const GLsizei viewportWidth = dynamicResolution.GetWidth();
+        const GLsizei viewportHeight = dynamicResolution.GetHeight();
 
-            glViewport(renderedTexture->GetWidth() / 2, 0, renderedTexture->GetWidth() / 2, renderedTexture->GetHeight());
-            glm::mat4 rightEyeProjection = glm::make_mat4((const float*) rightEyeParams.Projection.Transposed().M);
-            glm::mat4 rightViewAdjustment = glm::make_mat4((const float*) rightEyeParams.ViewAdjust.Transposed().M);
-            scene.Render(rightEyeProjection, rightViewAdjustment);
+        // levels of detail are chosen by their error in pixels of the render target, which is bigger than the screen
+        scene.SetLodProjection(leftEyeProjection[1][1] * viewportHeight / 2.0f);
 
-            glViewport(0, 0, renderedTexture->GetWidth(), renderedTexture->GetHeight());
-            glDisable(GL_DEPTH_TEST);
-            GLplus::CheckGLErrors();
-            debugLines.Render(debugLineProgram);
+        // one timestamp for the whole frame, shared by both eyes
+        int simulationTicks = simulationTimestep.Advance();
+        for (int tick = 0; tick < simulationTicks; tick++)
+        {
+            scene.Tick(simulationTimestep.GetTickLength());
         }
 
-        {
-            glViewport(0, 0, window.GetWidth(), window.GetHeight());
-            glClearColor(1.0f,1.0f,1.0f,1.0f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-            glDisable(GL_DEPTH_TEST);
-            GLplus::CheckGLErrors();
+        scene.Update(simulationTimestep.GetInterpolation());
 
-            const float screenLeftToLeftLensCenter = 0.5f - hmdInfo.LensSeparationDistance / 2 / hmdInfo.HScreenSize;
+        scene.SetHeadOrientation(oculus.GetHeadOrientation());
 
-            GLplus::Program* fullscreenProgram(nullptr);
+        const glm::mat4 sceneView = scene.GetView();
+        const glm::mat4 leftView = leftViewAdjustment * sceneView;
+        const glm::mat4 rightView = rightViewAdjustment * sceneView;
 
-            if (useDistortion)
-            {
-                float aspect = (float) hmdInfo.HResolution / hmdInfo.VResolution;
-                glm::vec2 lensSpaceToTextureSpaceScale(0.5f - screenLeftToLeftLensCenter, 0.5f / aspect);
-                glm::vec2 textureSpaceToLensSpaceScale(1.0f / lensSpaceToTextureSpaceScale);
+        // culled once for both eyes, whichever way they're drawn
+        scene.Cull(Frustum::StereoUnion(Frustum::FromViewProjection(leftEyeProjection * leftView),
+                                        Frustum::FromViewProjection(rightEyeProjection * rightView)));
+        scene.RecordUpload(commands);
 
-                barrelProgram.UploadInt("RenderedStereoscopicScene", 0);
-                barrelProgram.UploadVec2("TextureToLensScale", &textureSpaceToLensSpaceScale[0]);
-                barrelProgram.UploadVec2("LensToTextureScale", &lensSpaceToTextureSpaceScale[0]);
-                barrelProgram.UploadVec4("HmdWarpParam", hmdInfo.DistortionK);
+        // scene pass
+        commands.Record(MakeRenderKey(ScenePass, SceneSetupView), BindFrameBufferCommand{ offscreenFrameBuffer.GetGLHandle() });
+        commands.Record(MakeRenderKey(ScenePass, SceneSetupView),
+                        ClearCommand{ glm::vec4(1.0f), GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT });
+        commands.Record(MakeRenderKey(ScenePass, SceneSetupView), SetCapabilityCommand{ GL_DEPTH_TEST, true });
 
-                fullscreenProgram = &barrelProgram;
-            }
-            else
-            {
-                blitProgram.UploadInt("RenderedStereoscopicScene", 0);
-                fullscreenProgram = &blitProgram;
-            }
+        if (stereoRendering == StereoRendering::SinglePass)
+        {
+            // each eye is clipped to its half by the vertex shader, so no viewport per eye
+            GLuint64 setupKey = MakeRenderKey(ScenePass, BothEyesView);
+            commands.Record(setupKey, SetViewportCommand{ 0, 0, viewportWidth, viewportHeight });
+            commands.Record(setupKey, SetCapabilityCommand{ GL_CLIP_DISTANCE0, true });
+            RecordStereoCameraBlock(commands, setupKey, frameUniforms, leftView, rightView, leftEyeProjection, rightEyeProjection);
 
-            GLplus::ScopedTextureBind textureBind(*renderedTexture, GL_TEXTURE0);
+            scene.RecordStereo(commands, BothEyesView);
+        }
+        else
+        {
+            GLuint64 leftSetupKey = MakeRenderKey(ScenePass, LeftEyeView);
+            commands.Record(leftSetupKey, SetViewportCommand{ 0, 0, viewportWidth / 2, viewportHeight });
+            RecordCameraBlock(commands, leftSetupKey, frameUniforms, leftView, leftEyeProjection);
+            scene.Record(commands, LeftEyeView);
+
+            GLuint64 rightSetupKey = MakeRenderKey(ScenePass, RightEyeView);
+            commands.Record(rightSetupKey, SetViewportCommand{ viewportWidth / 2, 0, viewportWidth / 2, viewportHeight });
+            RecordCameraBlock(commands, rightSetupKey, frameUniforms, rightView, rightEyeProjection);
+            scene.Record(commands, RightEyeView);
+        }
 
-            // draw left eye
-            if (useDistortion)
-            {
-                barrelProgram.UploadVec2("LensCenter", screenLeftToLeftLensCenter, hmdInfo.VScreenCenter / hmdInfo.VScreenSize);
-                barrelProgram.UploadVec2("ScreenCenter", 0.25f, 0.5f);
-            }
-            fourTriangles.RenderLeft(*fullscreenProgram);
+        // one query for both eyes, so the proxies are drawn the single pass way however the eyes were
+        if (scene.IsOcclusionCulling())
+        {
+            RecordGPUScope(commands, &gpuProfiler, "occlusion queries",
+                           MakeRenderKey(ScenePass, OcclusionView), MakeRenderKey(ScenePass, OcclusionView + 1) - 1);
 
-            // draw right eye
-            if (useDistortion)
+            if (stereoRendering == StereoRendering::Multipass)
             {
-                barrelProgram.UploadVec2("LensCenter", 1.0f - screenLeftToLeftLensCenter, hmdInfo.VScreenCenter / hmdInfo.VScreenSize);
-                barrelProgram.UploadVec2("ScreenCenter", 0.75f, 0.5f);
+                GLuint64 occlusionSetupKey = MakeRenderKey(ScenePass, OcclusionView);
+                commands.Record(occlusionSetupKey, SetViewportCommand{ 0, 0, viewportWidth, viewportHeight });
+                commands.Record(occlusionSetupKey, SetCapabilityCommand{ GL_CLIP_DISTANCE0, true });
+                RecordStereoCameraBlock(commands, occlusionSetupKey, frameUniforms, leftView, rightView, leftEyeProjection, rightEyeProjection);
             }
-            fourTriangles.RenderRight(*fullscreenProgram);
+
+            scene.RecordOcclusionQueries(commands, OcclusionView);
+        }
+
+        commands.Record(MakeRenderKey(ScenePass, ErrorCheckView), SetCapabilityCommand{ GL_CLIP_DISTANCE0, false });
+
+        commands.Record(MakeRenderKey(ScenePass, ErrorCheckView), CheckErrorsCommand{ "scene pass" });
+
+        // debug lines over both eyes
+        commands.Record(MakeRenderKey(OverlayPass), SetViewportCommand{ 0, 0, viewportWidth, viewportHeight });
+        commands.Record(MakeRenderKey(OverlayPass), SetCapabilityCommand{ GL_DEPTH_TEST, false });
+        commands.Record(MakeRenderKey(OverlayPass, 0, debugLineProgram.GetGLHandle()),
+                        DrawDebugLinesCommand{ &debugLines, &debugLineProgram });
+        if (showGPUProfile)
+        {
+            commands.Record(MakeRenderKey(OverlayPass, 0, debugLineProgram.GetGLHandle()),
+                            DrawGPUProfilerOverlayCommand{ &gpuProfilerOverlay, &gpuProfiler, &debugLineProgram,
+                                                           framePacer.GetPeriod() * 1000.0, 2.0f / viewportHeight });
         }
 
+        PROFILE_ZONE_END(sceneZone);
+
+        // distortion pass
+        PROFILE_ZONE_NAMED(distortionZone, "distortion");
+        const DistortionMesh& mesh = useDistortion ? distortionMesh : blitMesh;
+
+        GLuint64 distortionSetupKey = MakeRenderKey(DistortionPass);
+        commands.Record(distortionSetupKey, BindFrameBufferCommand{ 0 });
+        commands.Record(distortionSetupKey, SetViewportCommand{ 0, 0, window.GetWidth(), window.GetHeight() });
+        // the mesh leaves out cells that fall entirely outside the rendered eyes
+        commands.Record(distortionSetupKey,
+                        ClearCommand{ glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT });
+        commands.Record(distortionSetupKey, BindTextureCommand{ GL_TEXTURE0, renderedTexture->GetGLHandle() });
+        commands.Record(MakeRenderKey(DistortionPass, 0, distortionMeshProgram.GetGLHandle()),
+                        DrawDistortionMeshCommand{ &mesh, &distortionMeshProgram, dynamicResolution.GetTextureScale() });
+        commands.Record(MakeRenderKey(DistortionPass, ErrorCheckView), CheckErrorsCommand{ "distortion pass" });
+        PROFILE_ZONE_END(distortionZone);
+
         // flip the display
-        window.GLSwapWindow();
+        commands.Record(MakeRenderKey(FrameEndPass), EndFrameCommand{ &framePacer, &gpuProfiler });
+
+        renderQueue.EndFrame();
 
-        // throttle the frame rate to 60fps
-        if (deltaTimeMilliSec < 1000/60)
+        if (trace)
         {
-            SDL_Delay(1000/60 - deltaTimeMilliSec);
+            PROFILE_ZONE("flush trace");
+            Profiler::Flush(*trace);
         }
+    }
 
-        timeOfLastFrame = timeOfThisFrame;
+    if (trace)
+    {
+        renderQueue.Finish();
+        Profiler::Flush(*trace);
+        if (Profiler::GetDroppedZones() > 0)
+        {
+            printf("Tracing: %llu zones dropped, their threads' buffers were full\n",
+                   (unsigned long long) Profiler::GetDroppedZones());
+            fflush(stdout);
+        }
     }
 }
 
 int main(int argc, char *argv[])
 {
+    // --no-render-thread keeps every GL call on the main thread, which is easier to debug.
+    // --gpu-profile <file> writes the GPU time of every pass of every frame, as CSV or a Chrome trace.
+    // --trace <file> writes a Chrome trace of CPU zones on every thread, with the GPU passes unless they go to --gpu-profile.
+    bool threadedRendering = true;
+    std::string gpuProfileFile;
+    std::string traceFile;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--no-render-thread")
+        {
+            threadedRendering = false;
+        }
+        else if (std::string(argv[i]) == "--gpu-profile" && i + 1 < argc)
+        {
+            gpuProfileFile = argv[++i];
+        }
+        else if (std::string(argv[i]) == "--trace" && i + 1 < argc)
+        {
+            traceFile = argv[++i];
+        }
+    }
+
     try
     {
-        run();
+        run(threadedRendering, gpuProfileFile, traceFile);
     }
     catch (const std::exception& e)
     {
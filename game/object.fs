@@ -1,13 +1,36 @@
-#version 130
+#version 140
+
+// Options:
+// DIFFUSE_TEXTURE: samples diffuseTexture, otherwise the whole surface is diffuseColor
+// ALPHA_TEST: discards fragments less opaque than alphaCutoff
 
 in vec3 fnormal;
 in vec2 ftexcoord0;
 
 out vec4 color;
 
+#ifdef DIFFUSE_TEXTURE
 uniform sampler2D diffuseTexture;
+#else
+uniform vec4 diffuseColor = vec4(1.0);
+#endif
+
+#ifdef ALPHA_TEST
+uniform float alphaCutoff = 0.5;
+#endif
 
 void main()
 {
+#ifdef DIFFUSE_TEXTURE
     color = texture(diffuseTexture, ftexcoord0);
+#else
+    color = diffuseColor;
+#endif
+
+#ifdef ALPHA_TEST
+    if (color.a < alphaCutoff)
+    {
+        discard;
+    }
+#endif
 }
@@ -1,18 +1,33 @@
-#version 130
+#version 140
+
+// Options:
+// INSTANCED: each instance's model matrix comes from the instanceModel attribute instead of the model uniform
+// STEREO: see camera.glsl
 
 in vec4 position;
 in vec3 normal;
 in vec2 texcoord0;
 
+#ifdef INSTANCED
+// one per instance, repeated for both eyes in stereo
+in mat4 instanceModel;
+#else
+uniform mat4 model;
+#endif
+
 out vec3 fnormal;
 out vec2 ftexcoord0;
 
-uniform mat4 modelview;
-uniform mat4 projection;
+#include "camera.glsl"
 
 void main()
 {
     fnormal = normal;
     ftexcoord0 = texcoord0;
-    gl_Position = projection * modelview * position;
+
+#ifdef INSTANCED
+    gl_Position = CameraTransform(instanceModel * position);
+#else
+    gl_Position = CameraTransform(model * position);
+#endif
 }
@@ -1,4 +1,4 @@
-#version 130
+#version 140
 
 in vec4 position;
 in vec4 color;